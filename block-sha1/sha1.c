@@ -0,0 +1,689 @@
+/*
+ * SHA1 routine optimized to do word accesses rather than byte accesses,
+ * and to avoid unnecessary copies into the context array.
+ *
+ * Besides the portable C block function, x86 processors can use the
+ * SHA-NI instructions for one stream, and AVX2 to hash eight
+ * independent streams at once for blk_SHA1_Update_multi().
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#ifndef NO_PTHREADS
+#include <pthread.h>
+#endif
+
+#include "sha1.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    ((defined(__GNUC__) && __GNUC__ >= 5) || defined(__clang__))
+#define BLK_SHA1_X86
+#include <immintrin.h>
+#include <cpuid.h>
+#endif
+
+#define BLK_SHA1_LANES 8
+
+/*
+ * Eight AVX2 lanes hash about 1.4 times as fast as one SHA-NI stream,
+ * so next to SHA-NI they only pay off with six streams or more.
+ */
+#define BLK_SHA1_LANES_MIN_SHANI 6
+
+typedef void (*blk_sha1_block_fn)(unsigned int *H, const unsigned char *data,
+				  unsigned long blocks);
+typedef void (*blk_sha1_lanes_fn)(unsigned int **H,
+				  const unsigned char **data,
+				  unsigned long blocks);
+
+static inline unsigned int get_be32(const unsigned char *p)
+{
+	return (unsigned int)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static inline void put_be32(unsigned char *p, unsigned int v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+#define SHA_ROT(X,l,r)	(((X) << (l)) | ((X) >> (r)))
+#define SHA_ROL(X,n)	SHA_ROT(X,n,32-(n))
+#define SHA_ROR(X,n)	SHA_ROT(X,32-(n),n)
+
+/*
+ * Only the last 16 words of the message schedule are needed; keep
+ * them in a circular array indexed modulo 16.
+ */
+#define W(x) (array[(x)&15])
+
+#define SHA_SRC(t) get_be32(data + (t)*4)
+#define SHA_MIX(t) SHA_ROL(W((t)+13) ^ W((t)+8) ^ W((t)+2) ^ W(t), 1)
+
+#define SHA_ROUND(t, input, fn, constant, A, B, C, D, E) do { \
+	unsigned int TEMP = input(t); W(t) = TEMP; \
+	E += TEMP + SHA_ROL(A,5) + (fn) + (constant); \
+	B = SHA_ROR(B, 2); } while (0)
+
+#define T_0_15(t, A, B, C, D, E)  SHA_ROUND(t, SHA_SRC, (((C^D)&B)^D) , 0x5a827999, A, B, C, D, E )
+#define T_16_19(t, A, B, C, D, E) SHA_ROUND(t, SHA_MIX, (((C^D)&B)^D) , 0x5a827999, A, B, C, D, E )
+#define T_20_39(t, A, B, C, D, E) SHA_ROUND(t, SHA_MIX, (B^C^D) , 0x6ed9eba1, A, B, C, D, E )
+#define T_40_59(t, A, B, C, D, E) SHA_ROUND(t, SHA_MIX, ((B&C)+(D&(B^C))) , 0x8f1bbcdc, A, B, C, D, E )
+#define T_60_79(t, A, B, C, D, E) SHA_ROUND(t, SHA_MIX, (B^C^D) ,  0xca62c1d6, A, B, C, D, E )
+
+static void blk_SHA1_Block_generic(unsigned int *H, const unsigned char *data,
+				   unsigned long blocks)
+{
+	unsigned int A, B, C, D, E;
+	unsigned int array[16];
+
+	for (; blocks; blocks--, data += 64) {
+		A = H[0];
+		B = H[1];
+		C = H[2];
+		D = H[3];
+		E = H[4];
+
+		T_0_15( 0, A, B, C, D, E);
+		T_0_15( 1, E, A, B, C, D);
+		T_0_15( 2, D, E, A, B, C);
+		T_0_15( 3, C, D, E, A, B);
+		T_0_15( 4, B, C, D, E, A);
+		T_0_15( 5, A, B, C, D, E);
+		T_0_15( 6, E, A, B, C, D);
+		T_0_15( 7, D, E, A, B, C);
+		T_0_15( 8, C, D, E, A, B);
+		T_0_15( 9, B, C, D, E, A);
+		T_0_15(10, A, B, C, D, E);
+		T_0_15(11, E, A, B, C, D);
+		T_0_15(12, D, E, A, B, C);
+		T_0_15(13, C, D, E, A, B);
+		T_0_15(14, B, C, D, E, A);
+		T_0_15(15, A, B, C, D, E);
+		T_16_19(16, E, A, B, C, D);
+		T_16_19(17, D, E, A, B, C);
+		T_16_19(18, C, D, E, A, B);
+		T_16_19(19, B, C, D, E, A);
+		T_20_39(20, A, B, C, D, E);
+		T_20_39(21, E, A, B, C, D);
+		T_20_39(22, D, E, A, B, C);
+		T_20_39(23, C, D, E, A, B);
+		T_20_39(24, B, C, D, E, A);
+		T_20_39(25, A, B, C, D, E);
+		T_20_39(26, E, A, B, C, D);
+		T_20_39(27, D, E, A, B, C);
+		T_20_39(28, C, D, E, A, B);
+		T_20_39(29, B, C, D, E, A);
+		T_20_39(30, A, B, C, D, E);
+		T_20_39(31, E, A, B, C, D);
+		T_20_39(32, D, E, A, B, C);
+		T_20_39(33, C, D, E, A, B);
+		T_20_39(34, B, C, D, E, A);
+		T_20_39(35, A, B, C, D, E);
+		T_20_39(36, E, A, B, C, D);
+		T_20_39(37, D, E, A, B, C);
+		T_20_39(38, C, D, E, A, B);
+		T_20_39(39, B, C, D, E, A);
+		T_40_59(40, A, B, C, D, E);
+		T_40_59(41, E, A, B, C, D);
+		T_40_59(42, D, E, A, B, C);
+		T_40_59(43, C, D, E, A, B);
+		T_40_59(44, B, C, D, E, A);
+		T_40_59(45, A, B, C, D, E);
+		T_40_59(46, E, A, B, C, D);
+		T_40_59(47, D, E, A, B, C);
+		T_40_59(48, C, D, E, A, B);
+		T_40_59(49, B, C, D, E, A);
+		T_40_59(50, A, B, C, D, E);
+		T_40_59(51, E, A, B, C, D);
+		T_40_59(52, D, E, A, B, C);
+		T_40_59(53, C, D, E, A, B);
+		T_40_59(54, B, C, D, E, A);
+		T_40_59(55, A, B, C, D, E);
+		T_40_59(56, E, A, B, C, D);
+		T_40_59(57, D, E, A, B, C);
+		T_40_59(58, C, D, E, A, B);
+		T_40_59(59, B, C, D, E, A);
+		T_60_79(60, A, B, C, D, E);
+		T_60_79(61, E, A, B, C, D);
+		T_60_79(62, D, E, A, B, C);
+		T_60_79(63, C, D, E, A, B);
+		T_60_79(64, B, C, D, E, A);
+		T_60_79(65, A, B, C, D, E);
+		T_60_79(66, E, A, B, C, D);
+		T_60_79(67, D, E, A, B, C);
+		T_60_79(68, C, D, E, A, B);
+		T_60_79(69, B, C, D, E, A);
+		T_60_79(70, A, B, C, D, E);
+		T_60_79(71, E, A, B, C, D);
+		T_60_79(72, D, E, A, B, C);
+		T_60_79(73, C, D, E, A, B);
+		T_60_79(74, B, C, D, E, A);
+		T_60_79(75, A, B, C, D, E);
+		T_60_79(76, E, A, B, C, D);
+		T_60_79(77, D, E, A, B, C);
+		T_60_79(78, C, D, E, A, B);
+		T_60_79(79, B, C, D, E, A);
+
+		H[0] += A;
+		H[1] += B;
+		H[2] += C;
+		H[3] += D;
+		H[4] += E;
+	}
+}
+
+#ifdef BLK_SHA1_X86
+
+static int blk_SHA1_have_shani(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	__builtin_cpu_init();
+	if (!__builtin_cpu_supports("sse4.1") ||
+	    __get_cpuid_max(0, NULL) < 7)
+		return 0;
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	return (ebx >> 29) & 1;
+}
+
+static int blk_SHA1_have_avx2(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+/*
+ * The SHA extensions do four rounds per instruction and compute the
+ * message schedule four words at a time; MSG0..MSG3 hold the last
+ * sixteen words and E0/E1 alternate as the "E" input of the rounds.
+ */
+__attribute__((target("sha,sse4.1")))
+static void blk_SHA1_Block_shani(unsigned int *H, const unsigned char *p,
+				 unsigned long blocks)
+{
+	__m128i ABCD, ABCD_SAVE, E0, E0_SAVE, E1;
+	__m128i MSG0, MSG1, MSG2, MSG3;
+	const __m128i MASK = _mm_set_epi64x(0x0001020304050607ULL,
+					    0x08090a0b0c0d0e0fULL);
+
+	ABCD = _mm_loadu_si128((const __m128i *)H);
+	ABCD = _mm_shuffle_epi32(ABCD, 0x1B);
+	E0 = _mm_set_epi32(H[4], 0, 0, 0);
+
+	for (; blocks; blocks--, p += 64) {
+		ABCD_SAVE = ABCD;
+		E0_SAVE = E0;
+
+		/* Rounds 0-3 */
+		MSG0 = _mm_loadu_si128((const __m128i *)(p + 0));
+		MSG0 = _mm_shuffle_epi8(MSG0, MASK);
+		E0 = _mm_add_epi32(E0, MSG0);
+		E1 = ABCD;
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 0);
+
+		/* Rounds 4-7 */
+		MSG1 = _mm_loadu_si128((const __m128i *)(p + 16));
+		MSG1 = _mm_shuffle_epi8(MSG1, MASK);
+		E1 = _mm_sha1nexte_epu32(E1, MSG1);
+		E0 = ABCD;
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 0);
+		MSG0 = _mm_sha1msg1_epu32(MSG0, MSG1);
+
+		/* Rounds 8-11 */
+		MSG2 = _mm_loadu_si128((const __m128i *)(p + 32));
+		MSG2 = _mm_shuffle_epi8(MSG2, MASK);
+		E0 = _mm_sha1nexte_epu32(E0, MSG2);
+		E1 = ABCD;
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 0);
+		MSG1 = _mm_sha1msg1_epu32(MSG1, MSG2);
+		MSG0 = _mm_xor_si128(MSG0, MSG2);
+
+		/* Rounds 12-15 */
+		MSG3 = _mm_loadu_si128((const __m128i *)(p + 48));
+		MSG3 = _mm_shuffle_epi8(MSG3, MASK);
+		E1 = _mm_sha1nexte_epu32(E1, MSG3);
+		E0 = ABCD;
+		MSG0 = _mm_sha1msg2_epu32(MSG0, MSG3);
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 0);
+		MSG2 = _mm_sha1msg1_epu32(MSG2, MSG3);
+		MSG1 = _mm_xor_si128(MSG1, MSG3);
+
+		/* Rounds 16-19 */
+		E0 = _mm_sha1nexte_epu32(E0, MSG0);
+		E1 = ABCD;
+		MSG1 = _mm_sha1msg2_epu32(MSG1, MSG0);
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 0);
+		MSG3 = _mm_sha1msg1_epu32(MSG3, MSG0);
+		MSG2 = _mm_xor_si128(MSG2, MSG0);
+
+		/* Rounds 20-23 */
+		E1 = _mm_sha1nexte_epu32(E1, MSG1);
+		E0 = ABCD;
+		MSG2 = _mm_sha1msg2_epu32(MSG2, MSG1);
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 1);
+		MSG0 = _mm_sha1msg1_epu32(MSG0, MSG1);
+		MSG3 = _mm_xor_si128(MSG3, MSG1);
+
+		/* Rounds 24-27 */
+		E0 = _mm_sha1nexte_epu32(E0, MSG2);
+		E1 = ABCD;
+		MSG3 = _mm_sha1msg2_epu32(MSG3, MSG2);
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 1);
+		MSG1 = _mm_sha1msg1_epu32(MSG1, MSG2);
+		MSG0 = _mm_xor_si128(MSG0, MSG2);
+
+		/* Rounds 28-31 */
+		E1 = _mm_sha1nexte_epu32(E1, MSG3);
+		E0 = ABCD;
+		MSG0 = _mm_sha1msg2_epu32(MSG0, MSG3);
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 1);
+		MSG2 = _mm_sha1msg1_epu32(MSG2, MSG3);
+		MSG1 = _mm_xor_si128(MSG1, MSG3);
+
+		/* Rounds 32-35 */
+		E0 = _mm_sha1nexte_epu32(E0, MSG0);
+		E1 = ABCD;
+		MSG1 = _mm_sha1msg2_epu32(MSG1, MSG0);
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 1);
+		MSG3 = _mm_sha1msg1_epu32(MSG3, MSG0);
+		MSG2 = _mm_xor_si128(MSG2, MSG0);
+
+		/* Rounds 36-39 */
+		E1 = _mm_sha1nexte_epu32(E1, MSG1);
+		E0 = ABCD;
+		MSG2 = _mm_sha1msg2_epu32(MSG2, MSG1);
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 1);
+		MSG0 = _mm_sha1msg1_epu32(MSG0, MSG1);
+		MSG3 = _mm_xor_si128(MSG3, MSG1);
+
+		/* Rounds 40-43 */
+		E0 = _mm_sha1nexte_epu32(E0, MSG2);
+		E1 = ABCD;
+		MSG3 = _mm_sha1msg2_epu32(MSG3, MSG2);
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 2);
+		MSG1 = _mm_sha1msg1_epu32(MSG1, MSG2);
+		MSG0 = _mm_xor_si128(MSG0, MSG2);
+
+		/* Rounds 44-47 */
+		E1 = _mm_sha1nexte_epu32(E1, MSG3);
+		E0 = ABCD;
+		MSG0 = _mm_sha1msg2_epu32(MSG0, MSG3);
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 2);
+		MSG2 = _mm_sha1msg1_epu32(MSG2, MSG3);
+		MSG1 = _mm_xor_si128(MSG1, MSG3);
+
+		/* Rounds 48-51 */
+		E0 = _mm_sha1nexte_epu32(E0, MSG0);
+		E1 = ABCD;
+		MSG1 = _mm_sha1msg2_epu32(MSG1, MSG0);
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 2);
+		MSG3 = _mm_sha1msg1_epu32(MSG3, MSG0);
+		MSG2 = _mm_xor_si128(MSG2, MSG0);
+
+		/* Rounds 52-55 */
+		E1 = _mm_sha1nexte_epu32(E1, MSG1);
+		E0 = ABCD;
+		MSG2 = _mm_sha1msg2_epu32(MSG2, MSG1);
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 2);
+		MSG0 = _mm_sha1msg1_epu32(MSG0, MSG1);
+		MSG3 = _mm_xor_si128(MSG3, MSG1);
+
+		/* Rounds 56-59 */
+		E0 = _mm_sha1nexte_epu32(E0, MSG2);
+		E1 = ABCD;
+		MSG3 = _mm_sha1msg2_epu32(MSG3, MSG2);
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 2);
+		MSG1 = _mm_sha1msg1_epu32(MSG1, MSG2);
+		MSG0 = _mm_xor_si128(MSG0, MSG2);
+
+		/* Rounds 60-63 */
+		E1 = _mm_sha1nexte_epu32(E1, MSG3);
+		E0 = ABCD;
+		MSG0 = _mm_sha1msg2_epu32(MSG0, MSG3);
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 3);
+		MSG2 = _mm_sha1msg1_epu32(MSG2, MSG3);
+		MSG1 = _mm_xor_si128(MSG1, MSG3);
+
+		/* Rounds 64-67 */
+		E0 = _mm_sha1nexte_epu32(E0, MSG0);
+		E1 = ABCD;
+		MSG1 = _mm_sha1msg2_epu32(MSG1, MSG0);
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 3);
+		MSG3 = _mm_sha1msg1_epu32(MSG3, MSG0);
+		MSG2 = _mm_xor_si128(MSG2, MSG0);
+
+		/* Rounds 68-71 */
+		E1 = _mm_sha1nexte_epu32(E1, MSG1);
+		E0 = ABCD;
+		MSG2 = _mm_sha1msg2_epu32(MSG2, MSG1);
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 3);
+		MSG3 = _mm_xor_si128(MSG3, MSG1);
+
+		/* Rounds 72-75 */
+		E0 = _mm_sha1nexte_epu32(E0, MSG2);
+		E1 = ABCD;
+		MSG3 = _mm_sha1msg2_epu32(MSG3, MSG2);
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 3);
+
+		/* Rounds 76-79 */
+		E1 = _mm_sha1nexte_epu32(E1, MSG3);
+		E0 = ABCD;
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 3);
+
+		E0 = _mm_sha1nexte_epu32(E0, E0_SAVE);
+		ABCD = _mm_add_epi32(ABCD, ABCD_SAVE);
+	}
+
+	ABCD = _mm_shuffle_epi32(ABCD, 0x1B);
+	_mm_storeu_si128((__m128i *)H, ABCD);
+	H[4] = _mm_extract_epi32(E0, 3);
+}
+
+/*
+ * Eight independent streams, one per 32-bit lane of the AVX2
+ * registers; every stream must have "blocks" blocks to hash, and
+ * data[] is advanced past them.
+ */
+#define V_ADD(a,b)	_mm256_add_epi32(a, b)
+#define V_XOR(a,b)	_mm256_xor_si256(a, b)
+#define V_AND(a,b)	_mm256_and_si256(a, b)
+#define V_OR(a,b)	_mm256_or_si256(a, b)
+#define V_ROL(x,n)	V_OR(_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32-(n)))
+
+#define V_LOAD(t) _mm256_set_epi32( \
+	get_be32(data[7] + (t)*4), get_be32(data[6] + (t)*4), \
+	get_be32(data[5] + (t)*4), get_be32(data[4] + (t)*4), \
+	get_be32(data[3] + (t)*4), get_be32(data[2] + (t)*4), \
+	get_be32(data[1] + (t)*4), get_be32(data[0] + (t)*4))
+#define V_MIX(t) V_ROL(V_XOR(V_XOR(W(t+13), W(t+8)), V_XOR(W(t+2), W(t))), 1)
+
+#define V_ROUND(t, fn, k) do { \
+	__m256i TEMP = (t) < 16 ? V_LOAD(t) : V_MIX(t); \
+	W(t) = TEMP; \
+	TEMP = V_ADD(V_ADD(TEMP, V_ROL(A, 5)), V_ADD(fn, E)); \
+	TEMP = V_ADD(TEMP, _mm256_set1_epi32(k)); \
+	E = D; D = C; C = V_ROL(B, 30); B = A; A = TEMP; } while (0)
+
+#define V_CH	V_XOR(V_AND(V_XOR(C, D), B), D)
+#define V_PARITY	V_XOR(V_XOR(B, C), D)
+#define V_MAJ	V_OR(V_AND(B, C), V_AND(D, V_OR(B, C)))
+
+__attribute__((target("avx2")))
+static void blk_SHA1_Lanes_avx2(unsigned int **H, const unsigned char **data,
+				unsigned long blocks)
+{
+	__m256i A, B, C, D, E, A0, B0, C0, D0, E0;
+	__m256i array[16];
+	unsigned int out[5][BLK_SHA1_LANES];
+	int t, i;
+
+	A = _mm256_set_epi32(H[7][0], H[6][0], H[5][0], H[4][0],
+			     H[3][0], H[2][0], H[1][0], H[0][0]);
+	B = _mm256_set_epi32(H[7][1], H[6][1], H[5][1], H[4][1],
+			     H[3][1], H[2][1], H[1][1], H[0][1]);
+	C = _mm256_set_epi32(H[7][2], H[6][2], H[5][2], H[4][2],
+			     H[3][2], H[2][2], H[1][2], H[0][2]);
+	D = _mm256_set_epi32(H[7][3], H[6][3], H[5][3], H[4][3],
+			     H[3][3], H[2][3], H[1][3], H[0][3]);
+	E = _mm256_set_epi32(H[7][4], H[6][4], H[5][4], H[4][4],
+			     H[3][4], H[2][4], H[1][4], H[0][4]);
+
+	for (; blocks; blocks--) {
+		A0 = A; B0 = B; C0 = C; D0 = D; E0 = E;
+		for (t = 0; t < 20; t++)
+			V_ROUND(t, V_CH, 0x5a827999);
+		for (; t < 40; t++)
+			V_ROUND(t, V_PARITY, 0x6ed9eba1);
+		for (; t < 60; t++)
+			V_ROUND(t, V_MAJ, 0x8f1bbcdc);
+		for (; t < 80; t++)
+			V_ROUND(t, V_PARITY, 0xca62c1d6);
+		A = V_ADD(A, A0); B = V_ADD(B, B0); C = V_ADD(C, C0);
+		D = V_ADD(D, D0); E = V_ADD(E, E0);
+		for (i = 0; i < BLK_SHA1_LANES; i++)
+			data[i] += 64;
+	}
+
+	_mm256_storeu_si256((__m256i *)out[0], A);
+	_mm256_storeu_si256((__m256i *)out[1], B);
+	_mm256_storeu_si256((__m256i *)out[2], C);
+	_mm256_storeu_si256((__m256i *)out[3], D);
+	_mm256_storeu_si256((__m256i *)out[4], E);
+	for (i = 0; i < BLK_SHA1_LANES; i++)
+		for (t = 0; t < 5; t++)
+			H[i][t] = out[t][i];
+}
+
+#endif /* BLK_SHA1_X86 */
+
+static blk_sha1_block_fn blk_SHA1_Block;
+static blk_sha1_lanes_fn blk_SHA1_Lanes;
+/* the fewest streams blk_SHA1_Lanes() is worth using for */
+static int blk_SHA1_Lanes_min;
+static const char *blk_SHA1_name;
+
+const char *blk_SHA1_backends[] = {
+	"generic", "sha-ni", "avx2", "sha-ni+avx2", NULL
+};
+
+static int select_backend(const char *name)
+{
+	blk_sha1_block_fn block = blk_SHA1_Block_generic;
+	blk_sha1_lanes_fn lanes = NULL;
+	int lanes_min = 2;
+
+	if (!strcmp(name, "auto")) {
+		const char *env = getenv("GIT_SHA1_BACKEND");
+		if (env && strcmp(env, "auto") && !select_backend(env))
+			return 0;
+		name = "generic";
+#ifdef BLK_SHA1_X86
+		/*
+		 * SHA-NI for single streams, and AVX2 for enough
+		 * streams at once.
+		 */
+		if (blk_SHA1_have_shani() && blk_SHA1_have_avx2())
+			name = "sha-ni+avx2";
+		else if (blk_SHA1_have_shani())
+			name = "sha-ni";
+		else if (blk_SHA1_have_avx2())
+			name = "avx2";
+#endif
+		return select_backend(name);
+	} else if (!strcmp(name, "generic"))
+		;
+#ifdef BLK_SHA1_X86
+	else if (!strcmp(name, "sha-ni") && blk_SHA1_have_shani())
+		block = blk_SHA1_Block_shani;
+	else if (!strcmp(name, "avx2") && blk_SHA1_have_avx2())
+		lanes = blk_SHA1_Lanes_avx2;
+	else if (!strcmp(name, "sha-ni+avx2") &&
+		 blk_SHA1_have_shani() && blk_SHA1_have_avx2()) {
+		block = blk_SHA1_Block_shani;
+		lanes = blk_SHA1_Lanes_avx2;
+		lanes_min = BLK_SHA1_LANES_MIN_SHANI;
+	}
+#endif
+	else
+		return -1;
+
+	blk_SHA1_Block = block;
+	blk_SHA1_Lanes = lanes;
+	blk_SHA1_Lanes_min = lanes_min;
+	blk_SHA1_name = name;
+	return 0;
+}
+
+static void select_auto(void)
+{
+	select_backend("auto");
+}
+
+/*
+ * The automatic choice is made once, before the first use, even when
+ * several threads start hashing at the same time.
+ */
+static void setup_backend(void)
+{
+#ifndef NO_PTHREADS
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+	pthread_once(&once, select_auto);
+#else
+	if (!blk_SHA1_name)
+		select_auto();
+#endif
+}
+
+int blk_SHA1_select(const char *name)
+{
+	setup_backend();
+	return select_backend(name);
+}
+
+const char *blk_SHA1_backend(void)
+{
+	setup_backend();
+	return blk_SHA1_name;
+}
+
+void blk_SHA1_Init(blk_SHA_CTX *ctx)
+{
+	setup_backend();
+
+	ctx->size = 0;
+
+	/* Initialize H with the magic constants (see FIPS180 for constants) */
+	ctx->H[0] = 0x67452301;
+	ctx->H[1] = 0xefcdab89;
+	ctx->H[2] = 0x98badcfe;
+	ctx->H[3] = 0x10325476;
+	ctx->H[4] = 0xc3d2e1f0;
+}
+
+void blk_SHA1_Update(blk_SHA_CTX *ctx, const void *data, unsigned long len)
+{
+	unsigned int lenW = ctx->size & 63;
+	const unsigned char *p = data;
+
+	ctx->size += len;
+
+	/* Read the data into W and process blocks as they get full */
+	if (lenW) {
+		unsigned int left = 64 - lenW;
+		if (len < left)
+			left = len;
+		memcpy(lenW + (unsigned char *)ctx->W, p, left);
+		lenW = (lenW + left) & 63;
+		len -= left;
+		p += left;
+		if (lenW)
+			return;
+		blk_SHA1_Block(ctx->H, (unsigned char *)ctx->W, 1);
+	}
+	if (len >= 64) {
+		unsigned long blocks = len / 64;
+		blk_SHA1_Block(ctx->H, p, blocks);
+		p += blocks * 64;
+		len -= blocks * 64;
+	}
+	if (len)
+		memcpy(ctx->W, p, len);
+}
+
+void blk_SHA1_Final(unsigned char hashout[20], blk_SHA_CTX *ctx)
+{
+	static const unsigned char pad[64] = { 0x80 };
+	unsigned char padlen[8];
+	int i;
+
+	/* Pad with a binary 1 (ie 0x80), then zeroes, then length */
+	put_be32(padlen, (unsigned int)(ctx->size >> 29));
+	put_be32(padlen + 4, (unsigned int)(ctx->size << 3));
+	i = ctx->size & 63;
+	blk_SHA1_Update(ctx, pad, 1 + (63 & (55 - i)));
+	blk_SHA1_Update(ctx, padlen, 8);
+
+	/* Output hash */
+	for (i = 0; i < 5; i++)
+		put_be32(hashout + i * 4, ctx->H[i]);
+}
+
+/*
+ * Hash the whole blocks of up to BLK_SHA1_LANES contexts in lockstep,
+ * as long as at least blk_SHA1_Lanes_min of them have some left.
+ * Unused lanes hash the data of the first one again, into a dummy
+ * state.
+ */
+static void update_lanes(blk_SHA_CTX **ctx, const unsigned char **p,
+			 unsigned long *left, int nr)
+{
+	unsigned int dummy_H[BLK_SHA1_LANES][5] = { { 0 } };
+	unsigned int *H[BLK_SHA1_LANES];
+	const unsigned char *data[BLK_SHA1_LANES];
+	int lane[BLK_SHA1_LANES];
+	int i, active;
+
+	for (;;) {
+		unsigned long blocks = 0;
+
+		for (i = active = 0; i < nr; i++) {
+			if (left[i] < 64)
+				continue;
+			if (!blocks || left[i] / 64 < blocks)
+				blocks = left[i] / 64;
+			lane[active++] = i;
+		}
+		if (active < blk_SHA1_Lanes_min)
+			return;
+		for (i = 0; i < BLK_SHA1_LANES; i++) {
+			if (i < active) {
+				H[i] = ctx[lane[i]]->H;
+				data[i] = p[lane[i]];
+			} else {
+				H[i] = dummy_H[i];
+				data[i] = p[lane[0]];
+			}
+		}
+		blk_SHA1_Lanes(H, data, blocks);
+		for (i = 0; i < active; i++) {
+			ctx[lane[i]]->size += blocks * 64;
+			p[lane[i]] += blocks * 64;
+			left[lane[i]] -= blocks * 64;
+		}
+	}
+}
+
+void blk_SHA1_Update_multi(blk_SHA_CTX **ctx, const void **data,
+			   const unsigned long *len, int nr)
+{
+	const unsigned char *p[BLK_SHA1_LANES];
+	unsigned long left[BLK_SHA1_LANES];
+	int i, n;
+
+	setup_backend();
+
+	for (; nr > 0; ctx += n, data += n, len += n, nr -= n) {
+		n = nr < BLK_SHA1_LANES ? nr : BLK_SHA1_LANES;
+		if (!blk_SHA1_Lanes || n < blk_SHA1_Lanes_min) {
+			for (i = 0; i < n; i++)
+				blk_SHA1_Update(ctx[i], data[i], len[i]);
+			continue;
+		}
+
+		/* Complete the partial block each context may have */
+		for (i = 0; i < n; i++) {
+			unsigned long fill = (64 - (ctx[i]->size & 63)) & 63;
+			if (fill > len[i])
+				fill = len[i];
+			blk_SHA1_Update(ctx[i], data[i], fill);
+			p[i] = (const unsigned char *)data[i] + fill;
+			left[i] = len[i] - fill;
+		}
+		update_lanes(ctx, p, left, n);
+		for (i = 0; i < n; i++)
+			blk_SHA1_Update(ctx[i], p[i], left[i]);
+	}
+}
@@ -0,0 +1,48 @@
+/*
+ * SHA1 routine optimized to do word accesses rather than byte accesses,
+ * and to avoid unnecessary copies into the context array.
+ *
+ * The backend is chosen once, the first time it is needed: on x86
+ * processors with the SHA extensions the SHA-NI instructions are used,
+ * otherwise portable C.
+ */
+
+typedef struct {
+	unsigned long long size;
+	unsigned int H[5];
+	unsigned int W[16];
+} blk_SHA_CTX;
+
+void blk_SHA1_Init(blk_SHA_CTX *ctx);
+void blk_SHA1_Update(blk_SHA_CTX *ctx, const void *dataIn, unsigned long len);
+void blk_SHA1_Final(unsigned char hashout[20], blk_SHA_CTX *ctx);
+
+/*
+ * Feed data[i] (len[i] bytes) to ctx[i], for "nr" independent
+ * contexts.  When the processor can, the blocks of up to eight
+ * contexts are hashed at the same time with AVX2; next to SHA-NI,
+ * only when there are enough of them for that to be faster.
+ */
+void blk_SHA1_Update_multi(blk_SHA_CTX **ctx, const void **data,
+			   const unsigned long *len, int nr);
+
+/*
+ * The backends are named "generic", "sha-ni", "avx2" and "sha-ni+avx2"
+ * (SHA-NI for single streams, AVX2 for many); "auto" picks the one
+ * named by $GIT_SHA1_BACKEND if it is available, otherwise the best
+ * one.  blk_SHA1_select() returns -1 if the named backend is
+ * unknown or not supported by this processor, and blk_SHA1_backend()
+ * names the one in use.
+ */
+extern const char *blk_SHA1_backends[];
+int blk_SHA1_select(const char *name);
+const char *blk_SHA1_backend(void);
+
+#define git_SHA_CTX	blk_SHA_CTX
+#define git_SHA1_Init	blk_SHA1_Init
+#define git_SHA1_Update	blk_SHA1_Update
+#define git_SHA1_Final	blk_SHA1_Final
+#define git_SHA1_Update_multi	blk_SHA1_Update_multi
+#define git_SHA1_backends	blk_SHA1_backends
+#define git_SHA1_select_backend	blk_SHA1_select
+#define git_SHA1_backend	blk_SHA1_backend
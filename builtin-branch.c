@@ -189,7 +189,7 @@ struct ref_list {
 	struct rev_info revs;
 	int index, alloc, maxwidth;
 	struct ref_item *list;
-	struct commit_list *with_commit;
+	struct contains_cache contains;
 	int kinds;
 };
 
@@ -211,16 +211,16 @@ static int append_ref(const char *refname, const unsigned char *sha1, int flags,
 	} else
 		return 0;
 
+	/* Don't add types the caller doesn't want */
+	if ((kind & ref_list->kinds) == 0)
+		return 0;
+
 	commit = lookup_commit_reference_gently(sha1, 1);
 	if (!commit)
 		return error("branch '%s' does not point at a commit", refname);
 
 	/* Filter with with_commit if specified */
-	if (!is_descendant_of(commit, ref_list->with_commit))
-		return 0;
-
-	/* Don't add types the caller doesn't want */
-	if ((kind & ref_list->kinds) == 0)
+	if (!commit_contains(&ref_list->contains, commit))
 		return 0;
 
 	if (merge_filter != NO_FILTER)
@@ -367,7 +367,7 @@ static void print_ref_list(int kinds, int detached, int verbose, int abbrev, str
 
 	memset(&ref_list, 0, sizeof(ref_list));
 	ref_list.kinds = kinds;
-	ref_list.with_commit = with_commit;
+	init_contains_cache(&ref_list.contains, with_commit);
 	if (merge_filter != NO_FILTER)
 		init_revisions(&ref_list.revs, NULL);
 	for_each_ref(append_ref, &ref_list);
@@ -387,7 +387,7 @@ static void print_ref_list(int kinds, int detached, int verbose, int abbrev, str
 
 	detached = (detached && (kinds & REF_LOCAL_BRANCH));
 	if (detached && head_commit &&
-	    is_descendant_of(head_commit, with_commit)) {
+	    commit_contains(&ref_list.contains, head_commit)) {
 		struct ref_item item;
 		item.name = xstrdup("(no branch)");
 		item.kind = REF_LOCAL_BRANCH;
@@ -406,6 +406,7 @@ static void print_ref_list(int kinds, int detached, int verbose, int abbrev, str
 			       abbrev, current);
 	}
 
+	clear_contains_cache(&ref_list.contains);
 	free_ref_list(&ref_list);
 }
 
@@ -147,62 +147,185 @@ static int cat_one_file(int opt, const char *exp_type, const char *obj_name)
 	return 0;
 }
 
-static int batch_one_object(const char *obj_name, int print_contents)
+/*
+ * With --buffer, the output is left to stdio, and only flushed when
+ * the buffer fills up or at the end; otherwise it is flushed after
+ * each object, for callers that wait for the answer to a request
+ * before sending the next one.
+ */
+static int batch_buffer;
+static int batch_unordered;
+
+#define BATCH_BUFFER_SIZE (256 * 1024)
+
+static void batch_flush(void)
+{
+	if (!batch_buffer)
+		maybe_flush_or_die(stdout, "batch output");
+}
+
+static void batch_missing(const char *obj_name)
+{
+	printf("%s missing\n", obj_name);
+	batch_flush();
+}
+
+static void batch_write_object(const char *obj_name,
+			       const unsigned char *sha1, int print_contents)
 {
-	unsigned char sha1[20];
 	enum object_type type = 0;
 	unsigned long size;
 	void *contents = contents;
 
-	if (!obj_name)
-	   return 1;
-
-	if (get_sha1(obj_name, sha1)) {
-		printf("%s missing\n", obj_name);
-		fflush(stdout);
-		return 0;
-	}
-
 	if (print_contents == BATCH)
 		contents = read_sha1_file(sha1, &type, &size);
 	else
 		type = sha1_object_info(sha1, &size);
 
 	if (type <= 0) {
-		printf("%s missing\n", obj_name);
-		fflush(stdout);
-		return 0;
+		batch_missing(obj_name);
+		return;
 	}
 
 	printf("%s %s %lu\n", sha1_to_hex(sha1), typename(type), size);
-	fflush(stdout);
 
 	if (print_contents == BATCH) {
-		write_or_die(1, contents, size);
-		printf("\n");
-		fflush(stdout);
+		if (fwrite(contents, 1, size, stdout) != size)
+			die("unable to write object %s: %s",
+			    sha1_to_hex(sha1), strerror(errno));
+		putchar('\n');
 		free(contents);
 	}
+	batch_flush();
+}
 
+static int batch_one_object(const char *obj_name, int print_contents)
+{
+	unsigned char sha1[20];
+
+	if (!obj_name)
+	   return 1;
+
+	if (get_sha1(obj_name, sha1)) {
+		batch_missing(obj_name);
+		return 0;
+	}
+	batch_write_object(obj_name, sha1, print_contents);
 	return 0;
 }
 
-static int batch_objects(int print_contents)
+/*
+ * With --unordered, all the requests are read first, and the objects
+ * are then shown in the order they are stored in the packs, so that
+ * the packs are read sequentially.  Loose and missing objects follow
+ * in the order they were asked for.
+ */
+struct batch_request {
+	char *name;
+	unsigned char sha1[20];
+	int pack_nr;		/* -1 if not packed */
+	off_t offset;
+	int nr;			/* position in the input */
+};
+
+static int batch_request_cmp(const void *a_, const void *b_)
+{
+	const struct batch_request *a = a_, *b = b_;
+
+	if (a->pack_nr != b->pack_nr) {
+		if (a->pack_nr < 0 || b->pack_nr < 0)
+			return a->pack_nr < 0 ? 1 : -1;
+		return a->pack_nr < b->pack_nr ? -1 : 1;
+	}
+	if (a->pack_nr >= 0 && a->offset != b->offset)
+		return a->offset < b->offset ? -1 : 1;
+	return a->nr - b->nr;
+}
+
+static int pack_nr(struct packed_git *pack)
+{
+	static struct packed_git *last;
+	static int last_nr;
+	struct packed_git *p;
+	int nr;
+
+	if (pack == last)
+		return last_nr;
+	for (nr = 0, p = packed_git; p && p != pack; p = p->next)
+		nr++;
+	last = pack;
+	last_nr = nr;
+	return nr;
+}
+
+static int batch_objects_unordered(int print_contents)
 {
 	struct strbuf buf = STRBUF_INIT;
+	struct batch_request *req = NULL;
+	int nr = 0, alloc = 0, i;
 
 	while (strbuf_getline(&buf, stdin, '\n') != EOF) {
-		int error = batch_one_object(buf.buf, print_contents);
-		if (error)
-			return error;
+		struct batch_request *r;
+		struct pack_entry e;
+
+		ALLOC_GROW(req, nr + 1, alloc);
+		r = &req[nr];
+		r->name = xstrdup(buf.buf);
+		r->nr = nr++;
+		r->pack_nr = -1;
+		if (get_sha1(r->name, r->sha1)) {
+			hashclr(r->sha1);
+			continue;
+		}
+		if (find_pack_entry(r->sha1, &e, NULL)) {
+			r->pack_nr = pack_nr(e.p);
+			r->offset = e.offset;
+		}
 	}
+	strbuf_release(&buf);
 
+	qsort(req, nr, sizeof(*req), batch_request_cmp);
+	for (i = 0; i < nr; i++) {
+		if (is_null_sha1(req[i].sha1))
+			batch_missing(req[i].name);
+		else
+			batch_write_object(req[i].name, req[i].sha1,
+					   print_contents);
+		free(req[i].name);
+	}
+	free(req);
 	return 0;
 }
 
+static int batch_objects(int print_contents)
+{
+	struct strbuf buf = STRBUF_INIT;
+	int error = 0;
+
+	if (batch_buffer)
+		setvbuf(stdout, xmalloc(BATCH_BUFFER_SIZE), _IOFBF,
+			BATCH_BUFFER_SIZE);
+
+	if (batch_unordered)
+		error = batch_objects_unordered(print_contents);
+	else
+		while (strbuf_getline(&buf, stdin, '\n') != EOF) {
+			error = batch_one_object(buf.buf, print_contents);
+			if (error)
+				break;
+		}
+	strbuf_release(&buf);
+
+	if (batch_buffer) {
+		batch_buffer = 0;
+		batch_flush();
+	}
+	return error;
+}
+
 static const char * const cat_file_usage[] = {
 	"git cat-file [-t|-s|-e|-p|<type>] <sha1>",
-	"git cat-file [--batch|--batch-check] < <list_of_sha1s>",
+	"git cat-file [--batch|--batch-check] [--buffer] [--unordered] < <list_of_sha1s>",
 	NULL
 };
 
@@ -223,12 +346,16 @@ int cmd_cat_file(int argc, const char **argv, const char *prefix)
 		OPT_SET_INT(0, "batch-check", &batch,
 			    "show info about objects feeded on stdin",
 			    BATCH_CHECK),
+		OPT_BOOLEAN(0, "buffer", &batch_buffer,
+			    "buffer the batch output instead of flushing each object"),
+		OPT_BOOLEAN(0, "unordered", &batch_unordered,
+			    "show the batch objects in pack order"),
 		OPT_END()
 	};
 
 	git_config(git_default_config, NULL);
 
-	if (argc != 3 && argc != 2)
+	if (argc < 2 || argc > 4)
 		usage_with_options(cat_file_usage, options);
 
 	argc = parse_options(argc, argv, options, cat_file_usage, 0);
@@ -249,6 +376,8 @@ int cmd_cat_file(int argc, const char **argv, const char *prefix)
 	if (batch && (opt || argc)) {
 		usage_with_options(cat_file_usage, options);
 	}
+	if (!batch && (batch_buffer || batch_unordered))
+		usage_with_options(cat_file_usage, options);
 
 	if (batch)
 		return batch_objects(batch);
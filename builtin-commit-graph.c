@@ -0,0 +1,39 @@
+/*
+ * Builtin "git commit-graph"
+ */
+#include "cache.h"
+#include "commit.h"
+#include "commit-graph.h"
+#include "builtin.h"
+
+static const char builtin_commit_graph_usage[] =
+"git commit-graph (write | read)";
+
+static int graph_read(void)
+{
+	struct commit_graph_info info;
+
+	if (read_commit_graph_info(&info))
+		return error("no usable commit-graph file");
+	printf("num_commits: %"PRIu32"\n", info.num_commits);
+	printf("chunks: oid_fanout oid_lookup commit_data%s\n",
+	       info.has_extra_edges ? " extra_edges" : "");
+	return 0;
+}
+
+int cmd_commit_graph(int argc, const char **argv, const char *prefix)
+{
+	git_config(git_default_config, NULL);
+
+	if (argc != 2)
+		usage(builtin_commit_graph_usage);
+
+	/* the graph does not store messages, so don't keep them around */
+	save_commit_buffer = 0;
+
+	if (!strcmp(argv[1], "write"))
+		return !!write_commit_graph();
+	if (!strcmp(argv[1], "read"))
+		return !!graph_read();
+	usage(builtin_commit_graph_usage);
+}
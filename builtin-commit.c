@@ -840,6 +840,16 @@ int cmd_status(int argc, const char **argv, const char *prefix)
 
 	commitable = run_status(stdout, index_file, prefix, 0);
 
+	/* Save what the untracked cache learned, if we can */
+	if (commit_style == COMMIT_AS_IS &&
+	    the_index.untracked && the_index.untracked->changed) {
+		int fd = hold_locked_index(&index_lock, 0);
+		if (0 <= fd &&
+		    (write_cache(fd, active_cache, active_nr) ||
+		     commit_locked_index(&index_lock)))
+			rollback_lock_file(&index_lock);
+	}
+
 	rollback_index_files();
 
 	return commitable ? 0 : 1;
@@ -120,23 +120,22 @@ static int compare_pt(const void *a_, const void *b_)
 }
 
 static unsigned long finish_depth_computation(
-	struct commit_list **list,
+	struct commit_queue *queue,
 	struct possible_tag *best)
 {
 	unsigned long seen_commits = 0;
-	while (*list) {
-		struct commit *c = pop_commit(list);
+	while (queue->nr) {
+		struct commit *c = commit_queue_get(queue);
 		struct commit_list *parents = c->parents;
 		seen_commits++;
 		if (c->object.flags & best->flag_within) {
-			struct commit_list *a = *list;
-			while (a) {
-				struct commit *i = a->item;
-				if (!(i->object.flags & best->flag_within))
+			int i;
+			for (i = 0; i < queue->nr; i++) {
+				struct commit *a = queue->array[i].commit;
+				if (!(a->object.flags & best->flag_within))
 					break;
-				a = a->next;
 			}
-			if (!a)
+			if (i == queue->nr)
 				break;
 		} else
 			best->depth++;
@@ -144,7 +143,7 @@ static unsigned long finish_depth_computation(
 			struct commit *p = parents->item;
 			parse_commit(p);
 			if (!(p->object.flags & SEEN))
-				insert_by_date(p, list);
+				commit_queue_put(queue, p);
 			p->object.flags |= c->object.flags;
 			parents = parents->next;
 		}
@@ -177,7 +176,7 @@ static void describe(const char *arg, int last_one)
 {
 	unsigned char sha1[20];
 	struct commit *cmit, *gave_up_on = NULL;
-	struct commit_list *list;
+	struct commit_queue queue = { NULL };
 	static int initialized = 0;
 	struct commit_name *n;
 	struct possible_tag all_matches[MAX_TAGS];
@@ -212,11 +211,10 @@ static void describe(const char *arg, int last_one)
 	if (debug)
 		fprintf(stderr, "searching to describe %s\n", arg);
 
-	list = NULL;
 	cmit->object.flags = SEEN;
-	commit_list_insert(cmit, &list);
-	while (list) {
-		struct commit *c = pop_commit(&list);
+	commit_queue_put(&queue, cmit);
+	while (queue.nr) {
+		struct commit *c = commit_queue_get(&queue);
 		struct commit_list *parents = c->parents;
 		seen_commits++;
 		n = c->util;
@@ -241,7 +239,7 @@ static void describe(const char *arg, int last_one)
 			if (!(c->object.flags & t->flag_within))
 				t->depth++;
 		}
-		if (annotated_cnt && !list) {
+		if (annotated_cnt && !queue.nr) {
 			if (debug)
 				fprintf(stderr, "finished search at %s\n",
 					sha1_to_hex(c->object.sha1));
@@ -251,7 +249,7 @@ static void describe(const char *arg, int last_one)
 			struct commit *p = parents->item;
 			parse_commit(p);
 			if (!(p->object.flags & SEEN))
-				insert_by_date(p, &list);
+				commit_queue_put(&queue, p);
 			p->object.flags |= c->object.flags;
 			parents = parents->next;
 		}
@@ -261,6 +259,7 @@ static void describe(const char *arg, int last_one)
 		const unsigned char *sha1 = cmit->object.sha1;
 		if (always) {
 			printf("%s\n", find_unique_abbrev(sha1, abbrev));
+			clear_commit_queue(&queue);
 			return;
 		}
 		die("cannot describe '%s'", sha1_to_hex(sha1));
@@ -269,11 +268,11 @@ static void describe(const char *arg, int last_one)
 	qsort(all_matches, match_cnt, sizeof(all_matches[0]), compare_pt);
 
 	if (gave_up_on) {
-		insert_by_date(gave_up_on, &list);
+		commit_queue_put(&queue, gave_up_on);
 		seen_commits--;
 	}
-	seen_commits += finish_depth_computation(&list, &all_matches[0]);
-	free_commit_list(list);
+	seen_commits += finish_depth_computation(&queue, &all_matches[0]);
+	clear_commit_queue(&queue);
 
 	if (debug) {
 		for (cur_match = 0; cur_match < match_cnt; cur_match++) {
@@ -313,7 +313,7 @@ done:
 	return count ? retval : 0;
 }
 
-static struct commit_list *complete;
+static struct commit_queue complete;
 
 static int mark_complete(const char *path, const unsigned char *sha1, int flag, void *cb_data)
 {
@@ -329,17 +329,20 @@ static int mark_complete(const char *path, const unsigned char *sha1, int flag,
 	if (o && o->type == OBJ_COMMIT) {
 		struct commit *commit = (struct commit *)o;
 		commit->object.flags |= COMPLETE;
-		insert_by_date(commit, &complete);
+		commit_queue_put(&complete, commit);
 	}
 	return 0;
 }
 
 static void mark_recent_complete_commits(unsigned long cutoff)
 {
-	while (complete && cutoff <= complete->item->date) {
+	struct commit *commit;
+
+	while ((commit = commit_queue_peek(&complete)) &&
+	       cutoff <= commit->date) {
 		if (args.verbose)
 			fprintf(stderr, "Marking %s as complete\n",
-				sha1_to_hex(complete->item->object.sha1));
+				sha1_to_hex(commit->object.sha1));
 		pop_most_recent_commit(&complete, COMPLETE);
 	}
 }
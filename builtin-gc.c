@@ -26,6 +26,7 @@ static int pack_refs = 1;
 static int aggressive_window = -1;
 static int gc_auto_threshold = 6700;
 static int gc_auto_pack_limit = 50;
+static int gc_geometric_factor;
 static const char *prune_expire = "2.weeks.ago";
 
 #define MAX_ADD 10
@@ -56,6 +57,12 @@ static int gc_config(const char *var, const char *value, void *cb)
 		gc_auto_pack_limit = git_config_int(var, value);
 		return 0;
 	}
+	if (!strcmp(var, "gc.geometricrepack")) {
+		gc_geometric_factor = git_config_int(var, value);
+		if (gc_geometric_factor == 1 || gc_geometric_factor < 0)
+			return error("Invalid %s: '%s'", var, value);
+		return 0;
+	}
 	if (!strcmp(var, "gc.pruneexpire")) {
 		if (value && strcmp(value, "now")) {
 			unsigned long now = approxidate("now");
@@ -121,6 +128,39 @@ static int too_many_loose_objects(void)
 	return needed;
 }
 
+/*
+ * Count the packs "repack --geometric" would roll up into one; the
+ * rule lives in git-repack.sh alone.
+ */
+static int count_geometric_rollup(void)
+{
+	struct child_process cp;
+	struct strbuf buf = STRBUF_INIT;
+	char geometric[40];
+	const char *argv[] = {"repack", geometric, "--list-rollup", NULL};
+	int i, len, cnt = 0;
+
+	sprintf(geometric, "--geometric=%d", gc_geometric_factor);
+	memset(&cp, 0, sizeof(cp));
+	cp.argv = argv;
+	cp.out = -1;
+	cp.git_cmd = 1;
+	if (start_command(&cp)) {
+		error(FAILED_RUN, argv[0]);
+		return 0;
+	}
+	len = strbuf_read(&buf, cp.out, 1024);
+	close(cp.out);
+	if (finish_command(&cp) || len < 0)
+		error(FAILED_RUN, argv[0]);
+	else
+		for (i = 0; i < buf.len; i++)
+			if (buf.buf[i] == '\n')
+				cnt++;
+	strbuf_release(&buf);
+	return cnt;
+}
+
 static int too_many_packs(void)
 {
 	struct packed_git *p;
@@ -129,6 +169,13 @@ static int too_many_packs(void)
 	if (gc_auto_pack_limit <= 0)
 		return 0;
 
+	/*
+	 * In geometric mode only the small packs that break the
+	 * progression count; the large ones are left alone anyway.
+	 */
+	if (gc_geometric_factor)
+		return gc_auto_pack_limit <= count_geometric_rollup();
+
 	prepare_packed_git();
 	for (cnt = 0, p = packed_git; p; p = p->next) {
 		if (!p->pack_local)
@@ -157,15 +204,24 @@ static int need_to_gc(void)
 	 * If there are too many loose objects, but not too many
 	 * packs, we run "repack -d -l".  If there are too many packs,
 	 * we run "repack -A -d -l".  Otherwise we tell the caller
-	 * there is no need.
+	 * there is no need.  With gc.geometricRepack, both cases run
+	 * "repack --geometric=<factor> -d -l", which packs the loose
+	 * objects and rolls up only the packs that need it.
 	 */
-	if (too_many_packs())
-		append_option(argv_repack,
-			      !strcmp(prune_expire, "now") ? "-a" : "-A",
-			      MAX_ADD);
-	else if (!too_many_loose_objects())
+	if (too_many_packs()) {
+		if (!gc_geometric_factor)
+			append_option(argv_repack,
+				      !strcmp(prune_expire, "now") ? "-a" : "-A",
+				      MAX_ADD);
+	} else if (!too_many_loose_objects())
 		return 0;
 
+	if (gc_geometric_factor) {
+		static char geometric[40];
+		sprintf(geometric, "--geometric=%d", gc_geometric_factor);
+		append_option(argv_repack, geometric, MAX_ADD);
+	}
+
 	if (run_hook(NULL, "pre-auto-gc", NULL))
 		return 0;
 	return 1;
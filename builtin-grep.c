@@ -12,6 +12,11 @@
 #include "builtin.h"
 #include "grep.h"
 
+#ifdef THREADED_DELTA_SEARCH
+#include "thread-utils.h"
+#include <pthread.h>
+#endif
+
 #ifndef NO_EXTERNAL_GREP
 #ifdef __unix__
 #define NO_EXTERNAL_GREP 0
@@ -22,6 +27,186 @@
 
 static int builtin_grep;
 
+/* 0 means one per CPU */
+static int num_threads;
+
+#ifdef THREADED_DELTA_SEARCH
+/*
+ * Threaded grep.  The main thread enumerates the paths and reads the
+ * blobs, as the object store is not thread safe, and queues them in a
+ * ring of work items.  Worker threads run grep_buffer() on the items,
+ * each into an output buffer of its own, and the main thread prints
+ * the buffers in the order the items were queued, so that the output
+ * is the same as that of a sequential grep.
+ */
+#define TODO_SIZE 128
+
+struct work_item {
+	char *name;
+	char *buf;
+	unsigned long size;
+	struct strbuf out;
+	int hit;
+	int done;
+};
+
+static struct work_item todo[TODO_SIZE];
+static int todo_start;	/* oldest item not printed yet */
+static int todo_end;	/* next free slot */
+static int todo_done;	/* next item to hand to a worker */
+static int all_work_added;
+static int work_hit;
+
+static int use_threads;
+static int nr_threads;
+static pthread_t *threads;
+
+static pthread_mutex_t grep_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* signalled when an item is queued, or all of them are */
+static pthread_cond_t cond_add = PTHREAD_COND_INITIALIZER;
+/* signalled when a worker is done with an item */
+static pthread_cond_t cond_result = PTHREAD_COND_INITIALIZER;
+
+static struct work_item *get_work(void)
+{
+	struct work_item *w;
+
+	pthread_mutex_lock(&grep_mutex);
+	while (todo_done == todo_end && !all_work_added)
+		pthread_cond_wait(&cond_add, &grep_mutex);
+	if (todo_done == todo_end) {
+		w = NULL;
+	} else {
+		w = todo + todo_done;
+		todo_done = (todo_done + 1) % TODO_SIZE;
+	}
+	pthread_mutex_unlock(&grep_mutex);
+	return w;
+}
+
+static void *run(void *arg)
+{
+	struct grep_opt *opt = arg;
+	struct work_item *w;
+
+	while ((w = get_work()) != NULL) {
+		opt->output = &w->out;
+		w->hit = grep_buffer(opt, w->name, w->buf, w->size);
+		free(w->buf);
+		w->buf = NULL;
+
+		pthread_mutex_lock(&grep_mutex);
+		w->done = 1;
+		pthread_cond_signal(&cond_result);
+		pthread_mutex_unlock(&grep_mutex);
+	}
+	free_grep_patterns(opt);
+	free(opt);
+	return NULL;
+}
+
+static void start_threads(struct grep_opt *opt)
+{
+	int i, ret;
+
+	for (i = 0; i < TODO_SIZE; i++)
+		strbuf_init(&todo[i].out, 0);
+	threads = xcalloc(nr_threads, sizeof(*threads));
+	for (i = 0; i < nr_threads; i++) {
+		struct grep_opt *o = grep_opt_dup(opt);
+		ret = pthread_create(&threads[i], NULL, run, o);
+		if (ret)
+			die("grep: unable to create thread: %s",
+			    strerror(ret));
+	}
+}
+
+/* Print the finished items at the head of the ring; grep_mutex is held */
+static void write_done_items(void)
+{
+	while (todo_start != todo_end && todo[todo_start].done) {
+		struct work_item *w = todo + todo_start;
+
+		fwrite(w->out.buf, 1, w->out.len, stdout);
+		strbuf_setlen(&w->out, 0);
+		work_hit |= w->hit;
+		free(w->name);
+		w->done = 0;
+		todo_start = (todo_start + 1) % TODO_SIZE;
+	}
+}
+
+static void add_work(struct grep_opt *opt, const char *name,
+		     char *buf, unsigned long size)
+{
+	struct work_item *w;
+
+	if (!threads)
+		start_threads(opt);
+
+	pthread_mutex_lock(&grep_mutex);
+	while ((todo_end + 1) % TODO_SIZE == todo_start) {
+		write_done_items();
+		if ((todo_end + 1) % TODO_SIZE == todo_start)
+			pthread_cond_wait(&cond_result, &grep_mutex);
+	}
+	w = todo + todo_end;
+	w->name = xstrdup(name);
+	w->buf = buf;
+	w->size = size;
+	w->hit = 0;
+	w->done = 0;
+	todo_end = (todo_end + 1) % TODO_SIZE;
+	pthread_cond_signal(&cond_add);
+	pthread_mutex_unlock(&grep_mutex);
+}
+
+/* Wait for the workers, print what is left and return whether any hit */
+static int wait_all(void)
+{
+	int i;
+
+	if (!threads)
+		return 0;
+
+	pthread_mutex_lock(&grep_mutex);
+	all_work_added = 1;
+	pthread_cond_broadcast(&cond_add);
+	for (;;) {
+		write_done_items();
+		if (todo_start == todo_end)
+			break;
+		pthread_cond_wait(&cond_result, &grep_mutex);
+	}
+	pthread_mutex_unlock(&grep_mutex);
+
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	threads = NULL;
+	return work_hit;
+}
+#else
+#define use_threads 0
+#define add_work(opt, name, buf, size) die("BUG: threaded grep")
+static int wait_all(void)
+{
+	return 0;
+}
+#endif
+
+static int grep_config(const char *var, const char *value, void *cb)
+{
+	if (!strcmp(var, "grep.threads")) {
+		num_threads = git_config_int(var, value);
+		if (num_threads < 0)
+			die("invalid number of threads specified (%d)",
+			    num_threads);
+		return 0;
+	}
+	return git_default_config(var, value, cb);
+}
+
 /*
  * git grep pathspecs are somewhat different from diff-tree pathspecs;
  * pathname wildcards are allowed.
@@ -121,6 +306,11 @@ static int grep_sha1(struct grep_opt *opt, const unsigned char *sha1, const char
 			name = cp;
 		}
 	}
+	if (use_threads) {
+		add_work(opt, name, data, size);
+		free(to_free);
+		return 0;
+	}
 	hit = grep_buffer(opt, name, data, size);
 	free(data);
 	free(to_free);
@@ -158,6 +348,10 @@ static int grep_file(struct grep_opt *opt, const char *filename)
 	close(i);
 	if (opt->relative && opt->prefix_length)
 		filename += opt->prefix_length;
+	if (use_threads) {
+		add_work(opt, filename, data, sz);
+		return 0;
+	}
 	i = grep_buffer(opt, filename, data, sz);
 	free(data);
 	return i;
@@ -426,6 +620,7 @@ static int grep_cache(struct grep_opt *opt, const char **paths, int cached)
 			nr--; /* compensate for loop control */
 		}
 	}
+	hit |= wait_all();
 	free_grep_patterns(opt);
 	return hit;
 }
@@ -536,6 +731,8 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 	opt.pattern_tail = &opt.pattern_list;
 	opt.regflags = REG_NEWLINE;
 
+	git_config(grep_config, NULL);
+
 	/*
 	 * If there is no -- then the paths must exist in the working
 	 * tree.  If there is no explicit pattern specified with -e or
@@ -558,6 +755,14 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 			builtin_grep = 1;
 			continue;
 		}
+		if (!prefixcmp(arg, "--threads=")) {
+			char *end;
+			num_threads = strtol(arg + 10, &end, 0);
+			if (!arg[10] || *end || num_threads < 0)
+				die("invalid number of threads specified (%s)",
+				    arg + 10);
+			continue;
+		}
 		if (!strcmp("-a", arg) ||
 		    !strcmp("--text", arg)) {
 			opt.binary = GREP_BINARY_TEXT;
@@ -763,6 +968,11 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 		die("cannot mix --fixed-strings and regexp");
 	compile_grep_patterns(&opt);
 
+#ifdef THREADED_DELTA_SEARCH
+	nr_threads = num_threads ? num_threads : online_cpus();
+	use_threads = nr_threads > 1;
+#endif
+
 	/* Check revs and then paths */
 	for (i = 1; i < argc; i++) {
 		const char *arg = argv[i];
@@ -819,6 +1029,7 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 		if (grep_object(&opt, paths, real_obj, list.objects[i].name))
 			hit = 1;
 	}
+	hit |= wait_all();
 	free_grep_patterns(&opt);
 	return !hit;
 }
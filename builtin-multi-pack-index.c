@@ -0,0 +1,40 @@
+/*
+ * Builtin "git multi-pack-index"
+ */
+#include "cache.h"
+#include "midx.h"
+#include "builtin.h"
+
+static const char builtin_multi_pack_index_usage[] =
+"git multi-pack-index (write | read)";
+
+static int midx_read(void)
+{
+	struct multi_pack_index_info info;
+	uint32_t i;
+
+	if (read_multi_pack_index_info(&info))
+		return error("no usable multi-pack-index file");
+	printf("num_packs: %"PRIu32"\n", info.num_packs);
+	printf("num_objects: %"PRIu32"\n", info.num_objects);
+	printf("chunks: pack_names oid_fanout oid_lookup object_offsets%s\n",
+	       info.has_large_offsets ? " large_offsets" : "");
+	printf("packs:\n");
+	for (i = 0; i < info.num_packs; i++)
+		printf("%s\n", info.pack_names[i]);
+	return 0;
+}
+
+int cmd_multi_pack_index(int argc, const char **argv, const char *prefix)
+{
+	git_config(git_default_config, NULL);
+
+	if (argc != 2)
+		usage(builtin_multi_pack_index_usage);
+
+	if (!strcmp(argv[1], "write"))
+		return !!write_multi_pack_index();
+	if (!strcmp(argv[1], "read"))
+		return !!midx_read();
+	usage(builtin_multi_pack_index_usage);
+}
@@ -9,6 +9,7 @@
 #include "delta.h"
 #include "pack.h"
 #include "pack-revindex.h"
+#include "pack-bitmap.h"
 #include "csum-file.h"
 #include "tree-walk.h"
 #include "diff.h"
@@ -30,6 +31,7 @@ git pack-objects [{ -q | --progress | --all-progress }] \n\
 	[--threads=N] [--non-empty] [--revs [--unpacked | --all]*] [--reflog] \n\
 	[--stdout | base-name] [--include-tag] \n\
 	[--keep-unreachable | --unpack-unreachable] \n\
+	[--[no-]use-bitmap-index] [--write-bitmap-index] \n\
 	[<ref-list | <object-list]";
 
 struct object_entry {
@@ -71,6 +73,8 @@ static int reuse_delta = 1, reuse_object = 1;
 static int keep_unreachable, unpack_unreachable, include_tag;
 static int local;
 static int incremental;
+static const char **unpacked_packs;
+static int nr_unpacked_packs, alloc_unpacked_packs;
 static int ignore_packed_keep;
 static int allow_ofs_delta;
 static const char *base_name;
@@ -84,6 +88,8 @@ static int num_preferred_base;
 static struct progress *progress_state;
 static int pack_compression_level = Z_DEFAULT_COMPRESSION;
 static int pack_compression_seen;
+static int use_bitmap_index = 1;
+static int write_bitmap_index;
 
 static unsigned long delta_cache_size = 0;
 static unsigned long max_delta_cache_size = 0;
@@ -105,6 +111,30 @@ static int object_ix_hashsz;
 static uint32_t written, written_delta;
 static uint32_t reused, reused_delta;
 
+#ifdef THREADED_DELTA_SEARCH
+
+static pthread_mutex_t read_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define read_lock()		pthread_mutex_lock(&read_mutex)
+#define read_unlock()		pthread_mutex_unlock(&read_mutex)
+
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define cache_lock()		pthread_mutex_lock(&cache_mutex)
+#define cache_unlock()		pthread_mutex_unlock(&cache_mutex)
+
+static pthread_mutex_t progress_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define progress_lock()		pthread_mutex_lock(&progress_mutex)
+#define progress_unlock()	pthread_mutex_unlock(&progress_mutex)
+
+#else
+
+#define read_lock()		(void)0
+#define read_unlock()		(void)0
+#define cache_lock()		(void)0
+#define cache_unlock()		(void)0
+#define progress_lock()		(void)0
+#define progress_unlock()	(void)0
+
+#endif
 
 static void *get_delta(struct object_entry *entry)
 {
@@ -112,12 +142,14 @@ static void *get_delta(struct object_entry *entry)
 	void *buf, *base_buf, *delta_buf;
 	enum object_type type;
 
+	read_lock();
 	buf = read_sha1_file(entry->idx.sha1, &type, &size);
 	if (!buf)
 		die("unable to read %s", sha1_to_hex(entry->idx.sha1));
 	base_buf = read_sha1_file(entry->delta->idx.sha1, &type, &base_size);
 	if (!base_buf)
 		die("unable to read %s", sha1_to_hex(entry->delta->idx.sha1));
+	read_unlock();
 	delta_buf = diff_delta(base_buf, base_size,
 			       buf, size, &delta_size, 0);
 	if (!delta_buf || delta_size != entry->delta_size)
@@ -229,6 +261,243 @@ static void copy_pack_data(struct sha1file *f,
 	}
 }
 
+static int want_reuse(struct object_entry *entry, int usable_delta)
+{
+	enum object_type type = entry->type;
+
+	if (!reuse_object)
+		return 0;	/* explicit */
+	else if (!entry->in_pack)
+		return 0;	/* can't reuse what we don't have */
+	else if (type == OBJ_REF_DELTA || type == OBJ_OFS_DELTA)
+				/* check_object() decided it for us ... */
+		return usable_delta;
+				/* ... but pack split may override that */
+	else if (type != entry->in_pack_type)
+		return 0;	/* pack has delta which is unusable */
+	else if (entry->delta)
+		return 0;	/* we want to pack afresh */
+	else
+		return 1;	/* we have it in-pack undeltified,
+				 * and we do not need to deltify it.
+				 */
+}
+
+#ifdef THREADED_DELTA_SEARCH
+
+/*
+ * Deflating the objects that are not reused as they are is most of
+ * the work of writing a pack.  When we may use several threads, the
+ * objects that need it are queued in the order write_one() is going
+ * to ask for them, and compressed ahead of the writer by worker
+ * threads.  The writer picks up the results in that same order, so
+ * the pack is the same whatever the number of threads.
+ */
+
+#define COMPRESS_AHEAD_OBJECTS	1024
+#define COMPRESS_AHEAD_MEMORY	(64 * 1024 * 1024)
+
+struct compressed_object {
+	struct object_entry *entry;
+	void *data;
+	unsigned long size, datalen;
+	enum object_type type;
+	int done;
+};
+
+static struct compressed_object *compress_queue;
+static unsigned compress_nr, compress_alloc;
+static unsigned compress_next;		/* next one to be claimed */
+static unsigned compress_written;	/* next one the writer wants */
+static unsigned long compress_pending;	/* compressed but not written */
+static int compress_stop;
+static pthread_t *compress_threads;
+static int nr_compress_threads;
+
+static pthread_mutex_t compress_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t compress_cond = PTHREAD_COND_INITIALIZER;
+#define compress_lock()		pthread_mutex_lock(&compress_mutex)
+#define compress_unlock()	pthread_mutex_unlock(&compress_mutex)
+
+static void compress_one(struct compressed_object *c)
+{
+	struct object_entry *entry = c->entry;
+	void *buf;
+
+	if (!entry->delta) {
+		read_lock();
+		buf = read_sha1_file(entry->idx.sha1, &c->type, &c->size);
+		read_unlock();
+		if (!buf)
+			die("unable to read %s", sha1_to_hex(entry->idx.sha1));
+	} else if (entry->delta_data) {
+		buf = entry->delta_data;
+		entry->delta_data = NULL;
+		c->size = entry->delta_size;
+	} else {
+		buf = get_delta(entry);
+		c->size = entry->delta_size;
+	}
+	c->datalen = do_compress(&buf, c->size);
+	c->data = buf;
+}
+
+/* called with compress_mutex held */
+static void compress_claimed(struct compressed_object *c)
+{
+	compress_unlock();
+	compress_one(c);
+	compress_lock();
+	c->done = 1;
+	compress_pending += c->datalen;
+	pthread_cond_broadcast(&compress_cond);
+}
+
+static int compress_may_claim(void)
+{
+	return compress_next < compress_nr &&
+	       compress_next < compress_written + COMPRESS_AHEAD_OBJECTS &&
+	       compress_pending < COMPRESS_AHEAD_MEMORY;
+}
+
+static void *threaded_compress(void *arg)
+{
+	compress_lock();
+	for (;;) {
+		while (!compress_stop && compress_next < compress_nr &&
+		       !compress_may_claim())
+			pthread_cond_wait(&compress_cond, &compress_mutex);
+		if (compress_stop || compress_next >= compress_nr)
+			break;
+		compress_claimed(&compress_queue[compress_next++]);
+	}
+	compress_unlock();
+	return NULL;
+}
+
+static void queue_compression(struct object_entry *e, char *seen)
+{
+	struct compressed_object *c;
+
+	/* the same walk as write_one() */
+	if (e->idx.offset || e->preferred_base || seen[e - objects])
+		return;
+	if (e->delta)
+		queue_compression(e->delta, seen);
+	seen[e - objects] = 1;
+
+	/* deltas in the cache may have been compressed already */
+	if (want_reuse(e, !!e->delta) || e->z_delta_size)
+		return;
+	ALLOC_GROW(compress_queue, compress_nr + 1, compress_alloc);
+	c = &compress_queue[compress_nr++];
+	memset(c, 0, sizeof(*c));
+	c->entry = e;
+}
+
+static void start_compression(void)
+{
+	char *seen;
+	uint32_t i;
+	int ret;
+
+	/* a pack split changes which deltas are usable as we go */
+	if (delta_search_threads <= 1 || pack_size_limit)
+		return;
+
+	seen = xcalloc(nr_objects, 1);
+	for (i = 0; i < nr_objects; i++)
+		queue_compression(objects + i, seen);
+	free(seen);
+	if (compress_nr < 2)
+		return;
+
+	nr_compress_threads = delta_search_threads;
+	compress_threads = xmalloc(nr_compress_threads * sizeof(*compress_threads));
+	for (i = 0; i < nr_compress_threads; i++) {
+		ret = pthread_create(&compress_threads[i], NULL,
+				     threaded_compress, NULL);
+		if (ret)
+			die("unable to create thread: %s", strerror(ret));
+	}
+}
+
+static void stop_compression(void)
+{
+	unsigned i;
+
+	compress_lock();
+	compress_stop = 1;
+	pthread_cond_broadcast(&compress_cond);
+	compress_unlock();
+	for (i = 0; i < nr_compress_threads; i++)
+		pthread_join(compress_threads[i], NULL);
+	for (i = 0; i < compress_nr; i++)
+		free(compress_queue[i].data);
+	free(compress_threads);
+	free(compress_queue);
+	compress_threads = NULL;
+	compress_queue = NULL;
+	nr_compress_threads = 0;
+	compress_nr = compress_alloc = 0;
+	compress_next = compress_written = 0;
+	compress_pending = 0;
+	compress_stop = 0;
+}
+
+/*
+ * Return the compressed data of "entry" if it is the next one in the
+ * queue, waiting for it or compressing it ourselves as needed.
+ */
+static void *take_compressed(struct object_entry *entry,
+			     enum object_type *type,
+			     unsigned long *size, unsigned long *datalen)
+{
+	struct compressed_object *c;
+	void *buf;
+
+	*datalen = 0;
+	if (compress_written >= compress_nr ||
+	    compress_queue[compress_written].entry != entry)
+		return NULL;
+
+	c = &compress_queue[compress_written];
+	compress_lock();
+	if (compress_next == compress_written) {
+		compress_next++;
+		compress_claimed(c);
+	}
+	while (!c->done)
+		pthread_cond_wait(&compress_cond, &compress_mutex);
+	compress_written++;
+	compress_pending -= c->datalen;
+	pthread_cond_broadcast(&compress_cond);
+	compress_unlock();
+
+	if (!entry->delta)
+		*type = c->type;
+	*size = c->size;
+	*datalen = c->datalen;
+	buf = c->data;
+	c->data = NULL;
+	return buf;
+}
+
+#else
+
+#define start_compression()	(void)0
+#define stop_compression()	(void)0
+
+static void *take_compressed(struct object_entry *entry,
+			     enum object_type *type,
+			     unsigned long *size, unsigned long *datalen)
+{
+	*datalen = 0;
+	return NULL;
+}
+
+#endif
+
 static unsigned long write_object(struct sha1file *f,
 				  struct object_entry *entry,
 				  off_t write_offset)
@@ -268,27 +537,19 @@ static unsigned long write_object(struct sha1file *f,
 	else
 		usable_delta = 0;	/* base could end up in another pack */
 
-	if (!reuse_object)
-		to_reuse = 0;	/* explicit */
-	else if (!entry->in_pack)
-		to_reuse = 0;	/* can't reuse what we don't have */
-	else if (type == OBJ_REF_DELTA || type == OBJ_OFS_DELTA)
-				/* check_object() decided it for us ... */
-		to_reuse = usable_delta;
-				/* ... but pack split may override that */
-	else if (type != entry->in_pack_type)
-		to_reuse = 0;	/* pack has delta which is unusable */
-	else if (entry->delta)
-		to_reuse = 0;	/* we want to pack afresh */
-	else
-		to_reuse = 1;	/* we have it in-pack undeltified,
-				 * and we do not need to deltify it.
-				 */
+	to_reuse = want_reuse(entry, usable_delta);
 
 	if (!to_reuse) {
 		no_reuse:
-		if (!usable_delta) {
+		buf = take_compressed(entry, &type, &size, &datalen);
+		if (buf) {
+			if (usable_delta)
+				type = (allow_ofs_delta && entry->delta->idx.offset) ?
+					OBJ_OFS_DELTA : OBJ_REF_DELTA;
+		} else if (!usable_delta) {
+			read_lock();
 			buf = read_sha1_file(entry->idx.sha1, &type, &size);
+			read_unlock();
 			if (!buf)
 				die("unable to read %s", sha1_to_hex(entry->idx.sha1));
 			/*
@@ -311,7 +572,9 @@ static unsigned long write_object(struct sha1file *f,
 				OBJ_OFS_DELTA : OBJ_REF_DELTA;
 		}
 
-		if (entry->z_delta_size)
+		if (datalen)
+			; /* compressed ahead by a compression thread */
+		else if (entry->z_delta_size)
 			datalen = entry->z_delta_size;
 		else
 			datalen = do_compress(&buf, size);
@@ -373,6 +636,8 @@ static unsigned long write_object(struct sha1file *f,
 				OBJ_OFS_DELTA : OBJ_REF_DELTA;
 		hdrlen = encode_header(type, entry->size, header);
 
+		/* compression threads may be reading packs, too */
+		read_lock();
 		offset = entry->in_pack_offset;
 		revidx = find_pack_revindex(p, offset);
 		datalen = revidx[1].offset - offset;
@@ -380,6 +645,7 @@ static unsigned long write_object(struct sha1file *f,
 		    check_pack_crc(p, &w_curs, offset, datalen, revidx->nr)) {
 			error("bad packed object CRC for %s", sha1_to_hex(entry->idx.sha1));
 			unuse_pack(&w_curs);
+			read_unlock();
 			goto no_reuse;
 		}
 
@@ -389,6 +655,7 @@ static unsigned long write_object(struct sha1file *f,
 		    check_pack_inflate(p, &w_curs, offset, datalen, entry->size)) {
 			error("corrupt packed object for %s", sha1_to_hex(entry->idx.sha1));
 			unuse_pack(&w_curs);
+			read_unlock();
 			goto no_reuse;
 		}
 
@@ -400,6 +667,7 @@ static unsigned long write_object(struct sha1file *f,
 				dheader[--pos] = 128 | (--ofs & 127);
 			if (limit && hdrlen + sizeof(dheader) - pos + datalen + 20 >= limit) {
 				unuse_pack(&w_curs);
+				read_unlock();
 				return 0;
 			}
 			sha1write(f, header, hdrlen);
@@ -409,6 +677,7 @@ static unsigned long write_object(struct sha1file *f,
 		} else if (type == OBJ_REF_DELTA) {
 			if (limit && hdrlen + 20 + datalen + 20 >= limit) {
 				unuse_pack(&w_curs);
+				read_unlock();
 				return 0;
 			}
 			sha1write(f, header, hdrlen);
@@ -418,12 +687,14 @@ static unsigned long write_object(struct sha1file *f,
 		} else {
 			if (limit && hdrlen + datalen + 20 >= limit) {
 				unuse_pack(&w_curs);
+				read_unlock();
 				return 0;
 			}
 			sha1write(f, header, hdrlen);
 		}
 		copy_pack_data(f, p, &w_curs, offset, datalen);
 		unuse_pack(&w_curs);
+		read_unlock();
 		reused++;
 	}
 	if (usable_delta)
@@ -466,6 +737,66 @@ static int write_one(struct sha1file *f,
 /* forward declaration for write_pack_file */
 static int adjust_perm(const char *path, mode_t mode);
 
+/*
+ * Write "<base_name>-<sha1>.bitmap" for the pack that has just been
+ * written from written_list[] and renamed into place.
+ */
+static void write_bitmap_file(const unsigned char *sha1, mode_t mode)
+{
+	struct packed_git *p;
+	struct revindex_entry *revindex;
+	enum object_type *types;
+	uint32_t *hashes, j;
+	char *bitmap_tmp_name, tmpname[PATH_MAX];
+
+	snprintf(tmpname, sizeof(tmpname), "%s-%s.idx",
+		 base_name, sha1_to_hex(sha1));
+	p = add_packed_git(tmpname, strlen(tmpname), 1);
+	if (!p || open_pack_index(p))
+		die("unable to open the new pack %s", tmpname);
+	if (p->num_objects != nr_written)
+		die("new pack %s has %"PRIu32" objects instead of %"PRIu32,
+		    tmpname, p->num_objects, nr_written);
+	install_packed_git(p);
+	/* the revindex hash does not know about the new pack yet */
+	discard_revindex();
+
+	/*
+	 * write_idx_file() has sorted written_list[] by object name,
+	 * i.e. in the order of the index; the bitmap wants pack order.
+	 */
+	revindex = get_pack_revindex(p);
+	types = xmalloc(nr_written * sizeof(*types));
+	hashes = xmalloc(nr_written * sizeof(*hashes));
+	for (j = 0; j < nr_written; j++) {
+		struct object_entry *e =
+			(struct object_entry *)written_list[revindex[j].nr];
+		struct object_entry *base = e;
+
+		/* reused deltas only know their type from their base */
+		while (base->type == OBJ_OFS_DELTA ||
+		       base->type == OBJ_REF_DELTA)
+			base = base->delta;
+		types[j] = base->type;
+		hashes[j] = e->hash;
+	}
+	bitmap_tmp_name = write_pack_bitmap(p, types, hashes);
+	free(types);
+	free(hashes);
+	if (!bitmap_tmp_name)
+		return;
+
+	snprintf(tmpname, sizeof(tmpname), "%s-%s.bitmap",
+		 base_name, sha1_to_hex(sha1));
+	if (adjust_perm(bitmap_tmp_name, mode))
+		die("unable to make temporary bitmap file readable: %s",
+		    strerror(errno));
+	if (rename(bitmap_tmp_name, tmpname))
+		die("unable to rename temporary bitmap file: %s",
+		    strerror(errno));
+	free(bitmap_tmp_name);
+}
+
 static void write_pack_file(void)
 {
 	uint32_t i = 0, j;
@@ -501,11 +832,14 @@ static void write_pack_file(void)
 		sha1write(f, &hdr, sizeof(hdr));
 		offset = sizeof(hdr);
 		nr_written = 0;
+		if (!i)
+			start_compression();
 		for (; i < nr_objects; i++) {
 			if (!write_one(f, objects + i, &offset))
 				break;
 			display_progress(progress_state, written);
 		}
+		stop_compression();
 
 		/*
 		 * Did we write the wrong # entries in the header?
@@ -573,6 +907,14 @@ static void write_pack_file(void)
 				die("unable to rename temporary index file: %s",
 				    strerror(errno));
 
+			if (write_bitmap_index) {
+				if (nr_written == nr_result)
+					write_bitmap_file(sha1, mode);
+				else
+					warning("pack split by --max-pack-size; "
+						"not writing a bitmap");
+			}
+
 			free(idx_tmp_name);
 			free(pack_tmp_name);
 			puts(sha1_to_hex(sha1));
@@ -652,27 +994,6 @@ static void rehash_objects(void)
 	}
 }
 
-static unsigned name_hash(const char *name)
-{
-	unsigned char c;
-	unsigned hash = 0;
-
-	if (!name)
-		return 0;
-
-	/*
-	 * This effectively just creates a sortable number from the
-	 * last sixteen non-whitespace characters. Last characters
-	 * count "most", so things that end in ".c" sort together.
-	 */
-	while ((c = *name++) != 0) {
-		if (isspace(c))
-			continue;
-		hash = (hash >> 2) + (c << 24);
-	}
-	return hash;
-}
-
 static void setup_delta_attr_check(struct git_attr_check *check)
 {
 	static struct git_attr *attr_delta;
@@ -695,25 +1016,29 @@ static int no_try_delta(const char *path)
 	return 0;
 }
 
-static int add_object_entry(const unsigned char *sha1, enum object_type type,
-			    const char *name, int exclude)
+/*
+ * Packs named with --unpacked=<pack> are being repacked, so
+ * --incremental does not count their objects as already packed.
+ */
+static int is_unpacked_pack(struct packed_git *p)
 {
-	struct object_entry *entry;
-	struct packed_git *p, *found_pack = NULL;
-	off_t found_offset = 0;
-	int ix;
-	unsigned hash = name_hash(name);
+	int i;
 
-	ix = nr_objects ? locate_object_entry_hash(sha1) : -1;
-	if (ix >= 0) {
-		if (exclude) {
-			entry = objects + object_ix[ix] - 1;
-			if (!entry->preferred_base)
-				nr_result--;
-			entry->preferred_base = 1;
-		}
-		return 0;
-	}
+	for (i = 0; i < nr_unpacked_packs; i++)
+		if (matches_pack_name(p, unpacked_packs[i]))
+			return 1;
+	return 0;
+}
+
+/*
+ * Decide whether the object should be packed, and find the pack it
+ * can be reused from; *found_pack may already be set by the caller.
+ */
+static int want_object_in_pack(const unsigned char *sha1, int exclude,
+			       struct packed_git **found_pack,
+			       off_t *found_offset)
+{
+	struct packed_git *p;
 
 	if (!exclude && local && has_loose_object_nonlocal(sha1))
 		return 0;
@@ -721,13 +1046,13 @@ static int add_object_entry(const unsigned char *sha1, enum object_type type,
 	for (p = packed_git; p; p = p->next) {
 		off_t offset = find_pack_entry_one(sha1, p);
 		if (offset) {
-			if (!found_pack) {
-				found_offset = offset;
-				found_pack = p;
+			if (!*found_pack) {
+				*found_offset = offset;
+				*found_pack = p;
 			}
 			if (exclude)
 				break;
-			if (incremental)
+			if (incremental && !is_unpacked_pack(p))
 				return 0;
 			if (local && !p->pack_local)
 				return 0;
@@ -735,6 +1060,16 @@ static int add_object_entry(const unsigned char *sha1, enum object_type type,
 				return 0;
 		}
 	}
+	return 1;
+}
+
+static void create_object_entry(const unsigned char *sha1,
+				enum object_type type, unsigned hash,
+				int exclude, int no_try_delta, int ix,
+				struct packed_git *found_pack,
+				off_t found_offset)
+{
+	struct object_entry *entry;
 
 	if (nr_objects >= nr_alloc) {
 		nr_alloc = (nr_alloc  + 1024) * 3 / 2;
@@ -763,9 +1098,51 @@ static int add_object_entry(const unsigned char *sha1, enum object_type type,
 
 	display_progress(progress_state, nr_objects);
 
-	if (name && no_try_delta(name))
+	if (no_try_delta)
 		entry->no_try_delta = 1;
+}
+
+static int add_object_entry(const unsigned char *sha1, enum object_type type,
+			    const char *name, int exclude)
+{
+	struct object_entry *entry;
+	struct packed_git *found_pack = NULL;
+	off_t found_offset = 0;
+	int ix;
 
+	ix = nr_objects ? locate_object_entry_hash(sha1) : -1;
+	if (ix >= 0) {
+		if (exclude) {
+			entry = objects + object_ix[ix] - 1;
+			if (!entry->preferred_base)
+				nr_result--;
+			entry->preferred_base = 1;
+		}
+		return 0;
+	}
+
+	if (!want_object_in_pack(sha1, exclude, &found_pack, &found_offset))
+		return 0;
+
+	create_object_entry(sha1, type, pack_name_hash(name), exclude,
+			    name && no_try_delta(name), ix,
+			    found_pack, found_offset);
+	return 1;
+}
+
+static int add_object_entry_from_bitmap(const unsigned char *sha1,
+					enum object_type type,
+					uint32_t name_hash,
+					struct packed_git *pack, off_t offset)
+{
+	int ix = nr_objects ? locate_object_entry_hash(sha1) : -1;
+
+	if (ix >= 0)
+		return 0;
+	if (!want_object_in_pack(sha1, 0, &pack, &offset))
+		return 0;
+
+	create_object_entry(sha1, type, name_hash, 0, 0, ix, pack, offset);
 	return 1;
 }
 
@@ -966,7 +1343,7 @@ static void add_preferred_base_object(const char *name)
 {
 	struct pbase_tree *it;
 	int cmplen;
-	unsigned hash = name_hash(name);
+	unsigned hash = pack_name_hash(name);
 
 	if (!num_preferred_base || check_pbase_path(hash))
 		return;
@@ -1232,31 +1609,6 @@ static int delta_cacheable(unsigned long src_size, unsigned long trg_size,
 	return 0;
 }
 
-#ifdef THREADED_DELTA_SEARCH
-
-static pthread_mutex_t read_mutex = PTHREAD_MUTEX_INITIALIZER;
-#define read_lock()		pthread_mutex_lock(&read_mutex)
-#define read_unlock()		pthread_mutex_unlock(&read_mutex)
-
-static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
-#define cache_lock()		pthread_mutex_lock(&cache_mutex)
-#define cache_unlock()		pthread_mutex_unlock(&cache_mutex)
-
-static pthread_mutex_t progress_mutex = PTHREAD_MUTEX_INITIALIZER;
-#define progress_lock()		pthread_mutex_lock(&progress_mutex)
-#define progress_unlock()	pthread_mutex_unlock(&progress_mutex)
-
-#else
-
-#define read_lock()		(void)0
-#define read_unlock()		(void)0
-#define cache_lock()		(void)0
-#define cache_unlock()		(void)0
-#define progress_lock()		(void)0
-#define progress_unlock()	(void)0
-
-#endif
-
 static int try_delta(struct unpacked *trg, struct unpacked *src,
 		     unsigned max_depth, unsigned long *mem_usage)
 {
@@ -1409,12 +1761,21 @@ static unsigned long free_unpacked(struct unpacked *n)
 	return freed_mem;
 }
 
-static void find_deltas(struct object_entry **list, unsigned *list_size,
-			int window, int depth, unsigned *processed)
+/*
+ * Search deltas for the objects of "list".  The list may be shortened
+ * from its end by another thread while we work on it, so its size, and
+ * the total size of the objects left in it if "list_weight" is given,
+ * are only looked at and updated under progress_lock().  Returns the
+ * number of objects we processed.
+ */
+static unsigned find_deltas(struct object_entry **list, unsigned *list_size,
+			    unsigned long *list_weight,
+			    int window, int depth, unsigned *processed)
 {
 	uint32_t i, idx = 0, count = 0;
 	struct unpacked *array;
 	unsigned long mem_usage = 0;
+	unsigned nr = 0;
 
 	array = xcalloc(window, sizeof(struct unpacked));
 
@@ -1430,6 +1791,9 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 		}
 		entry = *list++;
 		(*list_size)--;
+		if (list_weight)
+			*list_weight -= entry->size;
+		nr++;
 		if (!entry->preferred_base) {
 			(*processed)++;
 			display_progress(progress_state, *processed);
@@ -1542,6 +1906,7 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 		free(array[i].data);
 	}
 	free(array);
+	return nr;
 }
 
 #ifdef THREADED_DELTA_SEARCH
@@ -1560,6 +1925,7 @@ struct thread_params {
 	struct object_entry **list;
 	unsigned list_size;
 	unsigned remaining;
+	unsigned long remaining_weight;
 	int window;
 	int depth;
 	int working;
@@ -1567,19 +1933,43 @@ struct thread_params {
 	pthread_mutex_t mutex;
 	pthread_cond_t cond;
 	unsigned *processed;
+
+	/* statistics */
+	unsigned objects;
+	unsigned long busy_ms;
 };
 
 static pthread_cond_t progress_cond = PTHREAD_COND_INITIALIZER;
 
+/* what each thread did, shown once the progress meter is done */
+static struct thread_params *delta_thread_stats;
+static int nr_delta_thread_stats;
+
+static unsigned long elapsed_ms(const struct timeval *since)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - since->tv_sec) * 1000 +
+		((long)now.tv_usec - (long)since->tv_usec) / 1000;
+}
+
 static void *threaded_find_deltas(void *arg)
 {
 	struct thread_params *me = arg;
 
 	while (me->remaining) {
-		find_deltas(me->list, &me->remaining,
-			    me->window, me->depth, me->processed);
+		struct timeval start;
+		unsigned nr;
+
+		gettimeofday(&start, NULL);
+		nr = find_deltas(me->list, &me->remaining,
+				 &me->remaining_weight,
+				 me->window, me->depth, me->processed);
 
 		progress_lock();
+		me->objects += nr;
+		me->busy_ms += elapsed_ms(&start);
 		me->working = 0;
 		pthread_cond_signal(&progress_cond);
 		progress_unlock();
@@ -1602,27 +1992,65 @@ static void *threaded_find_deltas(void *arg)
 	return NULL;
 }
 
+static unsigned long list_weight(struct object_entry **list, unsigned nr)
+{
+	unsigned long weight = 0;
+
+	while (nr--)
+		weight += (*list++)->size;
+	return weight;
+}
+
+/*
+ * Take "sub_size" objects at "list" and move the cut to the next
+ * "path" boundary, so that objects of the same path end up in the
+ * same delta window.  The cut is moved forward, never beyond "max".
+ */
+static unsigned path_boundary(struct object_entry **list, unsigned sub_size,
+			      unsigned max)
+{
+	while (sub_size && sub_size < max &&
+	       list[sub_size]->hash &&
+	       list[sub_size]->hash == list[sub_size-1]->hash)
+		sub_size++;
+	return sub_size;
+}
+
 static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 			   int window, int depth, unsigned *processed)
 {
-	struct thread_params p[delta_search_threads];
+	struct thread_params *p;
 	int i, ret, active_threads = 0;
+	unsigned long total_weight;
 
 	if (delta_search_threads <= 1) {
-		find_deltas(list, &list_size, window, depth, processed);
+		find_deltas(list, &list_size, NULL, window, depth, processed);
 		return;
 	}
 	if (progress > pack_to_stdout)
 		fprintf(stderr, "Delta compression using %d threads.\n",
 				delta_search_threads);
+	p = xcalloc(delta_search_threads, sizeof(*p));
 
-	/* Partition the work amongst work threads. */
+	/*
+	 * Partition the work amongst work threads.  The time it takes
+	 * is more about the size of the objects than about their number,
+	 * so give each thread about the same total size.
+	 */
+	total_weight = list_weight(list, list_size);
 	for (i = 0; i < delta_search_threads; i++) {
-		unsigned sub_size = list_size / (delta_search_threads - i);
+		unsigned long goal = total_weight / (delta_search_threads - i);
+		unsigned long sub_weight = 0;
+		unsigned sub_size = 0;
+
+		while (sub_size < list_size && sub_weight < goal)
+			sub_weight += list[sub_size++]->size;
 
 		/* don't use too small segments or no deltas will be found */
-		if (sub_size < 2*window && i+1 < delta_search_threads)
-			sub_size = 0;
+		if (sub_size < 2*window)
+			sub_size = 2*window;
+		if (sub_size > list_size || i+1 == delta_search_threads)
+			sub_size = list_size;
 
 		p[i].window = window;
 		p[i].depth = depth;
@@ -1631,17 +2059,17 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 		p[i].data_ready = 0;
 
 		/* try to split chunks on "path" boundaries */
-		while (sub_size && sub_size < list_size &&
-		       list[sub_size]->hash &&
-		       list[sub_size]->hash == list[sub_size-1]->hash)
-			sub_size++;
+		sub_size = path_boundary(list, sub_size, list_size);
+		sub_weight = list_weight(list, sub_size);
 
 		p[i].list = list;
 		p[i].list_size = sub_size;
 		p[i].remaining = sub_size;
+		p[i].remaining_weight = sub_weight;
 
 		list += sub_size;
 		list_size -= sub_size;
+		total_weight -= sub_weight;
 	}
 
 	/* Start work threads. */
@@ -1660,15 +2088,18 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 	/*
 	 * Now let's wait for work completion.  Each time a thread is done
 	 * with its work, we steal half of the remaining work from the
-	 * thread with the largest number of unprocessed objects and give
-	 * it to that newly idle thread.  This ensure good load balancing
-	 * until the remaining object list segments are simply too short
-	 * to be worth splitting anymore.
+	 * thread with the most work left, counted in bytes of objects,
+	 * and give it to that newly idle thread.  Both halves keep at
+	 * least a window worth of objects, and we cut between "paths"
+	 * whenever we can.  This ensure good load balancing until the
+	 * remaining object list segments are simply too short to be
+	 * worth splitting anymore.
 	 */
 	while (active_threads) {
 		struct thread_params *target = NULL;
 		struct thread_params *victim = NULL;
 		unsigned sub_size = 0;
+		unsigned long sub_weight = 0;
 
 		progress_lock();
 		for (;;) {
@@ -1682,32 +2113,45 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 
 		for (i = 0; i < delta_search_threads; i++)
 			if (p[i].remaining > 2*window &&
-			    (!victim || victim->remaining < p[i].remaining))
+			    (!victim ||
+			     victim->remaining_weight < p[i].remaining_weight))
 				victim = &p[i];
 		if (victim) {
-			sub_size = victim->remaining / 2;
+			unsigned min = window, max = victim->remaining - window;
+			int cut;
+
+			/* take objects from the end up to half the weight */
+			while (sub_size < max &&
+			       (sub_size < min ||
+				2 * sub_weight < victim->remaining_weight))
+				sub_weight += victim->list[victim->list_size
+							   - ++sub_size]->size;
 			list = victim->list + victim->list_size - sub_size;
-			while (sub_size && list[0]->hash &&
-			       list[0]->hash == list[-1]->hash) {
-				list++;
-				sub_size--;
-			}
-			if (!sub_size) {
-				/*
-				 * It is possible for some "paths" to have
-				 * so many objects that no hash boundary
-				 * might be found.  Let's just steal the
-				 * exact half in that case.
-				 */
-				sub_size = victim->remaining / 2;
-				list -= sub_size;
+
+			/*
+			 * Move the cut forward to a "path" boundary.  It is
+			 * possible for some "paths" to have so many objects
+			 * that no hash boundary might be found; just cut
+			 * where the weight says in that case.
+			 */
+			for (cut = 0; sub_size - cut > min; cut++)
+				if (!list[cut]->hash ||
+				    list[cut]->hash != list[cut-1]->hash)
+					break;
+			if (sub_size - cut > min) {
+				list += cut;
+				sub_size -= cut;
+				sub_weight = list_weight(list, sub_size);
 			}
+
 			target->list = list;
 			victim->list_size -= sub_size;
 			victim->remaining -= sub_size;
+			victim->remaining_weight -= sub_weight;
 		}
 		target->list_size = sub_size;
 		target->remaining = sub_size;
+		target->remaining_weight = sub_weight;
 		target->working = 1;
 		progress_unlock();
 
@@ -1723,10 +2167,36 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 			active_threads--;
 		}
 	}
+
+	free(delta_thread_stats);
+	delta_thread_stats = p;
+	nr_delta_thread_stats = delta_search_threads;
+}
+
+static void show_delta_thread_stats(void)
+{
+	int i;
+
+	if (!delta_thread_stats)
+		return;
+	if (progress > pack_to_stdout) {
+		fprintf(stderr, "Delta compression time per thread:");
+		for (i = 0; i < nr_delta_thread_stats; i++) {
+			struct thread_params *p = &delta_thread_stats[i];
+			fprintf(stderr, " %lu.%02lus (%u objects)%s",
+				p->busy_ms / 1000, p->busy_ms % 1000 / 10,
+				p->objects,
+				i + 1 < nr_delta_thread_stats ? "," : "");
+		}
+		fputc('\n', stderr);
+	}
+	free(delta_thread_stats);
+	delta_thread_stats = NULL;
 }
 
 #else
-#define ll_find_deltas(l, s, w, d, p)	find_deltas(l, &s, w, d, p)
+#define ll_find_deltas(l, s, w, d, p)	find_deltas(l, &s, NULL, w, d, p)
+#define show_delta_thread_stats()	(void)0
 #endif
 
 static int add_ref_tag(const char *path, const unsigned char *sha1, int flag, void *cb_data)
@@ -1806,6 +2276,7 @@ static void prepare_pack(int window, int depth)
 		qsort(delta_list, n, sizeof(*delta_list), type_size_sort);
 		ll_find_deltas(delta_list, n, window+1, depth, &nr_done);
 		stop_progress(&progress_state);
+		show_delta_thread_stats();
 		if (nr_done != nr_deltas)
 			die("inconsistency with delta count");
 	}
@@ -1862,6 +2333,10 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 				pack_idx_default_version);
 		return 0;
 	}
+	if (!strcmp(k, "pack.usebitmaps")) {
+		use_bitmap_index = git_config_bool(k, v);
+		return 0;
+	}
 	if (!strcmp(k, "pack.packsizelimit")) {
 		pack_size_limit_cfg = git_config_ulong(k, v);
 		return 0;
@@ -2026,6 +2501,14 @@ static void loosen_unused_packed_objects(struct rev_info *revs)
 	}
 }
 
+static int get_object_list_from_bitmap(struct rev_info *revs)
+{
+	if (prepare_bitmap_walk(revs) < 0)
+		return -1;
+	traverse_bitmap_commit_list(add_object_entry_from_bitmap);
+	return 0;
+}
+
 static void get_object_list(int ac, const char **av)
 {
 	struct rev_info revs;
@@ -2053,6 +2536,16 @@ static void get_object_list(int ac, const char **av)
 			die("bad revision '%s'", line);
 	}
 
+	/*
+	 * The bitmaps cannot tell which objects are loose, nor honor
+	 * grafts or shallow boundaries that were not there when they
+	 * were written.
+	 */
+	if (use_bitmap_index && !revs.unpacked && !keep_unreachable &&
+	    !unpack_unreachable && !has_commit_grafts() &&
+	    !get_object_list_from_bitmap(&revs))
+		return;
+
 	if (prepare_revision_walk(&revs))
 		die("revision walk setup failed");
 	mark_edges_uninteresting(revs.commits, &revs, show_edge);
@@ -2075,6 +2568,7 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 {
 	int use_internal_rev_list = 0;
 	int thin = 0;
+	int rev_list_all = 0;
 	uint32_t i;
 	const char **rp_av;
 	int rp_ac_alloc = 64;
@@ -2208,11 +2702,30 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 			include_tag = 1;
 			continue;
 		}
+		if (!strcmp("--use-bitmap-index", arg)) {
+			use_bitmap_index = 1;
+			continue;
+		}
+		if (!strcmp("--no-use-bitmap-index", arg)) {
+			use_bitmap_index = 0;
+			continue;
+		}
+		if (!strcmp("--write-bitmap-index", arg)) {
+			write_bitmap_index = 1;
+			continue;
+		}
+		if (!strcmp("--all", arg))
+			rev_list_all = 1;
 		if (!strcmp("--unpacked", arg) ||
 		    !prefixcmp(arg, "--unpacked=") ||
 		    !strcmp("--reflog", arg) ||
 		    !strcmp("--all", arg)) {
 			use_internal_rev_list = 1;
+			if (!prefixcmp(arg, "--unpacked=")) {
+				ALLOC_GROW(unpacked_packs, nr_unpacked_packs + 1,
+					   alloc_unpacked_packs);
+				unpacked_packs[nr_unpacked_packs++] = arg + 11;
+			}
 			if (rp_ac >= rp_ac_alloc - 1) {
 				rp_ac_alloc = alloc_nr(rp_ac_alloc);
 				rp_av = xrealloc(rp_av,
@@ -2272,6 +2785,16 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	if (keep_unreachable && unpack_unreachable)
 		die("--keep-unreachable and --unpack-unreachable are incompatible.");
 
+	/*
+	 * A bitmap needs a pack that holds everything reachable from
+	 * the commits in it, which only "--all" can promise.
+	 */
+	if (write_bitmap_index && (pack_to_stdout || !rev_list_all)) {
+		warning("--write-bitmap-index needs --all and a pack on disk; "
+			"not writing a bitmap");
+		write_bitmap_index = 0;
+	}
+
 #ifdef THREADED_DELTA_SEARCH
 	if (!delta_search_threads)	/* --threads=0 means autodetect */
 		delta_search_threads = online_cpus();
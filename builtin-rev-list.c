@@ -11,6 +11,7 @@
 #include "builtin.h"
 #include "log-tree.h"
 #include "graph.h"
+#include "pack-bitmap.h"
 
 /* bits #0-15 in revision.h */
 
@@ -47,7 +48,8 @@ static const char rev_list_usage[] =
 "  special purpose:\n"
 "    --bisect\n"
 "    --bisect-vars\n"
-"    --bisect-all"
+"    --bisect-all\n"
+"    --use-bitmap-index"
 ;
 
 static struct rev_info revs;
@@ -56,8 +58,38 @@ static int bisect_list;
 static int show_timestamp;
 static int hdr_termination;
 static const char *header_prefix;
+static int use_bitmap_index;
 
 static void finish_commit(struct commit *commit);
+
+static int show_bitmap_object(const unsigned char *sha1,
+			      enum object_type type, uint32_t name_hash,
+			      struct packed_git *found_pack,
+			      off_t found_offset)
+{
+	if (type == OBJ_COMMIT || revs.tree_objects)
+		printf("%s\n", sha1_to_hex(sha1));
+	return 0;
+}
+
+/*
+ * The bitmaps can only answer "which objects are reachable from these
+ * but not from those"; anything that limits or decorates the output
+ * needs the real walk.
+ */
+static int can_use_bitmap(struct rev_info *revs)
+{
+	return revs->max_count < 0 && revs->max_age == -1 &&
+		revs->min_age == -1 && !revs->prune_data &&
+		!revs->no_merges && !revs->unpacked &&
+		!revs->grep_filter.pattern_list && !revs->verbose_header &&
+		revs->commit_format == CMIT_FMT_UNSPECIFIED &&
+		!revs->print_parents && !revs->left_right &&
+		!revs->boundary && !revs->edge_hint && !revs->graph &&
+		revs->skip_count <= 0 && !revs->first_parent_only &&
+		!revs->cherry_pick && !revs->reflog_info &&
+		!has_commit_grafts();
+}
 static void show_commit(struct commit *commit)
 {
 	graph_show_commit(revs.graph);
@@ -615,6 +647,10 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 			bisect_show_vars = 1;
 			continue;
 		}
+		if (!strcmp(arg, "--use-bitmap-index")) {
+			use_bitmap_index = 1;
+			continue;
+		}
 		if (!strcmp(arg, "--stdin")) {
 			if (read_from_stdin++)
 				die("--stdin given twice?");
@@ -649,6 +685,12 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 	if (bisect_list)
 		revs.limited = 1;
 
+	if (use_bitmap_index && !bisect_list && can_use_bitmap(&revs) &&
+	    !prepare_bitmap_walk(&revs)) {
+		traverse_bitmap_commit_list(show_bitmap_object);
+		return 0;
+	}
+
 	if (prepare_revision_walk(&revs))
 		die("revision walk setup failed");
 	if (revs.tree_objects)
@@ -94,12 +94,22 @@ static void unmark_and_free(struct commit_list *list, unsigned int mark)
 	}
 }
 
+static void unmark_and_clear(struct commit_queue *queue, unsigned int mark)
+{
+	int i;
+
+	for (i = 0; i < queue->nr; i++)
+		queue->array[i].commit->object.flags &= ~mark;
+	clear_commit_queue(queue);
+}
+
 static int ref_newer(const unsigned char *new_sha1,
 		     const unsigned char *old_sha1)
 {
 	struct object *o;
 	struct commit *old, *new;
-	struct commit_list *list, *used;
+	struct commit_queue queue = { NULL };
+	struct commit_list *used = NULL;
 	int found = 0;
 
 	/* Both new and old must be commit-ish and new is descendant of
@@ -118,17 +128,16 @@ static int ref_newer(const unsigned char *new_sha1,
 	if (parse_commit(new) < 0)
 		return 0;
 
-	used = list = NULL;
-	commit_list_insert(new, &list);
-	while (list) {
-		new = pop_most_recent_commit(&list, 1);
+	commit_queue_put(&queue, new);
+	while (queue.nr) {
+		new = pop_most_recent_commit(&queue, 1);
 		commit_list_insert(new, &used);
 		if (new == old) {
 			found = 1;
 			break;
 		}
 	}
-	unmark_and_free(list, 1);
+	unmark_and_clear(&queue, 1);
 	unmark_and_free(used, 1);
 	return found;
 }
@@ -27,6 +27,7 @@ struct tag_filter {
 	const char *pattern;
 	int lines;
 	struct commit_list *with_commit;
+	struct contains_cache contains;
 };
 
 #define PGP_SIGNATURE "-----BEGIN PGP SIGNATURE-----"
@@ -49,7 +50,7 @@ static int show_reference(const char *refname, const unsigned char *sha1,
 			commit = lookup_commit_reference_gently(sha1, 1);
 			if (!commit)
 				return 0;
-			if (!is_descendant_of(commit, filter->with_commit))
+			if (!commit_contains(&filter->contains, commit))
 				return 0;
 		}
 
@@ -101,8 +102,10 @@ static int list_tags(const char *pattern, int lines,
 	filter.pattern = pattern;
 	filter.lines = lines;
 	filter.with_commit = with_commit;
+	init_contains_cache(&filter.contains, with_commit);
 
 	for_each_tag_ref(show_reference, (void *) &filter);
+	clear_contains_cache(&filter.contains);
 
 	return 0;
 }
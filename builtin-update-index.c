@@ -388,7 +388,7 @@ static void read_index_info(int line_termination)
 }
 
 static const char update_index_usage[] =
-"git update-index [-q] [--add] [--replace] [--remove] [--unmerged] [--refresh] [--really-refresh] [--cacheinfo] [--chmod=(+|-)x] [--assume-unchanged] [--info-only] [--force-remove] [--stdin] [--index-info] [--unresolve] [--again | -g] [--ignore-missing] [-z] [--verbose] [--] <file>...";
+"git update-index [-q] [--add] [--replace] [--remove] [--unmerged] [--refresh] [--really-refresh] [--cacheinfo] [--chmod=(+|-)x] [--assume-unchanged] [--info-only] [--force-remove] [--stdin] [--index-info] [--unresolve] [--again | -g] [--ignore-missing] [-z] [--verbose] [--index-version <n>] [--] <file>...";
 
 static unsigned char head_sha1[20];
 static unsigned char merge_head_sha1[20];
@@ -639,6 +639,24 @@ int cmd_update_index(int argc, const char **argv, const char *prefix)
 				i += 3;
 				continue;
 			}
+			if (!strcmp(path, "--index-version")) {
+				unsigned int version;
+
+				if (i+1 >= argc)
+					die("git update-index: --index-version <n>");
+				if (strtoul_ui(argv[i+1], 10, &version) ||
+				    version < INDEX_FORMAT_LB ||
+				    version > INDEX_FORMAT_UB)
+					die("git update-index: index version %s"
+					    " not in range %d..%d", argv[i+1],
+					    INDEX_FORMAT_LB, INDEX_FORMAT_UB);
+				if (the_index.version != version) {
+					the_index.version = version;
+					active_cache_changed = 1;
+				}
+				i++;
+				continue;
+			}
 			if (!strcmp(path, "--chmod=-x") ||
 			    !strcmp(path, "--chmod=+x")) {
 				if (argc <= i+1)
@@ -13,6 +13,15 @@
 #define git_SHA1_Final	SHA1_Final
 #endif
 
+#ifndef git_SHA1_Update_multi
+/*
+ * Feed data[i] (len[i] bytes) to ctx[i] for "nr" contexts; backends
+ * that cannot hash several streams at once do it one after the other.
+ */
+extern void git_SHA1_Update_multi(git_SHA_CTX **ctx, const void **data,
+				  const unsigned long *len, int nr);
+#endif
+
 #include <zlib.h>
 #if defined(NO_DEFLATE_BOUND) || ZLIB_VERNUM < 0x1200
 #define deflateBound(c,s)  ((s) + (((s) + 7) >> 3) + (((s) + 63) >> 6) + 11)
@@ -81,6 +90,8 @@ int git_inflate(z_streamp strm, int flush);
  */
 
 #define CACHE_SIGNATURE 0x44495243	/* "DIRC" */
+#define INDEX_FORMAT_LB 2
+#define INDEX_FORMAT_UB 4
 struct cache_header {
 	unsigned int hdr_signature;
 	unsigned int hdr_version;
@@ -282,11 +293,15 @@ struct index_state {
 	struct cache_entry **cache;
 	unsigned int cache_nr, cache_alloc, cache_changed;
 	struct cache_tree *cache_tree;
+	struct untracked_cache *untracked;
+	struct split_index *split_index;
 	time_t timestamp;
 	void *alloc;
 	unsigned name_hash_initialized : 1,
 		 initialized : 1;
 	struct hash_table name_hash;
+	unsigned char sha1[20];	/* checksum of the file we read */
+	unsigned int version;	/* on-disk format, 0 for a new index */
 };
 
 extern struct index_state the_index;
@@ -515,9 +530,17 @@ extern int core_compression_seen;
 extern size_t packed_git_window_size;
 extern size_t packed_git_limit;
 extern size_t delta_base_cache_limit;
+extern unsigned long big_file_threshold;
 extern int auto_crlf;
 extern int fsync_object_files;
 extern int core_preload_index;
+extern int core_commit_graph;
+extern int core_multi_pack_index;
+extern int core_loose_object_cache;
+extern int core_checkout_workers;
+extern int core_untracked_cache;
+extern int core_split_index;
+extern int core_index_version;
 
 enum safe_crlf {
 	SAFE_CRLF_FALSE = 0,
@@ -634,9 +657,19 @@ int longest_ancestor_length(const char *path, const char *prefix_list);
 extern int sha1_object_info(const unsigned char *, unsigned long *);
 extern void * read_sha1_file(const unsigned char *sha1, enum object_type *type, unsigned long *size);
 extern int hash_sha1_file(const void *buf, unsigned long len, const char *type, unsigned char *sha1);
+/* Same as hash_sha1_file() for "nr" objects, hashed together when possible */
+extern void hash_sha1_files(int nr, const void **buf, const unsigned long *len,
+			    const char **type, unsigned char **sha1);
 extern int write_sha1_file(void *buf, unsigned long len, const char *type, unsigned char *return_sha1);
 extern int pretend_sha1_file(void *, unsigned long, enum object_type, unsigned char *);
 extern int force_object_loose(const unsigned char *sha1, time_t mtime);
+/*
+ * Inflate the blob "sha1" straight into fd, without holding it in
+ * memory.  Returns 0 on success, -1 on error, and 1 without writing
+ * anything if the object cannot be streamed (e.g. it is stored as a
+ * delta), in which case the caller should use read_sha1_file().
+ */
+extern int stream_blob_to_fd(int fd, const unsigned char *sha1);
 
 /* global flag to enable extra checks when accessing packed objects */
 extern int do_check_packed_object_crc;
@@ -724,6 +757,8 @@ struct checkout {
 };
 
 extern int checkout_entry(struct cache_entry *ce, const struct checkout *state, char *topath);
+extern void start_parallel_checkout(void);
+extern int finish_parallel_checkout(void);
 extern int has_symlink_leading_path(int len, const char *name);
 extern int has_symlink_or_noent_leading_path(int len, const char *name);
 extern int has_dirs_only_path(int len, const char *name, int prefix_len);
@@ -732,6 +767,7 @@ extern void clear_lstat_cache(void);
 
 extern struct alternate_object_database {
 	struct alternate_object_database *next;
+	struct loose_object_cache *loose_objects;
 	char *name;
 	char base[FLEX_ARRAY]; /* more */
 } *alt_odb_list;
@@ -762,7 +798,8 @@ extern struct packed_git {
 	time_t mtime;
 	int pack_fd;
 	unsigned pack_local:1,
-		 pack_keep:1;
+		 pack_keep:1,
+		 pack_midx:1;	/* covered by the multi-pack-index */
 	unsigned char sha1[20];
 	/* something like ".git/objects/pack/xxxxx.pack" */
 	char pack_name[FLEX_ARRAY]; /* more */
@@ -834,6 +871,7 @@ extern struct packed_git *add_packed_git(const char *, int, int);
 extern const unsigned char *nth_packed_object_sha1(struct packed_git *, uint32_t);
 extern off_t nth_packed_object_offset(const struct packed_git *, uint32_t);
 extern off_t find_pack_entry_one(const unsigned char *, struct packed_git *);
+extern int find_pack_entry(const unsigned char *sha1, struct pack_entry *e, const char **ignore_packed);
 extern void *unpack_entry(struct packed_git *, off_t, enum object_type *, unsigned long *);
 extern unsigned long unpack_object_header_buffer(const unsigned char *buf, unsigned long len, enum object_type *type, unsigned long *sizep);
 extern unsigned long get_size_from_delta(struct packed_git *, struct pack_window **, off_t);
@@ -906,12 +944,32 @@ extern void alloc_report(void);
 /* trace.c */
 extern void trace_printf(const char *format, ...);
 extern void trace_argv_printf(const char **argv, const char *format, ...);
+extern void trace_printf_key(const char *key, const char *format, ...);
+extern int trace_want(const char *key);
 
 /* convert.c */
 /* returns 1 if *dst was used */
 extern int convert_to_git(const char *path, const char *src, size_t len,
                           struct strbuf *dst, enum safe_crlf checksafe);
 extern int convert_to_working_tree(const char *path, const char *src, size_t len, struct strbuf *dst);
+/* returns 1 if the conversion might change the contents of path */
+extern int would_convert_to_git(const char *path);
+
+/*
+ * The attributes that drive convert_to_working_tree() for a path, so
+ * that they can be looked up once, before the conversion itself is
+ * done elsewhere (e.g. on another thread, as .gitattributes lookups
+ * are not thread safe).
+ */
+struct conv_attrs {
+	int crlf;
+	int ident;
+	const char *smudge;
+};
+extern void convert_attrs(const char *path, struct conv_attrs *ca);
+extern int convert_to_working_tree_ca(const struct conv_attrs *ca, const char *path,
+				      const char *src, size_t len, struct strbuf *dst);
+extern int would_convert_to_working_tree(const struct conv_attrs *ca);
 
 /* add */
 /*
@@ -0,0 +1,586 @@
+#include "cache.h"
+#include "commit.h"
+#include "refs.h"
+#include "csum-file.h"
+#include "commit-graph.h"
+
+#define GRAPH_SIGNATURE 0x43475048 /* "CGPH" */
+#define GRAPH_VERSION 1
+#define GRAPH_HASH_VERSION 1 /* SHA-1 */
+
+#define GRAPH_CHUNKID_OIDFANOUT 0x4f494446 /* "OIDF" */
+#define GRAPH_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
+#define GRAPH_CHUNKID_DATA      0x43444154 /* "CDAT" */
+#define GRAPH_CHUNKID_EXTRAEDGES 0x45444745 /* "EDGE" */
+
+#define GRAPH_HEADER_SIZE 8
+#define GRAPH_CHUNKLOOKUP_WIDTH 12
+#define GRAPH_FANOUT_SIZE (4 * 256)
+#define GRAPH_DATA_WIDTH (20 + 16)
+
+#define GRAPH_PARENT_NONE         0x70000000
+#define GRAPH_EXTRA_EDGES_NEEDED  0x80000000
+#define GRAPH_EDGE_LAST_MASK      0x7fffffff
+#define GRAPH_LAST_EDGE           0x80000000
+
+/* used only while collecting commits for write_commit_graph() */
+#define GRAPH_SEEN (1u<<20)
+
+struct commit_graph {
+	const unsigned char *data;
+	size_t data_len;
+
+	uint32_t num_commits;
+	const uint32_t *chunk_oid_fanout;
+	const unsigned char *chunk_oid_lookup;
+	const unsigned char *chunk_commit_data;
+	const uint32_t *chunk_extra_edges;
+	uint32_t num_extra_edges;
+};
+
+static struct commit_graph *commit_graph;
+static int commit_graph_prepared;
+
+static char *get_commit_graph_filename(void)
+{
+	return git_path("objects/info/commit-graph");
+}
+
+static uint64_t get_be64(const void *ptr)
+{
+	const uint32_t *p = ptr;
+	return ((uint64_t)ntohl(p[0]) << 32) | ntohl(p[1]);
+}
+
+static struct commit_graph *load_commit_graph_one(const char *path)
+{
+	struct commit_graph *g;
+	const unsigned char *data, *chunk_lookup;
+	size_t len;
+	uint32_t i, nr = 0, num_chunks;
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+	len = xsize_t(st.st_size);
+	if (len < GRAPH_HEADER_SIZE + GRAPH_CHUNKLOOKUP_WIDTH + 20) {
+		close(fd);
+		error("commit-graph file %s is too small", path);
+		return NULL;
+	}
+	data = xmmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	g = xcalloc(1, sizeof(*g));
+	g->data = data;
+	g->data_len = len;
+
+	if (ntohl(*(uint32_t *)data) != GRAPH_SIGNATURE) {
+		error("commit-graph file %s has a bad signature", path);
+		goto bad;
+	}
+	if (data[4] != GRAPH_VERSION || data[5] != GRAPH_HASH_VERSION) {
+		error("commit-graph file %s is version %d/%d and is not"
+		      " supported by this binary", path, data[4], data[5]);
+		goto bad;
+	}
+	num_chunks = data[6];
+	if (len < GRAPH_HEADER_SIZE +
+		  (num_chunks + 1) * GRAPH_CHUNKLOOKUP_WIDTH + 20) {
+		error("commit-graph file %s is truncated", path);
+		goto bad;
+	}
+
+	chunk_lookup = data + GRAPH_HEADER_SIZE;
+	for (i = 0; i < num_chunks; i++) {
+		uint32_t id = ntohl(*(uint32_t *)chunk_lookup);
+		uint64_t offset = get_be64(chunk_lookup + 4);
+		uint64_t next = get_be64(chunk_lookup + 4 + GRAPH_CHUNKLOOKUP_WIDTH);
+		uint64_t size;
+
+		chunk_lookup += GRAPH_CHUNKLOOKUP_WIDTH;
+		if (offset > next || next > len - 20 || (offset & 3)) {
+			error("commit-graph file %s has an invalid chunk"
+			      " offset", path);
+			goto bad;
+		}
+		size = next - offset;
+		switch (id) {
+		case GRAPH_CHUNKID_OIDFANOUT:
+			if (size != GRAPH_FANOUT_SIZE)
+				goto bad_chunk;
+			g->chunk_oid_fanout = (const uint32_t *)(data + offset);
+			break;
+		case GRAPH_CHUNKID_OIDLOOKUP:
+			if (size % 20)
+				goto bad_chunk;
+			g->chunk_oid_lookup = data + offset;
+			nr = size / 20;
+			break;
+		case GRAPH_CHUNKID_DATA:
+			g->chunk_commit_data = data + offset;
+			break;
+		case GRAPH_CHUNKID_EXTRAEDGES:
+			g->chunk_extra_edges = (const uint32_t *)(data + offset);
+			g->num_extra_edges = size / 4;
+			break;
+		}
+		continue;
+	bad_chunk:
+		error("commit-graph file %s has a chunk of bad size", path);
+		goto bad;
+	}
+
+	if (!g->chunk_oid_fanout || !g->chunk_oid_lookup ||
+	    !g->chunk_commit_data) {
+		error("commit-graph file %s is missing a required chunk", path);
+		goto bad;
+	}
+	for (i = 0; i < 256; i++) {
+		uint32_t n = ntohl(g->chunk_oid_fanout[i]);
+		if (n < g->num_commits) {
+			error("commit-graph file %s has a non-monotonic"
+			      " fanout table", path);
+			goto bad;
+		}
+		g->num_commits = n;
+	}
+	if (g->num_commits != nr ||
+	    g->chunk_commit_data + (size_t)nr * GRAPH_DATA_WIDTH > data + len - 20) {
+		error("commit-graph file %s has inconsistent chunk sizes", path);
+		goto bad;
+	}
+	return g;
+
+bad:
+	munmap((void *)data, len);
+	free(g);
+	return NULL;
+}
+
+static struct commit_graph *prepare_commit_graph(void)
+{
+	if (commit_graph_prepared)
+		return commit_graph;
+	commit_graph_prepared = 1;
+	if (!core_commit_graph)
+		return NULL;
+	commit_graph = load_commit_graph_one(get_commit_graph_filename());
+	return commit_graph;
+}
+
+void close_commit_graph(void)
+{
+	if (commit_graph) {
+		munmap((void *)commit_graph->data, commit_graph->data_len);
+		free(commit_graph);
+		commit_graph = NULL;
+	}
+	commit_graph_prepared = 0;
+}
+
+static int bsearch_graph(struct commit_graph *g, const unsigned char *sha1,
+			 uint32_t *pos)
+{
+	uint32_t lo, hi;
+
+	lo = sha1[0] ? ntohl(g->chunk_oid_fanout[sha1[0] - 1]) : 0;
+	hi = ntohl(g->chunk_oid_fanout[sha1[0]]);
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(g->chunk_oid_lookup + 20 * mi, sha1);
+		if (!cmp) {
+			*pos = mi;
+			return 1;
+		}
+		if (cmp > 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return 0;
+}
+
+static struct commit_list **insert_parent_or_die(struct commit_graph *g,
+						 uint32_t pos,
+						 struct commit_list **pptr)
+{
+	struct commit *c;
+
+	if (pos >= g->num_commits)
+		die("invalid parent position %"PRIu32" in commit-graph", pos);
+	c = lookup_commit(g->chunk_oid_lookup + 20 * pos);
+	if (!c)
+		return pptr;
+	return &commit_list_insert(c, pptr)->next;
+}
+
+static void fill_commit_in_graph(struct commit *item,
+				 struct commit_graph *g, uint32_t pos)
+{
+	const unsigned char *commit_data = g->chunk_commit_data +
+		(size_t)GRAPH_DATA_WIDTH * pos;
+	const uint32_t *words = (const uint32_t *)(commit_data + 20);
+	struct commit_list **pptr = &item->parents;
+	uint32_t edge_value;
+	uint64_t date_high, date_low;
+
+	item->object.parsed = 1;
+	item->tree = lookup_tree(commit_data);
+
+	date_high = ntohl(words[2]) & 0x3;
+	date_low = ntohl(words[3]);
+	item->date = (unsigned long)((date_high << 32) | date_low);
+	if (!has_commit_grafts())
+		item->generation = ntohl(words[2]) >> 2;
+
+	edge_value = ntohl(words[0]);
+	if (edge_value == GRAPH_PARENT_NONE)
+		return;
+	pptr = insert_parent_or_die(g, edge_value, pptr);
+
+	edge_value = ntohl(words[1]);
+	if (edge_value == GRAPH_PARENT_NONE)
+		return;
+	if (!(edge_value & GRAPH_EXTRA_EDGES_NEEDED)) {
+		insert_parent_or_die(g, edge_value, pptr);
+		return;
+	}
+
+	edge_value &= GRAPH_EDGE_LAST_MASK;
+	do {
+		uint32_t edge;
+
+		if (edge_value >= g->num_extra_edges)
+			die("invalid extra edge in commit-graph");
+		edge = ntohl(g->chunk_extra_edges[edge_value++]);
+		pptr = insert_parent_or_die(g, edge & GRAPH_EDGE_LAST_MASK, pptr);
+		if (edge & GRAPH_LAST_EDGE)
+			break;
+	} while (1);
+}
+
+int parse_commit_in_graph(struct commit *item)
+{
+	struct commit_graph *g = prepare_commit_graph();
+	uint32_t pos;
+
+	if (!g)
+		return 0;
+	if (lookup_commit_graft(item->object.sha1))
+		return 0;
+	if (!bsearch_graph(g, item->object.sha1, &pos))
+		return 0;
+	fill_commit_in_graph(item, g, pos);
+	return 1;
+}
+
+void load_commit_graph_info(struct commit *item)
+{
+	struct commit_graph *g;
+	const uint32_t *words;
+	uint32_t pos;
+
+	if (item->generation)
+		return;
+	g = prepare_commit_graph();
+	if (!g || has_commit_grafts())
+		return;
+	if (!bsearch_graph(g, item->object.sha1, &pos))
+		return;
+	words = (const uint32_t *)(g->chunk_commit_data +
+				   (size_t)GRAPH_DATA_WIDTH * pos + 20);
+	item->generation = ntohl(words[2]) >> 2;
+}
+
+int read_commit_graph_info(struct commit_graph_info *info)
+{
+	struct commit_graph *g = prepare_commit_graph();
+
+	if (!g)
+		return -1;
+	info->num_commits = g->num_commits;
+	info->has_extra_edges = !!g->chunk_extra_edges;
+	return 0;
+}
+
+/*
+ * Writing
+ */
+struct graph_commit_list {
+	struct commit **list;
+	int nr, alloc;
+};
+
+static void add_graph_commit(struct graph_commit_list *commits,
+			     struct commit *commit)
+{
+	if (commit->object.flags & GRAPH_SEEN)
+		return;
+	commit->object.flags |= GRAPH_SEEN;
+	ALLOC_GROW(commits->list, commits->nr + 1, commits->alloc);
+	commits->list[commits->nr++] = commit;
+}
+
+static int add_ref_to_graph(const char *refname, const unsigned char *sha1,
+			    int flags, void *cb_data)
+{
+	struct commit *commit = lookup_commit_reference_gently(sha1, 1);
+
+	if (commit)
+		add_graph_commit(cb_data, commit);
+	return 0;
+}
+
+static int collect_reachable_commits(struct graph_commit_list *commits)
+{
+	int i;
+
+	head_ref(add_ref_to_graph, commits);
+	for_each_ref(add_ref_to_graph, commits);
+
+	/* the list grows while we scan it, picking up all ancestors */
+	for (i = 0; i < commits->nr; i++) {
+		struct commit *commit = commits->list[i];
+		struct commit_list *parent;
+
+		if (parse_commit(commit))
+			return error("unable to parse commit %s",
+				     sha1_to_hex(commit->object.sha1));
+		for (parent = commit->parents; parent; parent = parent->next)
+			add_graph_commit(commits, parent->item);
+	}
+	return 0;
+}
+
+static void compute_generation_numbers(struct graph_commit_list *commits)
+{
+	struct commit **stack = NULL;
+	int i, nr = 0, alloc = 0;
+
+	for (i = 0; i < commits->nr; i++) {
+		if (commits->list[i]->generation)
+			continue;
+		ALLOC_GROW(stack, nr + 1, alloc);
+		stack[nr++] = commits->list[i];
+
+		while (nr) {
+			struct commit *current = stack[nr - 1];
+			struct commit_list *parent;
+			unsigned int max_generation = 0;
+			int all_parents_computed = 1;
+
+			for (parent = current->parents; parent; parent = parent->next) {
+				unsigned int generation = parent->item->generation;
+				if (!generation) {
+					all_parents_computed = 0;
+					ALLOC_GROW(stack, nr + 1, alloc);
+					stack[nr++] = parent->item;
+				} else if (generation > max_generation)
+					max_generation = generation;
+			}
+			if (!all_parents_computed)
+				continue;
+			nr--;
+			if (max_generation < GENERATION_NUMBER_MAX)
+				max_generation++;
+			current->generation = max_generation;
+		}
+	}
+	free(stack);
+}
+
+static int commit_sha1_cmp(const void *a_, const void *b_)
+{
+	const struct commit *a = *(const struct commit **)a_;
+	const struct commit *b = *(const struct commit **)b_;
+	return hashcmp(a->object.sha1, b->object.sha1);
+}
+
+static uint32_t graph_pos(struct graph_commit_list *commits,
+			  struct commit *commit)
+{
+	int lo = 0, hi = commits->nr;
+
+	while (lo < hi) {
+		int mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(commits->list[mi]->object.sha1,
+				  commit->object.sha1);
+		if (!cmp)
+			return mi;
+		if (cmp > 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	die("BUG: commit %s missing from the commit-graph",
+	    sha1_to_hex(commit->object.sha1));
+}
+
+static void sha1write_be32(struct sha1file *f, uint32_t value)
+{
+	value = htonl(value);
+	sha1write(f, &value, 4);
+}
+
+static void write_graph_chunk_fanout(struct sha1file *f,
+				     struct graph_commit_list *commits)
+{
+	int i, count = 0;
+
+	for (i = 0; i < 256; i++) {
+		while (count < commits->nr &&
+		       commits->list[count]->object.sha1[0] == i)
+			count++;
+		sha1write_be32(f, count);
+	}
+}
+
+static void write_graph_chunk_data(struct sha1file *f,
+				   struct graph_commit_list *commits)
+{
+	uint32_t num_extra_edges = 0;
+	int i;
+
+	for (i = 0; i < commits->nr; i++) {
+		struct commit *commit = commits->list[i];
+		struct commit_list *parent = commit->parents;
+		uint64_t date = commit->date;
+		uint32_t edge_value;
+
+		sha1write(f, commit->tree->object.sha1, 20);
+
+		edge_value = parent ? graph_pos(commits, parent->item)
+				    : GRAPH_PARENT_NONE;
+		sha1write_be32(f, edge_value);
+
+		if (parent)
+			parent = parent->next;
+		if (!parent)
+			edge_value = GRAPH_PARENT_NONE;
+		else if (!parent->next)
+			edge_value = graph_pos(commits, parent->item);
+		else {
+			edge_value = GRAPH_EXTRA_EDGES_NEEDED | num_extra_edges;
+			for (; parent; parent = parent->next)
+				num_extra_edges++;
+		}
+		sha1write_be32(f, edge_value);
+
+		sha1write_be32(f, (commit->generation << 2) |
+			       (uint32_t)((date >> 32) & 0x3));
+		sha1write_be32(f, (uint32_t)date);
+	}
+}
+
+static void write_graph_chunk_extra_edges(struct sha1file *f,
+					  struct graph_commit_list *commits)
+{
+	int i;
+
+	for (i = 0; i < commits->nr; i++) {
+		struct commit_list *parent = commits->list[i]->parents;
+
+		if (!parent || !parent->next || !parent->next->next)
+			continue;
+		/* the first parent lives in the commit data chunk */
+		for (parent = parent->next; parent; parent = parent->next) {
+			uint32_t edge_value = graph_pos(commits, parent->item);
+			if (!parent->next)
+				edge_value |= GRAPH_LAST_EDGE;
+			sha1write_be32(f, edge_value);
+		}
+	}
+}
+
+static struct lock_file graph_lock;
+
+int write_commit_graph(void)
+{
+	struct graph_commit_list commits;
+	struct sha1file *f;
+	uint32_t chunk_ids[5];
+	uint64_t chunk_offsets[5];
+	uint32_t num_extra_edges = 0;
+	int i, num_chunks, fd;
+	char *path;
+
+	if (has_commit_grafts())
+		return error("refusing to write a commit-graph in a repository"
+			     " with grafts or shallow history");
+
+	memset(&commits, 0, sizeof(commits));
+	if (collect_reachable_commits(&commits)) {
+		free(commits.list);
+		return -1;
+	}
+	if ((uint32_t)commits.nr >= GRAPH_PARENT_NONE) {
+		free(commits.list);
+		return error("too many commits to write a commit-graph");
+	}
+	compute_generation_numbers(&commits);
+	qsort(commits.list, commits.nr, sizeof(*commits.list), commit_sha1_cmp);
+
+	for (i = 0; i < commits.nr; i++) {
+		struct commit_list *parent = commits.list[i]->parents;
+		commits.list[i]->object.flags &= ~GRAPH_SEEN;
+		if (parent && parent->next && parent->next->next)
+			num_extra_edges += commit_list_count(parent) - 1;
+	}
+
+	chunk_ids[0] = GRAPH_CHUNKID_OIDFANOUT;
+	chunk_ids[1] = GRAPH_CHUNKID_OIDLOOKUP;
+	chunk_ids[2] = GRAPH_CHUNKID_DATA;
+	num_chunks = 3;
+	if (num_extra_edges)
+		chunk_ids[num_chunks++] = GRAPH_CHUNKID_EXTRAEDGES;
+	chunk_ids[num_chunks] = 0;
+
+	chunk_offsets[0] = GRAPH_HEADER_SIZE +
+		(num_chunks + 1) * GRAPH_CHUNKLOOKUP_WIDTH;
+	chunk_offsets[1] = chunk_offsets[0] + GRAPH_FANOUT_SIZE;
+	chunk_offsets[2] = chunk_offsets[1] + 20 * (uint64_t)commits.nr;
+	chunk_offsets[3] = chunk_offsets[2] +
+		GRAPH_DATA_WIDTH * (uint64_t)commits.nr;
+	chunk_offsets[4] = chunk_offsets[3] + 4 * (uint64_t)num_extra_edges;
+
+	path = get_commit_graph_filename();
+	if (safe_create_leading_directories(path)) {
+		free(commits.list);
+		return error("unable to create leading directories of %s", path);
+	}
+	fd = hold_lock_file_for_update(&graph_lock, path, LOCK_DIE_ON_ERROR);
+	f = sha1fd(fd, graph_lock.filename);
+
+	sha1write_be32(f, GRAPH_SIGNATURE);
+	sha1write_be32(f, (GRAPH_VERSION << 24) | (GRAPH_HASH_VERSION << 16) |
+		       (num_chunks << 8));
+
+	for (i = 0; i <= num_chunks; i++) {
+		sha1write_be32(f, chunk_ids[i]);
+		sha1write_be32(f, (uint32_t)(chunk_offsets[i] >> 32));
+		sha1write_be32(f, (uint32_t)chunk_offsets[i]);
+	}
+
+	write_graph_chunk_fanout(f, &commits);
+	for (i = 0; i < commits.nr; i++)
+		sha1write(f, commits.list[i]->object.sha1, 20);
+	write_graph_chunk_data(f, &commits);
+	if (num_extra_edges)
+		write_graph_chunk_extra_edges(f, &commits);
+
+	sha1close(f, NULL, CSUM_FSYNC);
+	graph_lock.fd = -1;
+	if (commit_lock_file(&graph_lock) < 0)
+		die("unable to write commit-graph file %s (%s)",
+		    path, strerror(errno));
+
+	free(commits.list);
+	close_commit_graph();
+	return 0;
+}
@@ -0,0 +1,42 @@
+#ifndef COMMIT_GRAPH_H
+#define COMMIT_GRAPH_H
+
+/*
+ * The commit-graph file ($GIT_OBJECT_DIRECTORY/info/commit-graph) caches
+ * the tree, parents, committer date and generation number of commits so
+ * that history walks do not have to inflate every commit object.  See
+ * Documentation/technical/commit-graph-format.txt for the layout.
+ */
+
+/*
+ * Fill in a commit from the commit-graph file, if it is recorded there.
+ * Returns 1 when the commit has been parsed, 0 when the caller needs to
+ * read the commit object itself.  Commits that have a graft are never
+ * answered from the graph.
+ */
+extern int parse_commit_in_graph(struct commit *item);
+
+/*
+ * Record the generation number of an already parsed commit if the
+ * commit-graph knows about it; used when the commit was parsed from
+ * its object, so that generation cut-offs still apply to it.
+ */
+extern void load_commit_graph_info(struct commit *item);
+
+/*
+ * Write a commit-graph file covering every commit reachable from the
+ * refs (and HEAD).  Returns 0 on success.
+ */
+extern int write_commit_graph(void);
+
+/* Forget the loaded commit-graph, e.g. after it has been rewritten. */
+extern void close_commit_graph(void);
+
+/* Summary of the loaded graph, for "git commit-graph read". */
+struct commit_graph_info {
+	uint32_t num_commits;
+	int has_extra_edges;
+};
+extern int read_commit_graph_info(struct commit_graph_info *info);
+
+#endif /* COMMIT_GRAPH_H */
@@ -6,6 +6,7 @@
 #include "diff.h"
 #include "revision.h"
 #include "notes.h"
+#include "commit-graph.h"
 
 int save_commit_buffer = 1;
 
@@ -204,6 +205,12 @@ struct commit_graft *lookup_commit_graft(const unsigned char *sha1)
 	return commit_graft[pos];
 }
 
+int has_commit_grafts(void)
+{
+	prepare_commit_graft();
+	return commit_graft_nr > 0;
+}
+
 int write_shallow_commits(int fd, int use_pack_protocol)
 {
 	int i, count = 0;
@@ -284,6 +291,7 @@ int parse_commit_buffer(struct commit *item, void *buffer, unsigned long size)
 		}
 	}
 	item->date = parse_commit_date(bufptr, tail);
+	load_commit_graph_info(item);
 
 	return 0;
 }
@@ -299,6 +307,12 @@ int parse_commit(struct commit *item)
 		return -1;
 	if (item->object.parsed)
 		return 0;
+	/*
+	 * The commit-graph has everything but the message, so use it
+	 * only when nobody is going to look at commit->buffer.
+	 */
+	if (!save_commit_buffer && parse_commit_in_graph(item))
+		return 0;
 	buffer = read_sha1_file(item->object.sha1, &type, &size);
 	if (!buffer)
 		return error("Could not read %s",
@@ -367,21 +381,114 @@ void sort_by_date(struct commit_list **list)
 	*list = ret;
 }
 
-struct commit *pop_most_recent_commit(struct commit_list **list,
+int compare_commits_by_date(const struct commit *a, const struct commit *b)
+{
+	if (a->date > b->date)
+		return -1;
+	return a->date < b->date;
+}
+
+/*
+ * A parent always has a smaller generation than its children, so this
+ * order is immune to clock skew; commits with an unknown generation
+ * come first, then by date.
+ */
+int compare_commits_by_generation(const struct commit *a,
+				  const struct commit *b)
+{
+	unsigned int ga = commit_generation(a), gb = commit_generation(b);
+
+	if (ga != gb)
+		return ga > gb ? -1 : 1;
+	return compare_commits_by_date(a, b);
+}
+
+static int commit_queue_before(struct commit_queue *queue, int i, int j)
+{
+	struct commit_queue_entry *a = queue->array + i, *b = queue->array + j;
+	int cmp = queue->compare ?
+		queue->compare(a->commit, b->commit) :
+		compare_commits_by_date(a->commit, b->commit);
+
+	if (cmp)
+		return cmp < 0;
+	return a->ctr < b->ctr;
+}
+
+static void commit_queue_swap(struct commit_queue *queue, int i, int j)
+{
+	struct commit_queue_entry tmp = queue->array[i];
+	queue->array[i] = queue->array[j];
+	queue->array[j] = tmp;
+}
+
+void commit_queue_put(struct commit_queue *queue, struct commit *commit)
+{
+	int ix, parent;
+
+	ALLOC_GROW(queue->array, queue->nr + 1, queue->alloc);
+	ix = queue->nr++;
+	queue->array[ix].commit = commit;
+	queue->array[ix].ctr = queue->ctr++;
+
+	/* Bubble it up towards the root while it beats its parent */
+	for (; ix; ix = parent) {
+		parent = (ix - 1) / 2;
+		if (!commit_queue_before(queue, ix, parent))
+			break;
+		commit_queue_swap(queue, ix, parent);
+	}
+}
+
+struct commit *commit_queue_peek(struct commit_queue *queue)
+{
+	return queue->nr ? queue->array[0].commit : NULL;
+}
+
+struct commit *commit_queue_get(struct commit_queue *queue)
+{
+	struct commit *result;
+	int ix, child;
+
+	if (!queue->nr)
+		return NULL;
+	result = queue->array[0].commit;
+	if (!--queue->nr)
+		return result;
+
+	/* Move the last one to the root and sift it down */
+	queue->array[0] = queue->array[queue->nr];
+	for (ix = 0; (child = 2 * ix + 1) < queue->nr; ix = child) {
+		if (child + 1 < queue->nr &&
+		    commit_queue_before(queue, child + 1, child))
+			child++;
+		if (!commit_queue_before(queue, child, ix))
+			break;
+		commit_queue_swap(queue, ix, child);
+	}
+	return result;
+}
+
+void clear_commit_queue(struct commit_queue *queue)
+{
+	free(queue->array);
+	queue->array = NULL;
+	queue->nr = 0;
+	queue->alloc = 0;
+	queue->ctr = 0;
+}
+
+struct commit *pop_most_recent_commit(struct commit_queue *queue,
 				      unsigned int mark)
 {
-	struct commit *ret = (*list)->item;
+	struct commit *ret = commit_queue_get(queue);
 	struct commit_list *parents = ret->parents;
-	struct commit_list *old = *list;
-
-	*list = (*list)->next;
-	free(old);
 
 	while (parents) {
 		struct commit *commit = parents->item;
 		if (!parse_commit(commit) && !(commit->object.flags & mark)) {
 			commit->object.flags |= mark;
-			insert_by_date(commit, list);
+			commit_queue_put(queue, commit);
 		}
 		parents = parents->next;
 	}
@@ -518,26 +625,46 @@ void sort_in_topological_order(struct commit_list ** list, int lifo)
 #define PARENT2		(1u<<17)
 #define STALE		(1u<<18)
 #define RESULT		(1u<<19)
+#define ENQUEUED	(1u<<23)
 
-static const unsigned all_flags = (PARENT1 | PARENT2 | STALE | RESULT);
+static const unsigned all_flags = (PARENT1 | PARENT2 | STALE | RESULT | ENQUEUED);
 
-static struct commit *interesting(struct commit_list *list)
+/*
+ * Add "flags" to commit and queue it, unless it is queued already.
+ * With each commit in the queue at most once, "nonstale" can count
+ * the queued commits that are not STALE, even when one turns STALE
+ * while it waits there, and the walk need not scan the queue.
+ */
+static void paint_commit(struct commit_queue *queue, int *nonstale,
+			 struct commit *commit, unsigned int flags)
 {
-	while (list) {
-		struct commit *commit = list->item;
-		list = list->next;
-		if (commit->object.flags & STALE)
-			continue;
-		return commit;
+	unsigned int old = commit->object.flags;
+
+	commit->object.flags |= flags;
+	if (old & ENQUEUED) {
+		if ((flags & STALE) && !(old & STALE))
+			(*nonstale)--;
+		return;
 	}
-	return NULL;
+	commit->object.flags |= ENQUEUED;
+	if (!(commit->object.flags & STALE))
+		(*nonstale)++;
+	commit_queue_put(queue, commit);
 }
 
-static struct commit_list *merge_bases_many(struct commit *one, int n, struct commit **twos)
+/*
+ * When min_generation is non-zero the caller only cares whether the
+ * commits with at least that generation are merge bases, so the walk
+ * stops once everything left to paint is below it.
+ */
+static struct commit_list *merge_bases_many(struct commit *one, int n,
+					    struct commit **twos,
+					    unsigned int min_generation)
 {
+	struct commit_queue queue = { compare_commits_by_generation };
 	struct commit_list *list = NULL;
 	struct commit_list *result = NULL;
-	int i;
+	int i, nonstale = 0;
 
 	for (i = 0; i < n; i++) {
 		if (one == twos[i])
@@ -555,23 +682,22 @@ static struct commit_list *merge_bases_many(struct commit *one, int n, struct co
 			return NULL;
 	}
 
-	one->object.flags |= PARENT1;
-	insert_by_date(one, &list);
-	for (i = 0; i < n; i++) {
-		twos[i]->object.flags |= PARENT2;
-		insert_by_date(twos[i], &list);
-	}
+	paint_commit(&queue, &nonstale, one, PARENT1);
+	for (i = 0; i < n; i++)
+		paint_commit(&queue, &nonstale, twos[i], PARENT2);
 
-	while (interesting(list)) {
+	while (nonstale) {
 		struct commit *commit;
 		struct commit_list *parents;
-		struct commit_list *n;
 		int flags;
 
-		commit = list->item;
-		n = list->next;
-		free(list);
-		list = n;
+		commit = commit_queue_peek(&queue);
+		if (commit_generation(commit) < min_generation)
+			break;
+		commit_queue_get(&queue);
+		commit->object.flags &= ~ENQUEUED;
+		if (!(commit->object.flags & STALE))
+			nonstale--;
 
 		flags = commit->object.flags & (PARENT1 | PARENT2 | STALE);
 		if (flags == (PARENT1 | PARENT2)) {
@@ -588,15 +714,16 @@ static struct commit_list *merge_bases_many(struct commit *one, int n, struct co
 			parents = parents->next;
 			if ((p->object.flags & flags) == flags)
 				continue;
-			if (parse_commit(p))
+			if (parse_commit(p)) {
+				clear_commit_queue(&queue);
 				return NULL;
-			p->object.flags |= flags;
-			insert_by_date(p, &list);
+			}
+			paint_commit(&queue, &nonstale, p, flags);
 		}
 	}
 
 	/* Clean up the result to remove stale ones */
-	free_commit_list(list);
+	clear_commit_queue(&queue);
 	list = result; result = NULL;
 	while (list) {
 		struct commit_list *n = list->next;
@@ -645,7 +772,7 @@ struct commit_list *get_merge_bases_many(struct commit *one,
 	struct commit_list *result;
 	int cnt, i, j;
 
-	result = merge_bases_many(one, n, twos);
+	result = merge_bases_many(one, n, twos, 0);
 	for (i = 0; i < n; i++) {
 		if (one == twos[i])
 			return result;
@@ -678,7 +805,7 @@ struct commit_list *get_merge_bases_many(struct commit *one,
 		for (j = i+1; j < cnt; j++) {
 			if (!rslt[i] || !rslt[j])
 				continue;
-			result = merge_bases_many(rslt[i], 1, &rslt[j]);
+			result = merge_bases_many(rslt[i], 1, &rslt[j], 0);
 			clear_commit_marks(rslt[i], all_flags);
 			clear_commit_marks(rslt[j], all_flags);
 			for (list = result; list; list = list->next) {
@@ -721,23 +848,153 @@ int is_descendant_of(struct commit *commit, struct commit_list *with_commit)
 	return 0;
 }
 
+#define CONTAINS_YES	(1u<<21)
+#define CONTAINS_NO	(1u<<22)
+
+static void mark_contains(struct contains_cache *cc, struct commit *commit,
+			  unsigned int flag)
+{
+	commit->object.flags |= flag;
+	ALLOC_GROW(cc->marked, cc->nr + 1, cc->alloc);
+	cc->marked[cc->nr++] = commit;
+}
+
+void init_contains_cache(struct contains_cache *cc,
+			 struct commit_list *with_commit)
+{
+	memset(cc, 0, sizeof(*cc));
+	cc->with_commit = with_commit;
+	cc->min_generation = GENERATION_NUMBER_INFINITY;
+	for (; with_commit; with_commit = with_commit->next) {
+		struct commit *commit = with_commit->item;
+		unsigned int generation;
+
+		if (parse_commit(commit))
+			continue;
+		generation = commit_generation(commit);
+		if (generation < cc->min_generation)
+			cc->min_generation = generation;
+		if (!(commit->object.flags & CONTAINS_YES))
+			mark_contains(cc, commit, CONTAINS_YES);
+	}
+}
+
+/* 1 or 0 if the answer for commit is known, -1 if its parents decide */
+static int contains_known(struct contains_cache *cc, struct commit *commit)
+{
+	unsigned int generation;
+
+	if (commit->object.flags & CONTAINS_YES)
+		return 1;
+	if (commit->object.flags & CONTAINS_NO)
+		return 0;
+	if (parse_commit(commit))
+		goto no;
+
+	/*
+	 * The commit-graph holds all the ancestors of its commits, so
+	 * a commit in it cannot reach one that is not, and a commit
+	 * only reaches commits of a smaller generation.  Commit dates
+	 * are not trusted for this, as clocks can be skewed.
+	 */
+	generation = commit_generation(commit);
+	if (generation != GENERATION_NUMBER_INFINITY &&
+	    generation < cc->min_generation)
+		goto no;
+	return -1;
+
+no:
+	mark_contains(cc, commit, CONTAINS_NO);
+	return 0;
+}
+
+int commit_contains(struct contains_cache *cc, struct commit *commit)
+{
+	struct contains_stack_entry {
+		struct commit *commit;
+		struct commit_list *parents;
+	} *stack = NULL;
+	int nr = 0, alloc = 0, result;
+
+	if (!cc->with_commit)
+		return 1;
+	result = contains_known(cc, commit);
+	if (result >= 0)
+		return result;
+
+	/*
+	 * Walk depth first with an explicit stack, as histories can be
+	 * far deeper than the C stack.  A commit is answered yes as soon
+	 * as one parent is, and no once none of them is.
+	 */
+	ALLOC_GROW(stack, nr + 1, alloc);
+	stack[nr].commit = commit;
+	stack[nr++].parents = commit->parents;
+	while (nr) {
+		struct contains_stack_entry *entry = &stack[nr - 1];
+		struct commit *parent;
+
+		if (!entry->parents) {
+			mark_contains(cc, entry->commit, CONTAINS_NO);
+			nr--;
+			continue;
+		}
+		parent = entry->parents->item;
+		switch (contains_known(cc, parent)) {
+		case 1:
+			mark_contains(cc, entry->commit, CONTAINS_YES);
+			nr--;
+			break;
+		case 0:
+			entry->parents = entry->parents->next;
+			break;
+		default:
+			ALLOC_GROW(stack, nr + 1, alloc);
+			stack[nr].commit = parent;
+			stack[nr++].parents = parent->parents;
+		}
+	}
+	free(stack);
+	return contains_known(cc, commit);
+}
+
+void clear_contains_cache(struct contains_cache *cc)
+{
+	int i;
+
+	for (i = 0; i < cc->nr; i++)
+		cc->marked[i]->object.flags &= ~(CONTAINS_YES | CONTAINS_NO);
+	free(cc->marked);
+	cc->marked = NULL;
+	cc->nr = cc->alloc = 0;
+}
+
 int in_merge_bases(struct commit *commit, struct commit **reference, int num)
 {
 	struct commit_list *bases, *b;
+	unsigned int min_generation;
 	int ret = 0;
 
-	if (num == 1)
-		bases = get_merge_bases(commit, *reference, 1);
-	else
+	if (num != 1)
 		die("not yet");
+	if (parse_commit(commit) || parse_commit(*reference))
+		return 0;
+
+	/* a commit cannot reach anything of a larger generation */
+	min_generation = commit_generation(commit);
+	if (min_generation > commit_generation(*reference))
+		return 0;
+
+	bases = merge_bases_many(commit, 1, reference, min_generation);
 	for (b = bases; b; b = b->next) {
-		if (!hashcmp(commit->object.sha1, b->item->object.sha1)) {
+		if (b->item == commit) {
 			ret = 1;
 			break;
 		}
 	}
-
 	free_commit_list(bases);
+	clear_commit_marks(commit, all_flags);
+	clear_commit_marks(*reference, all_flags);
 	return ret;
 }
 
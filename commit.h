@@ -15,12 +15,27 @@ struct commit {
 	struct object object;
 	void *util;
 	unsigned int indegree;
+	unsigned int generation;
 	unsigned long date;
 	struct commit_list *parents;
 	struct tree *tree;
 	char *buffer;
 };
 
+/*
+ * A root commit has generation number 1, every other commit one more
+ * than the largest generation among its parents, so a commit can only
+ * reach commits with a strictly smaller generation.  The numbers come
+ * from the commit-graph file; 0 in commit->generation means unknown.
+ */
+#define GENERATION_NUMBER_INFINITY 0xFFFFFFFF
+#define GENERATION_NUMBER_MAX 0x3FFFFFFF
+
+static inline unsigned int commit_generation(const struct commit *commit)
+{
+	return commit->generation ? commit->generation : GENERATION_NUMBER_INFINITY;
+}
+
 extern int save_commit_buffer;
 extern const char *commit_type;
 
@@ -48,6 +63,36 @@ void free_commit_list(struct commit_list *list);
 
 void sort_by_date(struct commit_list **list);
 
+/*
+ * A queue of commits kept as a binary heap, so that putting a commit
+ * in and getting the first one out cost O(log n) however many commits
+ * are queued.  "compare" returns a negative value when its first
+ * argument should come out first; when it is NULL the most recent
+ * commit does.  Commits that compare equal come out in the order they
+ * were put in.  The queued commits are array[0..nr-1], in no
+ * particular order.
+ */
+typedef int (*commit_queue_compare_fn)(const struct commit *,
+				       const struct commit *);
+
+struct commit_queue {
+	commit_queue_compare_fn compare;
+	unsigned ctr;
+	int nr, alloc;
+	struct commit_queue_entry {
+		struct commit *commit;
+		unsigned ctr;
+	} *array;
+};
+
+int compare_commits_by_date(const struct commit *, const struct commit *);
+int compare_commits_by_generation(const struct commit *, const struct commit *);
+
+void commit_queue_put(struct commit_queue *queue, struct commit *commit);
+struct commit *commit_queue_get(struct commit_queue *queue);
+struct commit *commit_queue_peek(struct commit_queue *queue);
+void clear_commit_queue(struct commit_queue *queue);
+
 /* Commit formats */
 enum cmit_fmt {
 	CMIT_FMT_RAW,
@@ -92,10 +137,10 @@ void pp_remainder(enum cmit_fmt fmt,
 		  int indent);
 
 
-/** Removes the first commit from a list sorted by date, and adds all
- * of its parents.
+/** Removes the first commit from a queue, and adds all of its
+ * parents that do not have the mark yet.
  **/
-struct commit *pop_most_recent_commit(struct commit_list **list,
+struct commit *pop_most_recent_commit(struct commit_queue *queue,
 				      unsigned int mark);
 
 struct commit *pop_commit(struct commit_list **stack);
@@ -121,6 +166,7 @@ struct commit_graft {
 struct commit_graft *read_graft_line(char *buf, int len);
 int register_commit_graft(struct commit_graft *, int);
 struct commit_graft *lookup_commit_graft(const unsigned char *sha1);
+int has_commit_grafts(void);
 
 extern struct commit_list *get_merge_bases(struct commit *rev1, struct commit *rev2, int cleanup);
 extern struct commit_list *get_merge_bases_many(struct commit *one, int n, struct commit **twos, int cleanup);
@@ -134,6 +180,25 @@ extern struct commit_list *get_shallow_commits(struct object_array *heads,
 		int depth, int shallow_flag, int not_shallow_flag);
 
 int is_descendant_of(struct commit *, struct commit_list *);
+
+/*
+ * Ask whether many commits in a row, e.g. the tips of all tags, reach
+ * any of "with_commit".  Every commit looked at along the way has its
+ * answer remembered in its flags until clear_contains_cache(), so the
+ * history behind the tips is walked once for all of them, instead of
+ * once per tip as with is_descendant_of().  The walk does not go below
+ * the generation of the oldest "with_commit" in the commit-graph;
+ * without one, it goes down to the roots.
+ */
+struct contains_cache {
+	struct commit_list *with_commit;
+	unsigned int min_generation;
+	struct commit **marked;
+	int nr, alloc;
+};
+void init_contains_cache(struct contains_cache *, struct commit_list *with_commit);
+int commit_contains(struct contains_cache *, struct commit *);
+void clear_contains_cache(struct contains_cache *);
 int in_merge_bases(struct commit *, struct commit **, int);
 
 extern int interactive_add(int argc, const char **argv, const char *prefix);
@@ -566,6 +566,24 @@ static int git_path_check_ident(const char *path, struct git_attr_check *check)
 	return !!ATTR_TRUE(value);
 }
 
+int would_convert_to_git(const char *path)
+{
+	struct git_attr_check check[3];
+	int crlf = CRLF_GUESS;
+	struct convert_driver *drv = NULL;
+
+	setup_convert_check(check);
+	if (!git_checkattr(path, ARRAY_SIZE(check), check)) {
+		crlf = git_path_check_crlf(path, check + 0);
+		if (git_path_check_ident(path, check + 1))
+			return 1;
+		drv = git_path_check_convert(path, check + 2);
+	}
+	if (drv && drv->clean)
+		return 1;
+	return crlf != CRLF_BINARY && auto_crlf;
+}
+
 int convert_to_git(const char *path, const char *src, size_t len,
                    struct strbuf *dst, enum safe_crlf checksafe)
 {
@@ -597,32 +615,55 @@ int convert_to_git(const char *path, const char *src, size_t len,
 	return ret | ident_to_git(path, src, len, dst, ident);
 }
 
-int convert_to_working_tree(const char *path, const char *src, size_t len, struct strbuf *dst)
+void convert_attrs(const char *path, struct conv_attrs *ca)
 {
 	struct git_attr_check check[3];
-	int crlf = CRLF_GUESS;
-	int ident = 0, ret = 0;
-	const char *filter = NULL;
+
+	ca->crlf = CRLF_GUESS;
+	ca->ident = 0;
+	ca->smudge = NULL;
 
 	setup_convert_check(check);
 	if (!git_checkattr(path, ARRAY_SIZE(check), check)) {
 		struct convert_driver *drv;
-		crlf = git_path_check_crlf(path, check + 0);
-		ident = git_path_check_ident(path, check + 1);
+		ca->crlf = git_path_check_crlf(path, check + 0);
+		ca->ident = git_path_check_ident(path, check + 1);
 		drv = git_path_check_convert(path, check + 2);
 		if (drv && drv->smudge)
-			filter = drv->smudge;
+			ca->smudge = drv->smudge;
 	}
+}
+
+int would_convert_to_working_tree(const struct conv_attrs *ca)
+{
+	if (ca->ident || ca->smudge)
+		return 1;
+	return ca->crlf != CRLF_BINARY && ca->crlf != CRLF_INPUT &&
+		auto_crlf > 0;
+}
 
-	ret |= ident_to_worktree(path, src, len, dst, ident);
+int convert_to_working_tree_ca(const struct conv_attrs *ca, const char *path,
+			       const char *src, size_t len, struct strbuf *dst)
+{
+	int ret = 0;
+
+	ret |= ident_to_worktree(path, src, len, dst, ca->ident);
 	if (ret) {
 		src = dst->buf;
 		len = dst->len;
 	}
-	ret |= crlf_to_worktree(path, src, len, dst, crlf);
+	ret |= crlf_to_worktree(path, src, len, dst, ca->crlf);
 	if (ret) {
 		src = dst->buf;
 		len = dst->len;
 	}
-	return ret | apply_filter(path, src, len, dst, filter);
+	return ret | apply_filter(path, src, len, dst, ca->smudge);
+}
+
+int convert_to_working_tree(const char *path, const char *src, size_t len, struct strbuf *dst)
+{
+	struct conv_attrs ca;
+
+	convert_attrs(path, &ca);
+	return convert_to_working_tree_ca(&ca, path, src, len, dst);
 }
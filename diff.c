@@ -28,6 +28,7 @@ static const char *diff_word_regex_cfg;
 static const char *external_diff_cmd_cfg;
 int diff_auto_refresh_index = 1;
 static int diff_mnemonic_prefix;
+static long diff_algorithm;
 
 static char diff_colors[][COLOR_MAXLEN] = {
 	"\033[m",	/* reset */
@@ -41,6 +42,20 @@ static char diff_colors[][COLOR_MAXLEN] = {
 };
 
 static void diff_filespec_load_driver(struct diff_filespec *one);
+
+/* The xdiff flags for a diff algorithm name, or -1 if there is none */
+static long parse_algorithm_value(const char *value)
+{
+	if (!value)
+		return -1;
+	if (!strcasecmp(value, "myers") || !strcasecmp(value, "default"))
+		return 0;
+	if (!strcasecmp(value, "patience"))
+		return XDF_PATIENCE_DIFF;
+	if (!strcasecmp(value, "histogram"))
+		return XDF_HISTOGRAM_DIFF;
+	return -1;
+}
 static char *run_textconv(const char *, struct diff_filespec *, size_t *);
 
 static int parse_diff_color_slot(const char *var, int ofs)
@@ -96,6 +111,13 @@ int git_diff_ui_config(const char *var, const char *value, void *cb)
 		return git_config_string(&external_diff_cmd_cfg, var, value);
 	if (!strcmp(var, "diff.wordregex"))
 		return git_config_string(&diff_word_regex_cfg, var, value);
+	if (!strcmp(var, "diff.algorithm")) {
+		diff_algorithm = parse_algorithm_value(value);
+		if (diff_algorithm < 0)
+			return error("unknown value for config '%s': %s",
+				     var, value ? value : "(none)");
+		return 0;
+	}
 
 	return git_diff_basic_config(var, value, cb);
 }
@@ -106,6 +128,14 @@ int git_diff_basic_config(const char *var, const char *value, void *cb)
 		diff_rename_limit_default = git_config_int(var, value);
 		return 0;
 	}
+	if (!strcmp(var, "diff.fingerprintcachelimit")) {
+		diff_fingerprint_cache_limit = git_config_ulong(var, value);
+		return 0;
+	}
+	if (!strcmp(var, "diff.fingerprintcache")) {
+		diff_fingerprint_cache_file = git_config_bool(var, value);
+		return 0;
+	}
 
 	switch (userdiff_config(var, value)) {
 		case 0: break;
@@ -1407,6 +1437,12 @@ int diff_filespec_is_binary(struct diff_filespec *one)
 	return one->is_binary;
 }
 
+int diff_filespec_binary_attr(struct diff_filespec *one)
+{
+	diff_filespec_load_driver(one);
+	return one->driver->binary;
+}
+
 static const struct userdiff_funcname *diff_funcname_pattern(struct diff_filespec *one)
 {
 	diff_filespec_load_driver(one);
@@ -2336,6 +2372,7 @@ void diff_setup(struct diff_options *options)
 	else
 		DIFF_OPT_CLR(options, COLOR_DIFF);
 	options->detect_rename = diff_detect_rename_default;
+	options->xdl_opts |= diff_algorithm;
 
 	if (!diff_mnemonic_prefix) {
 		options->a_prefix = "a/";
@@ -2576,7 +2613,19 @@ int diff_opt_parse(struct diff_options *options, const char **av, int ac)
 	else if (!strcmp(arg, "--ignore-space-at-eol"))
 		options->xdl_opts |= XDF_IGNORE_WHITESPACE_AT_EOL;
 	else if (!strcmp(arg, "--patience"))
-		options->xdl_opts |= XDF_PATIENCE_DIFF;
+		options->xdl_opts = (options->xdl_opts & ~XDF_DIFF_ALGORITHM_MASK) |
+			XDF_PATIENCE_DIFF;
+	else if (!strcmp(arg, "--histogram"))
+		options->xdl_opts = (options->xdl_opts & ~XDF_DIFF_ALGORITHM_MASK) |
+			XDF_HISTOGRAM_DIFF;
+	else if (!prefixcmp(arg, "--diff-algorithm=")) {
+		long value = parse_algorithm_value(arg + 17);
+		if (value < 0)
+			die("option diff-algorithm accepts \"myers\", "
+			    "\"patience\" and \"histogram\"");
+		options->xdl_opts = (options->xdl_opts & ~XDF_DIFF_ALGORITHM_MASK) |
+			value;
+	}
 
 	/* flags options */
 	else if (!strcmp(arg, "--binary")) {
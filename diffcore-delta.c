@@ -1,6 +1,7 @@
 #include "cache.h"
 #include "diff.h"
 #include "diffcore.h"
+#include "csum-file.h"
 
 /*
  * Idea here is very simple.
@@ -163,6 +164,364 @@ static struct spanhash_top *hash_chars(struct diff_filespec *one)
 	return hash;
 }
 
+/*
+ * Fingerprints are cached per blob for the whole process, so that
+ * break, rename and copy detection do not hash the same blob again,
+ * and neither does "log -M" for every commit that touches it.  The
+ * cache holds at most diff.fingerprintCacheLimit bytes and drops the
+ * least recently used fingerprints first.  With diff.fingerprintCache
+ * it is read from $GIT_DIR/fingerprints when first needed, and written
+ * back there at exit if it changed.
+ *
+ * A fingerprint depends on whether the blob is taken as text, so only
+ * those for which the contents decided that are kept, and they are
+ * only used when no attribute says otherwise.  Cached fingerprints
+ * are stored compacted: the used slots, sorted, and a terminating
+ * empty one.  Only the main thread uses the cache.
+ */
+unsigned long diff_fingerprint_cache_limit = 32 * 1024 * 1024;
+int diff_fingerprint_cache_file;
+
+#define FINGERPRINT_CACHE_SIGNATURE 0x44465043 /* "DFPC" */
+#define FINGERPRINT_CACHE_VERSION 1
+
+struct fingerprint_lru_list {
+	struct fingerprint_lru_list *prev;
+	struct fingerprint_lru_list *next;
+};
+
+struct fingerprint_entry {
+	struct fingerprint_lru_list lru;	/* must be first */
+	struct fingerprint_entry *next;		/* hash chain */
+	unsigned char sha1[20];
+	int binary;
+	int nr;
+	struct spanhash_top *hash;
+};
+
+static struct fingerprint_cache {
+	struct fingerprint_lru_list lru;
+	struct fingerprint_entry **table;
+	unsigned int table_size, nr;
+	unsigned int hits, misses, evictions;
+	unsigned long size;
+	int initialized, dirty;
+} fingerprint_cache;
+
+static struct lock_file fingerprint_lock;
+
+static int spanhash_nr(struct spanhash_top *top)
+{
+	int i, lim = 1 << top->alloc_log2;
+
+	for (i = 0; i < lim && top->data[i].cnt; i++)
+		;
+	return i;
+}
+
+static struct spanhash_top *spanhash_compact(struct spanhash_top *top, int nr)
+{
+	struct spanhash_top *new;
+
+	new = xmalloc(sizeof(*new) + sizeof(struct spanhash) * (nr + 1));
+	/* no longer a hash table; only the terminator marks the end */
+	new->alloc_log2 = 0;
+	new->free = 0;
+	memcpy(new->data, top->data, sizeof(struct spanhash) * nr);
+	memset(new->data + nr, 0, sizeof(struct spanhash));
+	return new;
+}
+
+static unsigned long fingerprint_entry_size(int nr)
+{
+	return sizeof(struct fingerprint_entry) + sizeof(struct spanhash_top) +
+		sizeof(struct spanhash) * (nr + 1);
+}
+
+static struct fingerprint_entry **fingerprint_bucket(const unsigned char *sha1)
+{
+	unsigned int hash;
+
+	memcpy(&hash, sha1, sizeof(hash));
+	return fingerprint_cache.table +
+		(hash & (fingerprint_cache.table_size - 1));
+}
+
+static struct fingerprint_entry **find_fingerprint(const unsigned char *sha1)
+{
+	struct fingerprint_entry **pos;
+
+	if (!fingerprint_cache.table_size)
+		return NULL;
+	for (pos = fingerprint_bucket(sha1); *pos; pos = &(*pos)->next)
+		if (!hashcmp((*pos)->sha1, sha1))
+			return pos;
+	return NULL;
+}
+
+static void grow_fingerprint_cache(void)
+{
+	struct fingerprint_entry **old = fingerprint_cache.table;
+	unsigned int i, old_size = fingerprint_cache.table_size;
+
+	fingerprint_cache.table_size = old_size ? old_size * 2 : 256;
+	fingerprint_cache.table = xcalloc(fingerprint_cache.table_size,
+					  sizeof(*fingerprint_cache.table));
+	for (i = 0; i < old_size; i++) {
+		struct fingerprint_entry *ent = old[i];
+		while (ent) {
+			struct fingerprint_entry *next = ent->next;
+			struct fingerprint_entry **bucket;
+			bucket = fingerprint_bucket(ent->sha1);
+			ent->next = *bucket;
+			*bucket = ent;
+			ent = next;
+		}
+	}
+	free(old);
+}
+
+static void lru_unlink(struct fingerprint_entry *ent)
+{
+	ent->lru.next->prev = ent->lru.prev;
+	ent->lru.prev->next = ent->lru.next;
+}
+
+static void lru_append(struct fingerprint_entry *ent)
+{
+	ent->lru.prev = fingerprint_cache.lru.prev;
+	ent->lru.next = &fingerprint_cache.lru;
+	fingerprint_cache.lru.prev->next = &ent->lru;
+	fingerprint_cache.lru.prev = &ent->lru;
+}
+
+static void prune_fingerprint_cache(void)
+{
+	while (fingerprint_cache.size > diff_fingerprint_cache_limit &&
+	       fingerprint_cache.lru.next != &fingerprint_cache.lru) {
+		struct fingerprint_entry *ent = (void *)fingerprint_cache.lru.next;
+		struct fingerprint_entry **pos = find_fingerprint(ent->sha1);
+
+		*pos = ent->next;
+		lru_unlink(ent);
+		fingerprint_cache.nr--;
+		fingerprint_cache.size -= fingerprint_entry_size(ent->nr);
+		fingerprint_cache.evictions++;
+		fingerprint_cache.dirty = 1;
+		free(ent->hash);
+		free(ent);
+	}
+}
+
+/* Takes over "hash", which must be compact */
+static void add_fingerprint(const unsigned char *sha1, int binary,
+			    struct spanhash_top *hash, int nr)
+{
+	struct fingerprint_entry *ent, **bucket;
+
+	if (fingerprint_entry_size(nr) > diff_fingerprint_cache_limit ||
+	    find_fingerprint(sha1)) {
+		free(hash);
+		return;
+	}
+	if (fingerprint_cache.nr >= fingerprint_cache.table_size)
+		grow_fingerprint_cache();
+	ent = xmalloc(sizeof(*ent));
+	hashcpy(ent->sha1, sha1);
+	ent->binary = binary;
+	ent->nr = nr;
+	ent->hash = hash;
+	bucket = fingerprint_bucket(sha1);
+	ent->next = *bucket;
+	*bucket = ent;
+	lru_append(ent);
+	fingerprint_cache.nr++;
+	fingerprint_cache.size += fingerprint_entry_size(nr);
+	prune_fingerprint_cache();
+}
+
+static void write_fingerprint_cache(void)
+{
+	struct fingerprint_lru_list *lru;
+	struct sha1file *f;
+	uint32_t hdr[3];
+	int fd;
+
+	if (!fingerprint_cache.dirty)
+		return;
+	fd = hold_lock_file_for_update(&fingerprint_lock,
+				       git_path("fingerprints"), 0);
+	if (fd < 0)
+		return;
+	f = sha1fd(fd, fingerprint_lock.filename);
+	hdr[0] = htonl(FINGERPRINT_CACHE_SIGNATURE);
+	hdr[1] = htonl(FINGERPRINT_CACHE_VERSION);
+	hdr[2] = htonl(fingerprint_cache.nr);
+	sha1write(f, hdr, sizeof(hdr));
+	/* oldest first, so that reading it back keeps the LRU order */
+	for (lru = fingerprint_cache.lru.next;
+	     lru != &fingerprint_cache.lru;
+	     lru = lru->next) {
+		struct fingerprint_entry *ent = (void *)lru;
+		uint32_t word[2];
+		int i;
+
+		sha1write(f, ent->sha1, 20);
+		word[0] = htonl(ent->binary);
+		word[1] = htonl(ent->nr);
+		sha1write(f, word, sizeof(word));
+		for (i = 0; i < ent->nr; i++) {
+			word[0] = htonl(ent->hash->data[i].hashval);
+			word[1] = htonl(ent->hash->data[i].cnt);
+			sha1write(f, word, sizeof(word));
+		}
+	}
+	sha1close(f, NULL, CSUM_FSYNC);
+	fingerprint_lock.fd = -1;
+	if (commit_lock_file(&fingerprint_lock) < 0)
+		rollback_lock_file(&fingerprint_lock);
+}
+
+static int parse_fingerprint_cache(const unsigned char *map, size_t len)
+{
+	const unsigned char *p = map, *end;
+	unsigned char sha1[20];
+	git_SHA_CTX c;
+	uint32_t nr;
+
+	if (len < 12 + 20)
+		return -1;
+	end = map + len - 20;
+	git_SHA1_Init(&c);
+	git_SHA1_Update(&c, map, end - map);
+	git_SHA1_Final(sha1, &c);
+	if (hashcmp(sha1, end))
+		return -1;
+	if (ntohl(*(uint32_t *)p) != FINGERPRINT_CACHE_SIGNATURE ||
+	    ntohl(*(uint32_t *)(p + 4)) != FINGERPRINT_CACHE_VERSION)
+		return -1;
+	nr = ntohl(*(uint32_t *)(p + 8));
+	p += 12;
+	while (nr--) {
+		struct spanhash_top *hash;
+		int binary, i, cnt;
+
+		if (end - p < 28)
+			return -1;
+		binary = ntohl(*(uint32_t *)(p + 20));
+		cnt = ntohl(*(uint32_t *)(p + 24));
+		if (cnt < 0 || (end - p - 28) / 8 < cnt)
+			return -1;
+		hash = xmalloc(sizeof(*hash) + sizeof(struct spanhash) * (cnt + 1));
+		hash->alloc_log2 = 0;
+		hash->free = 0;
+		for (i = 0; i < cnt; i++) {
+			hash->data[i].hashval = ntohl(*(uint32_t *)(p + 28 + 8 * i));
+			hash->data[i].cnt = ntohl(*(uint32_t *)(p + 32 + 8 * i));
+		}
+		memset(hash->data + cnt, 0, sizeof(struct spanhash));
+		add_fingerprint(p, binary, hash, cnt);
+		p += 28 + 8 * cnt;
+	}
+	return 0;
+}
+
+static void read_fingerprint_cache(void)
+{
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(git_path("fingerprints"), O_RDONLY);
+	if (fd < 0)
+		return;
+	if (fstat(fd, &st) || !st.st_size) {
+		close(fd);
+		return;
+	}
+	map = xmmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (parse_fingerprint_cache(map, st.st_size))
+		warning("ignoring corrupt %s", git_path("fingerprints"));
+	munmap(map, st.st_size);
+	/* what was just read is already on disk */
+	fingerprint_cache.dirty = 0;
+}
+
+static void report_fingerprint_cache(void)
+{
+	if (!fingerprint_cache.hits && !fingerprint_cache.misses)
+		return;
+	trace_printf_key("GIT_TRACE_PERFORMANCE",
+			 "performance: fingerprint cache: %u hits, %u misses, "
+			 "%u evictions, %u entries (%lu bytes) at exit\n",
+			 fingerprint_cache.hits, fingerprint_cache.misses,
+			 fingerprint_cache.evictions, fingerprint_cache.nr,
+			 fingerprint_cache.size);
+}
+
+static void init_fingerprint_cache(void)
+{
+	fingerprint_cache.lru.next = fingerprint_cache.lru.prev =
+		&fingerprint_cache.lru;
+	fingerprint_cache.initialized = 1;
+	if (trace_want("GIT_TRACE_PERFORMANCE"))
+		atexit(report_fingerprint_cache);
+	if (diff_fingerprint_cache_file && have_git_dir()) {
+		read_fingerprint_cache();
+		atexit(write_fingerprint_cache);
+	}
+}
+
+/*
+ * Return the fingerprint of one, which the caller owns, or NULL if
+ * its data cannot be read.  The data is read only if the cache does
+ * not already know the blob, but the size always is.
+ */
+static struct spanhash_top *get_fingerprint(struct diff_filespec *one)
+{
+	struct spanhash_top *hash, *compact;
+	struct fingerprint_entry **pos;
+	int binary, nr;
+
+	if (!one->sha1_valid || !diff_fingerprint_cache_limit) {
+		if (diff_populate_filespec(one, 0))
+			return NULL;
+		return hash_chars(one);
+	}
+	if (!fingerprint_cache.initialized)
+		init_fingerprint_cache();
+
+	/* users of cnt_data count on the size being known */
+	if (diff_populate_filespec(one, 1))
+		return NULL;
+	binary = diff_filespec_binary_attr(one);
+	pos = find_fingerprint(one->sha1);
+	if (pos && (binary == -1 || binary == (*pos)->binary)) {
+		struct fingerprint_entry *ent = *pos;
+		if (one->is_binary == -1)
+			one->is_binary = ent->binary;
+		lru_unlink(ent);
+		lru_append(ent);
+		fingerprint_cache.hits++;
+		return spanhash_compact(ent->hash, ent->nr);
+	}
+	fingerprint_cache.misses++;
+
+	if (diff_populate_filespec(one, 0))
+		return NULL;
+	hash = hash_chars(one);
+	if (binary != -1)
+		return hash;
+	nr = spanhash_nr(hash);
+	compact = spanhash_compact(hash, nr);
+	free(hash);
+	add_fingerprint(one->sha1, diff_filespec_is_binary(one),
+			spanhash_compact(compact, nr), nr);
+	fingerprint_cache.dirty = 1;
+	return compact;
+}
+
 int diffcore_count_changes(struct diff_filespec *src,
 			   struct diff_filespec *dst,
 			   void **src_count_p,
@@ -179,14 +538,21 @@ int diffcore_count_changes(struct diff_filespec *src,
 	if (src_count_p)
 		src_count = *src_count_p;
 	if (!src_count) {
-		src_count = hash_chars(src);
+		src_count = get_fingerprint(src);
+		if (!src_count)
+			return -1;
 		if (src_count_p)
 			*src_count_p = src_count;
 	}
 	if (dst_count_p)
 		dst_count = *dst_count_p;
 	if (!dst_count) {
-		dst_count = hash_chars(dst);
+		dst_count = get_fingerprint(dst);
+		if (!dst_count) {
+			if (!src_count_p)
+				free(src_count);
+			return -1;
+		}
 		if (dst_count_p)
 			*dst_count_p = dst_count;
 	}
@@ -222,3 +588,22 @@ int diffcore_count_changes(struct diff_filespec *src,
 	*literal_added = la;
 	return 0;
 }
+
+int diffcore_fingerprint(struct diff_filespec *one)
+{
+	if (!one->cnt_data) {
+		one->cnt_data = get_fingerprint(one);
+		if (!one->cnt_data)
+			return -1;
+	}
+	return 0;
+}
+
+void diffcore_for_each_chunk(void *cnt_data, each_chunk_fn fn, void *cb_data)
+{
+	struct spanhash *s;
+
+	/* the used slots are sorted first, up to an empty one */
+	for (s = ((struct spanhash_top *)cnt_data)->data; s->cnt; s++)
+		fn(s->hashval, s->cnt, cb_data);
+}
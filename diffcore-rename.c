@@ -6,6 +6,11 @@
 #include "diffcore.h"
 #include "hash.h"
 
+#ifdef THREADED_DELTA_SEARCH
+#include "thread-utils.h"
+#include <pthread.h>
+#endif
+
 /* Table of rename/copy destinations */
 
 static struct diff_rename_dst {
@@ -173,9 +178,7 @@ static int estimate_similarity(struct diff_filespec *src,
 	if (base_size * (MAX_SCORE-minimum_score) < delta_size * MAX_SCORE)
 		return 0;
 
-	if (!src->cnt_data && diff_populate_filespec(src, 0))
-		return 0;
-	if (!dst->cnt_data && diff_populate_filespec(dst, 0))
+	if (diffcore_fingerprint(src) || diffcore_fingerprint(dst))
 		return 0;
 
 	delta_limit = (unsigned long)
@@ -398,6 +401,275 @@ static int find_exact_renames(void)
 	return i;
 }
 
+/*
+ * Scoring every (src, dst) pair is O(N*M) fingerprint comparisons.
+ * Instead, the chunk fingerprints of all the sources are indexed by
+ * chunk, and for each destination the postings of its own chunks add
+ * up how many bytes each source can have contributed to it.  Only the
+ * pairs for which that can reach the minimum score are scored.
+ *
+ * A chunk found in many sources (blank lines, "}" ...) would make the
+ * postings quadratic again.  Those chunks are not indexed per source;
+ * what they can add to a pair is bounded by the number of bytes each
+ * side has in such chunks.
+ */
+#define RENAME_COMMON_CHUNK 64
+
+struct chunk_posting {
+	int src;
+	unsigned int cnt;
+};
+
+struct chunk_postings {
+	int nr, alloc;
+	struct chunk_posting *list; /* NULL if the chunk is common */
+};
+
+static struct rename_index {
+	struct hash_table chunks;
+	unsigned long *src_common; /* bytes of each source in common chunks */
+	unsigned long *copied;     /* per source, for the current destination */
+	int *touched, touched_nr;
+	unsigned long dst_common;
+	int src;
+} rename_index;
+
+static int fingerprint_filespec(struct diff_filespec *one)
+{
+	if (!S_ISREG(one->mode))
+		return -1;
+	if (diffcore_fingerprint(one))
+		return -1;
+	diff_free_filespec_blob(one);
+	return 0;
+}
+
+static void index_src_chunk(unsigned int hashval, unsigned int cnt, void *data)
+{
+	struct chunk_postings *p;
+	void **pos;
+
+	p = lookup_hash(hashval, &rename_index.chunks);
+	if (!p) {
+		p = xcalloc(1, sizeof(*p));
+		pos = insert_hash(hashval, p, &rename_index.chunks);
+		if (pos)
+			die("BUG: chunk %u indexed twice", hashval);
+	}
+	ALLOC_GROW(p->list, p->nr + 1, p->alloc);
+	p->list[p->nr].src = rename_index.src;
+	p->list[p->nr].cnt = cnt;
+	p->nr++;
+}
+
+static int mark_common_chunk(void *ptr)
+{
+	struct chunk_postings *p = ptr;
+	int i;
+
+	if (p->nr <= RENAME_COMMON_CHUNK)
+		return 0;
+	for (i = 0; i < p->nr; i++)
+		rename_index.src_common[p->list[i].src] += p->list[i].cnt;
+	free(p->list);
+	p->list = NULL;
+	p->nr = p->alloc = 0;
+	return 0;
+}
+
+static void build_rename_index(void)
+{
+	int i;
+
+	init_hash(&rename_index.chunks);
+	rename_index.src_common = xcalloc(rename_src_nr, sizeof(unsigned long));
+	rename_index.copied = xcalloc(rename_src_nr, sizeof(unsigned long));
+	rename_index.touched = xmalloc(rename_src_nr * sizeof(int));
+	for (i = 0; i < rename_src_nr; i++) {
+		struct diff_filespec *one = rename_src[i].one;
+		if (fingerprint_filespec(one))
+			continue;
+		rename_index.src = i;
+		diffcore_for_each_chunk(one->cnt_data, index_src_chunk, NULL);
+	}
+	for_each_hash(&rename_index.chunks, mark_common_chunk);
+}
+
+static int free_chunk_postings(void *ptr)
+{
+	struct chunk_postings *p = ptr;
+	free(p->list);
+	free(p);
+	return 0;
+}
+
+static void free_rename_index(void)
+{
+	for_each_hash(&rename_index.chunks, free_chunk_postings);
+	free_hash(&rename_index.chunks);
+	free(rename_index.src_common);
+	free(rename_index.copied);
+	free(rename_index.touched);
+	memset(&rename_index, 0, sizeof(rename_index));
+}
+
+static void lookup_dst_chunk(unsigned int hashval, unsigned int cnt, void *data)
+{
+	struct chunk_postings *p = lookup_hash(hashval, &rename_index.chunks);
+	int i;
+
+	if (!p)
+		return;
+	if (!p->list) {
+		rename_index.dst_common += cnt;
+		return;
+	}
+	for (i = 0; i < p->nr; i++) {
+		int src = p->list[i].src;
+		if (!rename_index.copied[src])
+			rename_index.touched[rename_index.touched_nr++] = src;
+		rename_index.copied[src] += cnt < p->list[i].cnt ?
+			cnt : p->list[i].cnt;
+	}
+}
+
+static int int_compare(const void *a_, const void *b_)
+{
+	int a = *(const int *)a_, b = *(const int *)b_;
+	return a < b ? -1 : a > b;
+}
+
+/*
+ * Can src and dst, of which "copied" bytes are known to match, be
+ * similar enough?  The same size test as estimate_similarity() comes
+ * first; after it, what is common between the two files cannot be
+ * more than the known matches plus the smaller of their totals in
+ * common chunks.
+ */
+static int may_be_similar(struct diff_filespec *src, struct diff_filespec *dst,
+			  unsigned long copied, unsigned long src_common,
+			  int minimum_score)
+{
+	unsigned long max_size, base_size, delta_size;
+
+	max_size = ((src->size > dst->size) ? src->size : dst->size);
+	base_size = ((src->size < dst->size) ? src->size : dst->size);
+	delta_size = max_size - base_size;
+	if (base_size * (MAX_SCORE-minimum_score) < delta_size * MAX_SCORE)
+		return 0;
+	copied += (src_common < rename_index.dst_common) ?
+		src_common : rename_index.dst_common;
+	return copied * MAX_SCORE >= (double)minimum_score * max_size;
+}
+
+/*
+ * Append the sources that may be similar enough to the destination
+ * "dst_index" to "cand", in increasing source order.
+ */
+static void find_candidates(int dst_index, int minimum_score,
+			   struct diff_score **cand, int *nr, int *alloc)
+{
+	struct diff_filespec *two = rename_dst[dst_index].two;
+	int i, all;
+
+	if (fingerprint_filespec(two))
+		return;
+	rename_index.touched_nr = 0;
+	rename_index.dst_common = 0;
+	diffcore_for_each_chunk(two->cnt_data, lookup_dst_chunk, NULL);
+
+	/*
+	 * If the common chunks alone can make a source similar enough,
+	 * a source that shares nothing else is a candidate, too.
+	 */
+	all = rename_index.dst_common * MAX_SCORE >=
+		(double)minimum_score * two->size;
+	if (!all)
+		qsort(rename_index.touched, rename_index.touched_nr,
+		      sizeof(int), int_compare);
+
+	for (i = 0; i < (all ? rename_src_nr : rename_index.touched_nr); i++) {
+		int src = all ? i : rename_index.touched[i];
+		struct diff_filespec *one = rename_src[src].one;
+
+		if (!one->cnt_data || !S_ISREG(one->mode))
+			continue;
+		if (!may_be_similar(one, two, rename_index.copied[src],
+				    rename_index.src_common[src],
+				    minimum_score))
+			continue;
+		ALLOC_GROW(*cand, *nr + 1, *alloc);
+		(*cand)[*nr].src = src;
+		(*cand)[*nr].dst = dst_index;
+		(*cand)[*nr].name_score = basename_same(one, two);
+		(*nr)++;
+	}
+	for (i = 0; i < rename_index.touched_nr; i++)
+		rename_index.copied[rename_index.touched[i]] = 0;
+}
+
+/*
+ * All the files involved are fingerprinted by now, so scoring reads
+ * nothing from the object store and can be spread over threads.
+ */
+struct score_range {
+	struct diff_score *list;
+	int nr;
+	int minimum_score;
+};
+
+static void *score_candidates_range(void *arg)
+{
+	struct score_range *r = arg;
+	int i;
+
+	for (i = 0; i < r->nr; i++) {
+		struct diff_score *c = &r->list[i];
+		c->score = estimate_similarity(rename_src[c->src].one,
+					       rename_dst[c->dst].two,
+					       r->minimum_score);
+	}
+	return NULL;
+}
+
+#define RENAME_THREAD_MIN_PAIRS 1024
+
+static void score_candidates(struct diff_score *cand, int nr, int minimum_score)
+{
+	struct score_range whole;
+#ifdef THREADED_DELTA_SEARCH
+	int nr_threads = online_cpus();
+
+	if (nr_threads > nr / RENAME_THREAD_MIN_PAIRS)
+		nr_threads = nr / RENAME_THREAD_MIN_PAIRS;
+	if (nr_threads > 1) {
+		pthread_t *threads = xmalloc(nr_threads * sizeof(*threads));
+		struct score_range *range = xmalloc(nr_threads * sizeof(*range));
+		int i, start = 0;
+
+		for (i = 0; i < nr_threads; i++) {
+			int end = (long long)nr * (i + 1) / nr_threads;
+			range[i].list = cand + start;
+			range[i].nr = end - start;
+			range[i].minimum_score = minimum_score;
+			start = end;
+			if (pthread_create(&threads[i], NULL,
+					   score_candidates_range, &range[i]))
+				die("unable to create rename scoring thread");
+		}
+		for (i = 0; i < nr_threads; i++)
+			pthread_join(threads[i], NULL);
+		free(threads);
+		free(range);
+		return;
+	}
+#endif
+	whole.list = cand;
+	whole.nr = nr;
+	whole.minimum_score = minimum_score;
+	score_candidates_range(&whole);
+}
+
 #define NUM_CANDIDATE_PER_DST 4
 static void record_if_better(struct diff_score m[], struct diff_score *o)
 {
@@ -414,6 +686,99 @@ static void record_if_better(struct diff_score m[], struct diff_score *o)
 		m[worst] = *o;
 }
 
+/*
+ * Candidates are gathered and scored a batch at a time, so that only
+ * the best few for each destination stay in memory however many
+ * pairs there are.  A batch holds whole destinations.
+ */
+#define RENAME_BATCH_PAIRS (16 * RENAME_THREAD_MIN_PAIRS)
+
+/*
+ * Keep the best candidates of each destination in "cand" in the next
+ * rows of "mx", starting at row "dst_cnt"; returns the rows used.
+ */
+static int record_candidates(struct diff_score *mx, int dst_cnt,
+			     struct diff_score *cand, int nr)
+{
+	int i = 0;
+
+	while (i < nr) {
+		struct diff_score *m = &mx[dst_cnt++ * NUM_CANDIDATE_PER_DST];
+		int dst = cand[i].dst;
+
+		while (i < nr && cand[i].dst == dst)
+			record_if_better(m, &cand[i++]);
+	}
+	return dst_cnt;
+}
+
+static int ulong_compare(const void *a_, const void *b_)
+{
+	unsigned long a = *(const unsigned long *)a_;
+	unsigned long b = *(const unsigned long *)b_;
+	return a < b ? -1 : a > b;
+}
+
+/* how many of the "nr" sorted sizes are below "size" */
+static int sizes_below(const unsigned long *sizes, int nr, unsigned long size)
+{
+	int lo = 0, hi = nr;
+
+	while (lo < hi) {
+		int mi = lo + (hi - lo) / 2;
+		if (sizes[mi] < size)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return lo;
+}
+
+/*
+ * Are there more than "limit" pairs that pass the size test of
+ * estimate_similarity()?  Every candidate has to, and the sizes come
+ * from the object headers, so this gives up on a hopeless case before
+ * any blob is read for the index.
+ */
+static int too_many_size_matches(int minimum_score, unsigned long limit)
+{
+	unsigned long *sizes = xmalloc(rename_src_nr * sizeof(*sizes));
+	unsigned long pairs = 0;
+	int i, nr = 0;
+
+	for (i = 0; i < rename_src_nr; i++) {
+		struct diff_filespec *one = rename_src[i].one;
+		if (!S_ISREG(one->mode) || diff_populate_filespec(one, 1))
+			continue;
+		sizes[nr++] = one->size;
+	}
+	qsort(sizes, nr, sizeof(*sizes), ulong_compare);
+
+	for (i = 0; i < rename_dst_nr && pairs <= limit; i++) {
+		struct diff_filespec *two = rename_dst[i].two;
+		unsigned long lo, hi;
+
+		if (rename_dst[i].pair)
+			continue;
+		if (!S_ISREG(two->mode) || diff_populate_filespec(two, 1))
+			continue;
+		/*
+		 * A smaller source must be at least MAX_SCORE /
+		 * (2*MAX_SCORE-minimum_score) of the destination; a
+		 * larger one may add at most (MAX_SCORE-minimum_score) /
+		 * MAX_SCORE of it.
+		 */
+		lo = (unsigned long)((double)two->size * MAX_SCORE /
+				     (2 * MAX_SCORE - minimum_score));
+		hi = two->size + (unsigned long)((double)two->size *
+				     (MAX_SCORE - minimum_score) / MAX_SCORE);
+		pairs += sizes_below(sizes, nr, hi + 1) -
+			sizes_below(sizes, nr, lo);
+	}
+	free(sizes);
+	return pairs > limit;
+}
+
 void diffcore_rename(struct diff_options *options)
 {
 	int detect_rename = options->detect_rename;
@@ -421,8 +786,8 @@ void diffcore_rename(struct diff_options *options)
 	int rename_limit = options->rename_limit;
 	struct diff_queue_struct *q = &diff_queued_diff;
 	struct diff_queue_struct outq;
-	struct diff_score *mx;
-	int i, j, rename_count;
+	struct diff_score *mx, *cand;
+	int i, rename_count, cand_nr, cand_alloc;
 	int num_create, num_src, dst_cnt;
 
 	if (!minimum_score)
@@ -485,50 +850,41 @@ void diffcore_rename(struct diff_options *options)
 		goto cleanup;
 
 	/*
-	 * This basically does a test for the rename matrix not
-	 * growing larger than a "rename_limit" square matrix, ie:
-	 *
-	 *    num_create * num_src > rename_limit * rename_limit
-	 *
-	 * but handles the potential overflow case specially (and we
-	 * assume at least 32-bit integers)
+	 * Only the pairs that the index cannot rule out are scored.
+	 * The limit bounds the pairs that pass the size test, which
+	 * include all of those, as if they were a square matrix of
+	 * "rename_limit" sources and destinations (and we assume at
+	 * least 32-bit integers).
 	 */
 	if (rename_limit <= 0 || rename_limit > 32767)
 		rename_limit = 32767;
-	if ((num_create > rename_limit && num_src > rename_limit) ||
-	    (num_create * num_src > rename_limit * rename_limit)) {
+	if (too_many_size_matches(minimum_score,
+				  (unsigned long)rename_limit * rename_limit)) {
 		if (options->warn_on_too_large_rename)
 			warning("too many files (created: %d deleted: %d), skipping inexact rename detection", num_create, num_src);
 		goto cleanup;
 	}
-
+	build_rename_index();
 	mx = xcalloc(num_create * NUM_CANDIDATE_PER_DST, sizeof(*mx));
-	for (dst_cnt = i = 0; i < rename_dst_nr; i++) {
-		struct diff_filespec *two = rename_dst[i].two;
-		struct diff_score *m;
-
+	for (i = 0; i < num_create * NUM_CANDIDATE_PER_DST; i++)
+		mx[i].dst = -1;
+	cand = NULL;
+	cand_nr = cand_alloc = 0;
+	dst_cnt = 0;
+	for (i = 0; i < rename_dst_nr; i++) {
 		if (rename_dst[i].pair)
 			continue; /* dealt with exact match already. */
-
-		m = &mx[dst_cnt * NUM_CANDIDATE_PER_DST];
-		for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
-			m[j].dst = -1;
-
-		for (j = 0; j < rename_src_nr; j++) {
-			struct diff_filespec *one = rename_src[j].one;
-			struct diff_score this_src;
-			this_src.score = estimate_similarity(one, two,
-							     minimum_score);
-			this_src.name_score = basename_same(one, two);
-			this_src.dst = i;
-			this_src.src = j;
-			record_if_better(m, &this_src);
-			diff_free_filespec_blob(one);
+		find_candidates(i, minimum_score, &cand, &cand_nr, &cand_alloc);
+		if (cand_nr >= RENAME_BATCH_PAIRS) {
+			score_candidates(cand, cand_nr, minimum_score);
+			dst_cnt = record_candidates(mx, dst_cnt, cand, cand_nr);
+			cand_nr = 0;
 		}
-		/* We do not need the text anymore */
-		diff_free_filespec_blob(two);
-		dst_cnt++;
 	}
+	free_rename_index();
+	score_candidates(cand, cand_nr, minimum_score);
+	dst_cnt = record_candidates(mx, dst_cnt, cand, cand_nr);
+	free(cand);
 
 	/* cost matrix sorted by most to least similar pair */
 	qsort(mx, dst_cnt * NUM_CANDIDATE_PER_DST, sizeof(*mx), score_compare);
@@ -57,6 +57,8 @@ extern int diff_populate_filespec(struct diff_filespec *, int);
 extern void diff_free_filespec_data(struct diff_filespec *);
 extern void diff_free_filespec_blob(struct diff_filespec *);
 extern int diff_filespec_is_binary(struct diff_filespec *);
+/* 1 or 0 if an attribute says whether it is binary, -1 if not */
+extern int diff_filespec_binary_attr(struct diff_filespec *);
 
 struct diff_filepair {
 	struct diff_filespec *one;
@@ -121,4 +123,18 @@ extern int diffcore_count_changes(struct diff_filespec *src,
 				  unsigned long *src_copied,
 				  unsigned long *literal_added);
 
+/*
+ * The fingerprint diffcore_count_changes() compares is a count of
+ * bytes per chunk hash.  diffcore_fingerprint() puts it in
+ * one->cnt_data, unless it is there already, reading the data only
+ * if the fingerprint cache does not know the blob; it returns -1 if
+ * the data cannot be read.  diffcore_for_each_chunk() walks a
+ * fingerprint in increasing hash order.
+ */
+typedef void (*each_chunk_fn)(unsigned int hashval, unsigned int cnt, void *);
+extern unsigned long diff_fingerprint_cache_limit;
+extern int diff_fingerprint_cache_file;
+extern int diffcore_fingerprint(struct diff_filespec *one);
+extern void diffcore_for_each_chunk(void *cnt_data, each_chunk_fn, void *);
+
 #endif
@@ -8,6 +8,7 @@
 #include "cache.h"
 #include "dir.h"
 #include "refs.h"
+#include "blob.h"
 
 struct path_simplify {
 	int len;
@@ -16,7 +17,8 @@ struct path_simplify {
 
 static int read_directory_recursive(struct dir_struct *dir,
 	const char *path, const char *base, int baselen,
-	int check_only, const struct path_simplify *simplify);
+	int check_only, const struct path_simplify *simplify,
+	struct untracked_cache_dir *untracked);
 static int get_dtype(struct dirent *de, const char *path);
 
 int common_prefix(const char **pathspec)
@@ -479,7 +481,8 @@ enum directory_treatment {
 
 static enum directory_treatment treat_directory(struct dir_struct *dir,
 	const char *dirname, int len,
-	const struct path_simplify *simplify)
+	const struct path_simplify *simplify,
+	struct untracked_cache_dir *untracked)
 {
 	/* The "len-1" is to strip the final '/' */
 	switch (directory_exists_in_index(dirname, len-1)) {
@@ -505,7 +508,8 @@ static enum directory_treatment treat_directory(struct dir_struct *dir,
 	/* This is the "show_other_directories" case */
 	if (!dir->hide_empty_directories)
 		return show_directory;
-	if (!read_directory_recursive(dir, dirname, dirname, len, 1, simplify))
+	if (!read_directory_recursive(dir, dirname, dirname, len, 1, simplify,
+				      untracked))
 		return ignore_directory;
 	return show_directory;
 }
@@ -565,6 +569,199 @@ static int get_dtype(struct dirent *de, const char *path)
 	return dtype;
 }
 
+static struct untracked_cache_dir *new_untracked_dir(const char *name, int len)
+{
+	struct untracked_cache_dir *ucd = xcalloc(1, sizeof(*ucd) + len + 1);
+	memcpy(ucd->name, name, len);
+	return ucd;
+}
+
+static void free_untracked_dir(struct untracked_cache_dir *ucd);
+
+static void free_untracked_entries(struct untracked_cache_entry *entries, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		free(entries[i].name);
+		free_untracked_dir(entries[i].dir);
+	}
+	free(entries);
+}
+
+static void free_untracked_dir(struct untracked_cache_dir *ucd)
+{
+	if (!ucd)
+		return;
+	free_untracked_entries(ucd->entries, ucd->nr);
+	free(ucd);
+}
+
+static void add_untracked_entry(struct untracked_cache_dir *ucd,
+				const char *name, int len,
+				struct untracked_cache_dir *child)
+{
+	struct untracked_cache_entry *e;
+
+	ALLOC_GROW(ucd->entries, ucd->nr + 1, ucd->alloc);
+	e = &ucd->entries[ucd->nr++];
+	e->name = child ? NULL : xmemdupz(name, len);
+	e->dir = child;
+}
+
+/*
+ * Find the node for subdirectory "name" among the entries of the
+ * previous scan, so that whatever we know about it survives a rescan
+ * of its parent.  Entries usually come back in the same order, so
+ * start looking where the last search stopped.
+ */
+static struct untracked_cache_dir *untracked_child(struct untracked_cache_entry *old,
+						   int old_nr, int *pos,
+						   const char *name, int len)
+{
+	int i, n;
+
+	for (n = 0, i = *pos; n < old_nr; n++, i = (i + 1) % old_nr) {
+		struct untracked_cache_dir *child = old[i].dir;
+		if (child && !strncmp(child->name, name, len) &&
+		    !child->name[len]) {
+			old[i].dir = NULL;
+			*pos = i + 1;
+			return child;
+		}
+	}
+	return new_untracked_dir(name, len);
+}
+
+static int hash_ignore_file(const char *path, unsigned char *sha1)
+{
+	struct strbuf buf = STRBUF_INIT;
+	int ret = 0;
+
+	if (strbuf_read_file(&buf, path, 0) < 0) {
+		hashclr(sha1);
+		ret = -1;
+	} else
+		hash_sha1_file(buf.buf, buf.len, blob_type, sha1);
+	strbuf_release(&buf);
+	return ret;
+}
+
+/*
+ * A modification time that is not older than the traversal itself
+ * cannot be trusted: the path may change again within the same second
+ * without its stat data changing.
+ */
+static int untracked_stat_racy(struct untracked_cache *uc, struct stat *st)
+{
+	return uc->scan_start <= st->st_mtime;
+}
+
+/*
+ * The per-directory exclude file of a directory applies to everything
+ * below it, so when it changes we forget the whole subtree.
+ */
+static void validate_untracked_ignore(struct dir_struct *dir,
+				      struct untracked_cache_dir *ucd,
+				      const char *base, int baselen)
+{
+	struct untracked_cache *uc = dir->untracked;
+	char path[PATH_MAX];
+	unsigned char sha1[20];
+	struct stat st;
+	int len = strlen(dir->exclude_per_dir);
+
+	if (baselen + len >= sizeof(path))
+		return;
+	memcpy(path, base, baselen);
+	memcpy(path + baselen, dir->exclude_per_dir, len + 1);
+
+	if (stat(path, &st)) {
+		if (is_null_sha1(ucd->ign_sha1))
+			return;
+		memset(&st, 0, sizeof(st));
+		hashclr(sha1);
+	} else {
+		if ((ucd->flags & UNTRACKED_IGNORE_VALID) &&
+		    ucd->ign_mtime == (unsigned int)st.st_mtime &&
+		    ucd->ign_ctime == (unsigned int)st.st_ctime &&
+		    ucd->ign_size == (unsigned int)st.st_size)
+			return;
+		hash_ignore_file(path, sha1);
+	}
+
+	if (hashcmp(sha1, ucd->ign_sha1)) {
+		free_untracked_entries(ucd->entries, ucd->nr);
+		ucd->entries = NULL;
+		ucd->nr = ucd->alloc = 0;
+		ucd->flags &= ~(UNTRACKED_DIR_VALID | UNTRACKED_DIR_COMPLETE);
+		hashcpy(ucd->ign_sha1, sha1);
+	}
+	ucd->ign_mtime = st.st_mtime;
+	ucd->ign_ctime = st.st_ctime;
+	ucd->ign_size = st.st_size;
+	if (untracked_stat_racy(uc, &st))
+		ucd->flags &= ~UNTRACKED_IGNORE_VALID;
+	else
+		ucd->flags |= UNTRACKED_IGNORE_VALID;
+	uc->changed = 1;
+}
+
+/*
+ * Produce the same result read_directory_recursive() would, from the
+ * entries recorded by an earlier scan of an unchanged directory.  How
+ * a subdirectory is treated depends on the index, so that decision is
+ * made again.  Returns -1 if the recorded entries are not enough.
+ */
+static int replay_untracked_dir(struct dir_struct *dir,
+				struct untracked_cache_dir *ucd,
+				const char *base, int baselen,
+				int check_only,
+				const struct path_simplify *simplify)
+{
+	char fullname[PATH_MAX + 1];
+	int i, contents = 0;
+
+	if (!check_only && !(ucd->flags & UNTRACKED_DIR_COMPLETE))
+		return -1;
+	dir->untracked->dir_reused++;
+	memcpy(fullname, base, baselen);
+
+	for (i = 0; i < ucd->nr; i++) {
+		struct untracked_cache_entry *e = &ucd->entries[i];
+		int len;
+
+		if (!e->dir) {
+			len = strlen(e->name);
+			memcpy(fullname + baselen, e->name, len + 1);
+		} else {
+			len = strlen(e->dir->name);
+			memcpy(fullname + baselen, e->dir->name, len);
+			memcpy(fullname + baselen + len, "/", 2);
+			len++;
+			switch (treat_directory(dir, fullname, baselen + len,
+						simplify, e->dir)) {
+			case show_directory:
+				break;
+			case recurse_into_directory:
+				contents += read_directory_recursive(dir,
+					fullname, fullname, baselen + len, 0,
+					simplify, e->dir);
+				continue;
+			case ignore_directory:
+				continue;
+			}
+		}
+		contents++;
+		if (check_only)
+			return contents;
+		dir_add_name(dir, fullname, baselen + len);
+	}
+	if (check_only && !(ucd->flags & UNTRACKED_DIR_COMPLETE))
+		return -1;
+	return contents;
+}
+
 /*
  * Read a directory tree. We currently ignore anything but
  * directories, regular files and symlinks. That's because git
@@ -573,12 +770,39 @@ static int get_dtype(struct dirent *de, const char *path)
  *
  * Also, we ignore the name ".git" (even if it is not a directory).
  * That likely will not change.
+ *
+ * With an untracked cache node, a directory whose stat data matches
+ * the last scan is replayed from the cache instead of being read;
+ * otherwise it is read and the node is refreshed.
  */
-static int read_directory_recursive(struct dir_struct *dir, const char *path, const char *base, int baselen, int check_only, const struct path_simplify *simplify)
+static int read_directory_recursive(struct dir_struct *dir, const char *path, const char *base, int baselen, int check_only, const struct path_simplify *simplify, struct untracked_cache_dir *untracked)
 {
-	DIR *fdir = opendir(path);
-	int contents = 0;
+	DIR *fdir;
+	int contents = 0, complete = 1;
+	struct untracked_cache_entry *old = NULL;
+	int old_nr = 0, old_pos = 0;
+	struct stat st;
 
+	if (untracked) {
+		validate_untracked_ignore(dir, untracked, base, baselen);
+		if (lstat(path, &st) || !S_ISDIR(st.st_mode))
+			memset(&st, 0, sizeof(st));
+		else if ((untracked->flags & UNTRACKED_DIR_VALID) &&
+			 untracked->mtime == (unsigned int)st.st_mtime &&
+			 untracked->ctime == (unsigned int)st.st_ctime) {
+			contents = replay_untracked_dir(dir, untracked,
+				base, baselen, check_only, simplify);
+			if (contents >= 0)
+				return contents;
+			contents = 0;
+		}
+		old = untracked->entries;
+		old_nr = untracked->nr;
+		untracked->entries = NULL;
+		untracked->nr = untracked->alloc = 0;
+	}
+
+	fdir = opendir(path);
 	if (fdir) {
 		struct dirent *de;
 		char fullname[PATH_MAX + 1];
@@ -587,6 +811,7 @@ static int read_directory_recursive(struct dir_struct *dir, const char *path, co
 		while ((de = readdir(fdir)) != NULL) {
 			int len, dtype;
 			int exclude;
+			struct untracked_cache_dir *child = NULL;
 
 			if (is_dot_or_dotdot(de->d_name) ||
 			     !strcmp(de->d_name, ".git"))
@@ -630,16 +855,22 @@ static int read_directory_recursive(struct dir_struct *dir, const char *path, co
 			default:
 				continue;
 			case DT_DIR:
+				if (untracked) {
+					child = untracked_child(old, old_nr,
+						&old_pos, de->d_name, len);
+					add_untracked_entry(untracked, NULL, 0, child);
+				}
 				memcpy(fullname + baselen + len, "/", 2);
 				len++;
-				switch (treat_directory(dir, fullname, baselen + len, simplify)) {
+				switch (treat_directory(dir, fullname, baselen + len, simplify, child)) {
 				case show_directory:
 					if (exclude != dir->show_ignored)
 						continue;
 					break;
 				case recurse_into_directory:
 					contents += read_directory_recursive(dir,
-						fullname, fullname, baselen + len, 0, simplify);
+						fullname, fullname, baselen + len, 0,
+						simplify, child);
 					continue;
 				case ignore_directory:
 					continue;
@@ -647,11 +878,15 @@ static int read_directory_recursive(struct dir_struct *dir, const char *path, co
 				break;
 			case DT_REG:
 			case DT_LNK:
+				if (untracked)
+					add_untracked_entry(untracked, de->d_name, len, NULL);
 				break;
 			}
 			contents++;
-			if (check_only)
+			if (check_only) {
+				complete = 0;
 				goto exit_early;
+			}
 			else
 				dir_add_name(dir, fullname, baselen + len);
 		}
@@ -659,6 +894,18 @@ exit_early:
 		closedir(fdir);
 	}
 
+	if (untracked) {
+		free_untracked_entries(old, old_nr);
+		untracked->mtime = st.st_mtime;
+		untracked->ctime = st.st_ctime;
+		untracked->flags &= ~(UNTRACKED_DIR_VALID | UNTRACKED_DIR_COMPLETE);
+		if (fdir && st.st_mtime && !untracked_stat_racy(dir->untracked, &st))
+			untracked->flags |= UNTRACKED_DIR_VALID;
+		if (complete)
+			untracked->flags |= UNTRACKED_DIR_COMPLETE;
+		dir->untracked->dir_scanned++;
+		dir->untracked->changed = 1;
+	}
 	return contents;
 }
 
@@ -716,16 +963,63 @@ static void free_simplify(struct path_simplify *simplify)
 	free(simplify);
 }
 
+/*
+ * The untracked cache describes a traversal of the whole work tree
+ * with the standard exclude rules and nothing else; the flags that
+ * only decide how directories are shown are applied when replaying.
+ */
+static struct untracked_cache_dir *validate_untracked_cache(struct dir_struct *dir,
+							    const char *path,
+							    int baselen,
+							    const char **pathspec)
+{
+	struct untracked_cache *uc = dir->untracked;
+	unsigned char info_exclude_sha1[20], excludes_file_sha1[20];
+
+	if (!uc || pathspec || baselen || strcmp(path, ".") ||
+	    dir->show_ignored || dir->collect_ignored ||
+	    dir->exclude_list[EXC_CMDL].nr ||
+	    !dir->exclude_per_dir || strcmp(dir->exclude_per_dir, ".gitignore"))
+		return NULL;
+
+	hash_ignore_file(git_path("info/exclude"), info_exclude_sha1);
+	if (excludes_file)
+		hash_ignore_file(excludes_file, excludes_file_sha1);
+	else
+		hashclr(excludes_file_sha1);
+
+	if (!uc->root ||
+	    hashcmp(uc->info_exclude_sha1, info_exclude_sha1) ||
+	    hashcmp(uc->excludes_file_sha1, excludes_file_sha1)) {
+		free_untracked_dir(uc->root);
+		uc->root = new_untracked_dir("", 0);
+		hashcpy(uc->info_exclude_sha1, info_exclude_sha1);
+		hashcpy(uc->excludes_file_sha1, excludes_file_sha1);
+		uc->changed = 1;
+	}
+	uc->scan_start = time(NULL);
+	uc->dir_reused = uc->dir_scanned = 0;
+	return uc->root;
+}
+
 int read_directory(struct dir_struct *dir, const char *path, const char *base, int baselen, const char **pathspec)
 {
 	struct path_simplify *simplify;
+	struct untracked_cache_dir *untracked;
 
 	if (has_symlink_leading_path(strlen(path), path))
 		return dir->nr;
 
 	simplify = create_simplify(pathspec);
-	read_directory_recursive(dir, path, base, baselen, 0, simplify);
+	untracked = validate_untracked_cache(dir, path, baselen, pathspec);
+	read_directory_recursive(dir, path, base, baselen, 0, simplify,
+				 untracked);
 	free_simplify(simplify);
+	if (untracked)
+		trace_printf_key("GIT_TRACE_PERFORMANCE",
+				 "performance: untracked cache: %u directories reused, %u scanned\n",
+				 dir->untracked->dir_reused,
+				 dir->untracked->dir_scanned);
 	qsort(dir->entries, dir->nr, sizeof(struct dir_entry *), cmp_name);
 	qsort(dir->ignored, dir->ignored_nr, sizeof(struct dir_entry *), cmp_name);
 	return dir->nr;
@@ -869,3 +1163,141 @@ int remove_path(const char *name)
 	return 0;
 }
 
+
+/*
+ * On-disk format of the untracked cache extension: the SHA-1 of
+ * $GIT_DIR/info/exclude and of core.excludesfile, followed by the
+ * root directory.  Each directory is an ondisk_untracked_dir, its
+ * NUL-terminated name and its entries in traversal order: 'f' and a
+ * NUL-terminated file name, or 'd' and a directory.
+ */
+struct ondisk_untracked_dir {
+	uint32_t flags;
+	uint32_t mtime;
+	uint32_t ctime;
+	uint32_t ign_mtime;
+	uint32_t ign_ctime;
+	uint32_t ign_size;
+	uint32_t nr;
+	unsigned char ign_sha1[20];
+};
+
+static void write_untracked_dir(struct strbuf *out, struct untracked_cache_dir *ucd)
+{
+	struct ondisk_untracked_dir ondisk;
+	int i;
+
+	ondisk.flags = htonl(ucd->flags);
+	ondisk.mtime = htonl(ucd->mtime);
+	ondisk.ctime = htonl(ucd->ctime);
+	ondisk.ign_mtime = htonl(ucd->ign_mtime);
+	ondisk.ign_ctime = htonl(ucd->ign_ctime);
+	ondisk.ign_size = htonl(ucd->ign_size);
+	ondisk.nr = htonl(ucd->nr);
+	hashcpy(ondisk.ign_sha1, ucd->ign_sha1);
+	strbuf_add(out, &ondisk, sizeof(ondisk));
+	strbuf_add(out, ucd->name, strlen(ucd->name) + 1);
+
+	for (i = 0; i < ucd->nr; i++) {
+		struct untracked_cache_entry *e = &ucd->entries[i];
+		if (e->dir) {
+			strbuf_addch(out, 'd');
+			write_untracked_dir(out, e->dir);
+		} else {
+			strbuf_addch(out, 'f');
+			strbuf_add(out, e->name, strlen(e->name) + 1);
+		}
+	}
+}
+
+void untracked_cache_write(struct strbuf *out, struct untracked_cache *uc)
+{
+	strbuf_add(out, uc->info_exclude_sha1, 20);
+	strbuf_add(out, uc->excludes_file_sha1, 20);
+	if (uc->root)
+		write_untracked_dir(out, uc->root);
+}
+
+static struct untracked_cache_dir *read_untracked_dir(const char **bufp,
+						      const char *end)
+{
+	struct ondisk_untracked_dir ondisk;
+	struct untracked_cache_dir *ucd;
+	const char *buf = *bufp, *eos;
+	unsigned int i, nr;
+
+	if (end - buf < sizeof(ondisk))
+		return NULL;
+	memcpy(&ondisk, buf, sizeof(ondisk));
+	buf += sizeof(ondisk);
+	eos = memchr(buf, '\0', end - buf);
+	if (!eos)
+		return NULL;
+	ucd = new_untracked_dir(buf, eos - buf);
+	buf = eos + 1;
+
+	ucd->flags = ntohl(ondisk.flags);
+	ucd->mtime = ntohl(ondisk.mtime);
+	ucd->ctime = ntohl(ondisk.ctime);
+	ucd->ign_mtime = ntohl(ondisk.ign_mtime);
+	ucd->ign_ctime = ntohl(ondisk.ign_ctime);
+	ucd->ign_size = ntohl(ondisk.ign_size);
+	hashcpy(ucd->ign_sha1, ondisk.ign_sha1);
+	nr = ntohl(ondisk.nr);
+
+	for (i = 0; i < nr; i++) {
+		if (buf >= end)
+			goto bad;
+		if (*buf == 'd') {
+			struct untracked_cache_dir *child;
+			buf++;
+			child = read_untracked_dir(&buf, end);
+			if (!child)
+				goto bad;
+			add_untracked_entry(ucd, NULL, 0, child);
+		} else if (*buf == 'f') {
+			buf++;
+			eos = memchr(buf, '\0', end - buf);
+			if (!eos)
+				goto bad;
+			add_untracked_entry(ucd, buf, eos - buf, NULL);
+			buf = eos + 1;
+		} else
+			goto bad;
+	}
+	*bufp = buf;
+	return ucd;
+
+ bad:
+	free_untracked_dir(ucd);
+	return NULL;
+}
+
+struct untracked_cache *untracked_cache_read(const char *buffer, unsigned long size)
+{
+	struct untracked_cache *uc;
+	const char *end = buffer + size;
+
+	if (size < 40)
+		return NULL;
+	uc = xcalloc(1, sizeof(*uc));
+	hashcpy(uc->info_exclude_sha1, (const unsigned char *)buffer);
+	hashcpy(uc->excludes_file_sha1, (const unsigned char *)buffer + 20);
+	buffer += 40;
+	if (buffer < end) {
+		uc->root = read_untracked_dir(&buffer, end);
+		if (!uc->root || buffer != end) {
+			free_untracked_cache(uc);
+			return NULL;
+		}
+	}
+	return uc;
+}
+
+void free_untracked_cache(struct untracked_cache *uc)
+{
+	if (!uc)
+		return;
+	free_untracked_dir(uc->root);
+	free(uc);
+}
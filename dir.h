@@ -31,6 +31,44 @@ struct exclude_stack {
 	int exclude_ix;
 };
 
+/*
+ * The untracked cache remembers, for each directory read_directory()
+ * visited, the files and subdirectories that survived the exclude
+ * rules, together with the stat data of the directory and of its
+ * .gitignore.  A later traversal replays a directory whose stat data
+ * did not change instead of reading it and matching every entry
+ * against the exclude patterns again.
+ */
+struct untracked_cache_dir;
+
+struct untracked_cache_entry {
+	char *name;			/* a file, or ... */
+	struct untracked_cache_dir *dir; /* ... a subdirectory */
+};
+
+#define UNTRACKED_DIR_VALID	01 /* directory stat data can be trusted */
+#define UNTRACKED_DIR_COMPLETE	02 /* entries cover the whole directory */
+#define UNTRACKED_IGNORE_VALID	04 /* .gitignore stat data can be trusted */
+
+struct untracked_cache_dir {
+	unsigned int flags;
+	unsigned int mtime, ctime;
+	unsigned int ign_mtime, ign_ctime, ign_size;
+	unsigned char ign_sha1[20];
+	int nr, alloc;
+	struct untracked_cache_entry *entries;
+	char name[FLEX_ARRAY];
+};
+
+struct untracked_cache {
+	unsigned char info_exclude_sha1[20];
+	unsigned char excludes_file_sha1[20];
+	struct untracked_cache_dir *root;
+	time_t scan_start;
+	unsigned int dir_reused, dir_scanned;
+	unsigned changed : 1;
+};
+
 struct dir_struct {
 	int nr, alloc;
 	int ignored_nr, ignored_alloc;
@@ -57,6 +95,9 @@ struct dir_struct {
 
 	struct exclude_stack *exclude_stack;
 	char basebuf[PATH_MAX];
+
+	/* Optional; see the untracked cache above */
+	struct untracked_cache *untracked;
 };
 
 extern int common_prefix(const char **pathspec);
@@ -89,6 +130,10 @@ extern int is_empty_dir(const char *dir);
 extern void setup_standard_excludes(struct dir_struct *dir);
 extern int remove_dir_recursively(struct strbuf *path, int only_empty);
 
+extern struct untracked_cache *untracked_cache_read(const char *buffer, unsigned long size);
+extern void untracked_cache_write(struct strbuf *, struct untracked_cache *);
+extern void free_untracked_cache(struct untracked_cache *);
+
 /* tries to remove the path with empty directories along it, ignores ENOENT */
 extern int remove_path(const char *path);
 
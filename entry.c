@@ -87,6 +87,138 @@ static void *read_blob_entry(struct cache_entry *ce, const char *path, unsigned
 	return NULL;
 }
 
+#ifndef NO_PTHREADS
+#include <pthread.h>
+
+static int threads_active;
+static pthread_mutex_t read_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define read_lock()	do { if (threads_active) pthread_mutex_lock(&read_mutex); } while (0)
+#define read_unlock()	do { if (threads_active) pthread_mutex_unlock(&read_mutex); } while (0)
+#else
+#define read_lock()	(void)0
+#define read_unlock()	(void)0
+#endif
+
+static int open_file_entry(struct cache_entry *ce, char *path,
+			   int to_tempfile, int *collided)
+{
+	int fd;
+
+	if (to_tempfile) {
+		strcpy(path, ".merge_file_XXXXXX");
+		fd = mkstemp(path);
+	} else
+		fd = create_file(path, ce->ce_mode);
+	if (fd < 0) {
+		if (collided && errno == EEXIST) {
+			*collided = 1;
+			return -2;
+		}
+		return error("git checkout-index: unable to create file %s (%s)",
+			path, strerror(errno));
+	}
+	return fd;
+}
+
+/*
+ * Inflate a big blob straight into path instead of reading it into
+ * memory first.  Returns 1, having left nothing behind, when the blob
+ * cannot be streamed, so that the caller can read it as usual.
+ */
+static int stream_file_entry(struct cache_entry *ce, char *path,
+			     int to_tempfile, int *collided)
+{
+	int fd, ret;
+
+	fd = open_file_entry(ce, path, to_tempfile, collided);
+	if (fd < 0)
+		return fd == -2 ? 0 : -1;
+	ret = stream_blob_to_fd(fd, ce->sha1);
+	if (close(fd) && !ret)
+		ret = error("git checkout-index: unable to write file %s", path);
+	if (ret)
+		unlink(path);
+	return ret;
+}
+
+/*
+ * Write the blob of a regular file entry to path, converted as ca says.
+ * When collided is not NULL and path already exists, set *collided
+ * instead of reporting an error, so that the caller can retry.
+ */
+static int write_file_entry(struct cache_entry *ce, char *path,
+			    const struct conv_attrs *ca, int to_tempfile,
+			    int *collided)
+{
+	int fd;
+	long wrote;
+	char *new;
+	struct strbuf buf;
+	unsigned long size;
+
+	/*
+	 * Big blobs that need no conversion go straight to the file.
+	 * Streaming reads the object database all along, so the read
+	 * lock is held until it is done.
+	 */
+	if (!would_convert_to_working_tree(ca)) {
+		read_lock();
+		if (sha1_object_info(ce->sha1, &size) == OBJ_BLOB &&
+		    size > big_file_threshold) {
+			int ret = stream_file_entry(ce, path, to_tempfile,
+						    collided);
+			if (ret <= 0) {
+				read_unlock();
+				return ret;
+			}
+		}
+		read_unlock();
+	}
+
+	read_lock();
+	new = read_blob_entry(ce, path, &size);
+	if (!new) {
+		error("git checkout-index: unable to read sha1 file of %s (%s)",
+			path, sha1_to_hex(ce->sha1));
+		read_unlock();
+		return -1;
+	}
+	read_unlock();
+
+	/*
+	 * Convert from git internal format to working tree format
+	 */
+	strbuf_init(&buf, 0);
+	if (convert_to_working_tree_ca(ca, ce->name, new, size, &buf)) {
+		size_t newsize = 0;
+		free(new);
+		new = strbuf_detach(&buf, &newsize);
+		size = newsize;
+	}
+
+	fd = open_file_entry(ce, path, to_tempfile, collided);
+	if (fd < 0) {
+		free(new);
+		return fd == -2 ? 0 : -1;
+	}
+
+	wrote = write_in_full(fd, new, size);
+	close(fd);
+	free(new);
+	if (wrote != size)
+		return error("git checkout-index: unable to write file %s", path);
+	return 0;
+}
+
+static void refresh_entry_stat(struct cache_entry *ce, const struct checkout *state)
+{
+	if (state->refresh_cache) {
+		struct stat st;
+		lstat(ce->name, &st);
+		fill_stat_cache_info(ce, &st);
+	}
+}
+
 static int write_entry(struct cache_entry *ce, char *path, const struct checkout *state, int to_tempfile)
 {
 	int fd;
@@ -94,42 +226,13 @@ static int write_entry(struct cache_entry *ce, char *path, const struct checkout
 
 	switch (ce->ce_mode & S_IFMT) {
 		char *new;
-		struct strbuf buf;
 		unsigned long size;
+		struct conv_attrs ca;
 
 	case S_IFREG:
-		new = read_blob_entry(ce, path, &size);
-		if (!new)
-			return error("git checkout-index: unable to read sha1 file of %s (%s)",
-				path, sha1_to_hex(ce->sha1));
-
-		/*
-		 * Convert from git internal format to working tree format
-		 */
-		strbuf_init(&buf, 0);
-		if (convert_to_working_tree(ce->name, new, size, &buf)) {
-			size_t newsize = 0;
-			free(new);
-			new = strbuf_detach(&buf, &newsize);
-			size = newsize;
-		}
-
-		if (to_tempfile) {
-			strcpy(path, ".merge_file_XXXXXX");
-			fd = mkstemp(path);
-		} else
-			fd = create_file(path, ce->ce_mode);
-		if (fd < 0) {
-			free(new);
-			return error("git checkout-index: unable to create file %s (%s)",
-				path, strerror(errno));
-		}
-
-		wrote = write_in_full(fd, new, size);
-		close(fd);
-		free(new);
-		if (wrote != size)
-			return error("git checkout-index: unable to write file %s", path);
+		convert_attrs(ce->name, &ca);
+		if (write_file_entry(ce, path, &ca, to_tempfile, NULL))
+			return -1;
 		break;
 	case S_IFLNK:
 		new = read_blob_entry(ce, path, &size);
@@ -171,13 +274,165 @@ static int write_entry(struct cache_entry *ce, char *path, const struct checkout
 		return error("git checkout-index: unknown file mode for %s", path);
 	}
 
-	if (state->refresh_cache) {
-		struct stat st;
-		lstat(ce->name, &st);
-		fill_stat_cache_info(ce, &st);
+	refresh_entry_stat(ce, state);
+	return 0;
+}
+
+/*
+ * Parallel checkout.  Between start_parallel_checkout() and
+ * finish_parallel_checkout(), checkout_entry() still gets rid of
+ * whatever is in the way and creates the leading directories of each
+ * path, but instead of writing regular files right away it queues
+ * them, with their attributes already looked up.  The queue is then
+ * written out by core.checkoutWorkers threads.  Only reading the
+ * blobs is serialized, as the object store is not thread safe.
+ */
+struct parallel_checkout_item {
+	struct cache_entry *ce;
+	const struct checkout *state;
+	struct conv_attrs ca;
+	char *path;
+	int status, collided;
+};
+
+static struct parallel_checkout {
+	int enabled;
+	int nr, alloc;
+	struct parallel_checkout_item *items;
+} parallel_checkout;
+
+#ifndef NO_PTHREADS
+/*
+ * Cap the parallelism to 20 threads, and have at least 25 files per
+ * thread for it to be worth starting one.
+ */
+#define MAX_PARALLEL (20)
+#define THREAD_COST (25)
+
+static int next_item;
+static pthread_mutex_t item_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void write_queued_entry(struct parallel_checkout_item *item)
+{
+	item->status = write_file_entry(item->ce, item->path, &item->ca,
+					0, &item->collided);
+	if (!item->status && !item->collided)
+		refresh_entry_stat(item->ce, item->state);
+}
+
+#ifndef NO_PTHREADS
+static void *checkout_thread(void *data)
+{
+	for (;;) {
+		int i;
+
+		pthread_mutex_lock(&item_mutex);
+		i = next_item++;
+		pthread_mutex_unlock(&item_mutex);
+		if (i >= parallel_checkout.nr)
+			break;
+		write_queued_entry(parallel_checkout.items + i);
 	}
+	return NULL;
+}
+
+static int write_queued_entries(void)
+{
+	int threads, i;
+	pthread_t thread[MAX_PARALLEL];
+
+	threads = core_checkout_workers;
+	if (threads > MAX_PARALLEL)
+		threads = MAX_PARALLEL;
+	if (threads > parallel_checkout.nr / THREAD_COST)
+		threads = parallel_checkout.nr / THREAD_COST;
+	if (threads < 2)
+		return 0;
+
+	next_item = 0;
+	threads_active = 1;
+	for (i = 0; i < threads; i++)
+		if (pthread_create(&thread[i], NULL, checkout_thread, NULL))
+			die("unable to create checkout thread");
+	for (i = 0; i < threads; i++)
+		if (pthread_join(thread[i], NULL))
+			die("unable to join checkout thread");
+	threads_active = 0;
+	return 1;
+}
+#else
+static int write_queued_entries(void)
+{
 	return 0;
 }
+#endif
+
+void start_parallel_checkout(void)
+{
+#ifndef NO_PTHREADS
+	if (core_checkout_workers > 1)
+		parallel_checkout.enabled = 1;
+#endif
+}
+
+int finish_parallel_checkout(void)
+{
+	int i, errs = 0;
+
+	if (!parallel_checkout.enabled)
+		return 0;
+	parallel_checkout.enabled = 0;
+
+	if (!write_queued_entries())
+		for (i = 0; i < parallel_checkout.nr; i++)
+			write_queued_entry(parallel_checkout.items + i);
+
+	for (i = 0; i < parallel_checkout.nr; i++) {
+		struct parallel_checkout_item *item = parallel_checkout.items + i;
+
+		/*
+		 * Another entry was written to the same file (e.g. on a
+		 * case insensitive filesystem); redo this one the usual
+		 * way, which will replace it.
+		 */
+		if (item->collided)
+			item->status = checkout_entry(item->ce, item->state, NULL);
+		if (item->status)
+			errs = 1;
+		free(item->path);
+	}
+	free(parallel_checkout.items);
+	parallel_checkout.items = NULL;
+	parallel_checkout.nr = parallel_checkout.alloc = 0;
+	return errs ? -1 : 0;
+}
+
+static int queue_entry(struct cache_entry *ce, const char *path,
+		       const struct checkout *state)
+{
+	struct parallel_checkout_item *item;
+	struct conv_attrs ca;
+
+	/*
+	 * ident expansion and smudge filters are not thread safe;
+	 * such entries are written right away.
+	 */
+	convert_attrs(ce->name, &ca);
+	if (ca.ident || ca.smudge)
+		return 0;
+
+	ALLOC_GROW(parallel_checkout.items, parallel_checkout.nr + 1,
+		   parallel_checkout.alloc);
+	item = parallel_checkout.items + parallel_checkout.nr++;
+	item->ce = ce;
+	item->state = state;
+	item->ca = ca;
+	item->path = xstrdup(path);
+	item->status = 0;
+	item->collided = 0;
+	return 1;
+}
 
 int checkout_entry(struct cache_entry *ce, const struct checkout *state, char *topath)
 {
@@ -219,5 +474,8 @@ int checkout_entry(struct cache_entry *ce, const struct checkout *state, char *t
 	} else if (state->not_new)
 		return 0;
 	create_directories(path, state);
+	if (parallel_checkout.enabled && S_ISREG(ce->ce_mode) &&
+	    queue_entry(ce, path, state))
+		return 0;
 	return write_entry(ce, path, state, 0);
 }
@@ -33,6 +33,7 @@ int fsync_object_files;
 size_t packed_git_window_size = DEFAULT_PACKED_GIT_WINDOW_SIZE;
 size_t packed_git_limit = DEFAULT_PACKED_GIT_LIMIT;
 size_t delta_base_cache_limit = 16 * 1024 * 1024;
+unsigned long big_file_threshold = 512 * 1024 * 1024;
 const char *pager_program;
 int pager_use_color = 1;
 const char *editor_program;
@@ -45,6 +46,27 @@ enum rebase_setup_type autorebase = AUTOREBASE_NEVER;
 
 /* Parallel index stat data preload? */
 int core_preload_index = 0;
+
+/* Use $GIT_OBJECT_DIRECTORY/info/commit-graph when present? */
+int core_commit_graph = 1;
+
+/* Use $GIT_OBJECT_DIRECTORY/pack/multi-pack-index when present? */
+int core_multi_pack_index = 1;
+
+/* Answer loose object lookups from one readdir() per fan-out directory? */
+int core_loose_object_cache;
+
+/* Number of threads writing files during a checkout */
+int core_checkout_workers = 1;
+
+/* Keep the untracked cache index extension up to date */
+int core_untracked_cache;
+
+/* Write the index as a shared index plus the changes since */
+int core_split_index;
+
+/* Format of newly created index files; 0 writes version 2 or 3 */
+int core_index_version;
 char *notes_ref_name;
 
 /* This is set by setup_git_dir_gently() and/or git_default_config() */
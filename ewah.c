@@ -0,0 +1,302 @@
+/*
+ * Plain and EWAH-compressed bitmaps for the pack reachability index.
+ */
+#include "cache.h"
+#include "csum-file.h"
+#include "ewah.h"
+
+#define RLW_RUNNING_BITS	32
+#define RLW_LITERAL_BITS	(BITS_IN_EWORD - 1 - RLW_RUNNING_BITS)
+#define RLW_LARGEST_RUNNING	(((eword_t)1 << RLW_RUNNING_BITS) - 1)
+#define RLW_LARGEST_LITERAL	(((eword_t)1 << RLW_LITERAL_BITS) - 1)
+
+#define rlw_running_bit(w)	((w) & 1)
+#define rlw_running_len(w)	(((w) >> 1) & RLW_LARGEST_RUNNING)
+#define rlw_literal_words(w)	((w) >> (1 + RLW_RUNNING_BITS))
+
+static inline eword_t rlw_make(int bit, eword_t running, eword_t literals)
+{
+	return (eword_t)bit | (running << 1) |
+		(literals << (1 + RLW_RUNNING_BITS));
+}
+
+#define EWORD_WORD(pos)	((pos) / BITS_IN_EWORD)
+#define EWORD_MASK(pos)	((eword_t)1 << ((pos) % BITS_IN_EWORD))
+
+struct bitmap *bitmap_new(void)
+{
+	struct bitmap *self = xmalloc(sizeof(*self));
+	self->word_alloc = 32;
+	self->words = xcalloc(self->word_alloc, sizeof(eword_t));
+	return self;
+}
+
+void bitmap_free(struct bitmap *self)
+{
+	if (!self)
+		return;
+	free(self->words);
+	free(self);
+}
+
+static void bitmap_grow(struct bitmap *self, size_t words)
+{
+	size_t old = self->word_alloc;
+
+	if (words <= old)
+		return;
+	self->word_alloc = alloc_nr(old);
+	if (self->word_alloc < words)
+		self->word_alloc = words;
+	self->words = xrealloc(self->words,
+			       self->word_alloc * sizeof(eword_t));
+	memset(self->words + old, 0,
+	       (self->word_alloc - old) * sizeof(eword_t));
+}
+
+void bitmap_set(struct bitmap *self, size_t pos)
+{
+	size_t block = EWORD_WORD(pos);
+
+	bitmap_grow(self, block + 1);
+	self->words[block] |= EWORD_MASK(pos);
+}
+
+int bitmap_get(struct bitmap *self, size_t pos)
+{
+	size_t block = EWORD_WORD(pos);
+	return block < self->word_alloc &&
+		(self->words[block] & EWORD_MASK(pos)) != 0;
+}
+
+void bitmap_or(struct bitmap *self, const struct bitmap *other)
+{
+	size_t i;
+
+	bitmap_grow(self, other->word_alloc);
+	for (i = 0; i < other->word_alloc; i++)
+		self->words[i] |= other->words[i];
+}
+
+void bitmap_xor(struct bitmap *self, const struct bitmap *other)
+{
+	size_t i;
+
+	bitmap_grow(self, other->word_alloc);
+	for (i = 0; i < other->word_alloc; i++)
+		self->words[i] ^= other->words[i];
+}
+
+void bitmap_and_not(struct bitmap *self, const struct bitmap *other)
+{
+	size_t i, n = self->word_alloc;
+
+	if (other->word_alloc < n)
+		n = other->word_alloc;
+	for (i = 0; i < n; i++)
+		self->words[i] &= ~other->words[i];
+}
+
+static unsigned int popcount_word(eword_t w)
+{
+	unsigned int count = 0;
+	while (w) {
+		w &= w - 1;
+		count++;
+	}
+	return count;
+}
+
+size_t bitmap_popcount(struct bitmap *self)
+{
+	size_t i, count = 0;
+
+	for (i = 0; i < self->word_alloc; i++)
+		count += popcount_word(self->words[i]);
+	return count;
+}
+
+int bitmap_each_bit(struct bitmap *self,
+		    int (*fn)(size_t pos, void *data), void *data)
+{
+	size_t i;
+
+	for (i = 0; i < self->word_alloc; i++) {
+		eword_t w = self->words[i];
+		unsigned int offset;
+
+		for (offset = 0; w; offset++, w >>= 1) {
+			int ret;
+			if (!(w & 1))
+				continue;
+			ret = fn(i * BITS_IN_EWORD + offset, data);
+			if (ret)
+				return ret;
+		}
+	}
+	return 0;
+}
+
+void ewah_free(struct ewah_bitmap *self)
+{
+	if (!self)
+		return;
+	free(self->buffer);
+	free(self);
+}
+
+static struct ewah_bitmap *ewah_new(void)
+{
+	struct ewah_bitmap *self = xcalloc(1, sizeof(*self));
+	return self;
+}
+
+static void ewah_push(struct ewah_bitmap *self, eword_t word)
+{
+	ALLOC_GROW(self->buffer, self->buffer_size + 1, self->alloc_size);
+	self->buffer[self->buffer_size++] = word;
+}
+
+struct ewah_bitmap *bitmap_to_ewah(struct bitmap *bitmap)
+{
+	struct ewah_bitmap *self = ewah_new();
+	size_t i = 0, n = bitmap->word_alloc;
+	const eword_t *w = bitmap->words;
+
+	/* trailing zero words need not be stored */
+	while (n && !w[n - 1])
+		n--;
+
+	while (i < n) {
+		size_t rlw = self->buffer_size;
+		eword_t running = 0, literals = 0;
+		int bit = 0;
+
+		ewah_push(self, 0);
+		if (w[i] == 0 || w[i] == ~(eword_t)0) {
+			eword_t clean = w[i];
+			bit = clean != 0;
+			while (i < n && w[i] == clean &&
+			       running < RLW_LARGEST_RUNNING) {
+				running++;
+				i++;
+			}
+		}
+		while (i < n && w[i] != 0 && w[i] != ~(eword_t)0 &&
+		       literals < RLW_LARGEST_LITERAL) {
+			ewah_push(self, w[i]);
+			literals++;
+			i++;
+		}
+		self->buffer[rlw] = rlw_make(bit, running, literals);
+	}
+	self->bit_size = n * BITS_IN_EWORD;
+	return self;
+}
+
+void bitmap_or_ewah(struct bitmap *self, struct ewah_bitmap *other)
+{
+	size_t i = 0, pos = 0;
+
+	bitmap_grow(self, (other->bit_size + BITS_IN_EWORD - 1) / BITS_IN_EWORD);
+	while (i < other->buffer_size) {
+		eword_t rlw = other->buffer[i++];
+		eword_t running = rlw_running_len(rlw);
+		eword_t literals = rlw_literal_words(rlw);
+
+		if (rlw_running_bit(rlw)) {
+			bitmap_grow(self, pos + running);
+			memset(self->words + pos, 0xff, running * sizeof(eword_t));
+		}
+		pos += running;
+		bitmap_grow(self, pos + literals);
+		while (literals--)
+			self->words[pos++] |= other->buffer[i++];
+	}
+}
+
+struct bitmap *ewah_to_bitmap(struct ewah_bitmap *self)
+{
+	struct bitmap *bitmap = bitmap_new();
+	bitmap_or_ewah(bitmap, self);
+	return bitmap;
+}
+
+static void put_be32_sha1file(void *data, uint32_t v)
+{
+	v = htonl(v);
+	sha1write(data, &v, 4);
+}
+
+static void put_be32_strbuf(void *data, uint32_t v)
+{
+	v = htonl(v);
+	strbuf_add(data, &v, 4);
+}
+
+static size_t ewah_serialize_1(struct ewah_bitmap *self,
+			       void (*put_be32)(void *, uint32_t), void *data)
+{
+	size_t i, last_rlw = 0;
+
+	put_be32(data, self->bit_size);
+	put_be32(data, self->buffer_size);
+	for (i = 0; i < self->buffer_size; i++) {
+		eword_t w = self->buffer[i];
+		put_be32(data, (uint32_t)(w >> 32));
+		put_be32(data, (uint32_t)w);
+	}
+	/* position of the last marker word, for appending in place */
+	for (i = 0; i < self->buffer_size; i += 1 + rlw_literal_words(self->buffer[i]))
+		last_rlw = i;
+	put_be32(data, last_rlw);
+	return 4 + 4 + self->buffer_size * 8 + 4;
+}
+
+size_t ewah_serialize(struct ewah_bitmap *self, struct sha1file *f)
+{
+	return ewah_serialize_1(self, put_be32_sha1file, f);
+}
+
+size_t ewah_serialize_strbuf(struct ewah_bitmap *self, struct strbuf *out)
+{
+	return ewah_serialize_1(self, put_be32_strbuf, out);
+}
+
+static uint32_t get_be32(const unsigned char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return ntohl(v);
+}
+
+ssize_t ewah_read_mmap(struct ewah_bitmap *self, const void *map, size_t len)
+{
+	const unsigned char *ptr = map;
+	const unsigned char *words;
+	size_t i, size;
+
+	if (len < 12)
+		return -1;
+	self->bit_size = get_be32(ptr);
+	size = get_be32(ptr + 4);
+	if ((len - 12) / 8 < size)
+		return -1;
+
+	/* the bitmap may be embedded at any offset, e.g. in the index */
+	self->buffer_size = self->alloc_size = size;
+	self->buffer = xmalloc(size * sizeof(eword_t) + 1);
+	words = ptr + 8;
+	for (i = 0; i < size; i++)
+		self->buffer[i] = ((eword_t)get_be32(words + 8 * i) << 32) |
+			get_be32(words + 8 * i + 4);
+
+	/* every literal run must fit in the buffer */
+	for (i = 0; i < size; i += 1 + rlw_literal_words(self->buffer[i]))
+		if (rlw_literal_words(self->buffer[i]) > size - i - 1) {
+			free(self->buffer);
+			self->buffer = NULL;
+			return -1;
+		}
+	return 8 + size * 8 + 4;
+}
@@ -0,0 +1,71 @@
+#ifndef EWAH_H
+#define EWAH_H
+
+/*
+ * Plain and EWAH (Enhanced Word-Aligned Hybrid) compressed bitmaps, as
+ * used by the pack reachability bitmaps.
+ *
+ * A "struct bitmap" is an uncompressed, automatically growing array of
+ * 64-bit words that is cheap to modify.  A "struct ewah_bitmap" is the
+ * compressed form we store on disk: a sequence of marker words, each
+ * followed by a number of literal words.  A marker word stores
+ *
+ *	bit 0		the value of the "clean" words it describes
+ *	bits 1..32	how many clean (all 0 or all 1) words follow
+ *	bits 33..63	how many literal words follow the clean run
+ *
+ * See Documentation/technical/bitmap-format.txt for the serialized form.
+ */
+
+struct sha1file;
+struct strbuf;
+
+typedef uint64_t eword_t;
+#define BITS_IN_EWORD 64
+
+struct bitmap {
+	eword_t *words;
+	size_t word_alloc;
+};
+
+extern struct bitmap *bitmap_new(void);
+extern void bitmap_free(struct bitmap *self);
+extern void bitmap_set(struct bitmap *self, size_t pos);
+extern int bitmap_get(struct bitmap *self, size_t pos);
+extern void bitmap_or(struct bitmap *self, const struct bitmap *other);
+extern void bitmap_xor(struct bitmap *self, const struct bitmap *other);
+extern void bitmap_and_not(struct bitmap *self, const struct bitmap *other);
+extern size_t bitmap_popcount(struct bitmap *self);
+
+/*
+ * Call fn() for every bit set in the bitmap, in increasing order;
+ * stops early and returns the value if fn() returns non-zero.
+ */
+extern int bitmap_each_bit(struct bitmap *self,
+			   int (*fn)(size_t pos, void *data), void *data);
+
+struct ewah_bitmap {
+	eword_t *buffer;
+	size_t buffer_size;
+	size_t alloc_size;
+	size_t bit_size;
+};
+
+extern void ewah_free(struct ewah_bitmap *self);
+extern struct ewah_bitmap *bitmap_to_ewah(struct bitmap *bitmap);
+extern struct bitmap *ewah_to_bitmap(struct ewah_bitmap *self);
+extern void bitmap_or_ewah(struct bitmap *self, struct ewah_bitmap *other);
+
+/* Append the serialized bitmap to f, returning the number of bytes. */
+extern size_t ewah_serialize(struct ewah_bitmap *self, struct sha1file *f);
+extern size_t ewah_serialize_strbuf(struct ewah_bitmap *self, struct strbuf *out);
+
+/*
+ * Read a serialized bitmap from a memory region of len bytes.  Returns
+ * the number of bytes consumed, or -1 if the data is truncated or
+ * otherwise invalid.
+ */
+extern ssize_t ewah_read_mmap(struct ewah_bitmap *self,
+			      const void *map, size_t len);
+
+#endif /* EWAH_H */
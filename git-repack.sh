@@ -14,6 +14,9 @@ f               pass --no-reuse-object to git-pack-objects
 n               do not run git-update-server-info
 q,quiet         be quiet
 l               pass --local to git-pack-objects
+b,write-bitmap-index write a reachability bitmap index (with -a)
+geometric=      roll up the smallest packs to keep each pack N times larger than the next smaller one
+list-rollup     with --geometric, only list the packs that would be rolled up
  Packing constraints
 window=         size of the window used for delta compression
 window-memory=  same as the above, but limit memory size instead of entries count
@@ -24,7 +27,7 @@ SUBDIRECTORY_OK='Yes'
 . git-sh-setup
 
 no_update_info= all_into_one= remove_redundant= unpack_unreachable=
-local= quiet= no_reuse= extra=
+local= quiet= no_reuse= extra= write_bitmap= geometric= list_rollup=
 while test $# != 0
 do
 	case "$1" in
@@ -36,6 +39,11 @@ do
 	-q)	quiet=-q ;;
 	-f)	no_reuse=--no-reuse-object ;;
 	-l)	local=--local ;;
+	-b)	write_bitmap=t ;;
+	--geometric)
+		geometric="$2"; shift ;;
+	--list-rollup)
+		list_rollup=t ;;
 	--max-pack-size|--window|--window-memory|--depth)
 		extra="$extra $1=$2"; shift ;;
 	--) shift; break;;
@@ -49,17 +57,89 @@ true)
 	extra="$extra --delta-base-offset" ;;
 esac
 
+test -z "$write_bitmap" &&
+test "`git config --bool repack.writebitmaps`" = true &&
+write_bitmap=t
+
+if test -n "$geometric"
+then
+	test -z "$all_into_one" ||
+	die "--geometric cannot be used with -a or -A"
+	case "$geometric" in
+	[2-9]|[1-9][0-9]*) ;;
+	*)	die "--geometric needs a factor of at least 2" ;;
+	esac
+elif test -n "$list_rollup"
+then
+	die "--list-rollup needs --geometric"
+fi
+
 PACKDIR="$GIT_OBJECT_DIRECTORY/pack"
+
+# Print the names of the packs to roll up into one so that, sorted by
+# size, each pack that is not marked with .keep is at least $1 times
+# as large as the one before it: all packs up to the largest one that
+# breaks the progression, and then as many of the next packs as are
+# not $1 times larger than everything rolled up before them.
+geometric_rollup () {
+	test -d "$PACKDIR" || return 0
+	( cd "$PACKDIR" &&
+	  for e in `find . -type f -name '*.pack' \
+		| sed -e 's/^\.\///' -e 's/\.pack$//'`
+	  do
+		test -e "$e.keep" || echo "`wc -c <"$e.pack"` $e"
+	  done
+	) | sort -n | awk -v factor="$1" '
+	{ size[NR] = $1; name[NR] = $2 }
+	END {
+		for (n = NR; n > 1; n--)
+			if (size[n] < factor * size[n - 1])
+				break
+		if (n < 2)
+			exit
+		for (i = 1; i <= n; i++)
+			total += size[i]
+		for (; n < NR && size[n + 1] < factor * total; n++)
+			total += size[n + 1]
+		for (i = 1; i <= n; i++)
+			print name[i]
+	}'
+}
+
+if test -n "$list_rollup"
+then
+	geometric_rollup "$geometric"
+	exit
+fi
+
 PACKTMP="$GIT_OBJECT_DIRECTORY/.tmp-$$-pack"
 rm -f "$PACKTMP"-*
 trap 'rm -f "$PACKTMP"-*' 0 1 2 3 15
 
 # There will be more repacking strategies to come...
-case ",$all_into_one," in
-,,)
+case ",$all_into_one,$geometric," in
+,,,)
 	args='--unpacked --incremental'
 	;;
-,t,)
+,,*)
+	# Pack the loose objects together with what is reachable in the
+	# rolled up packs; other packs stay as they are.  As with -A, the
+	# unreachable objects of packs that -d removes are turned loose
+	# for "git prune" to expire.
+	args='--unpacked --incremental'
+	for e in `geometric_rollup "$geometric"`
+	do
+		args="$args --unpacked=$e.pack"
+		existing="$existing $e"
+	done
+	test -z "$existing" || test -z "$remove_redundant" ||
+	args="$args --unpack-unreachable"
+	;;
+,t,*)
+	if test -n "$write_bitmap"
+	then
+		args="--write-bitmap-index"
+	fi
 	if [ -d "$PACKDIR" ]; then
 		for e in `cd "$PACKDIR" && find . -type f -name '*.pack' \
 			| sed -e 's/^\.\///' -e 's/\.pack$//'`
@@ -111,6 +191,11 @@ for name in $names ; do
 		echo >&2 "old-pack-$name.{pack,idx} in $PACKDIR."
 		exit 1
 	}
+	if test -f "$PACKTMP-$name.bitmap"
+	then
+		chmod a-w "$PACKTMP-$name.bitmap"
+		mv -f "$PACKTMP-$name.bitmap" "$PACKDIR/pack-$name.bitmap"
+	fi
 	rm -f "$PACKDIR/old-pack-$name.pack" "$PACKDIR/old-pack-$name.idx"
 done
 
@@ -124,7 +209,7 @@ then
 		  do
 			case " $fullbases " in
 			*" $e "*) ;;
-			*)	rm -f "$e.pack" "$e.idx" "$e.keep" ;;
+			*)	rm -f "$e.pack" "$e.idx" "$e.keep" "$e.bitmap" ;;
 			esac
 		  done
 		)
@@ -132,6 +217,12 @@ then
 	git prune-packed $quiet
 fi
 
+# Keep an existing multi-pack-index up to date with the new set of packs.
+if test -f "$PACKDIR/multi-pack-index"
+then
+	git multi-pack-index write || exit
+fi
+
 case "$no_update_info" in
 t) : ;;
 *) git-update-server-info ;;
@@ -63,6 +63,246 @@ static void compile_regexp(struct grep_pat *p, struct grep_opt *opt)
 	}
 }
 
+/*
+ * Literal extraction.  For each pattern we look for strings, one of
+ * which appears in every line the pattern matches: the pattern itself
+ * when it is a fixed string, and for a regexp the longest run of plain
+ * characters in each of its top-level alternatives.  When every
+ * pattern has such strings, grep_buffer() looks for them in the whole
+ * buffer with memmem() and runs the matcher only on the lines where
+ * one was found.  The parser is conservative: a pattern it does not
+ * understand gets no literal, and that disables the fast path.
+ */
+enum literal_token {
+	LIT_CHAR,
+	LIT_OPEN,
+	LIT_CLOSE,
+	LIT_ALT,
+	LIT_OPTIONAL,	/* the previous atom may be absent */
+	LIT_REPEAT,	/* the previous atom may be repeated */
+	LIT_OTHER,	/* anything that is not a plain character */
+	LIT_ERROR,
+};
+
+static int skip_bracket(const char *pat, int i, int len)
+{
+	i++;
+	if (i < len && pat[i] == '^')
+		i++;
+	if (i < len && pat[i] == ']')
+		i++;
+	while (i < len) {
+		if (pat[i] == '[' && i + 1 < len &&
+		    (pat[i + 1] == ':' || pat[i + 1] == '.' || pat[i + 1] == '=')) {
+			char delim = pat[i + 1];
+			i += 2;
+			while (i + 1 < len && !(pat[i] == delim && pat[i + 1] == ']'))
+				i++;
+			if (i + 1 >= len)
+				return -1;
+			i += 2;
+			continue;
+		}
+		if (pat[i] == ']')
+			return i + 1;
+		i++;
+	}
+	return -1;
+}
+
+static enum literal_token next_literal_token(const char *pat, int *i, int len,
+					     int ere, char *ch)
+{
+	int c = pat[(*i)++];
+
+	if (c == '\\') {
+		if (*i >= len)
+			return LIT_ERROR;
+		c = pat[(*i)++];
+		if (!ere) {
+			switch (c) {
+			case '(':
+				return LIT_OPEN;
+			case ')':
+				return LIT_CLOSE;
+			case '|':
+				return LIT_ALT;
+			case '?':
+				return LIT_OPTIONAL;
+			case '+':
+				return LIT_REPEAT;
+			case '{':
+				while (*i + 1 < len &&
+				       !(pat[*i] == '\\' && pat[*i + 1] == '}'))
+					(*i)++;
+				if (*i + 1 >= len)
+					return LIT_ERROR;
+				*i += 2;
+				return LIT_OPTIONAL;
+			}
+		}
+		/* \w, \b, \<, \1 and friends */
+		if (isalnum(c) || c == '<' || c == '>' || c == '`' || c == '\'')
+			return LIT_OTHER;
+		*ch = c;
+		return LIT_CHAR;
+	}
+
+	switch (c) {
+	case '[':
+		*i = skip_bracket(pat, *i - 1, len);
+		return *i < 0 ? LIT_ERROR : LIT_OTHER;
+	case '.':
+	case '^':
+	case '$':
+		return LIT_OTHER;
+	case '*':
+		return LIT_OPTIONAL;
+	}
+	if (ere) {
+		switch (c) {
+		case '(':
+			return LIT_OPEN;
+		case ')':
+			return LIT_CLOSE;
+		case '|':
+			return LIT_ALT;
+		case '?':
+			return LIT_OPTIONAL;
+		case '+':
+			return LIT_REPEAT;
+		case '{':
+			while (*i < len && pat[*i] != '}')
+				(*i)++;
+			if (*i >= len)
+				return LIT_ERROR;
+			(*i)++;
+			return LIT_OPTIONAL;
+		}
+	}
+	*ch = c;
+	return LIT_CHAR;
+}
+
+static void end_literal_run(struct strbuf *run, struct strbuf *best)
+{
+	if (run->len > best->len) {
+		strbuf_reset(best);
+		strbuf_addbuf(best, run);
+	}
+	strbuf_reset(run);
+}
+
+static void drop_last_char(struct strbuf *run)
+{
+	int len = run->len;
+
+	if (!len)
+		return;
+	/* do not leave part of a multi-byte character behind */
+	if (run->buf[--len] & 0x80)
+		while (len && (run->buf[len - 1] & 0x80))
+			len--;
+	strbuf_setlen(run, len);
+}
+
+static void add_literal(struct grep_opt *opt, const char *s, size_t len)
+{
+	struct grep_literal *lit;
+
+	ALLOC_GROW(opt->literals, opt->literals_nr + 1, opt->literals_alloc);
+	lit = opt->literals + opt->literals_nr++;
+	lit->len = len;
+	lit->s = xmemdupz(s, len);
+}
+
+/* Add the literals of p to opt; return 0 if it has none */
+static int add_pattern_literals(struct grep_opt *opt, struct grep_pat *p)
+{
+	const char *pat = p->pattern;
+	int i = 0, len = strlen(pat), depth = 0, last_char = 0;
+	int ere = !!(opt->regflags & REG_EXTENDED), nr = opt->literals_nr;
+	struct strbuf run, best;
+
+	if (p->fixed) {
+		if (!len)
+			return 0;
+		add_literal(opt, pat, len);
+		return 1;
+	}
+	if (opt->regflags & REG_ICASE)
+		return 0;
+
+	strbuf_init(&run, 0);
+	strbuf_init(&best, 0);
+	while (i < len) {
+		char ch = 0;
+		enum literal_token t = next_literal_token(pat, &i, len, ere, &ch);
+
+		if (t == LIT_ERROR)
+			goto fail;
+		if (depth) {
+			/* groups may be optional, ignore what is inside */
+			if (t == LIT_OPEN)
+				depth++;
+			else if (t == LIT_CLOSE)
+				depth--;
+			continue;
+		}
+		switch (t) {
+		case LIT_CHAR:
+			strbuf_addch(&run, ch);
+			last_char = 1;
+			continue;
+		case LIT_OPTIONAL:
+			if (last_char)
+				drop_last_char(&run);
+			break;
+		case LIT_OPEN:
+			depth++;
+			break;
+		case LIT_CLOSE:
+			goto fail;
+		case LIT_ALT:
+			end_literal_run(&run, &best);
+			if (!best.len)
+				goto fail;
+			add_literal(opt, best.buf, best.len);
+			strbuf_reset(&best);
+			break;
+		default:
+			break;
+		}
+		end_literal_run(&run, &best);
+		last_char = 0;
+	}
+	end_literal_run(&run, &best);
+	if (depth || !best.len)
+		goto fail;
+	add_literal(opt, best.buf, best.len);
+	strbuf_release(&run);
+	strbuf_release(&best);
+	return 1;
+
+fail:
+	while (opt->literals_nr > nr)
+		free(opt->literals[--opt->literals_nr].s);
+	strbuf_release(&run);
+	strbuf_release(&best);
+	return 0;
+}
+
+static void free_literals(struct grep_opt *opt)
+{
+	int i;
+
+	for (i = 0; i < opt->literals_nr; i++)
+		free(opt->literals[i].s);
+	free(opt->literals);
+	opt->literals = NULL;
+	opt->literals_nr = opt->literals_alloc = 0;
+}
+
 static struct grep_expr *compile_pattern_or(struct grep_pat **);
 static struct grep_expr *compile_pattern_atom(struct grep_pat **list)
 {
@@ -166,6 +406,7 @@ static struct grep_expr *compile_pattern_expr(struct grep_pat **list)
 void compile_grep_patterns(struct grep_opt *opt)
 {
 	struct grep_pat *p;
+	int literals = 1;
 
 	if (opt->all_match)
 		opt->extended = 1;
@@ -176,6 +417,8 @@ void compile_grep_patterns(struct grep_opt *opt)
 		case GREP_PATTERN_HEAD:
 		case GREP_PATTERN_BODY:
 			compile_regexp(p, opt);
+			if (literals)
+				literals = add_pattern_literals(opt, p);
 			break;
 		default:
 			opt->extended = 1;
@@ -183,6 +426,13 @@ void compile_grep_patterns(struct grep_opt *opt)
 		}
 	}
 
+	/*
+	 * A line matches when any of the patterns does, unless they are
+	 * combined with --and, --not and friends.
+	 */
+	if (!literals || opt->extended)
+		free_literals(opt);
+
 	if (!opt->extended)
 		return;
 
@@ -195,6 +445,34 @@ void compile_grep_patterns(struct grep_opt *opt)
 		die("incomplete pattern expression: %s", p->pattern);
 }
 
+/*
+ * Make a copy of opt with its own compiled patterns, that can be used
+ * to grep on another thread: matching with --all-match records hits
+ * in the pattern expression.
+ */
+struct grep_opt *grep_opt_dup(const struct grep_opt *opt)
+{
+	struct grep_opt *ret = xmalloc(sizeof(*ret));
+	struct grep_pat *p;
+
+	*ret = *opt;
+	ret->pattern_list = NULL;
+	ret->pattern_tail = &ret->pattern_list;
+	ret->pattern_expression = NULL;
+	ret->output = NULL;
+	ret->literals = NULL;
+	ret->literals_nr = ret->literals_alloc = 0;
+	for (p = opt->pattern_list; p; p = p->next) {
+		if (p->token == GREP_PATTERN_HEAD)
+			append_header_grep_pattern(ret, p->field, p->pattern);
+		else
+			append_grep_pattern(ret, p->pattern, p->origin,
+					    p->no, p->token);
+	}
+	compile_grep_patterns(ret);
+	return ret;
+}
+
 static void free_pattern_expr(struct grep_expr *x)
 {
 	switch (x->node) {
@@ -229,6 +507,7 @@ void free_grep_patterns(struct grep_opt *opt)
 		}
 		free(p);
 	}
+	free_literals(opt);
 
 	if (!opt->extended)
 		return;
@@ -251,21 +530,33 @@ static int word_char(char ch)
 	return isalnum(ch) || ch == '_';
 }
 
+static void output(struct grep_opt *opt, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	if (opt->output)
+		strbuf_vaddf(opt->output, fmt, ap);
+	else
+		vprintf(fmt, ap);
+	va_end(ap);
+}
+
 static void show_line(struct grep_opt *opt, const char *bol, const char *eol,
 		      const char *name, unsigned lno, char sign)
 {
 	if (opt->null_following_name)
 		sign = '\0';
 	if (opt->pathname)
-		printf("%s%c", name, sign);
+		output(opt, "%s%c", name, sign);
 	if (opt->linenum)
-		printf("%d%c", lno, sign);
-	printf("%.*s\n", (int)(eol-bol), bol);
+		output(opt, "%d%c", lno, sign);
+	output(opt, "%.*s\n", (int)(eol-bol), bol);
 }
 
 static void show_name(struct grep_opt *opt, const char *name)
 {
-	printf("%s%c", name, opt->null_following_name ? '\0' : '\n');
+	output(opt, "%s%c", name, opt->null_following_name ? '\0' : '\n');
 }
 
 static int fixmatch(const char *pattern, char *line, regmatch_t *match)
@@ -442,6 +733,52 @@ static int match_line(struct grep_opt *opt, char *bol, char *eol,
 	return 0;
 }
 
+/*
+ * Return the earliest place at or after bol where one of the literals
+ * of opt appears, or end if there is none.  Each literal remembers
+ * where it was last found, so that the buffer is scanned only once
+ * for each of them.
+ */
+static char *next_literal(struct grep_opt *opt, char *bol, char *end)
+{
+	char *first = end;
+	int i;
+
+	for (i = 0; i < opt->literals_nr; i++) {
+		struct grep_literal *lit = opt->literals + i;
+
+		if (!lit->pos || (lit->pos < bol && lit->pos != end)) {
+			lit->pos = memmem(bol, end - bol, lit->s, lit->len);
+			if (!lit->pos)
+				lit->pos = end;
+		}
+		if (lit->pos < first)
+			first = lit->pos;
+	}
+	return first;
+}
+
+static int literals_usable(struct grep_opt *opt, int collect_hits)
+{
+	return opt->literals_nr && !collect_hits && !opt->invert &&
+		!opt->unmatch_name_only && !opt->pre_context;
+}
+
+/*
+ * Whether some pattern only applies to the header or the body of a
+ * commit, in which case no line may be skipped before the blank line
+ * that ends the header.
+ */
+static int context_matters(struct grep_opt *opt)
+{
+	struct grep_pat *p;
+
+	for (p = opt->pattern_list; p; p = p->next)
+		if (p->token != GREP_PATTERN)
+			return 1;
+	return 0;
+}
+
 static int grep_buffer_1(struct grep_opt *opt, const char *name,
 			 char *buf, unsigned long size, int collect_hits)
 {
@@ -458,6 +795,9 @@ static int grep_buffer_1(struct grep_opt *opt, const char *name,
 	const char *hunk_mark = "";
 	unsigned count = 0;
 	enum grep_context ctx = GREP_CONTEXT_HEAD;
+	int use_literals = literals_usable(opt, collect_hits);
+	int ctx_matters = use_literals && context_matters(opt);
+	char *candidate = NULL, *end = buf + size;
 
 	if (buffer_is_binary(buf, size)) {
 		switch (opt->binary) {
@@ -476,11 +816,39 @@ static int grep_buffer_1(struct grep_opt *opt, const char *name,
 		prev = xcalloc(opt->pre_context, sizeof(*prev));
 	if (opt->pre_context || opt->post_context)
 		hunk_mark = "--\n";
+	if (use_literals) {
+		int i;
+		for (i = 0; i < opt->literals_nr; i++)
+			opt->literals[i].pos = NULL;
+	}
 
 	while (left) {
 		char *eol, ch;
 		int hit;
 
+		/*
+		 * Skip to the line holding the next occurrence of one
+		 * of the literals; the lines before cannot match.
+		 */
+		if (use_literals &&
+		    (!ctx_matters || ctx == GREP_CONTEXT_BODY) &&
+		    !(last_hit && lno <= last_hit + opt->post_context)) {
+			char *cp;
+
+			if (!candidate || candidate < bol)
+				candidate = next_literal(opt, bol, end);
+			if (candidate == end)
+				break;
+			for (cp = candidate; bol < cp && cp[-1] != '\n'; cp--)
+				;
+			while (bol < cp) {
+				char *nl = memchr(bol, '\n', cp - bol);
+				left -= nl + 1 - bol;
+				bol = nl + 1;
+				lno++;
+			}
+		}
+
 		eol = end_of_line(bol, &left);
 		ch = *eol;
 		*eol = 0;
@@ -510,7 +878,7 @@ static int grep_buffer_1(struct grep_opt *opt, const char *name,
 			if (opt->status_only)
 				return 1;
 			if (binary_match_only) {
-				printf("Binary file %s matches\n", name);
+				output(opt, "Binary file %s matches\n", name);
 				return 1;
 			}
 			if (opt->name_only) {
@@ -532,7 +900,7 @@ static int grep_buffer_1(struct grep_opt *opt, const char *name,
 				if (from <= last_shown)
 					from = last_shown + 1;
 				if (last_shown && from != last_shown + 1)
-					fputs(hunk_mark, stdout);
+					output(opt, "%s", hunk_mark);
 				while (from < lno) {
 					pcl = &prev[lno-from-1];
 					show_line(opt, pcl->bol, pcl->eol,
@@ -542,7 +910,7 @@ static int grep_buffer_1(struct grep_opt *opt, const char *name,
 				last_shown = lno-1;
 			}
 			if (last_shown && lno != last_shown + 1)
-				fputs(hunk_mark, stdout);
+				output(opt, "%s", hunk_mark);
 			if (!opt->count)
 				show_line(opt, bol, eol, name, lno, ':');
 			last_shown = last_hit = lno;
@@ -553,7 +921,7 @@ static int grep_buffer_1(struct grep_opt *opt, const char *name,
 			 * we need to show this line.
 			 */
 			if (last_shown && lno != last_shown + 1)
-				fputs(hunk_mark, stdout);
+				output(opt, "%s", hunk_mark);
 			show_line(opt, bol, eol, name, lno, '-');
 			last_shown = lno;
 		}
@@ -590,7 +958,7 @@ static int grep_buffer_1(struct grep_opt *opt, const char *name,
 	 * make it another option?  For now suppress them.
 	 */
 	if (opt->count && count)
-		printf("%s%c%u\n", name,
+		output(opt, "%s%c%u\n", name,
 		       opt->null_following_name ? '\0' : ':', count);
 	return !!last_hit;
 }
@@ -53,6 +53,12 @@ struct grep_expr {
 	} u;
 };
 
+struct grep_literal {
+	char *s;
+	size_t len;
+	char *pos;	/* where it was last found in the buffer */
+};
+
 struct grep_opt {
 	struct grep_pat *pattern_list;
 	struct grep_pat **pattern_tail;
@@ -79,12 +85,18 @@ struct grep_opt {
 	int regflags;
 	unsigned pre_context;
 	unsigned post_context;
+	/* when set, results are appended here instead of going to stdout */
+	struct strbuf *output;
+	/* every matching line contains one of these */
+	struct grep_literal *literals;
+	int literals_nr, literals_alloc;
 };
 
 extern void append_grep_pattern(struct grep_opt *opt, const char *pat, const char *origin, int no, enum grep_pat_token t);
 extern void append_header_grep_pattern(struct grep_opt *, enum grep_header_field, const char *);
 extern void compile_grep_patterns(struct grep_opt *opt);
 extern void free_grep_patterns(struct grep_opt *opt);
+extern struct grep_opt *grep_opt_dup(const struct grep_opt *opt);
 extern int grep_buffer(struct grep_opt *opt, const char *name, char *buf, unsigned long size);
 
 #endif
@@ -33,19 +33,155 @@ static void hash_object(const char *path, const char *type, int write_object,
 	hash_fd(fd, type, write_object, vpath);
 }
 
+/*
+ * Without -w, the files named on stdin are hashed in batches with
+ * hash_sha1_files(), as long as more paths are ready to be read: a
+ * caller that waits for each answer before sending the next path
+ * still gets it right away.
+ */
+#define HASH_BATCH 8
+#define HASH_BATCH_SIZE (16 * 1024 * 1024)
+
+static struct strbuf input = STRBUF_INIT;
+static size_t input_pos;
+static int input_eof;
+
+static int more_input_ready(void)
+{
+	struct pollfd pfd;
+
+	if (input_pos < input.len || input_eof)
+		return 1;
+	pfd.fd = 0;
+	pfd.events = POLLIN;
+	return poll(&pfd, 1, 0) > 0;
+}
+
+static int read_path_line(struct strbuf *line)
+{
+	ssize_t len;
+
+	for (;;) {
+		char *eol = memchr(input.buf + input_pos, '\n',
+				   input.len - input_pos);
+		if (eol || (input_eof && input_pos < input.len)) {
+			size_t end = eol ? eol - input.buf : input.len;
+			strbuf_reset(line);
+			strbuf_add(line, input.buf + input_pos, end - input_pos);
+			input_pos = eol ? end + 1 : end;
+			return 0;
+		}
+		if (input_eof)
+			return EOF;
+		strbuf_remove(&input, 0, input_pos);
+		input_pos = 0;
+		strbuf_grow(&input, 8192);
+		len = xread(0, input.buf + input.len, 8192);
+		if (len < 0)
+			die("read error on input: %s", strerror(errno));
+		if (!len)
+			input_eof = 1;
+		strbuf_setlen(&input, input.len + len);
+	}
+}
+
+struct pending_file {
+	void *buf;
+	unsigned long size;
+	int mapped;
+};
+
+static struct pending_file pending[HASH_BATCH];
+static int nr_pending;
+static unsigned long pending_size;
+
+static void flush_pending(const char *type)
+{
+	const void *buf[HASH_BATCH];
+	unsigned long len[HASH_BATCH];
+	const char *types[HASH_BATCH];
+	unsigned char sha1[HASH_BATCH][20], *sha1p[HASH_BATCH];
+	int i;
+
+	for (i = 0; i < nr_pending; i++) {
+		buf[i] = pending[i].buf;
+		len[i] = pending[i].size;
+		types[i] = type;
+		sha1p[i] = sha1[i];
+	}
+	hash_sha1_files(nr_pending, buf, len, types, sha1p);
+	for (i = 0; i < nr_pending; i++) {
+		printf("%s\n", sha1_to_hex(sha1[i]));
+		if (pending[i].mapped)
+			munmap(pending[i].buf, pending[i].size);
+		else
+			free(pending[i].buf);
+	}
+	maybe_flush_or_die(stdout, "hash to stdout");
+	nr_pending = 0;
+	pending_size = 0;
+}
+
+/* Returns 0 if "path" is not a regular file and must be hashed alone */
+static int queue_path(const char *path, const char *type)
+{
+	struct pending_file *p = &pending[nr_pending];
+	struct strbuf nbuf = STRBUF_INIT;
+	enum object_type t = type_from_string(type);
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		die("Cannot open %s", path);
+	if (fstat(fd, &st) < 0)
+		die("Unable to hash %s", path);
+	if (!S_ISREG(st.st_mode)) {
+		close(fd);
+		return 0;
+	}
+	p->size = xsize_t(st.st_size);
+	p->buf = p->size ? xmmap(NULL, p->size, PROT_READ, MAP_PRIVATE, fd, 0)
+			 : NULL;
+	p->mapped = !!p->size;
+	close(fd);
+
+	if (t == OBJ_BLOB && convert_to_git(path, p->buf, p->size, &nbuf, 0)) {
+		size_t size;
+		if (p->mapped)
+			munmap(p->buf, p->size);
+		p->buf = strbuf_detach(&nbuf, &size);
+		p->size = size;
+		p->mapped = 0;
+	}
+	pending_size += p->size;
+	nr_pending++;
+	if (nr_pending == HASH_BATCH || pending_size >= HASH_BATCH_SIZE)
+		flush_pending(type);
+	return 1;
+}
+
 static void hash_stdin_paths(const char *type, int write_objects)
 {
 	struct strbuf buf = STRBUF_INIT, nbuf = STRBUF_INIT;
 
-	while (strbuf_getline(&buf, stdin, '\n') != EOF) {
+	while (read_path_line(&buf) != EOF) {
 		if (buf.buf[0] == '"') {
 			strbuf_reset(&nbuf);
 			if (unquote_c_style(&nbuf, buf.buf, NULL))
 				die("line is badly quoted");
 			strbuf_swap(&buf, &nbuf);
 		}
-		hash_object(buf.buf, type, write_objects, buf.buf);
+		if (write_objects || !queue_path(buf.buf, type)) {
+			if (nr_pending)
+				flush_pending(type);
+			hash_object(buf.buf, type, write_objects, buf.buf);
+		}
+		if (nr_pending && !more_input_ready())
+			flush_pending(type);
 	}
+	if (nr_pending)
+		flush_pending(type);
 	strbuf_release(&buf);
 	strbuf_release(&nbuf);
 }
@@ -1863,12 +1863,22 @@ static void unmark_and_free(struct commit_list *list, unsigned int mark)
 	}
 }
 
+static void unmark_and_clear(struct commit_queue *queue, unsigned int mark)
+{
+	int i;
+
+	for (i = 0; i < queue->nr; i++)
+		queue->array[i].commit->object.flags &= ~mark;
+	clear_commit_queue(queue);
+}
+
 static int ref_newer(const unsigned char *new_sha1,
 		     const unsigned char *old_sha1)
 {
 	struct object *o;
 	struct commit *old, *new;
-	struct commit_list *list, *used;
+	struct commit_queue queue = { NULL };
+	struct commit_list *used = NULL;
 	int found = 0;
 
 	/* Both new and old must be commit-ish and new is descendant of
@@ -1887,17 +1897,16 @@ static int ref_newer(const unsigned char *new_sha1,
 	if (parse_commit(new) < 0)
 		return 0;
 
-	used = list = NULL;
-	commit_list_insert(new, &list);
-	while (list) {
-		new = pop_most_recent_commit(&list, TMP_MARK);
+	commit_queue_put(&queue, new);
+	while (queue.nr) {
+		new = pop_most_recent_commit(&queue, TMP_MARK);
 		commit_list_insert(new, &used);
 		if (new == old) {
 			found = 1;
 			break;
 		}
 	}
-	unmark_and_free(list, TMP_MARK);
+	unmark_and_clear(&queue, TMP_MARK);
 	unmark_and_free(used, TMP_MARK);
 	return found;
 }
@@ -10,8 +10,13 @@
 #include "fsck.h"
 #include "exec_cmd.h"
 
+#ifdef THREADED_DELTA_SEARCH
+#include "thread-utils.h"
+#include <pthread.h>
+#endif
+
 static const char index_pack_usage[] =
-"git index-pack [-v] [-o <index-file>] [{ ---keep | --keep=<msg> }] [--strict] { <pack-file> | --stdin [--fix-thin] [<pack-file>] }";
+"git index-pack [-v] [-o <index-file>] [{ ---keep | --keep=<msg> }] [--strict] [--threads=<n>] { <pack-file> | --stdin [--fix-thin] [<pack-file>] }";
 
 struct object_entry
 {
@@ -50,18 +55,85 @@ struct delta_entry
 	int obj_no;
 };
 
+/*
+ * What each delta resolving thread keeps to itself: the chain of
+ * base objects it is currently expanding, and a zlib stream that is
+ * reset rather than set up anew for every object.
+ */
+struct thread_local {
+#ifdef THREADED_DELTA_SEARCH
+	pthread_t thread;
+#endif
+	struct base_data *base_cache;
+	z_stream stream;
+	int stream_ready;
+};
+
 static struct object_entry *objects;
 static struct delta_entry *deltas;
-static struct base_data *base_cache;
+static struct thread_local nothread_data;
 static size_t base_cache_used;
 static int nr_objects;
 static int nr_deltas;
 static int nr_resolved_deltas;
+static int nr_threads;
 
 static int from_stdin;
 static int strict;
 static int verbose;
 
+#ifdef THREADED_DELTA_SEARCH
+
+static struct thread_local *thread_data;
+static int nr_dispatched;
+static int threads_active;
+static pthread_key_t key;
+
+/* the object database, the object hash and fsck */
+static pthread_mutex_t read_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* nr_resolved_deltas and the progress meter */
+static pthread_mutex_t counter_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* handing out base objects, claiming their deltas, base_cache_used */
+static pthread_mutex_t work_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static inline void lock_mutex(pthread_mutex_t *mutex)
+{
+	if (threads_active)
+		pthread_mutex_lock(mutex);
+}
+
+static inline void unlock_mutex(pthread_mutex_t *mutex)
+{
+	if (threads_active)
+		pthread_mutex_unlock(mutex);
+}
+
+#define read_lock()		lock_mutex(&read_mutex)
+#define read_unlock()		unlock_mutex(&read_mutex)
+#define counter_lock()		lock_mutex(&counter_mutex)
+#define counter_unlock()	unlock_mutex(&counter_mutex)
+#define work_lock()		lock_mutex(&work_mutex)
+#define work_unlock()		unlock_mutex(&work_mutex)
+
+static inline struct thread_local *get_thread_data(void)
+{
+	if (threads_active)
+		return pthread_getspecific(key);
+	return &nothread_data;
+}
+
+#else
+
+#define read_lock()		(void)0
+#define read_unlock()		(void)0
+#define counter_lock()		(void)0
+#define counter_unlock()	(void)0
+#define work_lock()		(void)0
+#define work_unlock()		(void)0
+#define get_thread_data()	(&nothread_data)
+
+#endif
+
 static struct progress *progress;
 
 /* We always read in 4kB chunks. */
@@ -222,20 +294,42 @@ static void bad_object(unsigned long offset, const char *format, ...)
 	die("pack has bad object at offset %lu: %s", offset, buf);
 }
 
+static void account_base_data(long size)
+{
+	work_lock();
+	base_cache_used += size;
+	work_unlock();
+}
+
+static int base_cache_over_limit(void)
+{
+	int ret;
+
+	work_lock();
+	ret = base_cache_used > delta_base_cache_limit;
+	work_unlock();
+	return ret;
+}
+
 static void free_base_data(struct base_data *c)
 {
 	if (c->data) {
 		free(c->data);
 		c->data = NULL;
-		base_cache_used -= c->size;
+		account_base_data(-(long)c->size);
 	}
 }
 
+/*
+ * The budget of delta_base_cache_limit is shared by all threads; a
+ * thread over it can only give back the bases of its own chain.
+ */
 static void prune_base_data(struct base_data *retain)
 {
-	struct base_data *b = base_cache;
-	for (b = base_cache;
-	     base_cache_used > delta_base_cache_limit && b;
+	struct base_data *b;
+
+	for (b = get_thread_data()->base_cache;
+	     b && base_cache_over_limit();
 	     b = b->child) {
 		if (b->data && b != retain)
 			free_base_data(b);
@@ -247,12 +341,12 @@ static void link_base_data(struct base_data *base, struct base_data *c)
 	if (base)
 		base->child = c;
 	else
-		base_cache = c;
+		get_thread_data()->base_cache = c;
 
 	c->base = base;
 	c->child = NULL;
 	if (c->data)
-		base_cache_used += c->size;
+		account_base_data(c->size);
 	prune_base_data(c);
 }
 
@@ -262,7 +356,7 @@ static void unlink_base_data(struct base_data *c)
 	if (base)
 		base->child = NULL;
 	else
-		base_cache = NULL;
+		get_thread_data()->base_cache = NULL;
 	free_base_data(c);
 }
 
@@ -363,7 +457,8 @@ static void *get_data_from_pack(struct object_entry *obj)
 	unsigned long len = obj[1].idx.offset - from;
 	unsigned long rdy = 0;
 	unsigned char *src, *data;
-	z_stream stream;
+	struct thread_local *tl = get_thread_data();
+	z_stream *stream = &tl->stream;
 	int st;
 
 	src = xmalloc(len);
@@ -378,15 +473,18 @@ static void *get_data_from_pack(struct object_entry *obj)
 		rdy += n;
 	} while (rdy < len);
 	data = xmalloc(obj->size);
-	memset(&stream, 0, sizeof(stream));
-	stream.next_out = data;
-	stream.avail_out = obj->size;
-	stream.next_in = src;
-	stream.avail_in = len;
-	git_inflate_init(&stream);
-	while ((st = git_inflate(&stream, Z_FINISH)) == Z_OK);
-	git_inflate_end(&stream);
-	if (st != Z_STREAM_END || stream.total_out != obj->size)
+	if (!tl->stream_ready) {
+		memset(stream, 0, sizeof(*stream));
+		git_inflate_init(stream);
+		tl->stream_ready = 1;
+	} else
+		inflateReset(stream);
+	stream->next_out = data;
+	stream->avail_out = obj->size;
+	stream->next_in = src;
+	stream->avail_in = len;
+	while ((st = git_inflate(stream, Z_FINISH)) == Z_OK);
+	if (st != Z_STREAM_END || stream->total_out != obj->size)
 		die("serious inflate inconsistency");
 	free(src);
 	return data;
@@ -433,10 +531,11 @@ static void find_delta_children(const union delta_base *base,
 	*last_index = last;
 }
 
-static void sha1_object(const void *data, unsigned long size,
-			enum object_type type, unsigned char *sha1)
+/* Check an object whose name "sha1" has been computed already */
+static void check_object_data(const void *data, unsigned long size,
+			      enum object_type type, unsigned char *sha1)
 {
-	hash_sha1_file(data, size, typename(type), sha1);
+	read_lock();
 	if (has_sha1_file(sha1)) {
 		void *has_data;
 		enum object_type has_type;
@@ -484,6 +583,63 @@ static void sha1_object(const void *data, unsigned long size,
 			obj->flags |= FLAG_CHECKED;
 		}
 	}
+	read_unlock();
+}
+
+static void sha1_object(const void *data, unsigned long size,
+			enum object_type type, unsigned char *sha1)
+{
+	hash_sha1_file(data, size, typename(type), sha1);
+	check_object_data(data, size, type, sha1);
+}
+
+/*
+ * The non-delta objects of the first pass are hashed a few at a time,
+ * which lets the SHA-1 implementation work on several at once.
+ */
+#define HASH_BATCH 8
+#define HASH_BATCH_SIZE (8 * 1024 * 1024)
+
+static struct object_entry *hash_pending[HASH_BATCH];
+static void *hash_pending_data[HASH_BATCH];
+static int nr_hash_pending;
+static unsigned long hash_pending_size;
+
+static void flush_hash_pending(void)
+{
+	const void *buf[HASH_BATCH];
+	unsigned long len[HASH_BATCH];
+	const char *type[HASH_BATCH];
+	unsigned char *sha1[HASH_BATCH];
+	int i;
+
+	for (i = 0; i < nr_hash_pending; i++) {
+		struct object_entry *obj = hash_pending[i];
+		buf[i] = hash_pending_data[i];
+		len[i] = obj->size;
+		type[i] = typename(obj->type);
+		sha1[i] = obj->idx.sha1;
+	}
+	hash_sha1_files(nr_hash_pending, buf, len, type, sha1);
+	for (i = 0; i < nr_hash_pending; i++) {
+		struct object_entry *obj = hash_pending[i];
+		check_object_data(hash_pending_data[i], obj->size, obj->type,
+				  obj->idx.sha1);
+		free(hash_pending_data[i]);
+	}
+	nr_hash_pending = 0;
+	hash_pending_size = 0;
+}
+
+static void queue_sha1_object(struct object_entry *obj, void *data)
+{
+	hash_pending[nr_hash_pending] = obj;
+	hash_pending_data[nr_hash_pending] = data;
+	nr_hash_pending++;
+	hash_pending_size += obj->size;
+	if (nr_hash_pending == HASH_BATCH ||
+	    hash_pending_size >= HASH_BATCH_SIZE)
+		flush_hash_pending();
 }
 
 static void *get_base_data(struct base_data *c)
@@ -506,7 +662,7 @@ static void *get_base_data(struct base_data *c)
 			c->size = obj->size;
 		}
 
-		base_cache_used += c->size;
+		account_base_data(c->size);
 		prune_base_data(c);
 	}
 	return c->data;
@@ -517,7 +673,6 @@ static void resolve_delta(struct object_entry *delta_obj,
 {
 	void *base_data, *delta_data;
 
-	delta_obj->real_type = base->obj->real_type;
 	delta_data = get_data_from_pack(delta_obj);
 	base_data = get_base_data(base);
 	result->obj = delta_obj;
@@ -528,7 +683,27 @@ static void resolve_delta(struct object_entry *delta_obj,
 		bad_object(delta_obj->idx.offset, "failed to apply delta");
 	sha1_object(result->data, result->size, delta_obj->real_type,
 		    delta_obj->idx.sha1);
+	counter_lock();
 	nr_resolved_deltas++;
+	counter_unlock();
+}
+
+/*
+ * Take the delta for resolving against base, unless it has been
+ * resolved already (against another copy of the same base object).
+ */
+static int claim_delta(struct object_entry *child, enum object_type type,
+		       struct base_data *base)
+{
+	int ret = 0;
+
+	work_lock();
+	if (child->real_type == type) {
+		child->real_type = base->obj->real_type;
+		ret = 1;
+	}
+	work_unlock();
+	return ret;
 }
 
 static void find_unresolved_deltas(struct base_data *base,
@@ -560,7 +735,7 @@ static void find_unresolved_deltas(struct base_data *base,
 
 	for (i = ref_first; i <= ref_last; i++) {
 		struct object_entry *child = objects + deltas[i].obj_no;
-		if (child->real_type == OBJ_REF_DELTA) {
+		if (claim_delta(child, OBJ_REF_DELTA, base)) {
 			struct base_data result;
 			resolve_delta(child, base, &result);
 			if (i == ref_last && ofs_last == -1)
@@ -571,7 +746,7 @@ static void find_unresolved_deltas(struct base_data *base,
 
 	for (i = ofs_first; i <= ofs_last; i++) {
 		struct object_entry *child = objects + deltas[i].obj_no;
-		if (child->real_type == OBJ_OFS_DELTA) {
+		if (claim_delta(child, OBJ_OFS_DELTA, base)) {
 			struct base_data result;
 			resolve_delta(child, base, &result);
 			if (i == ofs_last)
@@ -583,6 +758,77 @@ static void find_unresolved_deltas(struct base_data *base,
 	unlink_base_data(base);
 }
 
+static int is_delta_type(enum object_type type)
+{
+	return type == OBJ_REF_DELTA || type == OBJ_OFS_DELTA;
+}
+
+/* Resolve all the deltas that have obj at the root of their chain. */
+static void resolve_base(struct object_entry *obj)
+{
+	struct base_data base_obj;
+
+	base_obj.obj = obj;
+	base_obj.data = NULL;
+	find_unresolved_deltas(&base_obj, NULL);
+	counter_lock();
+	display_progress(progress, nr_resolved_deltas);
+	counter_unlock();
+}
+
+#ifdef THREADED_DELTA_SEARCH
+static void *threaded_second_pass(void *arg)
+{
+	struct thread_local *data = arg;
+
+	pthread_setspecific(key, data);
+	for (;;) {
+		int i;
+
+		work_lock();
+		while (nr_dispatched < nr_objects &&
+		       is_delta_type(objects[nr_dispatched].type))
+			nr_dispatched++;
+		if (nr_dispatched >= nr_objects) {
+			work_unlock();
+			break;
+		}
+		i = nr_dispatched++;
+		work_unlock();
+
+		resolve_base(&objects[i]);
+	}
+	if (data->stream_ready)
+		git_inflate_end(&data->stream);
+	return NULL;
+}
+
+/*
+ * The delta trees hanging off different base objects are independent,
+ * so hand the bases out to a pool of threads.  The resulting index is
+ * the same whatever order they are resolved in.
+ */
+static void resolve_deltas_threaded(void)
+{
+	int i, ret;
+
+	thread_data = xcalloc(nr_threads, sizeof(*thread_data));
+	pthread_key_create(&key, NULL);
+	threads_active = 1;
+	for (i = 0; i < nr_threads; i++) {
+		ret = pthread_create(&thread_data[i].thread, NULL,
+				     threaded_second_pass, thread_data + i);
+		if (ret)
+			die("unable to create thread: %s", strerror(ret));
+	}
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(thread_data[i].thread, NULL);
+	threads_active = 0;
+	pthread_key_delete(key);
+	free(thread_data);
+}
+#endif
+
 static int compare_delta_entry(const void *a, const void *b)
 {
 	const struct delta_entry *delta_a = a;
@@ -615,11 +861,12 @@ static void parse_pack_objects(unsigned char *sha1)
 			nr_deltas++;
 			delta->obj_no = i;
 			delta++;
+			free(data);
 		} else
-			sha1_object(data, obj->size, obj->type, obj->idx.sha1);
-		free(data);
+			queue_sha1_object(obj, data);
 		display_progress(progress, i+1);
 	}
+	flush_hash_pending();
 	objects[i].idx.offset = consumed_bytes;
 	stop_progress(&progress);
 
@@ -654,16 +901,18 @@ static void parse_pack_objects(unsigned char *sha1)
 	 */
 	if (verbose)
 		progress = start_progress("Resolving deltas", nr_deltas);
+#ifdef THREADED_DELTA_SEARCH
+	if (nr_threads > 1) {
+		resolve_deltas_threaded();
+		return;
+	}
+#endif
 	for (i = 0; i < nr_objects; i++) {
 		struct object_entry *obj = &objects[i];
-		struct base_data base_obj;
 
-		if (obj->type == OBJ_REF_DELTA || obj->type == OBJ_OFS_DELTA)
+		if (is_delta_type(obj->type))
 			continue;
-		base_obj.obj = obj;
-		base_obj.data = NULL;
-		find_unresolved_deltas(&base_obj, NULL);
-		display_progress(progress, nr_resolved_deltas);
+		resolve_base(obj);
 	}
 }
 
@@ -861,6 +1110,18 @@ static void final(const char *final_pack_name, const char *curr_pack_name,
 
 static int git_index_pack_config(const char *k, const char *v, void *cb)
 {
+	if (!strcmp(k, "pack.threads")) {
+		nr_threads = git_config_int(k, v);
+		if (nr_threads < 0)
+			die("invalid number of threads specified (%d)",
+			    nr_threads);
+#ifndef THREADED_DELTA_SEARCH
+		if (nr_threads != 1)
+			warning("no threads support, ignoring %s", k);
+		nr_threads = 1;
+#endif
+		return 0;
+	}
 	if (!strcmp(k, "pack.indexversion")) {
 		pack_idx_default_version = git_config_int(k, v);
 		if (pack_idx_default_version > 2)
@@ -932,6 +1193,17 @@ int main(int argc, char **argv)
 				input_len = sizeof(*hdr);
 			} else if (!strcmp(arg, "-v")) {
 				verbose = 1;
+			} else if (!prefixcmp(arg, "--threads=")) {
+				char *end;
+				nr_threads = strtoul(arg+10, &end, 0);
+				if (!arg[10] || *end || nr_threads < 0)
+					usage(index_pack_usage);
+#ifndef THREADED_DELTA_SEARCH
+				if (nr_threads != 1)
+					warning("no threads support, "
+						"ignoring %s", arg);
+				nr_threads = 1;
+#endif
 			} else if (!strcmp(arg, "-o")) {
 				if (index_name || (i+1) >= argc)
 					usage(index_pack_usage);
@@ -980,6 +1252,11 @@ int main(int argc, char **argv)
 		keep_name = keep_name_buf;
 	}
 
+#ifdef THREADED_DELTA_SEARCH
+	if (!nr_threads)	/* --threads=0 means autodetect */
+		nr_threads = online_cpus();
+#endif
+
 	curr_pack = open_pack_file(pack_name);
 	parse_pack_header();
 	objects = xmalloc((nr_objects + 1) * sizeof(struct object_entry));
@@ -1019,6 +1296,8 @@ int main(int argc, char **argv)
 			die("pack has %d unresolved deltas",
 			    nr_deltas - nr_resolved_deltas);
 	}
+	if (nothread_data.stream_ready)
+		git_inflate_end(&nothread_data.stream);
 	free(deltas);
 	if (strict)
 		check_objects();
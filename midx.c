@@ -0,0 +1,580 @@
+#include "cache.h"
+#include "csum-file.h"
+#include "midx.h"
+
+#define MIDX_SIGNATURE 0x4d494458 /* "MIDX" */
+#define MIDX_VERSION 1
+#define MIDX_HASH_VERSION 1 /* SHA-1 */
+
+#define MIDX_CHUNKID_PACKNAMES 0x504e414d /* "PNAM" */
+#define MIDX_CHUNKID_OIDFANOUT 0x4f494446 /* "OIDF" */
+#define MIDX_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
+#define MIDX_CHUNKID_OBJECTOFFSETS 0x4f4f4646 /* "OOFF" */
+#define MIDX_CHUNKID_LARGEOFFSETS 0x4c4f4646 /* "LOFF" */
+
+#define MIDX_HEADER_SIZE 12
+#define MIDX_CHUNKLOOKUP_WIDTH 12
+#define MIDX_FANOUT_SIZE (4 * 256)
+#define MIDX_OFFSET_WIDTH 8
+#define MIDX_LARGE_OFFSET_NEEDED 0x80000000
+
+struct multi_pack_index {
+	const unsigned char *data;
+	size_t data_len;
+
+	uint32_t num_packs;
+	uint32_t num_objects;
+	const uint32_t *chunk_oid_fanout;
+	const unsigned char *chunk_oid_lookup;
+	const uint32_t *chunk_object_offsets;
+	const uint32_t *chunk_large_offsets;
+	uint32_t num_large_offsets;
+
+	const char **pack_names;
+	struct packed_git **packs;	/* NULL for the packs that are gone */
+};
+
+static struct multi_pack_index *midx;
+
+static char *get_midx_filename(void)
+{
+	return git_path("objects/pack/multi-pack-index");
+}
+
+static uint64_t get_be64(const void *ptr)
+{
+	const uint32_t *p = ptr;
+	return ((uint64_t)ntohl(p[0]) << 32) | ntohl(p[1]);
+}
+
+static void free_midx(struct multi_pack_index *m)
+{
+	munmap((void *)m->data, m->data_len);
+	free(m->pack_names);
+	free(m->packs);
+	free(m);
+}
+
+static struct multi_pack_index *load_midx_one(const char *path)
+{
+	struct multi_pack_index *m;
+	const unsigned char *data, *chunk_lookup, *names = NULL;
+	size_t len, names_len = 0;
+	uint32_t i, nr = 0, num_chunks;
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+	len = xsize_t(st.st_size);
+	if (len < MIDX_HEADER_SIZE + MIDX_CHUNKLOOKUP_WIDTH + 20) {
+		close(fd);
+		error("multi-pack-index file %s is too small", path);
+		return NULL;
+	}
+	data = xmmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	m = xcalloc(1, sizeof(*m));
+	m->data = data;
+	m->data_len = len;
+
+	if (ntohl(*(uint32_t *)data) != MIDX_SIGNATURE) {
+		error("multi-pack-index file %s has a bad signature", path);
+		goto bad;
+	}
+	if (data[4] != MIDX_VERSION || data[5] != MIDX_HASH_VERSION) {
+		error("multi-pack-index file %s is version %d/%d and is not"
+		      " supported by this binary", path, data[4], data[5]);
+		goto bad;
+	}
+	num_chunks = data[6];
+	m->num_packs = ntohl(*(uint32_t *)(data + 8));
+	if (len < MIDX_HEADER_SIZE +
+		  (num_chunks + 1) * MIDX_CHUNKLOOKUP_WIDTH + 20) {
+		error("multi-pack-index file %s is truncated", path);
+		goto bad;
+	}
+
+	chunk_lookup = data + MIDX_HEADER_SIZE;
+	for (i = 0; i < num_chunks; i++) {
+		uint32_t id = ntohl(*(uint32_t *)chunk_lookup);
+		uint64_t offset = get_be64(chunk_lookup + 4);
+		uint64_t next = get_be64(chunk_lookup + 4 + MIDX_CHUNKLOOKUP_WIDTH);
+		uint64_t size;
+
+		chunk_lookup += MIDX_CHUNKLOOKUP_WIDTH;
+		if (offset > next || next > len - 20 || (offset & 3)) {
+			error("multi-pack-index file %s has an invalid chunk"
+			      " offset", path);
+			goto bad;
+		}
+		size = next - offset;
+		switch (id) {
+		case MIDX_CHUNKID_PACKNAMES:
+			names = data + offset;
+			names_len = size;
+			break;
+		case MIDX_CHUNKID_OIDFANOUT:
+			if (size != MIDX_FANOUT_SIZE)
+				goto bad_chunk;
+			m->chunk_oid_fanout = (const uint32_t *)(data + offset);
+			break;
+		case MIDX_CHUNKID_OIDLOOKUP:
+			if (size % 20)
+				goto bad_chunk;
+			m->chunk_oid_lookup = data + offset;
+			nr = size / 20;
+			break;
+		case MIDX_CHUNKID_OBJECTOFFSETS:
+			m->chunk_object_offsets = (const uint32_t *)(data + offset);
+			break;
+		case MIDX_CHUNKID_LARGEOFFSETS:
+			if (size % 8)
+				goto bad_chunk;
+			m->chunk_large_offsets = (const uint32_t *)(data + offset);
+			m->num_large_offsets = size / 8;
+			break;
+		}
+		continue;
+	bad_chunk:
+		error("multi-pack-index file %s has a chunk of bad size", path);
+		goto bad;
+	}
+
+	if (!names || !m->chunk_oid_fanout || !m->chunk_oid_lookup ||
+	    !m->chunk_object_offsets) {
+		error("multi-pack-index file %s is missing a required chunk",
+		      path);
+		goto bad;
+	}
+	for (i = 0; i < 256; i++) {
+		uint32_t n = ntohl(m->chunk_oid_fanout[i]);
+		if (n < m->num_objects) {
+			error("multi-pack-index file %s has a non-monotonic"
+			      " fanout table", path);
+			goto bad;
+		}
+		m->num_objects = n;
+	}
+	if (m->num_objects != nr ||
+	    (const unsigned char *)m->chunk_object_offsets +
+	    (size_t)nr * MIDX_OFFSET_WIDTH > data + len - 20) {
+		error("multi-pack-index file %s has inconsistent chunk sizes",
+		      path);
+		goto bad;
+	}
+
+	m->pack_names = xcalloc(m->num_packs, sizeof(*m->pack_names));
+	m->packs = xcalloc(m->num_packs, sizeof(*m->packs));
+	for (i = 0; i < m->num_packs; i++) {
+		const unsigned char *end = memchr(names, '\0', names_len);
+
+		if (!end || end == names) {
+			error("multi-pack-index file %s has bad pack names",
+			      path);
+			goto bad;
+		}
+		m->pack_names[i] = (const char *)names;
+		names_len -= end + 1 - names;
+		names = end + 1;
+		if (i && strcmp(m->pack_names[i - 1], m->pack_names[i]) >= 0) {
+			error("multi-pack-index file %s has unsorted pack"
+			      " names", path);
+			goto bad;
+		}
+	}
+	return m;
+
+bad:
+	free_midx(m);
+	return NULL;
+}
+
+/*
+ * The length of the name of a pack without its directory and
+ * extension, e.g. "pack-1234...", stored at *base.
+ */
+static int pack_basename(const char *path, const char **base)
+{
+	const char *slash = strrchr(path, '/');
+	const char *dot;
+
+	*base = slash ? slash + 1 : path;
+	dot = strrchr(*base, '.');
+	return dot ? dot - *base : strlen(*base);
+}
+
+static int midx_pack_pos(struct multi_pack_index *m, struct packed_git *p)
+{
+	const char *base;
+	int len = pack_basename(p->pack_name, &base);
+	int lo = 0, hi = m->num_packs;
+
+	while (lo < hi) {
+		int mi = lo + (hi - lo) / 2;
+		int cmp = strncmp(m->pack_names[mi], base, len);
+		if (!cmp)
+			cmp = strcmp(m->pack_names[mi] + len, ".idx");
+		if (!cmp)
+			return mi;
+		if (cmp > 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return -1;
+}
+
+void prepare_multi_pack_index(void)
+{
+	struct packed_git *p;
+
+	if (midx || !core_multi_pack_index)
+		return;
+	midx = load_midx_one(get_midx_filename());
+	if (!midx)
+		return;
+	for (p = packed_git; p; p = p->next) {
+		int pos;
+
+		if (!p->pack_local)
+			continue;
+		pos = midx_pack_pos(midx, p);
+		if (pos < 0)
+			continue;
+		midx->packs[pos] = p;
+		p->pack_midx = 1;
+	}
+}
+
+void close_multi_pack_index(void)
+{
+	struct packed_git *p;
+
+	if (!midx)
+		return;
+	for (p = packed_git; p; p = p->next)
+		p->pack_midx = 0;
+	free_midx(midx);
+	midx = NULL;
+}
+
+struct multi_pack_index *get_multi_pack_index(void)
+{
+	prepare_packed_git();
+	return midx;
+}
+
+uint32_t midx_num_objects(struct multi_pack_index *m)
+{
+	return m->num_objects;
+}
+
+const unsigned char *nth_midxed_object_sha1(struct multi_pack_index *m,
+					    uint32_t n)
+{
+	if (n >= m->num_objects)
+		return NULL;
+	return m->chunk_oid_lookup + 20 * n;
+}
+
+int bsearch_midx(struct multi_pack_index *m, const unsigned char *sha1,
+		 uint32_t *pos)
+{
+	uint32_t lo, hi;
+
+	lo = sha1[0] ? ntohl(m->chunk_oid_fanout[sha1[0] - 1]) : 0;
+	hi = ntohl(m->chunk_oid_fanout[sha1[0]]);
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(m->chunk_oid_lookup + 20 * mi, sha1);
+		if (!cmp) {
+			if (pos)
+				*pos = mi;
+			return 1;
+		}
+		if (cmp > 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	if (pos)
+		*pos = lo;
+	return 0;
+}
+
+static off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t n,
+			       uint32_t *pack_pos)
+{
+	const uint32_t *entry = m->chunk_object_offsets + 2 * n;
+	uint32_t off = ntohl(entry[1]);
+
+	*pack_pos = ntohl(entry[0]);
+	if (*pack_pos >= m->num_packs)
+		die("multi-pack-index has a bad pack position");
+	if (!(off & MIDX_LARGE_OFFSET_NEEDED))
+		return off;
+	off &= ~MIDX_LARGE_OFFSET_NEEDED;
+	if (off >= m->num_large_offsets)
+		die("multi-pack-index has a bad large offset");
+	return get_be64(m->chunk_large_offsets + 2 * off);
+}
+
+int find_midx_entry(struct multi_pack_index *m, const unsigned char *sha1,
+		    struct packed_git **pack, off_t *offset)
+{
+	uint32_t pos, pack_pos;
+
+	if (!bsearch_midx(m, sha1, &pos))
+		return 0;
+	*offset = nth_midxed_offset(m, pos, &pack_pos);
+	*pack = m->packs[pack_pos];
+	return 1;
+}
+
+int read_multi_pack_index_info(struct multi_pack_index_info *info)
+{
+	struct multi_pack_index *m = get_multi_pack_index();
+
+	if (!m)
+		return -1;
+	info->num_packs = m->num_packs;
+	info->num_objects = m->num_objects;
+	info->has_large_offsets = !!m->chunk_large_offsets;
+	info->pack_names = m->pack_names;
+	return 0;
+}
+
+/*
+ * Writing
+ */
+struct midx_entry {
+	unsigned char sha1[20];
+	uint32_t pack_pos;
+	off_t offset;
+	time_t mtime;	/* of the pack, to prefer the newest copy */
+};
+
+struct midx_pack {
+	struct packed_git *p;
+	char *name;
+};
+
+static int midx_pack_cmp(const void *a_, const void *b_)
+{
+	const struct midx_pack *a = a_, *b = b_;
+	return strcmp(a->name, b->name);
+}
+
+static int midx_entry_cmp(const void *a_, const void *b_)
+{
+	const struct midx_entry *a = a_, *b = b_;
+	int cmp = hashcmp(a->sha1, b->sha1);
+
+	if (cmp)
+		return cmp;
+	/* newest pack first, as in sort_pack() */
+	if (a->mtime != b->mtime)
+		return a->mtime < b->mtime ? 1 : -1;
+	return (int)a->pack_pos - (int)b->pack_pos;
+}
+
+static void add_midx_entry(struct midx_entry **entries, uint32_t *nr,
+			   uint32_t *alloc, const unsigned char *sha1,
+			   uint32_t pack_pos, off_t offset, time_t mtime)
+{
+	struct midx_entry *e;
+
+	ALLOC_GROW(*entries, *nr + 1, *alloc);
+	e = &(*entries)[(*nr)++];
+	hashcpy(e->sha1, sha1);
+	e->pack_pos = pack_pos;
+	e->offset = offset;
+	e->mtime = mtime;
+}
+
+static void sha1write_be32(struct sha1file *f, uint32_t value)
+{
+	value = htonl(value);
+	sha1write(f, &value, 4);
+}
+
+static struct lock_file midx_lock;
+
+int write_multi_pack_index(void)
+{
+	struct multi_pack_index *m;
+	struct midx_pack *packs = NULL;
+	struct midx_entry *entries = NULL;
+	uint32_t nr_packs = 0, alloc_packs = 0, nr = 0, alloc = 0;
+	uint32_t i, j, num_large_offsets = 0, *old_to_new = NULL;
+	uint32_t chunk_ids[6];
+	uint64_t chunk_offsets[6];
+	size_t names_len = 0;
+	int num_chunks, fd, reuse;
+	struct sha1file *f;
+	struct packed_git *p;
+	char *path;
+
+	m = get_multi_pack_index();
+	for (p = packed_git; p; p = p->next) {
+		const char *base;
+		int len;
+
+		if (!p->pack_local)
+			continue;
+		ALLOC_GROW(packs, nr_packs + 1, alloc_packs);
+		len = pack_basename(p->pack_name, &base);
+		packs[nr_packs].p = p;
+		packs[nr_packs].name = xmalloc(len + 5);
+		memcpy(packs[nr_packs].name, base, len);
+		strcpy(packs[nr_packs].name + len, ".idx");
+		names_len += len + 5;
+		nr_packs++;
+	}
+	qsort(packs, nr_packs, sizeof(*packs), midx_pack_cmp);
+
+	/*
+	 * The current file only records one copy of each object, so it
+	 * can only stand in for the indexes of its packs if none of them
+	 * is gone.
+	 */
+	reuse = !!m;
+	for (i = 0; reuse && i < m->num_packs; i++)
+		if (!m->packs[i])
+			reuse = 0;
+	if (reuse) {
+		old_to_new = xmalloc(m->num_packs * sizeof(*old_to_new));
+		for (i = 0; i < nr_packs; i++)
+			if (packs[i].p->pack_midx)
+				old_to_new[midx_pack_pos(m, packs[i].p)] = i;
+		for (i = 0; i < m->num_objects; i++) {
+			uint32_t pack_pos;
+			off_t offset = nth_midxed_offset(m, i, &pack_pos);
+			add_midx_entry(&entries, &nr, &alloc,
+				       nth_midxed_object_sha1(m, i),
+				       old_to_new[pack_pos], offset,
+				       m->packs[pack_pos]->mtime);
+		}
+		free(old_to_new);
+	}
+	for (i = 0; i < nr_packs; i++) {
+		p = packs[i].p;
+		if (reuse && p->pack_midx)
+			continue;
+		if (open_pack_index(p)) {
+			error("cannot open index for %s", p->pack_name);
+			goto fail;
+		}
+		for (j = 0; j < p->num_objects; j++)
+			add_midx_entry(&entries, &nr, &alloc,
+				       nth_packed_object_sha1(p, j), i,
+				       nth_packed_object_offset(p, j),
+				       p->mtime);
+	}
+
+	qsort(entries, nr, sizeof(*entries), midx_entry_cmp);
+	for (i = 0, j = 0; i < nr; i++) {
+		if (j && !hashcmp(entries[j - 1].sha1, entries[i].sha1))
+			continue;
+		entries[j++] = entries[i];
+	}
+	nr = j;
+	for (i = 0; i < nr; i++)
+		if (entries[i].offset >= MIDX_LARGE_OFFSET_NEEDED)
+			num_large_offsets++;
+
+	chunk_ids[0] = MIDX_CHUNKID_PACKNAMES;
+	chunk_ids[1] = MIDX_CHUNKID_OIDFANOUT;
+	chunk_ids[2] = MIDX_CHUNKID_OIDLOOKUP;
+	chunk_ids[3] = MIDX_CHUNKID_OBJECTOFFSETS;
+	num_chunks = 4;
+	if (num_large_offsets)
+		chunk_ids[num_chunks++] = MIDX_CHUNKID_LARGEOFFSETS;
+	chunk_ids[num_chunks] = 0;
+
+	names_len = (names_len + 3) & ~3;
+	chunk_offsets[0] = MIDX_HEADER_SIZE +
+		(num_chunks + 1) * MIDX_CHUNKLOOKUP_WIDTH;
+	chunk_offsets[1] = chunk_offsets[0] + names_len;
+	chunk_offsets[2] = chunk_offsets[1] + MIDX_FANOUT_SIZE;
+	chunk_offsets[3] = chunk_offsets[2] + 20 * (uint64_t)nr;
+	chunk_offsets[4] = chunk_offsets[3] + MIDX_OFFSET_WIDTH * (uint64_t)nr;
+	chunk_offsets[5] = chunk_offsets[4] + 8 * (uint64_t)num_large_offsets;
+
+	path = get_midx_filename();
+	if (safe_create_leading_directories(path)) {
+		error("unable to create leading directories of %s", path);
+		goto fail;
+	}
+	fd = hold_lock_file_for_update(&midx_lock, path, LOCK_DIE_ON_ERROR);
+	f = sha1fd(fd, midx_lock.filename);
+
+	sha1write_be32(f, MIDX_SIGNATURE);
+	sha1write_be32(f, (MIDX_VERSION << 24) | (MIDX_HASH_VERSION << 16) |
+		       (num_chunks << 8));
+	sha1write_be32(f, nr_packs);
+
+	for (i = 0; i <= num_chunks; i++) {
+		sha1write_be32(f, chunk_ids[i]);
+		sha1write_be32(f, (uint32_t)(chunk_offsets[i] >> 32));
+		sha1write_be32(f, (uint32_t)chunk_offsets[i]);
+	}
+
+	/* pack names, padded with NULs to a multiple of 4 bytes */
+	for (i = 0; i < nr_packs; i++) {
+		size_t len = strlen(packs[i].name) + 1;
+		sha1write(f, packs[i].name, len);
+		names_len -= len;
+	}
+	if (names_len)
+		sha1write(f, "\0\0\0", names_len);
+
+	for (i = 0, j = 0; i < 256; i++) {
+		while (j < nr && entries[j].sha1[0] == i)
+			j++;
+		sha1write_be32(f, j);
+	}
+	for (i = 0; i < nr; i++)
+		sha1write(f, entries[i].sha1, 20);
+	for (i = 0, j = 0; i < nr; i++) {
+		sha1write_be32(f, entries[i].pack_pos);
+		if (entries[i].offset < MIDX_LARGE_OFFSET_NEEDED)
+			sha1write_be32(f, (uint32_t)entries[i].offset);
+		else
+			sha1write_be32(f, MIDX_LARGE_OFFSET_NEEDED | j++);
+	}
+	for (i = 0; i < nr; i++) {
+		uint64_t offset = entries[i].offset;
+		if (offset < MIDX_LARGE_OFFSET_NEEDED)
+			continue;
+		sha1write_be32(f, (uint32_t)(offset >> 32));
+		sha1write_be32(f, (uint32_t)offset);
+	}
+
+	sha1close(f, NULL, CSUM_FSYNC);
+	midx_lock.fd = -1;
+	if (commit_lock_file(&midx_lock) < 0)
+		die("unable to write multi-pack-index file %s (%s)",
+		    path, strerror(errno));
+
+	for (i = 0; i < nr_packs; i++)
+		free(packs[i].name);
+	free(packs);
+	free(entries);
+	close_multi_pack_index();
+	prepare_multi_pack_index();
+	return 0;
+
+fail:
+	for (i = 0; i < nr_packs; i++)
+		free(packs[i].name);
+	free(packs);
+	free(entries);
+	return -1;
+}
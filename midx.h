@@ -0,0 +1,64 @@
+#ifndef MIDX_H
+#define MIDX_H
+
+/*
+ * The multi-pack-index ($GIT_OBJECT_DIRECTORY/pack/multi-pack-index)
+ * maps every object of the local packs it was written for to one pack
+ * and the offset of the object in it, so that looking an object up
+ * costs one binary search instead of one per pack.  Packs created after
+ * the file was written are searched as usual.  See
+ * Documentation/technical/multi-pack-index-format.txt for the layout.
+ */
+
+struct multi_pack_index;
+
+/*
+ * Load the multi-pack-index of the local object directory, if any, and
+ * mark the packs of packed_git it covers.  Called by
+ * prepare_packed_git() once the packs are known.
+ */
+extern void prepare_multi_pack_index(void);
+
+/* Forget the loaded multi-pack-index and unmark its packs. */
+extern void close_multi_pack_index(void);
+
+/* The loaded multi-pack-index, or NULL. */
+extern struct multi_pack_index *get_multi_pack_index(void);
+
+/*
+ * Look "sha1" up in the multi-pack-index.  Returns 0 if it is not
+ * there, otherwise 1 with the pack and offset recorded for it.  The
+ * pack is NULL when it is no longer in packed_git.
+ */
+extern int find_midx_entry(struct multi_pack_index *m,
+			   const unsigned char *sha1,
+			   struct packed_git **pack, off_t *offset);
+
+/*
+ * The object names in the multi-pack-index are sorted; return the n-th
+ * one, or NULL past the end.  If "pos" is given, bsearch_midx() stores
+ * there the position of "sha1", or where it would be inserted.
+ */
+extern uint32_t midx_num_objects(struct multi_pack_index *m);
+extern const unsigned char *nth_midxed_object_sha1(struct multi_pack_index *m,
+						   uint32_t n);
+extern int bsearch_midx(struct multi_pack_index *m, const unsigned char *sha1,
+			uint32_t *pos);
+
+/*
+ * Write the multi-pack-index for the local packs.  When all the packs
+ * of the current file still exist, their objects are taken from it and
+ * only the indexes of new packs are read.  Returns 0 on success.
+ */
+extern int write_multi_pack_index(void);
+
+/* Summary of the loaded file, for "git multi-pack-index read". */
+struct multi_pack_index_info {
+	uint32_t num_packs;
+	uint32_t num_objects;
+	int has_large_offsets;
+	const char **pack_names;
+};
+extern int read_multi_pack_index_info(struct multi_pack_index_info *info);
+
+#endif /* MIDX_H */
@@ -0,0 +1,637 @@
+#include "cache.h"
+#include "commit.h"
+#include "tag.h"
+#include "tree.h"
+#include "blob.h"
+#include "tree-walk.h"
+#include "diff.h"
+#include "revision.h"
+#include "decorate.h"
+#include "refs.h"
+#include "pack.h"
+#include "pack-revindex.h"
+#include "csum-file.h"
+#include "ewah.h"
+#include "pack-bitmap.h"
+
+/*
+ * Select one commit out of this many (in pack order) for a bitmap, in
+ * addition to the tips of all refs.
+ */
+#define BITMAP_COMMIT_INTERVAL 100
+
+/* How far back an entry may refer for its XOR base. */
+#define MAX_XOR_OFFSET 160
+
+struct stored_bitmap {
+	struct ewah_bitmap *root;
+	struct stored_bitmap *xor;
+	uint32_t index_pos;
+};
+
+/*
+ * Objects that are reachable but not in the bitmapped pack get
+ * positions after the last object of the pack.
+ */
+struct ext_index {
+	struct object **objects;
+	uint32_t *hashes;
+	uint32_t nr, alloc;
+	struct decoration positions;
+};
+
+struct bitmap_index {
+	struct packed_git *pack;
+	struct revindex_entry *revindex;
+
+	unsigned char *map;
+	size_t map_size;
+	/* name-hash cache in the map, 4 bytes per object (may be NULL) */
+	const unsigned char *hashes;
+
+	/* object types, by position */
+	struct bitmap *commits, *trees, *blobs, *tags;
+
+	/* commit -> struct stored_bitmap */
+	struct decoration bitmaps;
+	struct ext_index ext;
+
+	struct bitmap *result;
+};
+
+static struct bitmap_index bitmap_git;
+static int bitmap_git_prepared;
+
+/*
+ * Position of an object in the bitmaps, adding it to the extended
+ * index if it is not in the pack.
+ */
+static int object_position(struct bitmap_index *b, struct object *obj,
+			   uint32_t name_hash)
+{
+	struct ext_index *ext = &b->ext;
+	off_t offset = find_pack_entry_one(obj->sha1, b->pack);
+	void *pos;
+
+	if (offset)
+		return find_revindex_position(b->pack, offset);
+
+	pos = lookup_decoration(&ext->positions, obj);
+	if (pos)
+		return b->pack->num_objects + (uintptr_t)pos - 1;
+
+	if (ext->nr >= ext->alloc) {
+		ext->alloc = alloc_nr(ext->alloc);
+		ext->objects = xrealloc(ext->objects,
+					ext->alloc * sizeof(*ext->objects));
+		ext->hashes = xrealloc(ext->hashes,
+				       ext->alloc * sizeof(*ext->hashes));
+	}
+	ext->objects[ext->nr] = obj;
+	ext->hashes[ext->nr] = name_hash;
+	ext->nr++;
+	add_decoration(&ext->positions, obj, (void *)(uintptr_t)ext->nr);
+	return b->pack->num_objects + ext->nr - 1;
+}
+
+static void or_stored_bitmap(struct bitmap *base, struct stored_bitmap *st)
+{
+	if (st->xor) {
+		struct bitmap *bits = ewah_to_bitmap(st->root);
+		struct bitmap *xor_base = bitmap_new();
+
+		/* resolve the XOR chain once and remember the result */
+		or_stored_bitmap(xor_base, st->xor);
+		bitmap_xor(bits, xor_base);
+		bitmap_free(xor_base);
+		ewah_free(st->root);
+		st->root = bitmap_to_ewah(bits);
+		st->xor = NULL;
+		bitmap_free(bits);
+	}
+	bitmap_or_ewah(base, st->root);
+}
+
+static int walk_seen(struct bitmap *base, struct bitmap *seen, int pos)
+{
+	return bitmap_get(base, pos) || (seen && bitmap_get(seen, pos));
+}
+
+static void fill_tree(struct bitmap_index *b, struct bitmap *base,
+		      struct tree *tree, uint32_t name_hash,
+		      struct bitmap *seen)
+{
+	struct tree_desc desc;
+	struct name_entry entry;
+	enum object_type type;
+	unsigned long size;
+	void *buf;
+	int pos = object_position(b, &tree->object, name_hash);
+
+	if (walk_seen(base, seen, pos))
+		return;
+	bitmap_set(base, pos);
+
+	/*
+	 * The tree may have been parsed and its buffer freed by an
+	 * earlier traversal, so read it afresh.
+	 */
+	buf = read_sha1_file(tree->object.sha1, &type, &size);
+	if (!buf || type != OBJ_TREE)
+		die("unable to read tree %s", sha1_to_hex(tree->object.sha1));
+	init_tree_desc(&desc, buf, size);
+	while (tree_entry(&desc, &entry)) {
+		uint32_t hash = pack_name_hash(entry.path);
+
+		if (S_ISDIR(entry.mode))
+			fill_tree(b, base, lookup_tree(entry.sha1), hash, seen);
+		else if (!S_ISGITLINK(entry.mode)) {
+			struct blob *blob = lookup_blob(entry.sha1);
+			if (!blob)
+				die("%s is not a blob", sha1_to_hex(entry.sha1));
+			bitmap_set(base, object_position(b, &blob->object, hash));
+		}
+	}
+	free(buf);
+}
+
+/*
+ * Set the bits of all objects reachable from roots, without walking
+ * into objects that are already set in seen.  Commits that have a
+ * stored bitmap are not walked either; their bitmap is used instead.
+ */
+static struct bitmap *find_objects(struct bitmap_index *b,
+				   struct object_list *roots,
+				   struct bitmap *seen)
+{
+	struct bitmap *base = bitmap_new();
+	struct commit_list *queue = NULL;
+	struct object_array trees = { 0, 0, NULL };
+	int i;
+
+	for (; roots; roots = roots->next) {
+		struct object *obj = roots->item;
+
+		for (;;) {
+			obj = parse_object(obj->sha1);
+			if (!obj)
+				die("unable to read object %s",
+				    sha1_to_hex(roots->item->sha1));
+			if (obj->type != OBJ_TAG)
+				break;
+			bitmap_set(base, object_position(b, obj, 0));
+			obj = ((struct tag *)obj)->tagged;
+			if (!obj)
+				die("bad tag %s", sha1_to_hex(roots->item->sha1));
+		}
+
+		if (obj->type == OBJ_COMMIT)
+			commit_list_insert((struct commit *)obj, &queue);
+		else if (obj->type == OBJ_TREE)
+			add_object_array(obj, NULL, &trees);
+		else
+			bitmap_set(base, object_position(b, obj, 0));
+	}
+
+	/*
+	 * Walk the commits first, so that the stored bitmaps we meet
+	 * cover as many trees as possible before we walk those.
+	 */
+	while (queue) {
+		struct commit *commit = pop_commit(&queue);
+		struct stored_bitmap *st;
+		struct commit_list *p;
+		int pos = object_position(b, &commit->object, 0);
+
+		if (walk_seen(base, seen, pos))
+			continue;
+		st = lookup_decoration(&b->bitmaps, &commit->object);
+		if (st) {
+			or_stored_bitmap(base, st);
+			continue;
+		}
+		bitmap_set(base, pos);
+		if (parse_commit(commit))
+			die("unable to parse commit %s",
+			    sha1_to_hex(commit->object.sha1));
+		add_object_array(&commit->tree->object, NULL, &trees);
+		for (p = commit->parents; p; p = p->next)
+			commit_list_insert(p->item, &queue);
+	}
+
+	for (i = 0; i < trees.nr; i++)
+		fill_tree(b, base, (struct tree *)trees.objects[i].item, 0, seen);
+	free(trees.objects);
+	return base;
+}
+
+static char *pack_bitmap_filename(struct packed_git *p)
+{
+	size_t len = strlen(p->pack_name);
+	char *name;
+
+	if (len < 5 || strcmp(p->pack_name + len - 5, ".pack"))
+		return NULL;
+	name = xmalloc(len - 5 + strlen(".bitmap") + 1);
+	memcpy(name, p->pack_name, len - 5);
+	strcpy(name + len - 5, ".bitmap");
+	return name;
+}
+
+/* the map has no alignment guarantee past its header */
+static uint32_t get_be32(const unsigned char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return ntohl(v);
+}
+
+static struct bitmap *read_type_bitmap(const unsigned char **ptr,
+				       const unsigned char *end)
+{
+	struct ewah_bitmap ewah;
+	struct bitmap *bits;
+	ssize_t len = ewah_read_mmap(&ewah, *ptr, end - *ptr);
+
+	if (len < 0)
+		return NULL;
+	*ptr += len;
+	bits = ewah_to_bitmap(&ewah);
+	free(ewah.buffer);
+	return bits;
+}
+
+static int load_bitmap(struct bitmap_index *b)
+{
+	struct packed_git *p = b->pack;
+	const unsigned char *ptr = b->map, *end;
+	struct stored_bitmap **entries;
+	uint32_t i, nr_entries;
+	unsigned int options;
+
+	if (b->map_size < 32 + 20 || memcmp(ptr, BITMAP_SIGNATURE, 4))
+		return error("bitmap file for %s has a bad signature",
+			     p->pack_name);
+	if (ntohs(*(uint16_t *)(ptr + 4)) != BITMAP_VERSION)
+		return error("bitmap file for %s has an unsupported version",
+			     p->pack_name);
+	options = ntohs(*(uint16_t *)(ptr + 6));
+	if (!(options & BITMAP_OPT_FULL_DAG))
+		return error("bitmap file for %s is not a full closure",
+			     p->pack_name);
+	nr_entries = get_be32(ptr + 8);
+	if (hashcmp(ptr + 12, p->sha1))
+		return error("bitmap file does not match pack %s",
+			     p->pack_name);
+	ptr += 32;
+	end = b->map + b->map_size - 20;
+
+	if (options & BITMAP_OPT_HASH_CACHE) {
+		if (end - ptr < 4 * (off_t)p->num_objects)
+			return error("bitmap file for %s is truncated",
+				     p->pack_name);
+		end -= 4 * p->num_objects;
+		b->hashes = end;
+	}
+
+	if (!(b->commits = read_type_bitmap(&ptr, end)) ||
+	    !(b->trees = read_type_bitmap(&ptr, end)) ||
+	    !(b->blobs = read_type_bitmap(&ptr, end)) ||
+	    !(b->tags = read_type_bitmap(&ptr, end)))
+		return error("bitmap file for %s has corrupt type bitmaps",
+			     p->pack_name);
+
+	entries = xcalloc(nr_entries, sizeof(*entries));
+	for (i = 0; i < nr_entries; i++) {
+		struct stored_bitmap *st;
+		struct commit *commit;
+		uint32_t index_pos;
+		int xor_offset;
+		ssize_t len;
+
+		if (end - ptr < 6)
+			break;
+		index_pos = get_be32(ptr);
+		xor_offset = ptr[4];
+		ptr += 6;
+		if (index_pos >= p->num_objects || xor_offset > i ||
+		    xor_offset > MAX_XOR_OFFSET)
+			break;
+
+		st = xcalloc(1, sizeof(*st));
+		st->root = xcalloc(1, sizeof(*st->root));
+		st->index_pos = index_pos;
+		if (xor_offset)
+			st->xor = entries[i - xor_offset];
+		len = ewah_read_mmap(st->root, ptr, end - ptr);
+		commit = lookup_commit(nth_packed_object_sha1(p, index_pos));
+		if (len < 0 || !commit) {
+			ewah_free(st->root);
+			free(st);
+			break;
+		}
+		ptr += len;
+		entries[i] = st;
+		add_decoration(&b->bitmaps, &commit->object, st);
+	}
+	free(entries);
+	if (i < nr_entries)
+		return error("bitmap file for %s has corrupt entries",
+			     p->pack_name);
+	return 0;
+}
+
+static int open_pack_bitmap_1(struct packed_git *p)
+{
+	char *name;
+	struct stat st;
+	int fd;
+
+	if (open_pack_index(p))
+		return -1;
+	name = pack_bitmap_filename(p);
+	if (!name)
+		return -1;
+	fd = open(name, O_RDONLY);
+	if (fd < 0) {
+		free(name);
+		return -1;
+	}
+	if (fstat(fd, &st)) {
+		close(fd);
+		free(name);
+		return -1;
+	}
+	if (bitmap_git.pack) {
+		warning("ignoring extra bitmap file: %s", name);
+		close(fd);
+		free(name);
+		return -1;
+	}
+	free(name);
+
+	bitmap_git.pack = p;
+	bitmap_git.map_size = xsize_t(st.st_size);
+	bitmap_git.map = xmmap(NULL, bitmap_git.map_size, PROT_READ,
+			       MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (load_bitmap(&bitmap_git) < 0) {
+		munmap(bitmap_git.map, bitmap_git.map_size);
+		memset(&bitmap_git, 0, sizeof(bitmap_git));
+		return -1;
+	}
+	return 0;
+}
+
+static int prepare_bitmap_git(void)
+{
+	struct packed_git *p;
+
+	if (!bitmap_git_prepared) {
+		bitmap_git_prepared = 1;
+		prepare_packed_git();
+		for (p = packed_git; p; p = p->next)
+			if (p->pack_local)
+				open_pack_bitmap_1(p);
+	}
+	if (!bitmap_git.pack)
+		return -1;
+	bitmap_git.revindex = get_pack_revindex(bitmap_git.pack);
+	return 0;
+}
+
+int prepare_bitmap_walk(struct rev_info *revs)
+{
+	struct object_list *wants = NULL, *haves = NULL, *l;
+	struct bitmap *wants_bitmap, *haves_bitmap = NULL;
+	int i;
+
+	if (prepare_bitmap_git() < 0)
+		return -1;
+
+	for (i = 0; i < revs->pending.nr; i++) {
+		struct object *obj = revs->pending.objects[i].item;
+		if (obj->flags & UNINTERESTING)
+			object_list_insert(obj, &haves);
+		else
+			object_list_insert(obj, &wants);
+	}
+
+	if (haves)
+		haves_bitmap = find_objects(&bitmap_git, haves, NULL);
+	wants_bitmap = find_objects(&bitmap_git, wants, haves_bitmap);
+	if (haves_bitmap) {
+		bitmap_and_not(wants_bitmap, haves_bitmap);
+		bitmap_free(haves_bitmap);
+	}
+	bitmap_free(bitmap_git.result);
+	bitmap_git.result = wants_bitmap;
+
+	while (wants) {
+		l = wants->next;
+		free(wants);
+		wants = l;
+	}
+	while (haves) {
+		l = haves->next;
+		free(haves);
+		haves = l;
+	}
+	return 0;
+}
+
+struct traverse_data {
+	show_reachable_fn show;
+	uint32_t count;
+};
+
+static int show_bitmap_object(size_t pos, void *data)
+{
+	struct traverse_data *td = data;
+	struct bitmap_index *b = &bitmap_git;
+	struct packed_git *p = b->pack;
+
+	if (pos < p->num_objects) {
+		struct revindex_entry *entry = &b->revindex[pos];
+		enum object_type type;
+
+		if (bitmap_get(b->commits, pos))
+			type = OBJ_COMMIT;
+		else if (bitmap_get(b->trees, pos))
+			type = OBJ_TREE;
+		else if (bitmap_get(b->blobs, pos))
+			type = OBJ_BLOB;
+		else
+			type = OBJ_TAG;
+		td->show(nth_packed_object_sha1(p, entry->nr), type,
+			 b->hashes ? get_be32(b->hashes + 4 * pos) : 0,
+			 p, entry->offset);
+	} else {
+		uint32_t i = pos - p->num_objects;
+		struct object *obj = b->ext.objects[i];
+		td->show(obj->sha1, obj->type, b->ext.hashes[i], NULL, 0);
+	}
+	td->count++;
+	return 0;
+}
+
+uint32_t traverse_bitmap_commit_list(show_reachable_fn show)
+{
+	struct traverse_data td;
+
+	if (!bitmap_git.result)
+		die("BUG: traverse_bitmap_commit_list without a bitmap walk");
+	td.show = show;
+	td.count = 0;
+	bitmap_each_bit(bitmap_git.result, show_bitmap_object, &td);
+	return td.count;
+}
+
+static int mark_ref_tip(const char *path, const unsigned char *sha1,
+			int flags, void *cb_data)
+{
+	struct decoration *tips = cb_data;
+	struct object *obj = deref_tag(parse_object(sha1), NULL, 0);
+
+	if (obj && obj->type == OBJ_COMMIT)
+		add_decoration(tips, obj, (void *)1);
+	return 0;
+}
+
+static void write_type_bitmap(struct sha1file *f,
+			      const enum object_type *types, uint32_t nr,
+			      enum object_type type)
+{
+	struct bitmap *bits = bitmap_new();
+	struct ewah_bitmap *ewah;
+	uint32_t i;
+
+	for (i = 0; i < nr; i++)
+		if (types[i] == type)
+			bitmap_set(bits, i);
+	ewah = bitmap_to_ewah(bits);
+	ewah_serialize(ewah, f);
+	ewah_free(ewah);
+	bitmap_free(bits);
+}
+
+char *write_pack_bitmap(struct packed_git *p,
+			const enum object_type *types,
+			const uint32_t *name_hashes)
+{
+	struct bitmap_index writer;
+	struct decoration tips;
+	struct commit **selected = NULL;
+	struct stored_bitmap **stored;
+	uint32_t i, nr_commits = 0, nr_selected = 0, alloc_selected = 0;
+	struct sha1file *f;
+	char tmpname[PATH_MAX];
+	uint16_t version = htons(BITMAP_VERSION);
+	uint16_t options = htons(BITMAP_OPT_FULL_DAG | BITMAP_OPT_HASH_CACHE);
+	uint32_t be32;
+	int fd;
+
+	memset(&writer, 0, sizeof(writer));
+	memset(&tips, 0, sizeof(tips));
+	writer.pack = p;
+	writer.revindex = get_pack_revindex(p);
+	for_each_ref(mark_ref_tip, &tips);
+
+	for (i = 0; i < p->num_objects; i++) {
+		struct commit *commit;
+
+		if (types[i] != OBJ_COMMIT)
+			continue;
+		commit = lookup_commit(nth_packed_object_sha1(p,
+						writer.revindex[i].nr));
+		if (!commit)
+			die("bad commit in new pack");
+		if (nr_commits++ % BITMAP_COMMIT_INTERVAL &&
+		    !lookup_decoration(&tips, &commit->object))
+			continue;
+		ALLOC_GROW(selected, nr_selected + 1, alloc_selected);
+		selected[nr_selected++] = commit;
+	}
+	free(tips.hash);
+
+	/*
+	 * Commits appear newest first in the pack; build the bitmaps of
+	 * older ones first so the later walks can stop at them.
+	 */
+	stored = xcalloc(nr_selected, sizeof(*stored));
+	for (i = nr_selected; i-- > 0; ) {
+		struct object_list root;
+		struct bitmap *bits;
+		struct stored_bitmap *st;
+		int pos;
+
+		root.item = &selected[i]->object;
+		root.next = NULL;
+		bits = find_objects(&writer, &root, NULL);
+		if (writer.ext.nr) {
+			warning("not writing bitmap: %s is reachable but "
+				"not in the pack",
+				sha1_to_hex(writer.ext.objects[0]->sha1));
+			bitmap_free(bits);
+			goto cleanup;
+		}
+		pos = object_position(&writer, &selected[i]->object, 0);
+		st = xcalloc(1, sizeof(*st));
+		st->root = bitmap_to_ewah(bits);
+		st->index_pos = writer.revindex[pos].nr;
+		bitmap_free(bits);
+		add_decoration(&writer.bitmaps, &selected[i]->object, st);
+		stored[nr_selected - 1 - i] = st;
+	}
+
+	snprintf(tmpname, sizeof(tmpname), "%s/pack/tmp_bitmap_XXXXXX",
+		 get_object_directory());
+	fd = xmkstemp(tmpname);
+	f = sha1fd(fd, tmpname);
+
+	sha1write(f, BITMAP_SIGNATURE, 4);
+	sha1write(f, &version, 2);
+	sha1write(f, &options, 2);
+	be32 = htonl(nr_selected);
+	sha1write(f, &be32, 4);
+	sha1write(f, p->sha1, 20);
+
+	write_type_bitmap(f, types, p->num_objects, OBJ_COMMIT);
+	write_type_bitmap(f, types, p->num_objects, OBJ_TREE);
+	write_type_bitmap(f, types, p->num_objects, OBJ_BLOB);
+	write_type_bitmap(f, types, p->num_objects, OBJ_TAG);
+
+	for (i = 0; i < nr_selected; i++) {
+		unsigned char xor_offset = 0, flags = 0;
+
+		be32 = htonl(stored[i]->index_pos);
+		sha1write(f, &be32, 4);
+		sha1write(f, &xor_offset, 1);
+		sha1write(f, &flags, 1);
+		ewah_serialize(stored[i]->root, f);
+	}
+
+	for (i = 0; i < p->num_objects; i++) {
+		be32 = htonl(name_hashes[i]);
+		sha1write(f, &be32, 4);
+	}
+	sha1close(f, NULL, CSUM_FSYNC);
+
+cleanup:
+	for (i = 0; i < nr_selected; i++) {
+		if (!stored[i])
+			continue;
+		ewah_free(stored[i]->root);
+		free(stored[i]);
+	}
+	free(stored);
+	free(selected);
+	free(writer.bitmaps.hash);
+	free(writer.ext.positions.hash);
+	free(writer.ext.objects);
+	free(writer.ext.hashes);
+	if (writer.ext.nr)
+		return NULL;
+	return xstrdup(tmpname);
+}
@@ -0,0 +1,53 @@
+#ifndef PACK_BITMAP_H
+#define PACK_BITMAP_H
+
+/*
+ * Reachability bitmaps ("pack-*.bitmap", next to the pack .idx) record,
+ * for a selection of commits, the set of objects reachable from each of
+ * them as an EWAH-compressed bitmap over the objects of the pack in pack
+ * order.  Counting the objects to send then becomes a matter of OR-ing
+ * the bitmaps of what the other side wants and removing those of what it
+ * has.  See Documentation/technical/bitmap-format.txt.
+ */
+
+struct rev_info;
+
+#define BITMAP_SIGNATURE	"BITM"
+#define BITMAP_VERSION		1
+
+#define BITMAP_OPT_FULL_DAG	1
+#define BITMAP_OPT_HASH_CACHE	4
+
+typedef int (*show_reachable_fn)(const unsigned char *sha1,
+				 enum object_type type, uint32_t name_hash,
+				 struct packed_git *found_pack,
+				 off_t found_offset);
+
+/*
+ * Compute the objects reachable from the positive pending objects of
+ * revs but not from the UNINTERESTING ones, using the bitmap of the
+ * local pack that has one.  Returns -1 when no usable bitmap exists, in
+ * which case the caller should fall back to a normal revision walk.
+ */
+extern int prepare_bitmap_walk(struct rev_info *revs);
+
+/*
+ * Report every object found by prepare_bitmap_walk(), in pack order.
+ * Objects that are not in the bitmapped pack are reported with a NULL
+ * found_pack.  Returns the number of objects reported.
+ */
+extern uint32_t traverse_bitmap_commit_list(show_reachable_fn show);
+
+/*
+ * Write a bitmap index for the pack p, which must have just been written
+ * and contain every object reachable from the commits it holds.  The
+ * types[] and name_hashes[] arrays describe the objects of the pack in
+ * pack order.  Returns the name of the temporary file holding the
+ * bitmap, to be renamed by the caller, or NULL (after a warning) if no
+ * bitmap could be written.
+ */
+extern char *write_pack_bitmap(struct packed_git *p,
+			       const enum object_type *types,
+			       const uint32_t *name_hashes);
+
+#endif
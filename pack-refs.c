@@ -13,6 +13,8 @@ struct pack_refs_cb_data {
 	unsigned int flags;
 	struct ref_to_prune *ref_to_prune;
 	FILE *refs_file;
+	struct strbuf last_ref;
+	int out_of_order;
 };
 
 static int do_not_prune(int flags)
@@ -38,6 +40,11 @@ static int handle_one_ref(const char *path, const unsigned char *sha1,
 	if (!(cb->flags & PACK_REFS_ALL) && !is_tag_ref && !(flags & REF_ISPACKED))
 		return 0;
 
+	if (cb->last_ref.len && strcmp(cb->last_ref.buf, path) >= 0)
+		cb->out_of_order = 1;
+	strbuf_reset(&cb->last_ref);
+	strbuf_addstr(&cb->last_ref, path);
+
 	fprintf(cb->refs_file, "%s %s\n", sha1_to_hex(sha1), path);
 	if (is_tag_ref) {
 		struct object *o = parse_object(sha1);
@@ -79,8 +86,42 @@ static void prune_refs(struct ref_to_prune *r)
 	}
 }
 
+static void free_refs_to_prune(struct ref_to_prune *r)
+{
+	while (r) {
+		struct ref_to_prune *next = r->next;
+		free(r);
+		r = next;
+	}
+}
+
 static struct lock_file packed;
 
+/*
+ * for_each_ref() gives the loose and packed refs merged in sorted
+ * order, which lets readers binary search the file.  Should a ref
+ * ever come out of order, write the file again without claiming it
+ * is sorted.
+ */
+static void write_packed_refs(struct pack_refs_cb_data *cbdata, int fd)
+{
+	/* perhaps other traits later as well */
+	fprintf(cbdata->refs_file, "# pack-refs with: peeled sorted \n");
+	for_each_ref(handle_one_ref, cbdata);
+	if (!cbdata->out_of_order)
+		return;
+
+	free_refs_to_prune(cbdata->ref_to_prune);
+	cbdata->ref_to_prune = NULL;
+	strbuf_reset(&cbdata->last_ref);
+	cbdata->out_of_order = 0;
+	if (fflush(cbdata->refs_file) || ftruncate(fd, 0) ||
+	    fseek(cbdata->refs_file, 0, SEEK_SET))
+		die("failed to write ref-pack file (%s)", strerror(errno));
+	fprintf(cbdata->refs_file, "# pack-refs with: peeled \n");
+	for_each_ref(handle_one_ref, cbdata);
+}
+
 int pack_refs(unsigned int flags)
 {
 	int fd;
@@ -88,6 +129,7 @@ int pack_refs(unsigned int flags)
 
 	memset(&cbdata, 0, sizeof(cbdata));
 	cbdata.flags = flags;
+	strbuf_init(&cbdata.last_ref, 0);
 
 	fd = hold_lock_file_for_update(&packed, git_path("packed-refs"),
 				       LOCK_DIE_ON_ERROR);
@@ -96,10 +138,8 @@ int pack_refs(unsigned int flags)
 		die("unable to create ref-pack file structure (%s)",
 		    strerror(errno));
 
-	/* perhaps other traits later as well */
-	fprintf(cbdata.refs_file, "# pack-refs with: peeled \n");
-
-	for_each_ref(handle_one_ref, &cbdata);
+	write_packed_refs(&cbdata, fd);
+	strbuf_release(&cbdata.last_ref);
 	if (ferror(cbdata.refs_file))
 		die("failed to write ref-pack file");
 	if (fflush(cbdata.refs_file) || fsync(fd) || fclose(cbdata.refs_file))
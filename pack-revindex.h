@@ -7,6 +7,14 @@ struct revindex_entry {
 };
 
 struct revindex_entry *find_pack_revindex(struct packed_git *p, off_t ofs);
+
+/*
+ * The objects of a pack ordered by their offset, followed by a sentinel
+ * entry for the pack trailer; find_revindex_position() returns the
+ * index of the object at ofs in that array, or -1.
+ */
+struct revindex_entry *get_pack_revindex(struct packed_git *p);
+int find_revindex_position(struct packed_git *p, off_t ofs);
 void discard_revindex(void);
 
 #endif
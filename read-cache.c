@@ -14,6 +14,7 @@
 #include "diffcore.h"
 #include "revision.h"
 #include "blob.h"
+#include "split-index.h"
 
 /* Index extensions.
  *
@@ -26,6 +27,8 @@
 
 #define CACHE_EXT(s) ( (s[0]<<24)|(s[1]<<16)|(s[2]<<8)|(s[3]) )
 #define CACHE_EXT_TREE 0x54524545	/* "TREE" */
+#define CACHE_EXT_UNTRACKED 0x554E5452	/* "UNTR" */
+#define CACHE_EXT_LINK 0x6c696e6b	/* "link" */
 
 struct index_state the_index;
 
@@ -1102,7 +1105,8 @@ static int verify_hdr(struct cache_header *hdr, unsigned long size)
 
 	if (hdr->hdr_signature != htonl(CACHE_SIGNATURE))
 		return error("bad signature");
-	if (hdr->hdr_version != htonl(2) && hdr->hdr_version != htonl(3))
+	if (ntohl(hdr->hdr_version) < INDEX_FORMAT_LB ||
+	    ntohl(hdr->hdr_version) > INDEX_FORMAT_UB)
 		return error("bad index version");
 	git_SHA1_Init(&c);
 	git_SHA1_Update(&c, hdr, size - 20);
@@ -1119,6 +1123,13 @@ static int read_index_extension(struct index_state *istate,
 	case CACHE_EXT_TREE:
 		istate->cache_tree = cache_tree_read(data, sz);
 		break;
+	case CACHE_EXT_UNTRACKED:
+		istate->untracked = untracked_cache_read(data, sz);
+		break;
+	case CACHE_EXT_LINK:
+		if (read_link_extension(istate, data, sz) < 0)
+			return -1;
+		break;
 	default:
 		if (*ext < 'A' || 'Z' < *ext)
 			return error("index uses %.4s extension, which we do not understand",
@@ -1134,11 +1145,13 @@ int read_index(struct index_state *istate)
 	return read_index_from(istate, get_index_file());
 }
 
-static void convert_from_disk(struct ondisk_cache_entry *ondisk, struct cache_entry *ce)
+/*
+ * Fill in everything but the name; returns where the name starts,
+ * which depends on whether the entry has extended flags.
+ */
+static const char *convert_stat_from_disk(const struct ondisk_cache_entry *ondisk,
+					  struct cache_entry *ce)
 {
-	size_t len;
-	const char *name;
-
 	ce->ce_ctime = ntohl(ondisk->ctime.sec);
 	ce->ce_mtime = ntohl(ondisk->mtime.sec);
 	ce->ce_dev   = ntohl(ondisk->dev);
@@ -1152,22 +1165,27 @@ static void convert_from_disk(struct ondisk_cache_entry *ondisk, struct cache_en
 
 	hashcpy(ce->sha1, ondisk->sha1);
 
-	len = ce->ce_flags & CE_NAMEMASK;
-
 	if (ce->ce_flags & CE_EXTENDED) {
-		struct ondisk_cache_entry_extended *ondisk2;
+		const struct ondisk_cache_entry_extended *ondisk2;
 		int extended_flags;
-		ondisk2 = (struct ondisk_cache_entry_extended *)ondisk;
+		ondisk2 = (const struct ondisk_cache_entry_extended *)ondisk;
 		extended_flags = ntohs(ondisk2->flags2) << 16;
 		/* We do not yet understand any bit out of CE_EXTENDED_FLAGS */
 		if (extended_flags & ~CE_EXTENDED_FLAGS)
 			die("Unknown index entry format %08x", extended_flags);
 		ce->ce_flags |= extended_flags;
-		name = ondisk2->name;
+		return ondisk2->name;
 	}
-	else
-		name = ondisk->name;
+	return ondisk->name;
+}
 
+static void convert_from_disk(struct ondisk_cache_entry *ondisk, struct cache_entry *ce)
+{
+	size_t len;
+	const char *name;
+
+	name = convert_stat_from_disk(ondisk, ce);
+	len = ce->ce_flags & CE_NAMEMASK;
 	if (len == CE_NAMEMASK)
 		len = strlen(name);
 	/*
@@ -1191,6 +1209,133 @@ static inline size_t estimate_cache_size(size_t ondisk_size, unsigned int entrie
 	return ondisk_size + entries*per_entry;
 }
 
+/*
+ * Version 4 stores each path as the number of bytes to drop from the
+ * end of the previous path, in the varint encoding used for offsets
+ * in packs, followed by the NUL-terminated bytes to append.
+ */
+static int encode_varint(uintmax_t value, unsigned char *buf)
+{
+	unsigned char varint[16];
+	unsigned pos = sizeof(varint) - 1;
+
+	varint[pos] = value & 127;
+	while (value >>= 7)
+		varint[--pos] = 128 | (--value & 127);
+	memcpy(buf, varint + pos, sizeof(varint) - pos);
+	return sizeof(varint) - pos;
+}
+
+static uintmax_t decode_varint(const unsigned char **bufp,
+			       const unsigned char *end)
+{
+	const unsigned char *buf = *bufp;
+	unsigned char c;
+	uintmax_t val;
+
+	if (buf >= end)
+		return UINTMAX_MAX;
+	c = *buf++;
+	val = c & 127;
+	while (c & 128) {
+		if (buf >= end || (val + 1) >> (sizeof(val) * 8 - 7))
+			return UINTMAX_MAX;
+		c = *buf++;
+		val = ((val + 1) << 7) + (c & 127);
+	}
+	*bufp = buf;
+	return val;
+}
+
+/*
+ * The in-core size of a version 4 index cannot be told from the file
+ * size, as the paths are stored compressed; guess from a typical path
+ * length and grow if the guess was too small.
+ */
+#define CACHE_ENTRY_PATH_LENGTH 80
+
+static void grow_compressed_arena(struct index_state *istate, unsigned int nr,
+				  size_t used, size_t *alloc, size_t want)
+{
+	char *old = istate->alloc, *new;
+	unsigned int i;
+
+	*alloc = alloc_nr(want);
+	new = xmalloc(*alloc);
+	memcpy(new, old, used);
+	for (i = 0; i < nr; i++)
+		istate->cache[i] = (struct cache_entry *)
+			(new + ((char *)istate->cache[i] - old));
+	free(old);
+	istate->alloc = new;
+}
+
+/*
+ * Read the entries of a version 4 index in one pass, building each
+ * path from the one before.  The entries are not padded, so the fixed
+ * part is copied out before it is looked at.  Returns the offset of
+ * the first extension.
+ */
+static unsigned long read_compressed_entries(struct index_state *istate,
+					     const void *mmap, size_t mmap_size)
+{
+	const unsigned char *ptr, *end;
+	size_t alloc, used = 0, prev_len = 0;
+	unsigned int i;
+
+	ptr = (const unsigned char *)mmap + sizeof(struct cache_header);
+	end = (const unsigned char *)mmap + mmap_size - 20;
+	alloc = istate->cache_nr * cache_entry_size(CACHE_ENTRY_PATH_LENGTH);
+	istate->alloc = xmalloc(alloc ? alloc : 1);
+
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct ondisk_cache_entry_extended ondisk;
+		struct cache_entry tmp, *ce;
+		const char *suffix, *nul;
+		size_t fixed, strip, suffix_len, len;
+
+		fixed = offsetof(struct ondisk_cache_entry, name);
+		if (end - ptr < fixed + 2)
+			die("index file corrupt (truncated entry)");
+		memcpy(&ondisk, ptr, offsetof(struct ondisk_cache_entry_extended, name));
+		convert_stat_from_disk((struct ondisk_cache_entry *)&ondisk, &tmp);
+		if (tmp.ce_flags & CE_EXTENDED)
+			fixed = offsetof(struct ondisk_cache_entry_extended, name);
+		ptr += fixed;
+
+		strip = decode_varint(&ptr, end);
+		if (strip > prev_len)
+			die("index file corrupt (bad path prefix)");
+		suffix = (const char *)ptr;
+		nul = memchr(suffix, '\0', (const char *)end - suffix);
+		if (!nul)
+			die("index file corrupt (unterminated path)");
+		suffix_len = nul - suffix;
+		ptr = (const unsigned char *)nul + 1;
+
+		len = prev_len - strip + suffix_len;
+		if ((tmp.ce_flags & CE_NAMEMASK) != CE_NAMEMASK
+		    ? len != (tmp.ce_flags & CE_NAMEMASK)
+		    : len < CE_NAMEMASK)
+			die("index file corrupt (path length mismatch)");
+
+		if (alloc < used + cache_entry_size(len))
+			grow_compressed_arena(istate, i, used, &alloc,
+					      used + cache_entry_size(len));
+		ce = (struct cache_entry *)((char *)istate->alloc + used);
+		memcpy(ce, &tmp, offsetof(struct cache_entry, name));
+		if (i)
+			memcpy(ce->name, istate->cache[i - 1]->name,
+			       prev_len - strip);
+		memcpy(ce->name + prev_len - strip, suffix, suffix_len + 1);
+		set_index_entry(istate, i, ce);
+
+		used += cache_entry_size(len);
+		prev_len = len;
+	}
+	return (const char *)ptr - (const char *)mmap;
+}
+
 /* remember to discard_cache() before reading a different cache! */
 int read_index_from(struct index_state *istate, const char *path)
 {
@@ -1230,10 +1375,18 @@ int read_index_from(struct index_state *istate, const char *path)
 	hdr = mmap;
 	if (verify_hdr(hdr, mmap_size) < 0)
 		goto unmap;
+	hashcpy(istate->sha1, (unsigned char *)hdr + mmap_size - 20);
 
+	istate->version = ntohl(hdr->hdr_version);
 	istate->cache_nr = ntohl(hdr->hdr_entries);
 	istate->cache_alloc = alloc_nr(istate->cache_nr);
 	istate->cache = xcalloc(istate->cache_alloc, sizeof(struct cache_entry *));
+	istate->initialized = 1;
+
+	if (istate->version == 4) {
+		src_offset = read_compressed_entries(istate, mmap, mmap_size);
+		goto extensions;
+	}
 
 	/*
 	 * The disk format is actually larger than the in-memory format,
@@ -1242,7 +1395,6 @@ int read_index_from(struct index_state *istate, const char *path)
 	 * index size
 	 */
 	istate->alloc = xmalloc(estimate_cache_size(mmap_size, istate->cache_nr));
-	istate->initialized = 1;
 
 	src_offset = sizeof(*hdr);
 	dst_offset = 0;
@@ -1258,6 +1410,7 @@ int read_index_from(struct index_state *istate, const char *path)
 		src_offset += ondisk_ce_size(ce);
 		dst_offset += ce_size(ce);
 	}
+extensions:
 	istate->timestamp = st.st_mtime;
 	while (src_offset <= mmap_size - 20 - 8) {
 		/* After an array of active_nr index entries,
@@ -1278,6 +1431,11 @@ int read_index_from(struct index_state *istate, const char *path)
 		src_offset += extsize;
 	}
 	munmap(mmap, mmap_size);
+
+	if (istate->split_index)
+		merge_base_index(istate);
+	else if (core_split_index && !strcmp(path, get_index_file()))
+		init_split_index(istate);
 	return istate->cache_nr;
 
 unmap:
@@ -1299,6 +1457,9 @@ int discard_index(struct index_state *istate)
 	istate->name_hash_initialized = 0;
 	free_hash(&istate->name_hash);
 	cache_tree_free(&(istate->cache_tree));
+	free_untracked_cache(istate->untracked);
+	istate->untracked = NULL;
+	discard_split_index(istate);
 	free(istate->alloc);
 	istate->alloc = NULL;
 	istate->initialized = 0;
@@ -1364,7 +1525,7 @@ static int write_index_ext_header(git_SHA_CTX *context, int fd,
 		(ce_write(context, fd, &sz, 4) < 0)) ? -1 : 0;
 }
 
-static int ce_flush(git_SHA_CTX *context, int fd)
+static int ce_flush(git_SHA_CTX *context, int fd, unsigned char *sha1)
 {
 	unsigned int left = write_buffer_len;
 
@@ -1382,6 +1543,8 @@ static int ce_flush(git_SHA_CTX *context, int fd)
 
 	/* Append the SHA1 signature at the end */
 	git_SHA1_Final(write_buffer + left, context);
+	if (sha1)
+		hashcpy(sha1, write_buffer + left);
 	left += 20;
 	return (write_in_full(fd, write_buffer, left) != left) ? -1 : 0;
 }
@@ -1435,12 +1598,32 @@ static void ce_smudge_racily_clean_entry(struct cache_entry *ce)
 	}
 }
 
-static int ce_write_entry(git_SHA_CTX *c, int fd, struct cache_entry *ce)
+/*
+ * In version 4, "previous_name" is the path of the entry written before
+ * this one, and only the part of the path that differs from it is
+ * written, without padding.
+ */
+static int ce_write_entry(git_SHA_CTX *c, int fd, struct cache_entry *ce,
+			  struct strbuf *previous_name)
 {
-	int size = ondisk_ce_size(ce);
-	struct ondisk_cache_entry *ondisk = xcalloc(1, size);
+	int size = ondisk_ce_size(ce), len = ce_namelen(ce), common = 0;
+	struct ondisk_cache_entry *ondisk;
+	unsigned char strip[16];
+	int strip_len = 0, result;
 	char *name;
 
+	if (previous_name) {
+		while (common < len && common < previous_name->len &&
+		       ce->name[common] == previous_name->buf[common])
+			common++;
+		strip_len = encode_varint(previous_name->len - common, strip);
+		size = (ce->ce_flags & CE_EXTENDED
+			? offsetof(struct ondisk_cache_entry_extended, name)
+			: offsetof(struct ondisk_cache_entry, name))
+			+ strip_len + len - common + 1;
+	}
+	ondisk = xcalloc(1, size);
+
 	ondisk->ctime.sec = htonl(ce->ce_ctime);
 	ondisk->ctime.nsec = 0;
 	ondisk->mtime.sec = htonl(ce->ce_mtime);
@@ -1461,18 +1644,34 @@ static int ce_write_entry(git_SHA_CTX *c, int fd, struct cache_entry *ce)
 	}
 	else
 		name = ondisk->name;
-	memcpy(name, ce->name, ce_namelen(ce));
 
-	return ce_write(c, fd, ondisk, size);
+	if (previous_name) {
+		memcpy(name, strip, strip_len);
+		memcpy(name + strip_len, ce->name + common, len - common);
+		strbuf_setlen(previous_name, common);
+		strbuf_add(previous_name, ce->name + common, len - common);
+	} else
+		memcpy(name, ce->name, len);
+
+	result = ce_write(c, fd, ondisk, size);
+	free(ondisk);
+	return result;
 }
 
-int write_index(const struct index_state *istate, int newfd)
+/*
+ * Write the given entries as an index file.  The shared index of a
+ * split index has no extensions; the index file proper carries the
+ * "link" extension when "link" is given.
+ */
+static int do_write_index(const struct index_state *istate, int newfd,
+			  struct cache_entry **cache, int entries,
+			  struct strbuf *link, int shared,
+			  unsigned char *sha1)
 {
 	git_SHA_CTX c;
 	struct cache_header hdr;
-	int i, err, removed, extended;
-	struct cache_entry **cache = istate->cache;
-	int entries = istate->cache_nr;
+	int i, err, removed, extended, version;
+	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
 
 	for (i = removed = extended = 0; i < entries; i++) {
 		if (cache[i]->ce_flags & CE_REMOVE)
@@ -1487,26 +1686,39 @@ int write_index(const struct index_state *istate, int newfd)
 	}
 
 	hdr.hdr_signature = htonl(CACHE_SIGNATURE);
-	/* for extended format, increase version so older git won't try to read it */
-	hdr.hdr_version = htonl(extended ? 3 : 2);
+	version = istate->version ? istate->version : core_index_version;
+	if (version != 4)
+		/* for extended format, increase version so older git won't try to read it */
+		version = extended ? 3 : 2;
+	hdr.hdr_version = htonl(version);
 	hdr.hdr_entries = htonl(entries - removed);
 
 	git_SHA1_Init(&c);
 	if (ce_write(&c, newfd, &hdr, sizeof(hdr)) < 0)
 		return -1;
 
+	previous_name = version == 4 ? &previous_name_buf : NULL;
 	for (i = 0; i < entries; i++) {
 		struct cache_entry *ce = cache[i];
 		if (ce->ce_flags & CE_REMOVE)
 			continue;
 		if (!ce_uptodate(ce) && is_racy_timestamp(istate, ce))
 			ce_smudge_racily_clean_entry(ce);
-		if (ce_write_entry(&c, newfd, ce) < 0)
+		if (ce_write_entry(&c, newfd, ce, previous_name) < 0) {
+			strbuf_release(&previous_name_buf);
 			return -1;
+		}
 	}
+	strbuf_release(&previous_name_buf);
 
 	/* Write extension data here */
-	if (istate->cache_tree) {
+	if (link) {
+		err = write_index_ext_header(&c, newfd, CACHE_EXT_LINK, link->len) < 0
+			|| ce_write(&c, newfd, link->buf, link->len) < 0;
+		if (err)
+			return -1;
+	}
+	if (!shared && istate->cache_tree) {
 		struct strbuf sb = STRBUF_INIT;
 
 		cache_tree_write(&sb, istate->cache_tree);
@@ -1516,7 +1728,91 @@ int write_index(const struct index_state *istate, int newfd)
 		if (err)
 			return -1;
 	}
-	return ce_flush(&c, newfd);
+	if (!shared && istate->untracked && core_untracked_cache) {
+		struct strbuf sb = STRBUF_INIT;
+
+		untracked_cache_write(&sb, istate->untracked);
+		err = write_index_ext_header(&c, newfd, CACHE_EXT_UNTRACKED, sb.len) < 0
+			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		strbuf_release(&sb);
+		if (err)
+			return -1;
+	}
+	return ce_flush(&c, newfd, sha1);
+}
+
+/*
+ * Write all entries to a new $GIT_DIR/sharedindex.<SHA-1>, named
+ * after the checksum of its contents.
+ */
+static int write_shared_index(const struct index_state *istate,
+			      unsigned char *sha1)
+{
+	char tmp[PATH_MAX];
+	const char *path;
+	int fd;
+
+	snprintf(tmp, sizeof(tmp), "%s", git_path("sharedindex_XXXXXX"));
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		return error("unable to create temporary shared index: %s",
+			     strerror(errno));
+	if (do_write_index(istate, fd, istate->cache, istate->cache_nr,
+			   NULL, 1, sha1) < 0 || fchmod(fd, 0444) < 0) {
+		close(fd);
+		unlink(tmp);
+		return error("unable to write shared index %s", tmp);
+	}
+	if (close(fd) < 0) {
+		unlink(tmp);
+		return error("unable to write shared index %s", tmp);
+	}
+	adjust_shared_perm(tmp);
+	path = git_path("sharedindex.%s", sha1_to_hex(sha1));
+	if (rename(tmp, path) < 0) {
+		unlink(tmp);
+		return error("unable to rename shared index to %s: %s",
+			     path, strerror(errno));
+	}
+	clean_shared_index_files(sha1);
+	return 0;
+}
+
+static int write_split_index(const struct index_state *istate, int newfd)
+{
+	struct strbuf link = STRBUF_INIT;
+	struct cache_entry **cache = NULL;
+	int i, nr = 0, ret;
+
+	/* Smudge first, so that smudged entries count as changed */
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+		if (!(ce->ce_flags & CE_REMOVE) &&
+		    !ce_uptodate(ce) && is_racy_timestamp(istate, ce))
+			ce_smudge_racily_clean_entry(ce);
+	}
+
+	if (prepare_split_index_write(istate, &cache, &nr, &link) < 0) {
+		unsigned char sha1[20];
+
+		if (write_shared_index(istate, sha1) < 0)
+			return -1;
+		write_link_extension(&link, sha1, NULL, NULL);
+	} else
+		freshen_shared_index(istate->split_index->base_sha1);
+
+	ret = do_write_index(istate, newfd, cache, nr, &link, 0, NULL);
+	free(cache);
+	strbuf_release(&link);
+	return ret;
+}
+
+int write_index(const struct index_state *istate, int newfd)
+{
+	if (core_split_index && istate->split_index)
+		return write_split_index(istate, newfd);
+	return do_write_index(istate, newfd, istate->cache, istate->cache_nr,
+			      NULL, 0, NULL);
 }
 
 /*
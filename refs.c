@@ -6,17 +6,51 @@
 
 /* ISSYMREF=01 and ISPACKED=02 are public interfaces */
 #define REF_KNOWS_PEELED 04
+#define REF_DIR 010
+#define REF_INCOMPLETE 020	/* loose ref directory not read yet */
 
-struct ref_list {
-	struct ref_list *next;
-	unsigned char flag; /* ISSYMREF? ISPACKED? */
+/*
+ * The refs are cached as a tree of directories.  Each directory keeps
+ * its entries in an array sorted by name, so that a ref is found by a
+ * binary search at each level, and iterating over the refs under a
+ * prefix only visits that part of the tree.  The name of an entry is
+ * the full refname; directories are named with a trailing slash, e.g.
+ * "refs/heads/".
+ *
+ * Loose ref directories are only read from the filesystem when they
+ * are first looked at.
+ */
+struct ref_entry;
+
+struct ref_dir {
+	int nr, alloc;
+	int sorted;	/* the first "sorted" entries are in order */
+	struct ref_entry **entries;
+};
+
+struct ref_value {
 	unsigned char sha1[20];
 	unsigned char peeled[20];
+};
+
+struct ref_entry {
+	unsigned char flag; /* ISSYMREF? ISPACKED? DIR? */
+	union {
+		struct ref_value value;	/* if not REF_DIR */
+		struct ref_dir subdir;	/* if REF_DIR */
+	} u;
 	char name[FLEX_ARRAY];
 };
 
-static const char *parse_ref_line(char *line, unsigned char *sha1)
+/*
+ * Parse a "<sha1> <refname>\n" line of packed-refs that starts at
+ * "line"; returns the length of the refname, or -1 if it is not such
+ * a line.
+ */
+static int parse_ref_line(const char *line, const char *end, unsigned char *sha1)
 {
+	const char *eol = memchr(line, '\n', end - line);
+
 	/*
 	 * 42: the answer to everything.
 	 *
@@ -25,126 +59,200 @@ static const char *parse_ref_line(char *line, unsigned char *sha1)
 	 *  +1 (space in between hex and name)
 	 *  +1 (newline at the end of the line)
 	 */
-	int len = strlen(line) - 42;
-
-	if (len <= 0)
-		return NULL;
+	if (!eol || eol - line <= 41)
+		return -1;
 	if (get_sha1_hex(line, sha1) < 0)
-		return NULL;
+		return -1;
 	if (!isspace(line[40]))
-		return NULL;
-	line += 41;
-	if (isspace(*line))
-		return NULL;
-	if (line[len] != '\n')
-		return NULL;
-	line[len] = 0;
-
-	return line;
+		return -1;
+	if (isspace(line[41]))
+		return -1;
+	return eol - line - 41;
 }
 
-static struct ref_list *add_ref(const char *name, const unsigned char *sha1,
-				int flag, struct ref_list *list,
-				struct ref_list **new_entry)
+static struct ref_entry *create_ref_entry_len(const char *name, int len,
+					      const unsigned char *sha1, int flag)
 {
-	int len;
-	struct ref_list *entry;
+	struct ref_entry *entry = xmalloc(sizeof(struct ref_entry) + len + 1);
 
-	/* Allocate it and add it in.. */
-	len = strlen(name) + 1;
-	entry = xmalloc(sizeof(struct ref_list) + len);
-	hashcpy(entry->sha1, sha1);
-	hashclr(entry->peeled);
+	hashcpy(entry->u.value.sha1, sha1);
+	hashclr(entry->u.value.peeled);
 	memcpy(entry->name, name, len);
+	entry->name[len] = '\0';
 	entry->flag = flag;
-	entry->next = list;
-	if (new_entry)
-		*new_entry = entry;
 	return entry;
 }
 
-/* merge sort the ref list */
-static struct ref_list *sort_ref_list(struct ref_list *list)
+static struct ref_entry *create_ref_entry(const char *name,
+					  const unsigned char *sha1, int flag)
 {
-	int psize, qsize, last_merge_count, cmp;
-	struct ref_list *p, *q, *l, *e;
-	struct ref_list *new_list = list;
-	int k = 1;
-	int merge_count = 0;
+	return create_ref_entry_len(name, strlen(name), sha1, flag);
+}
 
-	if (!list)
-		return list;
+static struct ref_entry *create_dir_entry(const char *name, int len,
+					  int incomplete)
+{
+	struct ref_entry *entry = xcalloc(1, sizeof(struct ref_entry) + len + 1);
 
-	do {
-		last_merge_count = merge_count;
-		merge_count = 0;
+	memcpy(entry->name, name, len);
+	entry->flag = REF_DIR | (incomplete ? REF_INCOMPLETE : 0);
+	return entry;
+}
 
-		psize = 0;
+static void free_ref_dir(struct ref_dir *dir);
 
-		p = new_list;
-		q = new_list;
-		new_list = NULL;
-		l = NULL;
+static void free_ref_entry(struct ref_entry *entry)
+{
+	if (entry->flag & REF_DIR)
+		free_ref_dir(&entry->u.subdir);
+	free(entry);
+}
 
-		while (p) {
-			merge_count++;
+static void free_ref_dir(struct ref_dir *dir)
+{
+	int i;
 
-			while (psize < k && q->next) {
-				q = q->next;
-				psize++;
-			}
-			qsize = k;
-
-			while ((psize > 0) || (qsize > 0 && q)) {
-				if (qsize == 0 || !q) {
-					e = p;
-					p = p->next;
-					psize--;
-				} else if (psize == 0) {
-					e = q;
-					q = q->next;
-					qsize--;
-				} else {
-					cmp = strcmp(q->name, p->name);
-					if (cmp < 0) {
-						e = q;
-						q = q->next;
-						qsize--;
-					} else if (cmp > 0) {
-						e = p;
-						p = p->next;
-						psize--;
-					} else {
-						if (hashcmp(q->sha1, p->sha1))
-							die("Duplicated ref, and SHA1s don't match: %s",
-							    q->name);
-						warning("Duplicated ref: %s", q->name);
-						e = q;
-						q = q->next;
-						qsize--;
-						free(e);
-						e = p;
-						p = p->next;
-						psize--;
-					}
-				}
+	for (i = 0; i < dir->nr; i++)
+		free_ref_entry(dir->entries[i]);
+	free(dir->entries);
+	dir->entries = NULL;
+	dir->nr = dir->alloc = dir->sorted = 0;
+}
+
+static void add_entry(struct ref_dir *dir, struct ref_entry *entry)
+{
+	ALLOC_GROW(dir->entries, dir->nr + 1, dir->alloc);
+	dir->entries[dir->nr++] = entry;
+	/* packed-refs is sorted, so reading it keeps every directory sorted */
+	if (dir->sorted == dir->nr - 1 &&
+	    (dir->nr == 1 ||
+	     strcmp(dir->entries[dir->nr - 2]->name, entry->name) < 0))
+		dir->sorted = dir->nr;
+}
 
-				e->next = NULL;
+static int ref_entry_cmp(const void *a_, const void *b_)
+{
+	struct ref_entry *a = *(struct ref_entry **)a_;
+	struct ref_entry *b = *(struct ref_entry **)b_;
+	return strcmp(a->name, b->name);
+}
 
-				if (l)
-					l->next = e;
-				if (!new_list)
-					new_list = e;
-				l = e;
-			}
+static void sort_ref_dir(struct ref_dir *dir)
+{
+	int i, j;
+
+	if (dir->sorted == dir->nr)
+		return;
+	qsort(dir->entries, dir->nr, sizeof(*dir->entries), ref_entry_cmp);
+
+	/* Drop duplicates */
+	for (i = j = 1; i < dir->nr; i++) {
+		struct ref_entry *last = dir->entries[j - 1];
+		struct ref_entry *entry = dir->entries[i];
+
+		if (strcmp(last->name, entry->name)) {
+			dir->entries[j++] = entry;
+			continue;
+		}
+		if (!(entry->flag & REF_DIR)) {
+			if (hashcmp(last->u.value.sha1, entry->u.value.sha1))
+				die("Duplicated ref, and SHA1s don't match: %s",
+				    entry->name);
+			warning("Duplicated ref: %s", entry->name);
+		}
+		free_ref_entry(entry);
+	}
+	dir->nr = dir->sorted = j < dir->nr ? j : dir->nr;
+}
+
+static void read_loose_refs(const char *dirname, struct ref_dir *dir);
+
+/* The entries of a directory, reading a loose ref directory if needed */
+static struct ref_dir *get_ref_dir(struct ref_entry *entry)
+{
+	if (entry->flag & REF_INCOMPLETE) {
+		read_loose_refs(entry->name, &entry->u.subdir);
+		entry->flag &= ~REF_INCOMPLETE;
+	}
+	return &entry->u.subdir;
+}
+
+struct ref_key {
+	const char *name;
+	int len;
+};
+
+static int ref_entry_key_cmp(const void *key_, const void *entry_)
+{
+	const struct ref_key *key = key_;
+	const struct ref_entry *entry = *(const struct ref_entry **)entry_;
+	int cmp = strncmp(key->name, entry->name, key->len);
+
+	if (cmp)
+		return cmp;
+	return '\0' - (unsigned char)entry->name[key->len];
+}
+
+/* Look up the first "len" bytes of "name" among the entries of "dir" */
+static struct ref_entry *search_ref_dir(struct ref_dir *dir,
+					const char *name, int len)
+{
+	struct ref_entry **found;
+	struct ref_key key;
 
-			p = q;
-		};
+	if (!dir->nr)
+		return NULL;
+	sort_ref_dir(dir);
+	key.name = name;
+	key.len = len;
+	found = bsearch(&key, dir->entries, dir->nr, sizeof(*dir->entries),
+			ref_entry_key_cmp);
+	return found ? *found : NULL;
+}
+
+/*
+ * Return the directory that would hold "refname", i.e. the one named
+ * by its part up to the last slash.  Missing directories are created
+ * if "mkdir" is set, otherwise NULL is returned.
+ */
+static struct ref_dir *find_containing_dir(struct ref_dir *dir,
+					   const char *refname, int mkdir)
+{
+	const char *slash;
+
+	for (slash = strchr(refname, '/'); slash; slash = strchr(slash + 1, '/')) {
+		int len = slash - refname + 1;
+		struct ref_entry *entry = search_ref_dir(dir, refname, len);
+
+		if (!entry) {
+			if (!mkdir)
+				return NULL;
+			entry = create_dir_entry(refname, len, 0);
+			add_entry(dir, entry);
+		}
+		dir = get_ref_dir(entry);
+	}
+	return dir;
+}
+
+static struct ref_entry *find_ref(struct ref_dir *dir, const char *refname)
+{
+	struct ref_entry *entry;
+
+	dir = find_containing_dir(dir, refname, 0);
+	if (!dir)
+		return NULL;
+	entry = search_ref_dir(dir, refname, strlen(refname));
+	return (entry && !(entry->flag & REF_DIR)) ? entry : NULL;
+}
 
-		k = k * 2;
-	} while ((last_merge_count != merge_count) || (last_merge_count != 1));
+static struct ref_entry *add_ref(struct ref_dir *dir, const char *name, int len,
+				 const unsigned char *sha1, int flag)
+{
+	struct ref_entry *entry = create_ref_entry_len(name, len, sha1, flag);
 
-	return new_list;
+	add_entry(find_containing_dir(dir, entry->name, 1), entry);
+	return entry;
 }
 
 /*
@@ -154,146 +262,295 @@ static struct ref_list *sort_ref_list(struct ref_list *list)
 static struct cached_refs {
 	char did_loose;
 	char did_packed;
-	struct ref_list *loose;
-	struct ref_list *packed;
+	struct ref_entry *loose;
+	struct ref_dir packed;
 } cached_refs;
-static struct ref_list *current_ref;
 
-static struct ref_list *extra_refs;
+/*
+ * packed-refs as it is on disk.  Single refs are looked up in it
+ * directly with a binary search when it is known to be sorted, so
+ * that reading one ref does not need to parse the whole file.
+ */
+struct packed_refs_file {
+	char *map;
+	size_t size;
+	const char *records, *end;	/* the lines after the header */
+	int flag;			/* REF_ISPACKED and traits */
+	int sorted;
+};
 
-static void free_ref_list(struct ref_list *list)
-{
-	struct ref_list *next;
-	for ( ; list; list = next) {
-		next = list->next;
-		free(list);
-	}
-}
+static struct packed_refs_file packed_file;
+static int did_packed_file;
+static struct ref_entry *current_ref;
+
+static struct ref_dir extra_refs;
 
 static void invalidate_cached_refs(void)
 {
 	struct cached_refs *ca = &cached_refs;
 
-	if (ca->did_loose && ca->loose)
-		free_ref_list(ca->loose);
-	if (ca->did_packed && ca->packed)
-		free_ref_list(ca->packed);
-	ca->loose = ca->packed = NULL;
+	if (ca->loose)
+		free_ref_entry(ca->loose);
+	free_ref_dir(&ca->packed);
+	ca->loose = NULL;
 	ca->did_loose = ca->did_packed = 0;
+
+	if (packed_file.map)
+		munmap(packed_file.map, packed_file.size);
+	memset(&packed_file, 0, sizeof(packed_file));
+	did_packed_file = 0;
 }
 
-static void read_packed_refs(FILE *f, struct cached_refs *cached_refs)
+static int open_packed_refs(const char *path, struct packed_refs_file *file)
 {
-	struct ref_list *list = NULL;
-	struct ref_list *last = NULL;
-	char refline[PATH_MAX];
-	int flag = REF_ISPACKED;
+	static const char header[] = "# pack-refs with:";
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	const char *eol;
 
-	while (fgets(refline, sizeof(refline), f)) {
+	memset(file, 0, sizeof(*file));
+	file->flag = REF_ISPACKED;
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+	file->size = xsize_t(st.st_size);
+	if (file->size)
+		file->map = xmmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	file->records = file->map;
+	file->end = file->records + file->size;
+
+	if (file->size >= sizeof(header) - 1 &&
+	    !memcmp(file->map, header, sizeof(header) - 1) &&
+	    (eol = memchr(file->map, '\n', file->size))) {
+		struct strbuf traits = STRBUF_INIT;
+
+		strbuf_add(&traits, file->map + sizeof(header) - 1,
+			   eol - file->map - (sizeof(header) - 1));
+		if (strstr(traits.buf, " peeled "))
+			file->flag |= REF_KNOWS_PEELED;
+		/* Without a final newline, a search could run off the end */
+		if (strstr(traits.buf, " sorted ") && file->end[-1] == '\n')
+			file->sorted = 1;
+		/* perhaps other traits later as well */
+		strbuf_release(&traits);
+		file->records = eol + 1;
+	}
+	return 0;
+}
+
+static void close_packed_refs(struct packed_refs_file *file)
+{
+	if (file->map)
+		munmap(file->map, file->size);
+	memset(file, 0, sizeof(*file));
+}
+
+static void read_packed_refs(const struct packed_refs_file *file,
+			     struct ref_dir *dir)
+{
+	struct ref_entry *last = NULL;
+	const char *line, *next;
+
+	for (line = file->records; line < file->end; line = next) {
 		unsigned char sha1[20];
-		const char *name;
-		static const char header[] = "# pack-refs with:";
-
-		if (!strncmp(refline, header, sizeof(header)-1)) {
-			const char *traits = refline + sizeof(header) - 1;
-			if (strstr(traits, " peeled "))
-				flag |= REF_KNOWS_PEELED;
-			/* perhaps other traits later as well */
-			continue;
-		}
+		int len;
 
-		name = parse_ref_line(refline, sha1);
-		if (name) {
-			list = add_ref(name, sha1, flag, list, &last);
+		next = memchr(line, '\n', file->end - line);
+		next = next ? next + 1 : file->end;
+
+		len = parse_ref_line(line, file->end, sha1);
+		if (0 <= len) {
+			last = add_ref(dir, line + 41, len, sha1, file->flag);
 			continue;
 		}
 		if (last &&
-		    refline[0] == '^' &&
-		    strlen(refline) == 42 &&
-		    refline[41] == '\n' &&
-		    !get_sha1_hex(refline + 1, sha1))
-			hashcpy(last->peeled, sha1);
+		    line[0] == '^' &&
+		    next - line == 42 &&
+		    line[41] == '\n' &&
+		    !get_sha1_hex(line + 1, sha1))
+			hashcpy(last->u.value.peeled, sha1);
 	}
-	cached_refs->packed = sort_ref_list(list);
 }
 
+/* Compare the refname of the record at "rec" with "refname" */
+static int cmp_packed_ref(const char *rec, const char *end, const char *refname)
+{
+	const unsigned char *r = (const unsigned char *)rec + 41;
+	const unsigned char *n = (const unsigned char *)refname;
+
+	for (; (const char *)r < end; r++, n++) {
+		if (*r == '\n')
+			return *n ? -1 : 0;
+		if (!*n)
+			return 1;
+		if (*r != *n)
+			return *r - *n;
+	}
+	return *n ? -1 : 0;
+}
+
+/*
+ * The record containing "p" starts after a newline that is not
+ * followed by the "^" of a peeled line.
+ */
+static const char *packed_record_start(const char *start, const char *p)
+{
+	while (p > start && (p[-1] != '\n' || p[0] == '^'))
+		p--;
+	return p;
+}
+
+static const char *packed_record_end(const char *p, const char *end)
+{
+	while (++p < end && (p[-1] != '\n' || p[0] == '^'))
+		;
+	return p;
+}
+
+/*
+ * Binary search a sorted packed-refs for "refname" without parsing
+ * the rest of it.  Returns 0 and fills "value" if it is found.
+ */
+static int search_packed_refs(const struct packed_refs_file *file,
+			      const char *refname, struct ref_value *value)
+{
+	const char *lo = file->records, *hi = file->end;
+
+	while (lo < hi) {
+		const char *rec = packed_record_start(lo, lo + (hi - lo) / 2);
+		int cmp = cmp_packed_ref(rec, hi, refname);
+
+		if (cmp < 0)
+			lo = packed_record_end(rec, hi);
+		else if (cmp > 0)
+			hi = rec;
+		else {
+			const char *peeled = packed_record_end(rec, file->end) - 42;
+
+			if (parse_ref_line(rec, file->end, value->sha1) < 0)
+				return -1;
+			hashclr(value->peeled);
+			if (peeled > rec && peeled[0] == '^')
+				get_sha1_hex(peeled + 1, value->peeled);
+			return 0;
+		}
+	}
+	return -1;
+}
 void add_extra_ref(const char *name, const unsigned char *sha1, int flag)
 {
-	extra_refs = add_ref(name, sha1, flag, extra_refs, NULL);
+	add_entry(&extra_refs, create_ref_entry(name, sha1, flag));
 }
 
 void clear_extra_refs(void)
 {
-	free_ref_list(extra_refs);
-	extra_refs = NULL;
+	free_ref_dir(&extra_refs);
+}
+
+static struct packed_refs_file *get_packed_refs_file(void)
+{
+	if (!did_packed_file) {
+		open_packed_refs(git_path("packed-refs"), &packed_file);
+		did_packed_file = 1;
+	}
+	return &packed_file;
 }
 
-static struct ref_list *get_packed_refs(void)
+static struct ref_dir *get_packed_refs(void)
 {
 	if (!cached_refs.did_packed) {
-		FILE *f = fopen(git_path("packed-refs"), "r");
-		cached_refs.packed = NULL;
-		if (f) {
-			read_packed_refs(f, &cached_refs);
-			fclose(f);
-		}
+		read_packed_refs(get_packed_refs_file(), &cached_refs.packed);
 		cached_refs.did_packed = 1;
 	}
-	return cached_refs.packed;
+	return &cached_refs.packed;
 }
 
-static struct ref_list *get_ref_dir(const char *base, struct ref_list *list)
+/*
+ * Look up one packed ref.  Unless all packed refs were read already,
+ * or packed-refs is not known to be sorted, this is a binary search
+ * of the file that allocates nothing.
+ */
+static int find_packed_ref(const char *refname, struct ref_value *value,
+			   int *flag)
 {
-	DIR *dir = opendir(git_path("%s", base));
-
-	if (dir) {
-		struct dirent *de;
-		int baselen = strlen(base);
-		char *ref = xmalloc(baselen + 257);
+	struct packed_refs_file *file = get_packed_refs_file();
+	struct ref_entry *entry;
 
-		memcpy(ref, base, baselen);
-		if (baselen && base[baselen-1] != '/')
-			ref[baselen++] = '/';
+	if (!cached_refs.did_packed && file->sorted) {
+		if (search_packed_refs(file, refname, value))
+			return -1;
+		*flag = file->flag;
+		return 0;
+	}
+	entry = find_ref(get_packed_refs(), refname);
+	if (!entry)
+		return -1;
+	*value = entry->u.value;
+	*flag = entry->flag;
+	return 0;
+}
 
-		while ((de = readdir(dir)) != NULL) {
-			unsigned char sha1[20];
-			struct stat st;
-			int flag;
-			int namelen;
+/*
+ * Read one level of a loose ref directory; its subdirectories are
+ * added as entries to be read when they are first looked at.
+ */
+static void read_loose_refs(const char *dirname, struct ref_dir *dir)
+{
+	DIR *d = opendir(git_path("%s", dirname));
+	struct dirent *de;
+	int dirnamelen;
+	char *ref;
+
+	if (!d)
+		return;
+	dirnamelen = strlen(dirname);
+	ref = xmalloc(dirnamelen + 257);
+	memcpy(ref, dirname, dirnamelen);
+
+	while ((de = readdir(d)) != NULL) {
+		unsigned char sha1[20];
+		struct stat st;
+		int flag;
+		int namelen;
 
-			if (de->d_name[0] == '.')
-				continue;
-			namelen = strlen(de->d_name);
-			if (namelen > 255)
-				continue;
-			if (has_extension(de->d_name, ".lock"))
-				continue;
-			memcpy(ref + baselen, de->d_name, namelen+1);
-			if (stat(git_path("%s", ref), &st) < 0)
-				continue;
-			if (S_ISDIR(st.st_mode)) {
-				list = get_ref_dir(ref, list);
-				continue;
-			}
-			if (!resolve_ref(ref, sha1, 1, &flag)) {
-				error("%s points nowhere!", ref);
-				continue;
-			}
-			list = add_ref(ref, sha1, flag, list, NULL);
+		if (de->d_name[0] == '.')
+			continue;
+		namelen = strlen(de->d_name);
+		if (namelen > 255)
+			continue;
+		if (has_extension(de->d_name, ".lock"))
+			continue;
+		memcpy(ref + dirnamelen, de->d_name, namelen+1);
+		if (stat(git_path("%s", ref), &st) < 0)
+			continue;
+		if (S_ISDIR(st.st_mode)) {
+			ref[dirnamelen + namelen] = '/';
+			add_entry(dir, create_dir_entry(ref, dirnamelen + namelen + 1, 1));
+			continue;
 		}
-		free(ref);
-		closedir(dir);
+		if (!resolve_ref(ref, sha1, 1, &flag)) {
+			error("%s points nowhere!", ref);
+			continue;
+		}
+		add_entry(dir, create_ref_entry(ref, sha1, flag));
 	}
-	return sort_ref_list(list);
+	free(ref);
+	closedir(d);
 }
 
-static struct ref_list *get_loose_refs(void)
+static struct ref_dir *get_loose_refs(void)
 {
 	if (!cached_refs.did_loose) {
-		cached_refs.loose = get_ref_dir("refs", NULL);
+		cached_refs.loose = create_dir_entry("", 0, 0);
+		add_entry(&cached_refs.loose->u.subdir,
+			  create_dir_entry("refs/", 5, 1));
 		cached_refs.did_loose = 1;
 	}
-	return cached_refs.loose;
+	return &cached_refs.loose->u.subdir;
 }
 
 /* We allow "recursive" symbolic refs. Only within reason, though */
@@ -302,28 +559,32 @@ static struct ref_list *get_loose_refs(void)
 
 static int resolve_gitlink_packed_ref(char *name, int pathlen, const char *refname, unsigned char *result)
 {
-	FILE *f;
-	struct cached_refs refs;
-	struct ref_list *ref;
-	int retval;
+	struct packed_refs_file file;
+	struct ref_value value;
+	int retval = -1;
 
 	strcpy(name + pathlen, "packed-refs");
-	f = fopen(name, "r");
-	if (!f)
+	if (open_packed_refs(name, &file))
 		return -1;
-	read_packed_refs(f, &refs);
-	fclose(f);
-	ref = refs.packed;
-	retval = -1;
-	while (ref) {
-		if (!strcmp(ref->name, refname)) {
+	if (file.sorted) {
+		if (!search_packed_refs(&file, refname, &value)) {
+			hashcpy(result, value.sha1);
 			retval = 0;
-			memcpy(result, ref->sha1, 20);
-			break;
 		}
-		ref = ref->next;
+	} else {
+		struct ref_dir refs;
+		struct ref_entry *ref;
+
+		memset(&refs, 0, sizeof(refs));
+		read_packed_refs(&file, &refs);
+		ref = find_ref(&refs, refname);
+		if (ref) {
+			hashcpy(result, ref->u.value.sha1);
+			retval = 0;
+		}
+		free_ref_dir(&refs);
 	}
-	free_ref_list(refs.packed);
+	close_packed_refs(&file);
 	return retval;
 }
 
@@ -424,15 +685,13 @@ const char *resolve_ref(const char *ref, unsigned char *sha1, int reading, int *
 		git_snpath(path, sizeof(path), "%s", ref);
 		/* Special case: non-existing file. */
 		if (lstat(path, &st) < 0) {
-			struct ref_list *list = get_packed_refs();
-			while (list) {
-				if (!strcmp(ref, list->name)) {
-					hashcpy(sha1, list->sha1);
-					if (flag)
-						*flag |= REF_ISPACKED;
-					return ref;
-				}
-				list = list->next;
+			struct ref_value value;
+			int packed_flag;
+			if (!find_packed_ref(ref, &value, &packed_flag)) {
+				hashcpy(sha1, value.sha1);
+				if (flag)
+					*flag |= REF_ISPACKED;
+				return ref;
 			}
 			if (reading || errno != ENOENT)
 				return NULL;
@@ -499,18 +758,18 @@ int read_ref(const char *ref, unsigned char *sha1)
 }
 
 static int do_one_ref(const char *base, each_ref_fn fn, int trim,
-		      void *cb_data, struct ref_list *entry)
+		      void *cb_data, struct ref_entry *entry)
 {
 	if (strncmp(base, entry->name, trim))
 		return 0;
-	if (is_null_sha1(entry->sha1))
+	if (is_null_sha1(entry->u.value.sha1))
 		return 0;
-	if (!has_sha1_file(entry->sha1)) {
+	if (!has_sha1_file(entry->u.value.sha1)) {
 		error("%s does not point to a valid object!", entry->name);
 		return 0;
 	}
 	current_ref = entry;
-	return fn(entry->name + trim, entry->sha1, entry->flag, cb_data);
+	return fn(entry->name + trim, entry->u.value.sha1, entry->flag, cb_data);
 }
 
 int peel_ref(const char *ref, unsigned char *sha1)
@@ -522,10 +781,10 @@ int peel_ref(const char *ref, unsigned char *sha1)
 	if (current_ref && (current_ref->name == ref
 		|| !strcmp(current_ref->name, ref))) {
 		if (current_ref->flag & REF_KNOWS_PEELED) {
-			hashcpy(sha1, current_ref->peeled);
+			hashcpy(sha1, current_ref->u.value.peeled);
 			return 0;
 		}
-		hashcpy(base, current_ref->sha1);
+		hashcpy(base, current_ref->u.value.sha1);
 		goto fallback;
 	}
 
@@ -533,18 +792,14 @@ int peel_ref(const char *ref, unsigned char *sha1)
 		return -1;
 
 	if ((flag & REF_ISPACKED)) {
-		struct ref_list *list = get_packed_refs();
+		struct ref_value value;
+		int packed_flag;
 
-		while (list) {
-			if (!strcmp(list->name, ref)) {
-				if (list->flag & REF_KNOWS_PEELED) {
-					hashcpy(sha1, list->peeled);
-					return 0;
-				}
-				/* older pack-refs did not leave peeled ones */
-				break;
-			}
-			list = list->next;
+		/* older pack-refs did not leave peeled ones */
+		if (!find_packed_ref(ref, &value, &packed_flag) &&
+		    (packed_flag & REF_KNOWS_PEELED)) {
+			hashcpy(sha1, value.peeled);
+			return 0;
 		}
 	}
 
@@ -560,44 +815,69 @@ fallback:
 	return -1;
 }
 
-static int do_for_each_ref(const char *base, each_ref_fn fn, int trim,
-			   void *cb_data)
+/*
+ * Call fn for the refs in "packed" and "loose" (either may be NULL)
+ * and their subdirectories in order; a loose ref hides the packed
+ * one of the same name.
+ */
+static int do_for_each_ref_in_dirs(struct ref_dir *packed, struct ref_dir *loose,
+				   const char *base, each_ref_fn fn, int trim,
+				   void *cb_data)
 {
-	int retval = 0;
-	struct ref_list *packed = get_packed_refs();
-	struct ref_list *loose = get_loose_refs();
-
-	struct ref_list *extra;
+	int i = 0, j = 0, retval = 0;
 
-	for (extra = extra_refs; extra; extra = extra->next)
-		retval = do_one_ref(base, fn, trim, cb_data, extra);
+	if (packed)
+		sort_ref_dir(packed);
+	if (loose)
+		sort_ref_dir(loose);
+	for (;;) {
+		struct ref_entry *p = packed && i < packed->nr ? packed->entries[i] : NULL;
+		struct ref_entry *l = loose && j < loose->nr ? loose->entries[j] : NULL;
+		struct ref_dir *psub = NULL, *lsub = NULL;
+		int cmp;
 
-	while (packed && loose) {
-		struct ref_list *entry;
-		int cmp = strcmp(packed->name, loose->name);
-		if (!cmp) {
-			packed = packed->next;
-			continue;
+		if (!p && !l)
+			return 0;
+		cmp = !p ? 1 : !l ? -1 : strcmp(p->name, l->name);
+		if (cmp <= 0) {
+			i++;
+			if (p->flag & REF_DIR)
+				psub = get_ref_dir(p);
 		}
-		if (cmp > 0) {
-			entry = loose;
-			loose = loose->next;
-		} else {
-			entry = packed;
-			packed = packed->next;
+		if (cmp >= 0) {
+			j++;
+			if (l->flag & REF_DIR)
+				lsub = get_ref_dir(l);
 		}
-		retval = do_one_ref(base, fn, trim, cb_data, entry);
-		if (retval)
-			goto end_each;
-	}
 
-	for (packed = packed ? packed : loose; packed; packed = packed->next) {
-		retval = do_one_ref(base, fn, trim, cb_data, packed);
+		if (psub || lsub)
+			retval = do_for_each_ref_in_dirs(psub, lsub, base, fn,
+							 trim, cb_data);
+		else
+			retval = do_one_ref(base, fn, trim, cb_data,
+					    cmp < 0 ? p : l);
 		if (retval)
-			goto end_each;
+			return retval;
 	}
+}
 
-end_each:
+static int do_for_each_ref(const char *base, each_ref_fn fn, int trim,
+			   void *cb_data)
+{
+	int i, retval = 0;
+	struct ref_dir *packed, *loose;
+	char *prefix;
+
+	for (i = 0; i < extra_refs.nr; i++)
+		retval = do_one_ref(base, fn, trim, cb_data, extra_refs.entries[i]);
+
+	/* Only look at the part of the tree that holds the prefix */
+	prefix = xstrndup(base, trim);
+	packed = find_containing_dir(get_packed_refs(), prefix, 0);
+	loose = find_containing_dir(get_loose_refs(), prefix, 0);
+	free(prefix);
+
+	retval = do_for_each_ref_in_dirs(packed, loose, base, fn, trim, cb_data);
 	current_ref = NULL;
 	return retval;
 }
@@ -617,6 +897,11 @@ int for_each_ref(each_ref_fn fn, void *cb_data)
 	return do_for_each_ref("refs/", fn, 0, cb_data);
 }
 
+int for_each_ref_in(const char *prefix, each_ref_fn fn, void *cb_data)
+{
+	return do_for_each_ref(prefix, fn, strlen(prefix), cb_data);
+}
+
 int for_each_tag_ref(each_ref_fn fn, void *cb_data)
 {
 	return do_for_each_ref("refs/tags/", fn, 10, cb_data);
@@ -767,25 +1052,58 @@ static int remove_empty_directories(const char *file)
 	return result;
 }
 
+/* Find a ref in the tree under "dir" that is not "skip" */
+static struct ref_entry *find_other_ref(struct ref_dir *dir, const char *skip)
+{
+	int i;
+
+	for (i = 0; i < dir->nr; i++) {
+		struct ref_entry *entry = dir->entries[i];
+
+		if (entry->flag & REF_DIR) {
+			entry = find_other_ref(get_ref_dir(entry), skip);
+			if (entry)
+				return entry;
+		} else if (!skip || strcmp(skip, entry->name))
+			return entry;
+	}
+	return NULL;
+}
+
+/*
+ * A ref "foo/bar" cannot be created if there is a ref "foo", or refs
+ * under "foo/bar/"; "oldref" is about to go away and does not count.
+ */
 static int is_refname_available(const char *ref, const char *oldref,
-				struct ref_list *list, int quiet)
-{
-	int namlen = strlen(ref); /* e.g. 'foo/bar' */
-	while (list) {
-		/* list->name could be 'foo' or 'foo/bar/baz' */
-		if (!oldref || strcmp(oldref, list->name)) {
-			int len = strlen(list->name);
-			int cmplen = (namlen < len) ? namlen : len;
-			const char *lead = (namlen < len) ? list->name : ref;
-			if (!strncmp(ref, list->name, cmplen) &&
-			    lead[cmplen] == '/') {
-				if (!quiet)
-					error("'%s' exists; cannot create '%s'",
-					      list->name, ref);
-				return 0;
-			}
-		}
-		list = list->next;
+				struct ref_dir *dir, int quiet)
+{
+	struct strbuf name = STRBUF_INIT;
+	struct ref_entry *entry = NULL;
+	const char *slash;
+
+	for (slash = strchr(ref, '/'); slash; slash = strchr(slash + 1, '/')) {
+		strbuf_reset(&name);
+		strbuf_add(&name, ref, slash - ref);
+		entry = find_ref(dir, name.buf);
+		if (entry && (!oldref || strcmp(oldref, entry->name)))
+			break;
+		entry = NULL;
+	}
+	if (!entry) {
+		struct ref_dir *subdir;
+
+		strbuf_reset(&name);
+		strbuf_addf(&name, "%s/", ref);
+		subdir = find_containing_dir(dir, name.buf, 0);
+		if (subdir)
+			entry = find_other_ref(subdir, oldref);
+	}
+	strbuf_release(&name);
+	if (entry) {
+		if (!quiet)
+			error("'%s' exists; cannot create '%s'",
+			      entry->name, ref);
+		return 0;
 	}
 	return 1;
 }
@@ -888,38 +1206,54 @@ struct ref_lock *lock_any_ref_for_update(const char *ref, const unsigned char *o
 
 static struct lock_file packlock;
 
-static int repack_without_ref(const char *refname)
+static void write_packed_dir(int fd, struct ref_dir *dir, const char *skip)
 {
-	struct ref_list *list, *packed_ref_list;
-	int fd;
-	int found = 0;
+	int i;
 
-	packed_ref_list = get_packed_refs();
-	for (list = packed_ref_list; list; list = list->next) {
-		if (!strcmp(refname, list->name)) {
-			found = 1;
-			break;
-		}
-	}
-	if (!found)
-		return 0;
-	fd = hold_lock_file_for_update(&packlock, git_path("packed-refs"), 0);
-	if (fd < 0)
-		return error("cannot delete '%s' from packed refs", refname);
-
-	for (list = packed_ref_list; list; list = list->next) {
+	sort_ref_dir(dir);
+	for (i = 0; i < dir->nr; i++) {
+		struct ref_entry *entry = dir->entries[i];
 		char line[PATH_MAX + 100];
 		int len;
 
-		if (!strcmp(refname, list->name))
+		if (entry->flag & REF_DIR) {
+			write_packed_dir(fd, &entry->u.subdir, skip);
+			continue;
+		}
+		if (!strcmp(skip, entry->name))
 			continue;
 		len = snprintf(line, sizeof(line), "%s %s\n",
-			       sha1_to_hex(list->sha1), list->name);
+			       sha1_to_hex(entry->u.value.sha1), entry->name);
 		/* this should not happen but just being defensive */
 		if (len > sizeof(line))
-			die("too long a refname '%s'", list->name);
+			die("too long a refname '%s'", entry->name);
 		write_or_die(fd, line, len);
+		if ((entry->flag & REF_KNOWS_PEELED) &&
+		    !is_null_sha1(entry->u.value.peeled)) {
+			len = sprintf(line, "^%s\n",
+				      sha1_to_hex(entry->u.value.peeled));
+			write_or_die(fd, line, len);
+		}
 	}
+}
+
+static int repack_without_ref(const char *refname)
+{
+	struct ref_dir *packed = get_packed_refs();
+	const char *header;
+	int fd;
+
+	if (!find_ref(packed, refname))
+		return 0;
+	fd = hold_lock_file_for_update(&packlock, git_path("packed-refs"), 0);
+	if (fd < 0)
+		return error("cannot delete '%s' from packed refs", refname);
+	/* We write the refs in order, and keep what we knew of peeled tags */
+	header = (packed_file.flag & REF_KNOWS_PEELED)
+		? "# pack-refs with: peeled sorted \n"
+		: "# pack-refs with: sorted \n";
+	write_or_die(fd, header, strlen(header));
+	write_packed_dir(fd, packed, refname);
 	return commit_lock_file(&packlock);
 }
 
@@ -241,16 +241,13 @@ static struct commit *handle_commit(struct rev_info *revs, struct object *object
 	die("%s is unknown object", name);
 }
 
-static int everybody_uninteresting(struct commit_list *orig)
+static int everybody_uninteresting(struct commit_queue *queue)
 {
-	struct commit_list *list = orig;
-	while (list) {
-		struct commit *commit = list->item;
-		list = list->next;
-		if (commit->object.flags & UNINTERESTING)
-			continue;
-		return 0;
-	}
+	int i;
+
+	for (i = 0; i < queue->nr; i++)
+		if (!(queue->array[i].commit->object.flags & UNINTERESTING))
+			return 0;
 	return 1;
 }
 
@@ -441,26 +438,11 @@ static void try_to_simplify_commit(struct rev_info *revs, struct commit *commit)
 	commit->object.flags |= TREESAME;
 }
 
-static void insert_by_date_cached(struct commit *p, struct commit_list **head,
-		    struct commit_list *cached_base, struct commit_list **cache)
-{
-	struct commit_list *new_entry;
-
-	if (cached_base && p->date < cached_base->item->date)
-		new_entry = insert_by_date(p, &cached_base->next);
-	else
-		new_entry = insert_by_date(p, head);
-
-	if (cache && (!*cache || p->date < (*cache)->item->date))
-		*cache = new_entry;
-}
-
-static int add_parents_to_list(struct rev_info *revs, struct commit *commit,
-		    struct commit_list **list, struct commit_list **cache_ptr)
+static int add_parents_to_queue(struct rev_info *revs, struct commit *commit,
+				struct commit_queue *queue)
 {
 	struct commit_list *parent = commit->parents;
 	unsigned left_flag;
-	struct commit_list *cached_base = cache_ptr ? *cache_ptr : NULL;
 
 	if (commit->object.flags & ADDED)
 		return 0;
@@ -491,7 +473,7 @@ static int add_parents_to_list(struct rev_info *revs, struct commit *commit,
 			if (p->object.flags & SEEN)
 				continue;
 			p->object.flags |= SEEN;
-			insert_by_date_cached(p, list, cached_base, cache_ptr);
+			commit_queue_put(queue, p);
 		}
 		return 0;
 	}
@@ -518,7 +500,7 @@ static int add_parents_to_list(struct rev_info *revs, struct commit *commit,
 		p->object.flags |= left_flag;
 		if (!(p->object.flags & SEEN)) {
 			p->object.flags |= SEEN;
-			insert_by_date_cached(p, list, cached_base, cache_ptr);
+			commit_queue_put(queue, p);
 		}
 		if (revs->first_parent_only)
 			break;
@@ -614,19 +596,47 @@ static void cherry_pick_list(struct commit_list *list, struct rev_info *revs)
 /* How many extra uninteresting commits we want to see.. */
 #define SLOP 5
 
-static int still_interesting(struct commit_list *src, unsigned long date, int slop)
+/*
+ * Can any commit in the list still reach a commit whose generation
+ * is "generation" or more?  Commits that are not in the commit-graph
+ * have an unknown generation and might.
+ */
+static int none_reaches_generation(struct commit_queue *queue,
+				   unsigned int generation)
+{
+	int i;
+
+	for (i = 0; i < queue->nr; i++) {
+		unsigned int g = commit_generation(queue->array[i].commit);
+		if (g == GENERATION_NUMBER_INFINITY || g > generation)
+			return 0;
+	}
+	return 1;
+}
+
+static int still_interesting(struct commit_queue *src, unsigned long date,
+			     unsigned int generation, int slop)
 {
 	/*
 	 * No source list at all? We're definitely done..
 	 */
-	if (!src)
+	if (!src->nr)
+		return 0;
+
+	/*
+	 * Only uninteresting commits are left, and none of them can
+	 * reach what we have already collected? Done, without having
+	 * to trust the commit dates.
+	 */
+	if (everybody_uninteresting(src) &&
+	    none_reaches_generation(src, generation))
 		return 0;
 
 	/*
 	 * Does the destination list contain entries with a date
 	 * before the source list? Definitely _not_ done.
 	 */
-	if (date < src->item->date)
+	if (date < commit_queue_peek(src)->date)
 		return SLOP;
 
 	/*
@@ -644,38 +654,43 @@ static int limit_list(struct rev_info *revs)
 {
 	int slop = SLOP;
 	unsigned long date = ~0ul;
-	struct commit_list *list = revs->commits;
+	unsigned int generation = GENERATION_NUMBER_INFINITY;
+	struct commit_queue queue = { NULL };
 	struct commit_list *newlist = NULL;
 	struct commit_list **p = &newlist;
+	struct commit *commit;
 
-	while (list) {
-		struct commit_list *entry = list;
-		struct commit *commit = list->item;
+	while ((commit = pop_commit(&revs->commits)))
+		commit_queue_put(&queue, commit);
+
+	while ((commit = commit_queue_get(&queue))) {
 		struct object *obj = &commit->object;
 		show_early_output_fn_t show;
 
-		list = list->next;
-		free(entry);
-
 		if (revs->max_age != -1 && (commit->date < revs->max_age))
 			obj->flags |= UNINTERESTING;
-		if (add_parents_to_list(revs, commit, &list, NULL) < 0)
+		if (add_parents_to_queue(revs, commit, &queue) < 0) {
+			clear_commit_queue(&queue);
 			return -1;
+		}
 		if (obj->flags & UNINTERESTING) {
 			mark_parents_uninteresting(commit);
 			if (revs->show_all)
 				p = &commit_list_insert(commit, p)->next;
-			slop = still_interesting(list, date, slop);
+			slop = still_interesting(&queue, date, generation, slop);
 			if (slop)
 				continue;
 			/* If showing all, add the whole pending list to the end */
 			if (revs->show_all)
-				*p = list;
+				while ((commit = commit_queue_get(&queue)))
+					p = &commit_list_insert(commit, p)->next;
 			break;
 		}
 		if (revs->min_age != -1 && (commit->date > revs->min_age))
 			continue;
 		date = commit->date;
+		if (commit_generation(commit) < generation)
+			generation = commit_generation(commit);
 		p = &commit_list_insert(commit, p)->next;
 
 		show = show_early_output;
@@ -685,6 +700,7 @@ static int limit_list(struct rev_info *revs)
 		show(revs, newlist);
 		show_early_output = NULL;
 	}
+	clear_commit_queue(&queue);
 	if (revs->cherry_pick)
 		cherry_pick_list(newlist, revs);
 
@@ -1589,23 +1605,34 @@ int prepare_revision_walk(struct rev_info *revs)
 {
 	int nr = revs->pending.nr;
 	struct object_array_entry *e, *list;
+	struct commit_queue queue = { NULL };
+	struct commit_list **tail = &revs->commits;
+	struct commit *commit;
+
+	while ((commit = pop_commit(&revs->commits)))
+		commit_queue_put(&queue, commit);
 
 	e = list = revs->pending.objects;
 	revs->pending.nr = 0;
 	revs->pending.alloc = 0;
 	revs->pending.objects = NULL;
 	while (--nr >= 0) {
-		struct commit *commit = handle_commit(revs, e->item, e->name);
+		commit = handle_commit(revs, e->item, e->name);
 		if (commit) {
 			if (!(commit->object.flags & SEEN)) {
 				commit->object.flags |= SEEN;
-				insert_by_date(commit, &revs->commits);
+				commit_queue_put(&queue, commit);
 			}
 		}
 		e++;
 	}
 	free(list);
 
+	/* Start with the most recent commits */
+	while ((commit = commit_queue_get(&queue)))
+		tail = &commit_list_insert(commit, tail)->next;
+	clear_commit_queue(&queue);
+
 	if (revs->no_walk)
 		return 0;
 	if (revs->limited)
@@ -1628,12 +1655,10 @@ enum rewrite_result {
 
 static enum rewrite_result rewrite_one(struct rev_info *revs, struct commit **pp)
 {
-	struct commit_list *cache = NULL;
-
 	for (;;) {
 		struct commit *p = *pp;
 		if (!revs->limited)
-			if (add_parents_to_list(revs, p, &revs->commits, &cache) < 0)
+			if (add_parents_to_queue(revs, p, &revs->queue) < 0)
 				return rewrite_one_error;
 		if (p->parents && p->parents->next)
 			return rewrite_one_ok;
@@ -1715,15 +1740,24 @@ enum commit_action simplify_commit(struct rev_info *revs, struct commit *commit)
 
 static struct commit *get_revision_1(struct rev_info *revs)
 {
-	if (!revs->commits)
-		return NULL;
-
-	do {
-		struct commit_list *entry = revs->commits;
-		struct commit *commit = entry->item;
+	for (;;) {
+		struct commit *commit;
 
-		revs->commits = entry->next;
-		free(entry);
+		/*
+		 * A limited walk has already put the commits to show in
+		 * order; otherwise the ones given to us join the queue
+		 * of those still to walk.
+		 */
+		if (revs->limited)
+			commit = pop_commit(&revs->commits);
+		else {
+			while (revs->commits)
+				commit_queue_put(&revs->queue,
+						 pop_commit(&revs->commits));
+			commit = commit_queue_get(&revs->queue);
+		}
+		if (!commit)
+			return NULL;
 
 		if (revs->reflog_info)
 			fake_reflog_parent(revs->reflog_info, commit);
@@ -1737,7 +1771,7 @@ static struct commit *get_revision_1(struct rev_info *revs)
 			if (revs->max_age != -1 &&
 			    (commit->date < revs->max_age))
 				continue;
-			if (add_parents_to_list(revs, commit, &revs->commits, NULL) < 0)
+			if (add_parents_to_queue(revs, commit, &revs->queue) < 0)
 				return NULL;
 		}
 
@@ -1749,8 +1783,7 @@ static struct commit *get_revision_1(struct rev_info *revs)
 		default:
 			return commit;
 		}
-	} while (revs->commits);
-	return NULL;
+	}
 }
 
 static void gc_boundary(struct object_array *array)
@@ -23,6 +23,12 @@ struct rev_info {
 	struct commit_list *commits;
 	struct object_array pending;
 
+	/*
+	 * Commits still to be walked when the walk is not limited;
+	 * get_revision() moves "commits" here as it goes.
+	 */
+	struct commit_queue queue;
+
 	/* Parents of shown commits */
 	struct object_array boundary_commits;
 
@@ -16,6 +16,11 @@
 #include "refs.h"
 #include "pack-revindex.h"
 #include "sha1-lookup.h"
+#include "midx.h"
+
+#ifdef THREADED_DELTA_SEARCH
+#include <pthread.h>
+#endif
 
 #ifndef O_NOATIME
 #if defined(__linux__) && (defined(__i386__) || defined(__PPC__))
@@ -270,6 +275,7 @@ static int link_alt_odb_entry(const char * entry, int len, const char * relative
 		pfxlen += base_len;
 	}
 	ent = xmalloc(sizeof(*ent) + entlen);
+	ent->loose_objects = NULL;
 
 	if (!is_absolute_path(entry) && relative_base) {
 		memcpy(ent->base, relative_base, base_len - 1);
@@ -423,9 +429,171 @@ void prepare_alt_odb(void)
 	read_info_alternates(get_object_directory(), 0);
 }
 
+/*
+ * With core.looseObjectCache, the names of the loose objects of an
+ * object directory are read with one readdir() per fan-out directory,
+ * the first time an object in it is looked for, instead of probing
+ * the file system for every object.  Objects this process writes are
+ * added to the cache; objects other processes write meanwhile are only
+ * seen after the cache is discarded by reprepare_packed_git().
+ */
+struct loose_object_cache {
+	unsigned char loaded[256];
+	struct loose_object_subdir {
+		unsigned char (*sha1)[20];
+		int nr, alloc;
+	} subdir[256];
+};
+
+static struct loose_object_cache *local_loose_objects;
+
+static int loose_sha1_cmp(const void *a, const void *b)
+{
+	return hashcmp(a, b);
+}
+
+static int loose_object_pos(struct loose_object_subdir *dir,
+			    const unsigned char *sha1)
+{
+	int lo = 0, hi = dir->nr;
+
+	while (lo < hi) {
+		int mi = (lo + hi) / 2;
+		int cmp = hashcmp(dir->sha1[mi], sha1);
+		if (!cmp)
+			return mi;
+		if (cmp < 0)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return -lo - 1;
+}
+
+static void fill_loose_object_subdir(struct loose_object_cache *cache,
+				     const char *objdir, int len, int nr)
+{
+	struct loose_object_subdir *dir = &cache->subdir[nr];
+	char path[PATH_MAX], hex[41];
+	struct dirent *de;
+	DIR *d;
+
+	cache->loaded[nr] = 1;
+	if (snprintf(path, sizeof(path), "%.*s/%02x", len, objdir, nr)
+	    >= sizeof(path))
+		return;
+	d = opendir(path);
+	if (!d)
+		return;
+	memcpy(hex, path + len + 1, 2);
+	while ((de = readdir(d)) != NULL) {
+		if (strspn(de->d_name, "0123456789abcdef") != 38 ||
+		    de->d_name[38] != '\0')
+			continue;
+		memcpy(hex + 2, de->d_name, 39);
+		ALLOC_GROW(dir->sha1, dir->nr + 1, dir->alloc);
+		if (!get_sha1_hex(hex, dir->sha1[dir->nr]))
+			dir->nr++;
+	}
+	closedir(d);
+	qsort(dir->sha1, dir->nr, sizeof(*dir->sha1), loose_sha1_cmp);
+}
+
+/* "objdir" is the object directory, "len" bytes long. */
+static int loose_object_cached(struct loose_object_cache **cachep,
+			       const char *objdir, int len,
+			       const unsigned char *sha1)
+{
+	struct loose_object_cache *cache = *cachep;
+
+	if (!cache)
+		cache = *cachep = xcalloc(1, sizeof(*cache));
+	if (!cache->loaded[sha1[0]])
+		fill_loose_object_subdir(cache, objdir, len, sha1[0]);
+	return loose_object_pos(&cache->subdir[sha1[0]], sha1) >= 0;
+}
+
+static void add_loose_object_to_cache(struct loose_object_cache *cache,
+				      const unsigned char *sha1)
+{
+	struct loose_object_subdir *dir;
+	int pos;
+
+	if (!cache || !cache->loaded[sha1[0]])
+		return;
+	dir = &cache->subdir[sha1[0]];
+	pos = loose_object_pos(dir, sha1);
+	if (pos >= 0)
+		return;
+	pos = -pos - 1;
+	ALLOC_GROW(dir->sha1, dir->nr + 1, dir->alloc);
+	memmove(dir->sha1 + pos + 1, dir->sha1 + pos,
+		(dir->nr - pos) * sizeof(*dir->sha1));
+	hashcpy(dir->sha1[pos], sha1);
+	dir->nr++;
+}
+
+static void free_loose_object_cache(struct loose_object_cache **cachep)
+{
+	struct loose_object_cache *cache = *cachep;
+	int i;
+
+	if (!cache)
+		return;
+	for (i = 0; i < 256; i++)
+		free(cache->subdir[i].sha1);
+	free(cache);
+	*cachep = NULL;
+}
+
+static void discard_loose_object_caches(void)
+{
+	struct alternate_object_database *alt;
+
+	free_loose_object_cache(&local_loose_objects);
+	for (alt = alt_odb_list; alt; alt = alt->next)
+		free_loose_object_cache(&alt->loose_objects);
+}
+
+/*
+ * A loose object "filename" was just written by this process; if it
+ * is in our object directory, let the cache know about it.
+ */
+static void loose_object_written(const char *filename)
+{
+	const char *objdir;
+	unsigned char sha1[20];
+	char hex[40];
+	int len;
+
+	if (!local_loose_objects)
+		return;
+	objdir = get_object_directory();
+	len = strlen(objdir);
+	if (strlen(filename) != len + 42 || memcmp(filename, objdir, len) ||
+	    filename[len] != '/' || filename[len + 3] != '/')
+		return;
+	memcpy(hex, filename + len + 1, 2);
+	memcpy(hex + 2, filename + len + 4, 38);
+	if (!get_sha1_hex(hex, sha1))
+		add_loose_object_to_cache(local_loose_objects, sha1);
+}
+
+static int alt_objdir_len(struct alternate_object_database *alt)
+{
+	return alt->name - alt->base - 1;
+}
+
 static int has_loose_object_local(const unsigned char *sha1)
 {
-	char *name = sha1_file_name(sha1);
+	char *name;
+
+	if (core_loose_object_cache) {
+		const char *objdir = get_object_directory();
+		return loose_object_cached(&local_loose_objects,
+					   objdir, strlen(objdir), sha1);
+	}
+	name = sha1_file_name(sha1);
 	return !access(name, F_OK);
 }
 
@@ -434,6 +602,12 @@ int has_loose_object_nonlocal(const unsigned char *sha1)
 	struct alternate_object_database *alt;
 	prepare_alt_odb();
 	for (alt = alt_odb_list; alt; alt = alt->next) {
+		if (core_loose_object_cache) {
+			if (loose_object_cached(&alt->loose_objects, alt->base,
+						alt_objdir_len(alt), sha1))
+				return 1;
+			continue;
+		}
 		fill_sha1_path(alt->name, sha1);
 		if (!access(alt->base, F_OK))
 			return 1;
@@ -689,6 +863,8 @@ void free_pack_by_name(const char *pack_name)
 	while (*pp) {
 		p = *pp;
 		if (strcmp(pack_name, p->pack_name) == 0) {
+			if (p->pack_midx)
+				close_multi_pack_index();
 			close_pack_windows(p);
 			if (p->pack_fd != -1)
 				close(p->pack_fd);
@@ -1041,12 +1217,15 @@ void prepare_packed_git(void)
 		alt->name[-1] = '/';
 	}
 	rearrange_packed_git();
+	prepare_multi_pack_index();
 	prepare_packed_git_run_once = 1;
 }
 
 void reprepare_packed_git(void)
 {
+	discard_loose_object_caches();
 	discard_revindex();
+	close_multi_pack_index();
 	prepare_packed_git_run_once = 0;
 	prepare_packed_git();
 }
@@ -1098,17 +1277,22 @@ static int git_open_noatime(const char *name)
 
 static int open_sha1_file(const unsigned char *sha1)
 {
-	int fd;
+	int fd = -1;
 	char *name = sha1_file_name(sha1);
 	struct alternate_object_database *alt;
 
-	fd = git_open_noatime(name);
+	if (!core_loose_object_cache || has_loose_object_local(sha1))
+		fd = git_open_noatime(name);
 	if (fd >= 0)
 		return fd;
 
 	prepare_alt_odb();
 	errno = ENOENT;
 	for (alt = alt_odb_list; alt; alt = alt->next) {
+		if (core_loose_object_cache &&
+		    !loose_object_cached(&alt->loose_objects, alt->base,
+					 alt_objdir_len(alt), sha1))
+			continue;
 		name = alt->name;
 		fill_sha1_path(name, sha1);
 		fd = git_open_noatime(alt->base);
@@ -1601,23 +1785,91 @@ static void *unpack_compressed_entry(struct packed_git *p,
 	return buffer;
 }
 
-#define MAX_DELTA_CACHE (256)
-
-static size_t delta_base_cached;
+/*
+ * Delta base cache.  Bases that were just used to reconstruct a delta
+ * are kept, keyed by their pack and offset, so that the next delta
+ * against the same base does not have to inflate (and maybe resolve)
+ * it again.  The cache is split into shards, each with its own hash
+ * table, LRU list and lock, so that future threaded readers only
+ * contend when they hit the same shard.  The total size of all cached
+ * bases is bounded by core.deltaBaseCacheLimit.
+ */
+#define DELTA_BASE_CACHE_SHARDS 16
 
-static struct delta_base_cache_lru_list {
+struct delta_base_cache_lru_list {
 	struct delta_base_cache_lru_list *prev;
 	struct delta_base_cache_lru_list *next;
-} delta_base_cache_lru = { &delta_base_cache_lru, &delta_base_cache_lru };
+};
 
-static struct delta_base_cache_entry {
-	struct delta_base_cache_lru_list lru;
+struct delta_base_cache_entry {
+	struct delta_base_cache_lru_list lru;	/* must be first */
+	struct delta_base_cache_entry *next;	/* hash chain */
 	void *data;
 	struct packed_git *p;
 	off_t base_offset;
 	unsigned long size;
 	enum object_type type;
-} delta_base_cache[MAX_DELTA_CACHE];
+};
+
+static struct delta_base_cache_shard {
+	struct delta_base_cache_lru_list lru;
+	struct delta_base_cache_entry **table;
+	unsigned int table_size, nr;
+	unsigned int hits, misses, evictions;
+#ifdef THREADED_DELTA_SEARCH
+	pthread_mutex_t mutex;
+#endif
+} delta_base_cache[DELTA_BASE_CACHE_SHARDS];
+
+static size_t delta_base_cached;
+
+#ifdef THREADED_DELTA_SEARCH
+static pthread_once_t delta_base_cache_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t delta_base_cached_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define shard_lock(s)		pthread_mutex_lock(&(s)->mutex)
+#define shard_unlock(s)		pthread_mutex_unlock(&(s)->mutex)
+#define cached_lock()		pthread_mutex_lock(&delta_base_cached_mutex)
+#define cached_unlock()		pthread_mutex_unlock(&delta_base_cached_mutex)
+#else
+#define shard_lock(s)		(void)0
+#define shard_unlock(s)		(void)0
+#define cached_lock()		(void)0
+#define cached_unlock()		(void)0
+#endif
+
+static void report_delta_base_cache(void)
+{
+	unsigned int i, hits = 0, misses = 0, evictions = 0, nr = 0;
+
+	for (i = 0; i < DELTA_BASE_CACHE_SHARDS; i++) {
+		hits += delta_base_cache[i].hits;
+		misses += delta_base_cache[i].misses;
+		evictions += delta_base_cache[i].evictions;
+		nr += delta_base_cache[i].nr;
+	}
+	if (!hits && !misses)
+		return;
+	trace_printf_key("GIT_TRACE_PERFORMANCE",
+			 "performance: delta base cache: %u hits, %u misses, "
+			 "%u evictions, %u entries (%lu bytes) at exit\n",
+			 hits, misses, evictions, nr,
+			 (unsigned long)delta_base_cached);
+}
+
+static void init_delta_base_cache(void)
+{
+	int i;
+
+	for (i = 0; i < DELTA_BASE_CACHE_SHARDS; i++) {
+		struct delta_base_cache_shard *s = delta_base_cache + i;
+		s->lru.next = s->lru.prev = &s->lru;
+#ifdef THREADED_DELTA_SEARCH
+		pthread_mutex_init(&s->mutex, NULL);
+#endif
+	}
+	if (trace_want("GIT_TRACE_PERFORMANCE"))
+		atexit(report_delta_base_cache);
+}
 
 static unsigned long pack_entry_hash(struct packed_git *p, off_t base_offset)
 {
@@ -1625,79 +1877,229 @@ static unsigned long pack_entry_hash(struct packed_git *p, off_t base_offset)
 
 	hash = (unsigned long)p + (unsigned long)base_offset;
 	hash += (hash >> 8) + (hash >> 16);
-	return hash % MAX_DELTA_CACHE;
+	return hash;
+}
+
+static struct delta_base_cache_shard *delta_base_cache_shard(unsigned long hash)
+{
+#ifdef THREADED_DELTA_SEARCH
+	pthread_once(&delta_base_cache_once, init_delta_base_cache);
+#else
+	static int initialized;
+	if (!initialized) {
+		init_delta_base_cache();
+		initialized = 1;
+	}
+#endif
+	return delta_base_cache + hash % DELTA_BASE_CACHE_SHARDS;
+}
+
+static struct delta_base_cache_entry **delta_base_cache_bucket(
+	struct delta_base_cache_shard *s, unsigned long hash)
+{
+	hash /= DELTA_BASE_CACHE_SHARDS;
+	return s->table + (hash & (s->table_size - 1));
+}
+
+static struct delta_base_cache_entry **find_delta_base_cache(
+	struct delta_base_cache_shard *s, unsigned long hash,
+	struct packed_git *p, off_t base_offset)
+{
+	struct delta_base_cache_entry **pos;
+
+	if (!s->table_size)
+		return NULL;
+	for (pos = delta_base_cache_bucket(s, hash); *pos; pos = &(*pos)->next)
+		if ((*pos)->p == p && (*pos)->base_offset == base_offset)
+			return pos;
+	return NULL;
+}
+
+static void grow_delta_base_cache(struct delta_base_cache_shard *s)
+{
+	struct delta_base_cache_entry **old = s->table;
+	unsigned int i, old_size = s->table_size;
+
+	s->table_size = old_size ? old_size * 2 : 64;
+	s->table = xcalloc(s->table_size, sizeof(*s->table));
+	for (i = 0; i < old_size; i++) {
+		struct delta_base_cache_entry *ent = old[i];
+		while (ent) {
+			struct delta_base_cache_entry *next = ent->next;
+			struct delta_base_cache_entry **bucket;
+			bucket = delta_base_cache_bucket(s,
+					pack_entry_hash(ent->p, ent->base_offset));
+			ent->next = *bucket;
+			*bucket = ent;
+			ent = next;
+		}
+	}
+	free(old);
+}
+
+/* The most recently used entries are at the tail of the LRU list. */
+static void lru_append(struct delta_base_cache_shard *s,
+		       struct delta_base_cache_entry *ent)
+{
+	ent->lru.next = &s->lru;
+	ent->lru.prev = s->lru.prev;
+	s->lru.prev->next = &ent->lru;
+	s->lru.prev = &ent->lru;
+}
+
+static void lru_touch(struct delta_base_cache_shard *s,
+		      struct delta_base_cache_entry *ent)
+{
+	ent->lru.next->prev = ent->lru.prev;
+	ent->lru.prev->next = ent->lru.next;
+	lru_append(s, ent);
+}
+
+/*
+ * Unlink the entry at pos from its shard, and return its data, which
+ * the caller now owns.
+ */
+static void *detach_delta_base_cache(struct delta_base_cache_shard *s,
+				     struct delta_base_cache_entry **pos)
+{
+	struct delta_base_cache_entry *ent = *pos;
+	void *data = ent->data;
+
+	*pos = ent->next;
+	ent->lru.next->prev = ent->lru.prev;
+	ent->lru.prev->next = ent->lru.next;
+	s->nr--;
+	cached_lock();
+	delta_base_cached -= ent->size;
+	cached_unlock();
+	free(ent);
+	return data;
+}
+
+static void release_delta_base_cache(struct delta_base_cache_shard *s,
+				     struct delta_base_cache_entry *ent)
+{
+	struct delta_base_cache_entry **pos;
+
+	pos = find_delta_base_cache(s,
+			pack_entry_hash(ent->p, ent->base_offset),
+			ent->p, ent->base_offset);
+	free(detach_delta_base_cache(s, pos));
+	s->evictions++;
+}
+
+static int delta_base_cache_full(void)
+{
+	int full;
+
+	cached_lock();
+	full = delta_base_cached > delta_base_cache_limit;
+	cached_unlock();
+	return full;
+}
+
+/*
+ * Evict least recently used entries of the shard, blobs first, until
+ * the cache fits in its limit again.  The entry "keep" is spared.
+ */
+static void prune_delta_base_cache(struct delta_base_cache_shard *s,
+				   struct delta_base_cache_entry *keep)
+{
+	struct delta_base_cache_lru_list *lru, *next;
+
+	for (lru = s->lru.next;
+	     lru != &s->lru && delta_base_cache_full();
+	     lru = next) {
+		struct delta_base_cache_entry *f = (void *)lru;
+		next = lru->next;
+		if (f != keep && f->type == OBJ_BLOB)
+			release_delta_base_cache(s, f);
+	}
+	for (lru = s->lru.next;
+	     lru != &s->lru && delta_base_cache_full();
+	     lru = next) {
+		struct delta_base_cache_entry *f = (void *)lru;
+		next = lru->next;
+		if (f != keep)
+			release_delta_base_cache(s, f);
+	}
 }
 
 static void *cache_or_unpack_entry(struct packed_git *p, off_t base_offset,
 	unsigned long *base_size, enum object_type *type, int keep_cache)
 {
-	void *ret;
 	unsigned long hash = pack_entry_hash(p, base_offset);
-	struct delta_base_cache_entry *ent = delta_base_cache + hash;
+	struct delta_base_cache_shard *s = delta_base_cache_shard(hash);
+	struct delta_base_cache_entry **pos, *ent;
+	void *ret;
 
-	ret = ent->data;
-	if (!ret || ent->p != p || ent->base_offset != base_offset)
+	shard_lock(s);
+	pos = find_delta_base_cache(s, hash, p, base_offset);
+	if (!pos) {
+		s->misses++;
+		shard_unlock(s);
 		return unpack_entry(p, base_offset, type, base_size);
-
-	if (!keep_cache) {
-		ent->data = NULL;
-		ent->lru.next->prev = ent->lru.prev;
-		ent->lru.prev->next = ent->lru.next;
-		delta_base_cached -= ent->size;
-	} else {
-		ret = xmemdupz(ent->data, ent->size);
 	}
+
+	s->hits++;
+	ent = *pos;
 	*type = ent->type;
 	*base_size = ent->size;
-	return ret;
-}
-
-static inline void release_delta_base_cache(struct delta_base_cache_entry *ent)
-{
-	if (ent->data) {
-		free(ent->data);
-		ent->data = NULL;
-		ent->lru.next->prev = ent->lru.prev;
-		ent->lru.prev->next = ent->lru.next;
-		delta_base_cached -= ent->size;
+	if (!keep_cache)
+		ret = detach_delta_base_cache(s, pos);
+	else {
+		ret = xmemdupz(ent->data, ent->size);
+		lru_touch(s, ent);
 	}
+	shard_unlock(s);
+	return ret;
 }
 
 static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
 	void *base, unsigned long base_size, enum object_type type)
 {
 	unsigned long hash = pack_entry_hash(p, base_offset);
-	struct delta_base_cache_entry *ent = delta_base_cache + hash;
-	struct delta_base_cache_lru_list *lru;
-
-	release_delta_base_cache(ent);
-	delta_base_cached += base_size;
+	struct delta_base_cache_shard *s = delta_base_cache_shard(hash);
+	struct delta_base_cache_entry **pos, *ent;
+	int i;
 
-	for (lru = delta_base_cache_lru.next;
-	     delta_base_cached > delta_base_cache_limit
-	     && lru != &delta_base_cache_lru;
-	     lru = lru->next) {
-		struct delta_base_cache_entry *f = (void *)lru;
-		if (f->type == OBJ_BLOB)
-			release_delta_base_cache(f);
-	}
-	for (lru = delta_base_cache_lru.next;
-	     delta_base_cached > delta_base_cache_limit
-	     && lru != &delta_base_cache_lru;
-	     lru = lru->next) {
-		struct delta_base_cache_entry *f = (void *)lru;
-		release_delta_base_cache(f);
-	}
+	shard_lock(s);
+	pos = find_delta_base_cache(s, hash, p, base_offset);
+	if (pos)
+		free(detach_delta_base_cache(s, pos));
+	if (s->nr >= s->table_size)
+		grow_delta_base_cache(s);
 
+	ent = xmalloc(sizeof(*ent));
 	ent->p = p;
 	ent->base_offset = base_offset;
 	ent->type = type;
 	ent->data = base;
 	ent->size = base_size;
-	ent->lru.next = &delta_base_cache_lru;
-	ent->lru.prev = delta_base_cache_lru.prev;
-	delta_base_cache_lru.prev->next = &ent->lru;
-	delta_base_cache_lru.prev = &ent->lru;
+	pos = delta_base_cache_bucket(s, hash);
+	ent->next = *pos;
+	*pos = ent;
+	lru_append(s, ent);
+	s->nr++;
+	cached_lock();
+	delta_base_cached += base_size;
+	cached_unlock();
+
+	prune_delta_base_cache(s, ent);
+	shard_unlock(s);
+
+	/*
+	 * If this shard alone cannot make room, take the oldest bases
+	 * of the others.  Only one shard is ever locked at a time.
+	 */
+	for (i = 0; i < DELTA_BASE_CACHE_SHARDS && delta_base_cache_full(); i++) {
+		struct delta_base_cache_shard *other = delta_base_cache + i;
+		if (other == s)
+			continue;
+		shard_lock(other);
+		prune_delta_base_cache(other, NULL);
+		shard_unlock(other);
+	}
 }
 
 static void *read_object(const unsigned char *sha1, enum object_type *type,
@@ -1929,18 +2331,75 @@ int matches_pack_name(struct packed_git *p, const char *name)
 	return 0;
 }
 
-static int find_pack_entry(const unsigned char *sha1, struct pack_entry *e, const char **ignore_packed)
+static int is_bad_packed_object(struct packed_git *p,
+				const unsigned char *sha1)
+{
+	unsigned i;
+
+	for (i = 0; i < p->num_bad_objects; i++)
+		if (!hashcmp(sha1, p->bad_object_sha1 + 20 * i))
+			return 1;
+	return 0;
+}
+
+/*
+ * Look the object up in the multi-pack-index.  Returns 1 when found
+ * there in a pack we can use, 0 when the packs it covers do not have
+ * the object, and -1 when we need to look at all packs to know.
+ */
+static int find_midx_pack_entry(const unsigned char *sha1,
+				struct pack_entry *e)
+{
+	struct multi_pack_index *m = get_multi_pack_index();
+	struct packed_git *p;
+	off_t offset;
+
+	if (!m)
+		return -1;
+	if (!find_midx_entry(m, sha1, &p, &offset))
+		return 0;
+	if (!p || is_bad_packed_object(p, sha1))
+		return -1;
+	if (!p->index_data && open_pack_index(p))
+		return -1;
+	if (p->pack_fd == -1 && open_packed_git(p))
+		return -1;
+	e->offset = offset;
+	e->p = p;
+	hashcpy(e->sha1, sha1);
+	return 1;
+}
+
+int find_pack_entry(const unsigned char *sha1, struct pack_entry *e, const char **ignore_packed)
 {
 	static struct packed_git *last_found = (void *)1;
 	struct packed_git *p;
 	off_t offset;
+	int skip_midx = 0;
 
 	prepare_packed_git();
 	if (!packed_git)
 		return 0;
+
+	/*
+	 * The multi-pack-index answers for all the packs it covers at
+	 * once; we only have to search the others if it does not know
+	 * the object.  It only records one copy of each object, so it
+	 * cannot help when some packs are to be ignored.
+	 */
+	if (!ignore_packed) {
+		int ret = find_midx_pack_entry(sha1, e);
+		if (ret > 0)
+			return 1;
+		skip_midx = !ret;
+	}
+
 	p = (last_found == (void *)1) ? packed_git : last_found;
 
 	do {
+		if (skip_midx && p->pack_midx)
+			goto next;
+
 		if (ignore_packed) {
 			const char **ig;
 			for (ig = ignore_packed; *ig; ig++)
@@ -1950,12 +2409,8 @@ static int find_pack_entry(const unsigned char *sha1, struct pack_entry *e, cons
 				goto next;
 		}
 
-		if (p->num_bad_objects) {
-			unsigned i;
-			for (i = 0; i < p->num_bad_objects; i++)
-				if (!hashcmp(sha1, p->bad_object_sha1 + 20 * i))
-					goto next;
-		}
+		if (p->num_bad_objects && is_bad_packed_object(p, sha1))
+			goto next;
 
 		offset = find_pack_entry_one(sha1, p);
 		if (offset) {
@@ -2038,8 +2493,12 @@ int sha1_object_info(const unsigned char *sha1, unsigned long *sizep)
 
 		/* Not a loose object; someone else may have just packed it. */
 		reprepare_packed_git();
-		if (!find_pack_entry(sha1, &e, NULL))
+		if (!find_pack_entry(sha1, &e, NULL)) {
+			/* ... or written it, unseen by the loose object cache */
+			if (core_loose_object_cache)
+				status = sha1_loose_object_info(sha1, sizep);
 			return status;
+		}
 	}
 
 	status = packed_object_info(e.p, e.offset, sizep);
@@ -2157,7 +2616,15 @@ static void *read_object(const unsigned char *sha1, enum object_type *type,
 		return buf;
 	}
 	reprepare_packed_git();
-	return read_packed_sha1(sha1, type, size);
+	buf = read_packed_sha1(sha1, type, size);
+	if (!buf && core_loose_object_cache) {
+		map = map_sha1_file(sha1, &mapsize);
+		if (map) {
+			buf = unpack_sha1_file(map, mapsize, type, size, sha1);
+			munmap(map, mapsize);
+		}
+	}
+	return buf;
 }
 
 void *read_sha1_file(const unsigned char *sha1, enum object_type *type,
@@ -2170,6 +2637,159 @@ void *read_sha1_file(const unsigned char *sha1, enum object_type *type,
 	return data;
 }
 
+/*
+ * The streaming readers below go through small buffers rather than
+ * mapping the object, so that a big blob never adds much more than
+ * them to the resident size of the process.
+ */
+static int stream_loose_blob(int fd, const unsigned char *sha1, int src)
+{
+	z_stream stream;
+	unsigned char in[32 * 1024];
+	char buf[32 * 1024];
+	unsigned long size, done, n;
+	ssize_t len;
+	int hdrlen, status;
+
+	len = read_in_full(src, in, sizeof(in));
+	if (len < 2)
+		return error("unable to read loose object %s", sha1_to_hex(sha1));
+	status = unpack_sha1_header(&stream, in, len, buf, sizeof(buf));
+	if (status < 0)
+		return error("unable to unpack %s header", sha1_to_hex(sha1));
+	if (parse_sha1_header(buf, &size) != OBJ_BLOB) {
+		git_inflate_end(&stream);
+		return error("%s is not a blob", sha1_to_hex(sha1));
+	}
+
+	/* Whatever came out with the header is the start of the data */
+	hdrlen = strlen(buf) + 1;
+	done = stream.total_out - hdrlen;
+	if (done > size)
+		done = size;
+	if (write_in_full(fd, buf + hdrlen, done) < 0)
+		goto write_error;
+
+	while (status == Z_OK) {
+		if (!stream.avail_in) {
+			len = xread(src, in, sizeof(in));
+			if (len < 0) {
+				git_inflate_end(&stream);
+				return error("unable to read loose object %s",
+					     sha1_to_hex(sha1));
+			}
+			stream.next_in = in;
+			stream.avail_in = len;
+		}
+		stream.next_out = (unsigned char *)buf;
+		stream.avail_out = sizeof(buf);
+		status = git_inflate(&stream, Z_NO_FLUSH);
+		n = (char *)stream.next_out - buf;
+		if (n > size - done)
+			break;
+		if (write_in_full(fd, buf, n) < 0)
+			goto write_error;
+		done += n;
+	}
+	git_inflate_end(&stream);
+	if (status != Z_STREAM_END || done != size)
+		return error("corrupt loose object '%s'", sha1_to_hex(sha1));
+	if (stream.avail_in || xread(src, in, 1) > 0)
+		return error("garbage at end of loose object '%s'",
+			     sha1_to_hex(sha1));
+	return 0;
+
+write_error:
+	git_inflate_end(&stream);
+	return error("unable to write blob %s: %s",
+		     sha1_to_hex(sha1), strerror(errno));
+}
+
+static int stream_packed_blob(int fd, const unsigned char *sha1,
+			      struct packed_git *p, off_t obj_offset)
+{
+	struct pack_window *w_curs = NULL;
+	off_t curpos = obj_offset;
+	enum object_type type;
+	z_stream stream;
+	unsigned char in[32 * 1024], buf[32 * 1024];
+	unsigned long size, done = 0, n;
+	ssize_t len;
+	int status = Z_OK;
+
+	/*
+	 * The window holding the header stays in use until we are
+	 * done, so that the pack file cannot be closed under us.
+	 */
+	type = unpack_object_header(p, &w_curs, &curpos, &size);
+	if (type != OBJ_BLOB) {
+		unuse_pack(&w_curs);
+		if (type == OBJ_OFS_DELTA || type == OBJ_REF_DELTA)
+			return 1;
+		return error("%s is not a blob", sha1_to_hex(sha1));
+	}
+
+	memset(&stream, 0, sizeof(stream));
+	git_inflate_init(&stream);
+	while (status == Z_OK) {
+		if (!stream.avail_in) {
+			len = sizeof(in);
+			if (len > p->pack_size - 20 - curpos)
+				len = p->pack_size - 20 - curpos;
+			len = pread(p->pack_fd, in, len, curpos);
+			if (len < 0) {
+				status = Z_ERRNO;
+				break;
+			}
+			curpos += len;
+			stream.next_in = in;
+			stream.avail_in = len;
+		}
+		stream.next_out = buf;
+		stream.avail_out = sizeof(buf);
+		status = git_inflate(&stream, Z_NO_FLUSH);
+		n = stream.next_out - buf;
+		if (n > size - done)
+			break;
+		if (write_in_full(fd, buf, n) < 0) {
+			git_inflate_end(&stream);
+			unuse_pack(&w_curs);
+			return error("unable to write blob %s: %s",
+				     sha1_to_hex(sha1), strerror(errno));
+		}
+		done += n;
+	}
+	git_inflate_end(&stream);
+	unuse_pack(&w_curs);
+	if (status != Z_STREAM_END || done != size) {
+		mark_bad_packed_object(p, sha1);
+		return error("failed to unpack %s from %s",
+			     sha1_to_hex(sha1), p->pack_name);
+	}
+	return 0;
+}
+
+int stream_blob_to_fd(int fd, const unsigned char *sha1)
+{
+	struct pack_entry e;
+	int src, ret;
+
+	/*
+	 * Leave the objects we would not find, or could not check,
+	 * this way to read_sha1_file().
+	 */
+	if (find_cached_object(sha1) || do_check_packed_object_crc)
+		return 1;
+	if (find_pack_entry(sha1, &e, NULL))
+		return stream_packed_blob(fd, sha1, e.p, e.offset);
+	src = open_sha1_file(sha1);
+	if (src < 0)
+		return 1;
+	ret = stream_loose_blob(fd, sha1, src);
+	close(src);
+	return ret;
+}
+
 void *read_object_with_reference(const unsigned char *sha1,
 				 const char *required_type_name,
 				 unsigned long *size,
@@ -2255,8 +2875,10 @@ int move_temp_to_file(const char *tmpfile, const char *filename)
 	 * left to unlink.
 	 */
 	if (ret && ret != EEXIST) {
-		if (!rename(tmpfile, filename))
+		if (!rename(tmpfile, filename)) {
+			loose_object_written(filename);
 			return 0;
+		}
 		ret = errno;
 	}
 	unlink(tmpfile);
@@ -2267,6 +2889,7 @@ int move_temp_to_file(const char *tmpfile, const char *filename)
 		/* FIXME!!! Collision check here ? */
 	}
 
+	loose_object_written(filename);
 	return 0;
 }
 
@@ -2286,6 +2909,38 @@ int hash_sha1_file(const void *buf, unsigned long len, const char *type,
 	return 0;
 }
 
+#ifndef git_SHA1_Update_multi
+void git_SHA1_Update_multi(git_SHA_CTX **ctx, const void **data,
+			   const unsigned long *len, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++)
+		git_SHA1_Update(ctx[i], data[i], len[i]);
+}
+#endif
+
+void hash_sha1_files(int nr, const void **buf, const unsigned long *len,
+		     const char **type, unsigned char **sha1)
+{
+	git_SHA_CTX *c = xmalloc(nr * sizeof(*c));
+	git_SHA_CTX **cp = xmalloc(nr * sizeof(*cp));
+	char hdr[32];
+	int i, hdrlen;
+
+	for (i = 0; i < nr; i++) {
+		hdrlen = sprintf(hdr, "%s %lu", type[i], len[i]) + 1;
+		git_SHA1_Init(&c[i]);
+		git_SHA1_Update(&c[i], hdr, hdrlen);
+		cp[i] = &c[i];
+	}
+	git_SHA1_Update_multi(cp, buf, len, nr);
+	for (i = 0; i < nr; i++)
+		git_SHA1_Final(sha1[i], &c[i]);
+	free(cp);
+	free(c);
+}
+
 /* Finalize a file on disk, and close it. */
 static void close_sha1_file(int fd)
 {
@@ -2500,12 +3155,114 @@ static int index_mem(unsigned char *sha1, void *buf, size_t size,
 	return ret;
 }
 
+static void deflate_to_fd(int fd, z_stream *stream, int flush,
+			  unsigned char *buf, unsigned long bufsiz)
+{
+	do {
+		stream->next_out = buf;
+		stream->avail_out = bufsiz;
+		if (deflate(stream, flush) == Z_STREAM_ERROR)
+			die("unable to deflate new object");
+		if (write_buffer(fd, buf, stream->next_out - buf) < 0)
+			die("unable to write sha1 file");
+	} while (!stream->avail_out);
+}
+
+/*
+ * Hash "size" bytes read from fd and, if asked to, deflate them into a
+ * loose object as they come, so that big files never have to be held
+ * in memory as a whole.  The name of the object is only known at the
+ * end, so the temporary file is made at the top of the object
+ * directory and moved into its fan-out directory once it is complete.
+ */
+static int index_stream(unsigned char *sha1, int fd, size_t size,
+			enum object_type type, int write_object)
+{
+	git_SHA_CTX c;
+	z_stream stream;
+	char hdr[32];
+	unsigned char ibuf[64 * 1024], obuf[64 * 1024];
+	static char tmpfile[PATH_MAX];
+	char *filename;
+	int hdrlen, tmpfd = -1;
+	size_t done = 0;
+	ssize_t n;
+
+	hdrlen = sprintf(hdr, "%s %lu", typename(type),
+			 (unsigned long)size) + 1;
+	git_SHA1_Init(&c);
+	git_SHA1_Update(&c, hdr, hdrlen);
+
+	if (write_object) {
+		snprintf(tmpfile, sizeof(tmpfile), "%s/tmp_obj_XXXXXX",
+			 get_object_directory());
+		tmpfd = mkstemp(tmpfile);
+		if (tmpfd < 0) {
+			if (errno == EACCES)
+				return error("insufficient permission for adding an object to repository database %s\n", get_object_directory());
+			else
+				return error("unable to create temporary sha1 filename %s: %s\n", tmpfile, strerror(errno));
+		}
+		memset(&stream, 0, sizeof(stream));
+		deflateInit(&stream, zlib_compression_level);
+		stream.next_in = (unsigned char *)hdr;
+		stream.avail_in = hdrlen;
+		deflate_to_fd(tmpfd, &stream, Z_NO_FLUSH, obuf, sizeof(obuf));
+	}
+
+	while ((n = xread(fd, ibuf, sizeof(ibuf))) > 0) {
+		if (n > size - done)
+			break;
+		git_SHA1_Update(&c, ibuf, n);
+		if (write_object) {
+			stream.next_in = ibuf;
+			stream.avail_in = n;
+			deflate_to_fd(tmpfd, &stream, Z_NO_FLUSH,
+				      obuf, sizeof(obuf));
+		}
+		done += n;
+	}
+	if (n || done != size) {
+		if (write_object) {
+			deflateEnd(&stream);
+			close(tmpfd);
+			unlink(tmpfile);
+		}
+		if (n < 0)
+			return error("read error while indexing: %s",
+				     strerror(errno));
+		return error("file changed while being indexed");
+	}
+	git_SHA1_Final(sha1, &c);
+	if (!write_object)
+		return 0;
+
+	deflate_to_fd(tmpfd, &stream, Z_FINISH, obuf, sizeof(obuf));
+	if (deflateEnd(&stream) != Z_OK)
+		die("deflateEnd on object %s failed", sha1_to_hex(sha1));
+	close_sha1_file(tmpfd);
+
+	if (has_sha1_file(sha1)) {
+		unlink(tmpfile);
+		return 0;
+	}
+	filename = sha1_file_name(sha1);
+	if (safe_create_leading_directories(filename)) {
+		unlink(tmpfile);
+		return error("unable to create directory for %s", filename);
+	}
+	return move_temp_to_file(tmpfile, filename);
+}
+
 int index_fd(unsigned char *sha1, int fd, struct stat *st, int write_object,
 	     enum object_type type, const char *path)
 {
 	int ret;
 	size_t size = xsize_t(st->st_size);
 
+	if (!type)
+		type = OBJ_BLOB;
+
 	if (!S_ISREG(st->st_mode)) {
 		struct strbuf sbuf = STRBUF_INIT;
 		if (strbuf_read(&sbuf, fd, 4096) >= 0)
@@ -2514,6 +3271,9 @@ int index_fd(unsigned char *sha1, int fd, struct stat *st, int write_object,
 		else
 			ret = -1;
 		strbuf_release(&sbuf);
+	} else if (size > big_file_threshold &&
+		   !(type == OBJ_BLOB && path && would_convert_to_git(path))) {
+		ret = index_stream(sha1, fd, size, type, write_object);
 	} else if (size) {
 		void *buf = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
 		ret = index_mem(sha1, buf, size, write_object, type, path);
@@ -5,6 +5,7 @@
 #include "blob.h"
 #include "tree-walk.h"
 #include "refs.h"
+#include "midx.h"
 
 static int find_short_object_filename(int len, const char *name, unsigned char *sha1)
 {
@@ -68,59 +69,83 @@ static int match_sha(unsigned len, const unsigned char *a, const unsigned char *
 	return 1;
 }
 
+static const unsigned char *nth_sorted_sha1(struct packed_git *p,
+					    struct multi_pack_index *m,
+					    uint32_t n)
+{
+	return p ? nth_packed_object_sha1(p, n) : nth_midxed_object_sha1(m, n);
+}
+
+/*
+ * Look for objects matching the first "len" hex digits of "match" in
+ * the sorted object names of a pack index or of the multi-pack-index,
+ * and update "found" (0, 1 or 2 for ambiguous) and "found_sha1".
+ */
+static int find_short_in_sorted(int len, const unsigned char *match,
+				struct packed_git *p, struct multi_pack_index *m,
+				uint32_t num, int found,
+				const unsigned char **found_sha1)
+{
+	uint32_t last = num;
+	uint32_t first = 0;
+	const unsigned char *now, *next;
+
+	while (first < last) {
+		uint32_t mid = (first + last) / 2;
+		int cmp;
+
+		now = nth_sorted_sha1(p, m, mid);
+		cmp = hashcmp(match, now);
+		if (!cmp) {
+			first = mid;
+			break;
+		}
+		if (cmp > 0) {
+			first = mid+1;
+			continue;
+		}
+		last = mid;
+	}
+	if (first >= num)
+		return found;
+	now = nth_sorted_sha1(p, m, first);
+	if (!match_sha(len, match, now))
+		return found;
+	next = nth_sorted_sha1(p, m, first+1);
+	if (next && match_sha(len, match, next))
+		/* not even unique within this pack */
+		return 2;
+	/* unique within this pack */
+	if (!found) {
+		*found_sha1 = now;
+		return 1;
+	}
+	if (hashcmp(*found_sha1, now))
+		return 2;
+	return found;
+}
+
 static int find_short_packed_object(int len, const unsigned char *match, unsigned char *sha1)
 {
 	struct packed_git *p;
+	struct multi_pack_index *m;
 	const unsigned char *found_sha1 = NULL;
 	int found = 0;
 
 	prepare_packed_git();
+	m = get_multi_pack_index();
+	if (m)
+		found = find_short_in_sorted(len, match, NULL, m,
+					     midx_num_objects(m), found,
+					     &found_sha1);
 	for (p = packed_git; p && found < 2; p = p->next) {
-		uint32_t num, last;
-		uint32_t first = 0;
+		/* the multi-pack-index has all the objects of this one */
+		if (p->pack_midx)
+			continue;
 		open_pack_index(p);
-		num = p->num_objects;
-		last = num;
-		while (first < last) {
-			uint32_t mid = (first + last) / 2;
-			const unsigned char *now;
-			int cmp;
-
-			now = nth_packed_object_sha1(p, mid);
-			cmp = hashcmp(match, now);
-			if (!cmp) {
-				first = mid;
-				break;
-			}
-			if (cmp > 0) {
-				first = mid+1;
-				continue;
-			}
-			last = mid;
-		}
-		if (first < num) {
-			const unsigned char *now, *next;
-		       now = nth_packed_object_sha1(p, first);
-			if (match_sha(len, match, now)) {
-				next = nth_packed_object_sha1(p, first+1);
-			       if (!next|| !match_sha(len, match, next)) {
-					/* unique within this pack */
-					if (!found) {
-						found_sha1 = now;
-						found++;
-					}
-					else if (hashcmp(found_sha1, now)) {
-						found = 2;
-						break;
-					}
-				}
-				else {
-					/* not even unique within this pack */
-					found = 2;
-					break;
-				}
-			}
-		}
+		found = find_short_in_sorted(len, match, p, NULL,
+					     p->num_objects, found,
+					     &found_sha1);
 	}
 	if (found == 1)
 		hashcpy(sha1, found_sha1);
@@ -635,7 +660,7 @@ static int get_sha1_1(const char *name, int len, unsigned char *sha1)
 static int handle_one_ref(const char *path,
 		const unsigned char *sha1, int flag, void *cb_data)
 {
-	struct commit_list **list = cb_data;
+	struct commit_queue *queue = cb_data;
 	struct object *object = parse_object(sha1);
 	if (!object)
 		return 0;
@@ -646,7 +671,7 @@ static int handle_one_ref(const char *path,
 	}
 	if (object->type != OBJ_COMMIT)
 		return 0;
-	insert_by_date((struct commit *)object, list);
+	commit_queue_put(queue, (struct commit *)object);
 	return 0;
 }
 
@@ -662,7 +687,9 @@ static int handle_one_ref(const char *path,
 #define ONELINE_SEEN (1u<<20)
 static int get_sha1_oneline(const char *prefix, unsigned char *sha1)
 {
-	struct commit_list *list = NULL, *backup = NULL, *l;
+	struct commit_queue queue = { NULL };
+	struct commit_list *backup = NULL, *l;
+	int i;
 	int retval = -1;
 	char *temp_commit_buffer = NULL;
 
@@ -671,16 +698,16 @@ static int get_sha1_oneline(const char *prefix, unsigned char *sha1)
 			die ("Invalid search pattern: %s", prefix);
 		prefix++;
 	}
-	for_each_ref(handle_one_ref, &list);
-	for (l = list; l; l = l->next)
-		commit_list_insert(l->item, &backup);
-	while (list) {
+	for_each_ref(handle_one_ref, &queue);
+	for (i = 0; i < queue.nr; i++)
+		commit_list_insert(queue.array[i].commit, &backup);
+	while (queue.nr) {
 		char *p;
 		struct commit *commit;
 		enum object_type type;
 		unsigned long size;
 
-		commit = pop_most_recent_commit(&list, ONELINE_SEEN);
+		commit = pop_most_recent_commit(&queue, ONELINE_SEEN);
 		if (!parse_object(commit->object.sha1))
 			continue;
 		free(temp_commit_buffer);
@@ -701,7 +728,7 @@ static int get_sha1_oneline(const char *prefix, unsigned char *sha1)
 		}
 	}
 	free(temp_commit_buffer);
-	free_commit_list(list);
+	clear_commit_queue(&queue);
 	for (l = backup; l; l = l->next)
 		clear_commit_marks(l->item, ONELINE_SEEN);
 	return retval;
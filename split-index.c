@@ -0,0 +1,313 @@
+/*
+ * Split index: most entries live in a shared index file that is
+ * rarely rewritten, and the index proper records only the entries
+ * that changed since.
+ */
+#include "cache.h"
+#include "ewah.h"
+#include "split-index.h"
+
+/* Write a new shared index once this share of its entries changed */
+#define SPLIT_INDEX_MAX_PERCENT 20
+
+/* Shared index files nobody used for this long are removed */
+#define SHARED_INDEX_EXPIRE (14 * 24 * 60 * 60)
+
+struct split_index *init_split_index(struct index_state *istate)
+{
+	if (!istate->split_index)
+		istate->split_index = xcalloc(1, sizeof(*istate->split_index));
+	return istate->split_index;
+}
+
+static struct bitmap *read_link_bitmap(const unsigned char **ptr,
+				       const unsigned char *end)
+{
+	struct ewah_bitmap ewah;
+	struct bitmap *bits;
+	ssize_t len = ewah_read_mmap(&ewah, *ptr, end - *ptr);
+
+	if (len < 0)
+		return NULL;
+	*ptr += len;
+	bits = ewah_to_bitmap(&ewah);
+	free(ewah.buffer);
+	return bits;
+}
+
+int read_link_extension(struct index_state *istate,
+			const void *data, unsigned long sz)
+{
+	const unsigned char *ptr = data, *end = ptr + sz;
+	struct split_index *si;
+
+	if (sz < 20)
+		return error("corrupt link extension (too short)");
+	si = init_split_index(istate);
+	hashcpy(si->base_sha1, ptr);
+	ptr += 20;
+	si->delete_bitmap = read_link_bitmap(&ptr, end);
+	if (si->delete_bitmap)
+		si->replace_bitmap = read_link_bitmap(&ptr, end);
+	if (!si->replace_bitmap || ptr != end)
+		return error("corrupt link extension");
+	return 0;
+}
+
+static void write_link_bitmap(struct strbuf *out, struct bitmap *bits)
+{
+	struct bitmap *empty = NULL;
+	struct ewah_bitmap *ewah;
+
+	if (!bits)
+		bits = empty = bitmap_new();
+	ewah = bitmap_to_ewah(bits);
+	ewah_serialize_strbuf(ewah, out);
+	ewah_free(ewah);
+	bitmap_free(empty);
+}
+
+void write_link_extension(struct strbuf *out,
+			  const unsigned char *base_sha1,
+			  struct bitmap *delete_bitmap,
+			  struct bitmap *replace_bitmap)
+{
+	strbuf_add(out, base_sha1, 20);
+	write_link_bitmap(out, delete_bitmap);
+	write_link_bitmap(out, replace_bitmap);
+}
+
+static int ce_compare(const struct cache_entry *a, const struct cache_entry *b)
+{
+	return cache_name_compare(a->name, a->ce_flags, b->name, b->ce_flags);
+}
+
+/* Would the two entries of the same name be written out the same? */
+static int same_entry(const struct cache_entry *a, const struct cache_entry *b)
+{
+	const unsigned int ondisk_flags =
+		CE_NAMEMASK | CE_STAGEMASK | CE_VALID | CE_EXTENDED_FLAGS;
+
+	return a->ce_ctime == b->ce_ctime &&
+		a->ce_mtime == b->ce_mtime &&
+		a->ce_dev == b->ce_dev &&
+		a->ce_ino == b->ce_ino &&
+		a->ce_mode == b->ce_mode &&
+		a->ce_uid == b->ce_uid &&
+		a->ce_gid == b->ce_gid &&
+		a->ce_size == b->ce_size &&
+		(a->ce_flags & ondisk_flags) == (b->ce_flags & ondisk_flags) &&
+		!hashcmp(a->sha1, b->sha1);
+}
+
+/*
+ * The index file we just read holds the replacements for the shared
+ * entries marked in the replace bitmap, in order, followed by the new
+ * entries in index order.  Read the shared index and merge the two.
+ *
+ * The shared index is kept as it is to compare against when the index
+ * is written out again, so the index gets its own copy of the entries
+ * it takes from there.
+ */
+void merge_base_index(struct index_state *istate)
+{
+	struct split_index *si = istate->split_index;
+	struct index_state *base;
+	struct cache_entry **cache;
+	const char *path;
+	unsigned int i, nr, nr_replace, replaced, added;
+	unsigned long size, used;
+
+	path = git_path("sharedindex.%s", sha1_to_hex(si->base_sha1));
+	base = xcalloc(1, sizeof(*base));
+	if (read_index_from(base, path) < 0)
+		die("unable to read shared index file %s", path);
+	if (hashcmp(base->sha1, si->base_sha1))
+		die("broken index, expect %s in %s, got %s",
+		    sha1_to_hex(si->base_sha1), path,
+		    sha1_to_hex(base->sha1));
+	if (base->split_index)
+		die("shared index file %s is itself split", path);
+
+	nr_replace = bitmap_popcount(si->replace_bitmap);
+	if (istate->cache_nr < nr_replace)
+		die("corrupt link extension (too many replaced entries)");
+
+	size = 0;
+	for (i = 0; i < base->cache_nr; i++)
+		if (!bitmap_get(si->delete_bitmap, i) &&
+		    !bitmap_get(si->replace_bitmap, i))
+			size += ce_size(base->cache[i]);
+	si->alloc = xmalloc(size + 1);
+
+	cache = xmalloc((base->cache_nr + istate->cache_nr + 1) * sizeof(*cache));
+	nr = used = replaced = 0;
+	added = nr_replace;
+	for (i = 0; i < base->cache_nr; i++) {
+		struct cache_entry *ce = base->cache[i];
+
+		if (bitmap_get(si->replace_bitmap, i)) {
+			struct cache_entry *new = istate->cache[replaced++];
+			if (ce_compare(new, ce))
+				die("corrupt link extension (replacement for %s is %s)",
+				    ce->name, new->name);
+			ce = new;
+		} else if (bitmap_get(si->delete_bitmap, i))
+			continue;
+		else {
+			struct cache_entry *copy;
+			copy = (struct cache_entry *)((char *)si->alloc + used);
+			memcpy(copy, ce, ce_size(ce));
+			used += ce_size(ce);
+			ce = copy;
+		}
+		while (added < istate->cache_nr &&
+		       ce_compare(istate->cache[added], ce) < 0)
+			cache[nr++] = istate->cache[added++];
+		cache[nr++] = ce;
+	}
+	if (replaced != nr_replace)
+		die("corrupt link extension (replaced entries missing)");
+	while (added < istate->cache_nr)
+		cache[nr++] = istate->cache[added++];
+
+	free(istate->cache);
+	istate->cache = cache;
+	istate->cache_alloc = base->cache_nr + istate->cache_nr + 1;
+	istate->cache_nr = nr;
+	si->base = base;
+	bitmap_free(si->delete_bitmap);
+	bitmap_free(si->replace_bitmap);
+	si->delete_bitmap = si->replace_bitmap = NULL;
+}
+
+/*
+ * Compare the index against the shared index it was read with, and
+ * return the entries that need to be written to the index file, and
+ * the "link" extension describing the rest.  Returns -1 when there is
+ * no shared index yet, or when so much changed that it is time to
+ * write a new one.
+ */
+int prepare_split_index_write(const struct index_state *istate,
+			      struct cache_entry ***cache_p, int *nr_p,
+			      struct strbuf *link)
+{
+	struct split_index *si = istate->split_index;
+	struct index_state *base = si ? si->base : NULL;
+	struct bitmap *delete_bitmap, *replace_bitmap;
+	struct cache_entry **cache, **added;
+	unsigned int i, j, nr_replace, nr_added, nr_delete;
+
+	if (!base)
+		return -1;
+
+	delete_bitmap = bitmap_new();
+	replace_bitmap = bitmap_new();
+	cache = xmalloc((istate->cache_nr + 1) * sizeof(*cache));
+	added = xmalloc((istate->cache_nr + 1) * sizeof(*added));
+	nr_replace = nr_added = nr_delete = 0;
+
+	i = j = 0;
+	while (i < istate->cache_nr || j < base->cache_nr) {
+		struct cache_entry *ce = NULL, *old = NULL;
+		int cmp;
+
+		if (i < istate->cache_nr) {
+			ce = istate->cache[i];
+			if (ce->ce_flags & CE_REMOVE) {
+				i++;
+				continue;
+			}
+		}
+		if (j < base->cache_nr)
+			old = base->cache[j];
+
+		if (!ce)
+			cmp = 1;
+		else if (!old)
+			cmp = -1;
+		else
+			cmp = ce_compare(ce, old);
+
+		if (cmp < 0) {
+			added[nr_added++] = ce;
+			i++;
+		} else if (0 < cmp) {
+			bitmap_set(delete_bitmap, j);
+			nr_delete++;
+			j++;
+		} else {
+			if (!same_entry(ce, old)) {
+				bitmap_set(replace_bitmap, j);
+				cache[nr_replace++] = ce;
+			}
+			i++;
+			j++;
+		}
+	}
+
+	if ((nr_replace + nr_added + nr_delete) * 100 >
+	    base->cache_nr * SPLIT_INDEX_MAX_PERCENT) {
+		free(cache);
+		free(added);
+		bitmap_free(delete_bitmap);
+		bitmap_free(replace_bitmap);
+		return -1;
+	}
+
+	memcpy(cache + nr_replace, added, nr_added * sizeof(*cache));
+	free(added);
+	write_link_extension(link, si->base_sha1, delete_bitmap, replace_bitmap);
+	bitmap_free(delete_bitmap);
+	bitmap_free(replace_bitmap);
+	*cache_p = cache;
+	*nr_p = nr_replace + nr_added;
+	return 0;
+}
+
+void discard_split_index(struct index_state *istate)
+{
+	struct split_index *si = istate->split_index;
+
+	if (!si)
+		return;
+	if (si->base) {
+		discard_index(si->base);
+		free(si->base->cache);
+		free(si->base);
+	}
+	free(si->alloc);
+	bitmap_free(si->delete_bitmap);
+	bitmap_free(si->replace_bitmap);
+	free(si);
+	istate->split_index = NULL;
+}
+
+/* A shared index file that is in use must not expire */
+void freshen_shared_index(const unsigned char *sha1)
+{
+	utime(git_path("sharedindex.%s", sha1_to_hex(sha1)), NULL);
+}
+
+void clean_shared_index_files(const unsigned char *current)
+{
+	const char *keep = sha1_to_hex(current);
+	DIR *dir = opendir(get_git_dir());
+	struct dirent *de;
+	time_t expire = time(NULL) - SHARED_INDEX_EXPIRE;
+
+	if (!dir)
+		return;
+	while ((de = readdir(dir)) != NULL) {
+		const char *path;
+		struct stat st;
+
+		if (prefixcmp(de->d_name, "sharedindex.") ||
+		    !strcmp(de->d_name + strlen("sharedindex."), keep))
+			continue;
+		path = git_path("%s", de->d_name);
+		if (!stat(path, &st) && st.st_mtime < expire)
+			unlink(path);
+	}
+	closedir(dir);
+}
@@ -0,0 +1,44 @@
+#ifndef SPLIT_INDEX_H
+#define SPLIT_INDEX_H
+
+/*
+ * A split index keeps most entries in a shared index file,
+ * $GIT_DIR/sharedindex.<SHA-1>, that is rarely rewritten.  The index
+ * file proper only records the entries that differ from it, and a
+ * "link" extension naming the shared index together with bitmaps of
+ * the shared entries that were deleted or replaced.
+ *
+ * See Documentation/technical/split-index.txt.
+ */
+
+struct index_state;
+struct strbuf;
+struct bitmap;
+
+struct split_index {
+	unsigned char base_sha1[20];
+	struct index_state *base;	/* NULL until the index is split */
+	void *alloc;			/* our copies of the shared entries */
+
+	/* Only while reading */
+	struct bitmap *delete_bitmap;
+	struct bitmap *replace_bitmap;
+};
+
+extern struct split_index *init_split_index(struct index_state *istate);
+extern int read_link_extension(struct index_state *istate,
+			       const void *data, unsigned long sz);
+extern void write_link_extension(struct strbuf *out,
+				 const unsigned char *base_sha1,
+				 struct bitmap *delete_bitmap,
+				 struct bitmap *replace_bitmap);
+extern void merge_base_index(struct index_state *istate);
+extern int prepare_split_index_write(const struct index_state *istate,
+				     struct cache_entry ***cache_p, int *nr_p,
+				     struct strbuf *link);
+extern void discard_split_index(struct index_state *istate);
+
+extern void freshen_shared_index(const unsigned char *sha1);
+extern void clean_shared_index_files(const unsigned char *current);
+
+#endif
@@ -0,0 +1,76 @@
+#!/bin/sh
+
+test_description='commit queue and the walks that use it'
+
+. ./test-lib.sh
+
+cat >expect <<'EOF'
+10 5
+6 1
+5 4
+3 2
+2 0
+1 3
+NULL
+EOF
+
+test_expect_success 'most recent commit comes out first' '
+	test-commit-queue 2 6 3 1 5 10 get get get get get get get >actual &&
+	test_cmp expect actual
+'
+
+cat >expect <<'EOF'
+5 2
+3 0
+3 1
+3 4
+3 5
+1 3
+EOF
+
+test_expect_success 'commits with the same date keep their order' '
+	test-commit-queue 3 3 5 1 get 3 3 get get get get get >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'setup wide history' '
+	test_tick &&
+	git commit -q --allow-empty -m base &&
+	for i in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20
+	do
+		git checkout -q -b topic$i master &&
+		test_tick &&
+		git commit -q --allow-empty -m topic$i || return 1
+	done &&
+	git checkout -q master &&
+	for i in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20
+	do
+		test_tick &&
+		git commit -q --allow-empty -m main$i || return 1
+	done &&
+	test_tick &&
+	git merge -q topic1 topic2 topic3 topic4 topic5 topic6 topic7 \
+		topic8 topic9 topic10 topic11 topic12 topic13 topic14 \
+		topic15 topic16 topic17 topic18 topic19 topic20
+'
+
+test_expect_success 'rev-list walks a wide history by date' '
+	git rev-list --pretty=format:%ct HEAD | grep -v "^commit" >dates &&
+	test $(wc -l <dates) = 42 &&
+	sort -r -n dates >expect &&
+	test_cmp expect dates &&
+	git rev-list --all >all &&
+	test $(wc -l <all) = 42 &&
+	git rev-list HEAD ^topic7 >limited &&
+	test $(wc -l <limited) = 40
+'
+
+test_expect_success 'merge-base, describe and :/ across the merged topics' '
+	test $(git merge-base topic3 topic17) = $(git rev-parse master~1~20) &&
+	test $(git merge-base --all HEAD topic11) = $(git rev-parse topic11) &&
+	git tag -a -m base v0 master~1~20 &&
+	test $(git describe HEAD) = v0-41-g$(git rev-parse --short HEAD) &&
+	test $(git rev-parse :/topic13) = $(git rev-parse topic13)
+'
+
+test_done
@@ -0,0 +1,60 @@
+#!/bin/sh
+
+test_description='SHA-1 implementations give the same object names'
+
+. ./test-lib.sh
+
+# With BLK_SHA1, every backend this processor supports is tried;
+# other builds have a single implementation, called "auto" here.
+backends=auto
+for b in generic sha-ni avx2 sha-ni+avx2
+do
+	if test-sha1 --backend=$b </dev/null >/dev/null 2>&1
+	then
+		backends="$backends $b"
+	fi
+done
+
+test_expect_success 'setup' '
+	for i in 0 1 55 56 63 64 65 127 128 1000 4095 4096 100000
+	do
+		test-genrandom "seed $i" $i >file$i &&
+		echo file$i >>list || return 1
+	done &&
+	for f in $(cat list)
+	do
+		git hash-object $f || return 1
+	done >expect &&
+	for f in $(cat list)
+	do
+		git add $f &&
+		test_tick &&
+		git commit -q -m $f || return 1
+	done &&
+	git rev-list --objects HEAD |
+		git pack-objects --window=0 pack >/dev/null
+'
+
+for b in $backends
+do
+	test_expect_success "test-sha1 with backend $b" '
+		printf abc | test-sha1 --backend=$b >actual &&
+		echo a9993e364706816aba3e25717850c26c9cd0d89d >expect.abc &&
+		test_cmp expect.abc actual &&
+		perl -e "print q(a) x 1000000" | test-sha1 --backend=$b >actual &&
+		echo 34aa973cd4c4daa4f61eeb2bdbad27316534016f >expect.long &&
+		test_cmp expect.long actual
+	'
+
+	test_expect_success "hash-object --stdin-paths with backend $b" '
+		GIT_SHA1_BACKEND=$b git hash-object --stdin-paths <list >actual &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "index-pack with backend $b" '
+		GIT_SHA1_BACKEND=$b git index-pack -o actual.idx pack-*.pack &&
+		cmp pack-*.idx actual.idx
+	'
+done
+
+test_done
@@ -241,4 +241,48 @@ test_expect_success "--batch-check with multiple sha1s gives correct format" '
     "$(echo_without_newline "$batch_check_input" | git cat-file --batch-check)"
 '
 
+test_expect_success "--buffer gives the same output" '
+    test "$(maybe_remove_timestamp "$batch_output" 1)" = "$(maybe_remove_timestamp "$(echo_without_newline "$batch_input" | git cat-file --batch --buffer)" 1)" &&
+    test "$batch_check_output" = \
+    "$(echo_without_newline "$batch_check_input" | git cat-file --batch-check --buffer)"
+'
+
+test_expect_success "--buffer and --unordered need --batch" '
+    test_must_fail git cat-file --buffer -t $hello_sha1 &&
+    test_must_fail git cat-file --unordered blob $hello_sha1
+'
+
+test_expect_success "--unordered shows packed objects in pack order" '
+    for sha1 in $tag_sha1 $commit_sha1 $tree_sha1 $hello_sha1
+    do
+	echo $sha1
+    done | git pack-objects -q .git/objects/pack/pack &&
+    echo_without_newline "$batch_check_input" |
+	git cat-file --batch-check --unordered >actual &&
+    echo_without_newline "$batch_check_output" | sort >expect &&
+    sort actual >actual.sorted &&
+    test_cmp expect actual.sorted &&
+    tail -n 2 actual >missing &&
+    printf "deadbeef missing\n missing\n" >expect.missing &&
+    test_cmp expect.missing missing &&
+    pack=$(ls .git/objects/pack/*.idx) &&
+    git verify-pack -v $pack |
+	grep "^[0-9a-f]\{40\} \(blob\|tree\|commit\|tag\) " |
+	sort -n -k 5 | sed -e "s/ .*//" >packed &&
+    sed -e "s/ .*//" actual | grep -F -x -f packed >shown &&
+    grep -F -x -f shown packed >expect.order &&
+    test_cmp expect.order shown
+'
+
+test_expect_success "--batch --unordered --buffer shows every object once" '
+    echo_without_newline "$batch_input" |
+	git cat-file --batch --unordered --buffer >actual &&
+    test "$(maybe_remove_timestamp "$(echo_without_newline "$batch_input" | git cat-file --batch)" 1 | wc -c)" \
+	= "$(maybe_remove_timestamp "$(cat actual)" 1 | wc -c)" &&
+    for sha1 in $hello_sha1 $commit_sha1 $tag_sha1
+    do
+	test $(grep -c "^$sha1 " actual) = 1 || return 1
+    done
+'
+
 test_done
@@ -0,0 +1,84 @@
+#!/bin/sh
+
+test_description='loose objects looked up through core.looseObjectCache'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	for i in 1 2 3 4 5 6 7 8
+	do
+		echo $i >file$i &&
+		git add file$i &&
+		test_tick &&
+		git commit -q -m $i || return 1
+	done &&
+	git rev-list --objects HEAD >objects &&
+	git config core.looseobjectcache true
+'
+
+test_expect_success 'loose objects are found' '
+	git count-objects | sed -e "s/ .*//" >count &&
+	test $(cat count) = $(wc -l <objects) &&
+	while read sha1 path
+	do
+		git cat-file -e $sha1 || return 1
+	done <objects &&
+	git fsck --full &&
+	test_must_fail git cat-file -e 0000000000000000000000000000000000000001
+'
+
+test_expect_success 'objects written by the same process are seen' '
+	git rev-list --objects HEAD | sed -e "s/ .*//" |
+		git pack-objects --stdout >all.pack &&
+	head=$(git rev-parse HEAD) &&
+	mkdir unpacked &&
+	(
+		cd unpacked &&
+		git init -q &&
+		git config core.looseobjectcache true &&
+		git unpack-objects -q <../all.pack &&
+		git update-ref refs/heads/master $head &&
+		git fsck --full &&
+		git cat-file -e $head:file8
+	)
+'
+
+test_expect_success 'objects added one after the other are seen' '
+	git rm -q --cached file1 &&
+	echo changed >file2 &&
+	echo changed >file3 &&
+	git add file2 file3 &&
+	test_tick &&
+	git commit -q -m changed &&
+	git fsck --full &&
+	git cat-file -e HEAD:file2
+'
+
+test_expect_success 'loose objects of alternates are found' '
+	git clone -q -s . borrower &&
+	(
+		cd borrower &&
+		git config core.looseobjectcache true &&
+		test ! -d .git/objects/$(git rev-parse HEAD | cut -c1-2) &&
+		git cat-file -e HEAD:file8 &&
+		git log --raw >/dev/null &&
+		echo new >new &&
+		git add new &&
+		test_tick &&
+		git commit -q -m new &&
+		git fsck --full
+	)
+'
+
+test_expect_success 'packed objects are still found' '
+	git repack -q -a -d &&
+	git prune-packed &&
+	test $(git count-objects | sed -e "s/ .*//") = 0 &&
+	git rev-list --objects --all | sed -e "s/ .*//" >all &&
+	while read sha1
+	do
+		git cat-file -e $sha1 || return 1
+	done <all
+'
+
+test_done
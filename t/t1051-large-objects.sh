@@ -0,0 +1,80 @@
+#!/bin/sh
+
+test_description='blobs over core.bigFileThreshold are streamed in and out'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test-genrandom large 2000000 >large &&
+	sha1=$(git hash-object large) &&
+	git config core.bigfilethreshold 200k
+'
+
+test_expect_success 'hash-object streams to the same name' '
+	test $(git hash-object large) = $sha1 &&
+	test $(git hash-object -w large) = $sha1 &&
+	test -f .git/objects/$(echo $sha1 | sed -e "s|^..|&/|") &&
+	git cat-file blob $sha1 >actual &&
+	cmp large actual &&
+	test $(git hash-object -w large) = $sha1 &&
+	! ls .git/objects/tmp_obj_* 2>/dev/null
+'
+
+test_expect_success 'add streams a large file into a loose object' '
+	rm .git/objects/$(echo $sha1 | sed -e "s|^..|&/|") &&
+	git add large &&
+	test $(git ls-files -s large | cut -d" " -f2) = $sha1 &&
+	git fsck --full &&
+	test_tick &&
+	git commit -q -m large
+'
+
+test_expect_success 'checkout streams a loose blob' '
+	rm large &&
+	git checkout large &&
+	git cat-file blob $sha1 >actual &&
+	cmp actual large &&
+	git diff-files --exit-code
+'
+
+test_expect_success 'checkout streams a packed blob' '
+	git repack -a -d -q &&
+	test $(git count-objects | sed -e "s/ .*//") = 0 &&
+	rm large &&
+	git checkout large &&
+	cmp actual large &&
+	git diff-files --exit-code
+'
+
+test_expect_success 'checkout of a large delta falls back to reading it' '
+	cp large large2 &&
+	echo tail >>large2 &&
+	git add large2 &&
+	test_tick &&
+	git commit -q -m large2 &&
+	git repack -a -d -f -q &&
+	git verify-pack -v .git/objects/pack/*.pack >verify &&
+	test $(grep " blob .* [0-9a-f]\{40\}\$" verify | wc -l) = 1 &&
+	cp large2 expect &&
+	rm large large2 &&
+	git checkout large large2 &&
+	cmp actual large &&
+	cmp expect large2 &&
+	git diff-files --exit-code
+'
+
+test_expect_success 'conversion still applies to large files' '
+	awk "BEGIN { for (i = 0; i < 30000; i++) print \"line \" i }" >text &&
+	echo "text crlf" >.gitattributes &&
+	git config core.autocrlf true &&
+	git add text &&
+	git cat-file blob :text >expect &&
+	cmp text expect &&
+	rm text &&
+	git checkout text &&
+	grep -q "$(printf "\r")" text &&
+	tr -d "\015" <text >actual &&
+	cmp expect actual
+'
+
+test_done
@@ -0,0 +1,109 @@
+#!/bin/sh
+
+test_description='packed and loose refs seen through the ref cache'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test_tick &&
+	git commit -q --allow-empty -m initial &&
+	for b in a-b a/c a/d/e a0 z
+	do
+		git branch $b || return 1
+	done &&
+	git tag v1 &&
+	git tag deep/v2 &&
+	git pack-refs --all --prune &&
+	test_tick &&
+	git commit -q --allow-empty -m second &&
+	git branch a/d/f &&
+	git branch -f a/c &&
+	git branch m/loose &&
+	git tag v3
+'
+
+test_expect_success 'refs are listed in order, loose over packed' '
+	git for-each-ref --format="%(refname)" >actual &&
+	sort actual >expect &&
+	test_cmp expect actual &&
+	test "$(git rev-parse a/c)" = "$(git rev-parse HEAD)" &&
+	test "$(git rev-parse a/d/e)" = "$(git rev-parse HEAD^)" &&
+	test $(git show-ref | grep -c "refs/heads/a/c$") = 1
+'
+
+test_expect_success 'iterating a prefix only shows that prefix' '
+	git for-each-ref --format="%(refname)" refs/tags >expect &&
+	git tag -l | sed -e "s|^|refs/tags/|" >actual &&
+	test_cmp expect actual &&
+	git for-each-ref --format="%(refname)" refs/heads >expect &&
+	git branch | sed -e "s|^..|refs/heads/|" >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'a ref cannot be created over a packed or loose one' '
+	test_must_fail git branch a/d &&
+	test_must_fail git branch a/c/x &&
+	test_must_fail git branch m &&
+	test_must_fail git branch -m z a/d/e/x &&
+	test_must_fail git branch -m z a0/x &&
+	test_must_fail git branch -m z a &&
+	git branch -m a/d/e a/d/e/x &&
+	git branch -m a/d/e/x a/d/e &&
+	git rev-parse --verify a/d/e
+'
+
+test_expect_success 'deleting a packed ref keeps the other packed refs' '
+	git branch -d a-b &&
+	test_must_fail git rev-parse --verify a-b &&
+	! grep "refs/heads/a-b$" .git/packed-refs &&
+	grep "refs/heads/a0$" .git/packed-refs &&
+	grep "refs/tags/deep/v2$" .git/packed-refs &&
+	git rev-parse --verify deep/v2
+'
+
+test_expect_success 'packed refs are looked up in sorted packed-refs' '
+	for i in 1 2 3 4 5 6 7 8 9
+	do
+		git tag -a -m "tag $i" ann$i || return 1
+	done &&
+	git pack-refs --all --prune &&
+	head -n 1 .git/packed-refs >header &&
+	grep "^# pack-refs with: peeled sorted $" header &&
+	git show-ref -d >expect &&
+	for r in $(git for-each-ref --format="%(refname)")
+	do
+		git rev-parse --verify -q $r >/dev/null || return 1
+	done &&
+	test_must_fail git rev-parse --verify -q refs/heads/a/c0 &&
+	test_must_fail git rev-parse --verify -q refs/heads/ &&
+	test_must_fail git rev-parse --verify -q refs/tags/ann &&
+	test "$(git rev-parse ann5^{})" = "$(git rev-parse HEAD)"
+'
+
+test_expect_success 'deleting a packed ref keeps it sorted and peeled' '
+	git tag -d ann4 &&
+	head -n 1 .git/packed-refs >header &&
+	grep "^# pack-refs with: peeled sorted $" header &&
+	grep -v "refs/tags/ann4" expect >expect.del &&
+	git show-ref -d >actual &&
+	test_cmp expect.del actual
+'
+
+test_expect_success 'unsorted packed-refs is still read' '
+	git rev-parse ann1 >ann1 &&
+	git rev-parse ann9 >ann9 &&
+	{
+		echo "# pack-refs with: peeled " &&
+		sed -n -e "/refs\/tags\/ann9$/{p;n;p;}" .git/packed-refs &&
+		sed -e "/^#/d" -e "/refs\/tags\/ann9$/{N;d;}" .git/packed-refs
+	} >packed &&
+	mv packed .git/packed-refs &&
+	git rev-parse --verify ann1 >actual &&
+	test_cmp ann1 actual &&
+	git rev-parse --verify ann9 >actual &&
+	test_cmp ann9 actual &&
+	git show-ref -d >actual &&
+	test_cmp expect.del actual
+'
+
+test_done
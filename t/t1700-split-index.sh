@@ -0,0 +1,102 @@
+#!/bin/sh
+
+test_description='split index: shared index plus the changes since'
+
+. ./test-lib.sh
+
+# Change the stat data of a file, so that refreshing writes the index.
+rewrite_index () {
+	test-chmtime -1 file0 &&
+	git update-index --refresh
+}
+
+test_expect_success 'setup' '
+	for i in 0 1 2 3 4 5 6 7 8 9
+	do
+		echo $i >file$i || return 1
+	done &&
+	git add file? &&
+	test_tick &&
+	git commit -q -m initial &&
+	git config core.splitindex true
+'
+
+test_expect_success 'first write creates a shared index' '
+	git ls-files -s >expect &&
+	rewrite_index &&
+	test $(ls .git/sharedindex.* | wc -l) = 1 &&
+	git ls-files -s >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'index only records what changed' '
+	shared=$(ls .git/sharedindex.*) &&
+	echo new >new &&
+	git add new &&
+	test "$(ls .git/sharedindex.*)" = "$shared" &&
+	test $(wc -c <.git/index) -lt $(wc -c <$shared) &&
+	git ls-files >actual &&
+	grep "^new$" actual &&
+	git diff-files --exit-code
+'
+
+test_expect_success 'replaced and removed entries' '
+	echo changed >file3 &&
+	git add file3 &&
+	git rm -q --cached file5 &&
+	git ls-files -s >actual &&
+	! grep file5 actual &&
+	test "$(git ls-files -s file3)" = \
+		"100644 $(git hash-object file3) 0	file3" &&
+	git diff-files --exit-code file3
+'
+
+test_expect_success 'same index as without splitting' '
+	git ls-files -s >expect &&
+	git config core.splitindex false &&
+	rewrite_index &&
+	! grep link .git/index &&
+	git ls-files -s >actual &&
+	test_cmp expect actual &&
+	git config core.splitindex true &&
+	rewrite_index &&
+	grep link .git/index &&
+	git ls-files -s >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'many changes write a new shared index' '
+	ls .git/sharedindex.* >before &&
+	for i in 0 1 2 3 4 6 7 8 9
+	do
+		echo more >file$i || return 1
+	done &&
+	git add file? &&
+	git ls-files -s >expect &&
+	test $(ls .git/sharedindex.* | wc -l) -gt $(wc -l <before) &&
+	git diff-files --exit-code &&
+	test_tick &&
+	git commit -q -m more &&
+	git ls-files -s >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'checkout with a split index' '
+	git checkout -q HEAD^ &&
+	git ls-tree -r HEAD | wc -l >expect &&
+	git ls-files | wc -l >actual &&
+	test_cmp expect actual &&
+	git diff-files --exit-code &&
+	git checkout -q master &&
+	git diff-files --exit-code
+'
+
+test_expect_success 'missing shared index is an error' '
+	mkdir save &&
+	mv .git/sharedindex.* save/ &&
+	test_must_fail git ls-files &&
+	mv save/sharedindex.* .git/ &&
+	git ls-files
+'
+
+test_done
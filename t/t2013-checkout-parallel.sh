@@ -0,0 +1,80 @@
+#!/bin/sh
+
+test_description='checkout with several worker threads'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	i=0 &&
+	while test $i -lt 200
+	do
+		mkdir -p dir$(($i % 7)) &&
+		echo "file $i" >dir$(($i % 7))/file$i &&
+		i=$(($i + 1)) || return 1
+	done &&
+	printf "one\ntwo\n" >text &&
+	echo "\$Id\$" >ident &&
+	echo "ident ident" >.gitattributes &&
+	ln -s dir0 link &&
+	chmod +x dir1/file1 &&
+	git add . &&
+	test_tick &&
+	git commit -q -m initial &&
+	git ls-files -s >expect.index &&
+	git checkout -b other &&
+	git rm -q -r --cached dir[0-9] text ident &&
+	rm -rf dir[0-9] text ident &&
+	mkdir dir3 &&
+	echo changed >dir3/file3 &&
+	git add dir3 &&
+	test_tick &&
+	git commit -q -m other
+'
+
+test_expect_success 'parallel checkout writes every file' '
+	git config core.checkoutworkers 4 &&
+	git checkout master &&
+	git ls-files -s >actual.index &&
+	test_cmp expect.index actual.index &&
+	git diff-files --exit-code &&
+	test "$(cat dir5/file40)" = "file 40" &&
+	test -x dir1/file1 &&
+	test "$(cat ident)" != "\$Id\$"
+'
+
+test_expect_success 'parallel checkout updates the stat data' '
+	git ls-files -s >before &&
+	git update-index --refresh &&
+	git diff-files --exit-code &&
+	git checkout other &&
+	test ! -d dir5 &&
+	test "$(cat dir3/file3)" = changed &&
+	git diff-files --exit-code
+'
+
+test_expect_success 'parallel checkout converts line endings' '
+	git config core.autocrlf true &&
+	git checkout master &&
+	printf "one\r\ntwo\r\n" >expect &&
+	test_cmp expect text &&
+	git diff-files --exit-code &&
+	git config --unset core.autocrlf &&
+	git reset -q --hard
+'
+
+test_expect_success 'parallel and sequential checkouts agree' '
+	git checkout other &&
+	git config core.checkoutworkers 1 &&
+	git checkout master &&
+	git ls-files -s >sequential &&
+	find dir* -type f | sort | xargs cat >sequential.files &&
+	git checkout other &&
+	git config core.checkoutworkers 8 &&
+	git checkout master &&
+	git ls-files -s >parallel &&
+	find dir* -type f | sort | xargs cat >parallel.files &&
+	test_cmp sequential parallel &&
+	test_cmp sequential.files parallel.files
+'
+
+test_done
@@ -0,0 +1,119 @@
+#!/bin/sh
+
+test_description='index format version 4 with compressed path names'
+
+. ./test-lib.sh
+
+index_version () {
+	od -An -tu1 -j7 -N1 "${1-.git/index}" | tr -d " "
+}
+
+test_expect_success 'setup' '
+	for d in a a/deep a/deep/er a/deep/er/still b
+	do
+		mkdir -p $d &&
+		for f in one two three
+		do
+			echo "$d/$f" >$d/$f || return 1
+		done
+	done &&
+	echo top >top &&
+	git add . &&
+	test_tick &&
+	git commit -q -m initial &&
+	git ls-files -s >expect &&
+	test $(index_version) = 2
+'
+
+test_expect_success 'convert to version 4' '
+	wc -c <.git/index >size2 &&
+	git update-index --index-version 4 &&
+	test $(index_version) = 4 &&
+	test $(wc -c <.git/index) -lt $(cat size2) &&
+	git ls-files -s >actual &&
+	test_cmp expect actual &&
+	git diff-files --exit-code &&
+	git diff-index --cached --exit-code HEAD
+'
+
+test_expect_success 'version 4 survives updates' '
+	echo changed >a/deep/er/two &&
+	echo new >a/deep/new &&
+	git add a/deep/er/two a/deep/new &&
+	git rm -q --cached b/one &&
+	test $(index_version) = 4 &&
+	git ls-files >actual &&
+	grep "^a/deep/new$" actual &&
+	! grep "^b/one$" actual &&
+	git diff-files --exit-code a &&
+	git reset -q --hard &&
+	git ls-files -s >actual &&
+	test_cmp expect actual &&
+	test $(index_version) = 4
+'
+
+test_expect_success 'extended flags in version 4' '
+	echo intent >a/deep/intent &&
+	git add -N a/deep/intent &&
+	test $(index_version) = 4 &&
+	git ls-files >actual &&
+	grep "^a/deep/intent$" actual &&
+	git rm -q --cached a/deep/intent &&
+	rm a/deep/intent
+'
+
+test_expect_success 'long path names' '
+	long=$(printf "%05000d" 0) &&
+	sha1=$(git hash-object -w top) &&
+	cp .git/index .git/long-index &&
+	GIT_INDEX_FILE=.git/long-index \
+		git update-index --add --cacheinfo 100644 $sha1 $long/x &&
+	GIT_INDEX_FILE=.git/long-index git ls-files >actual &&
+	grep "^$long/x$" actual &&
+	grep "^top$" actual
+'
+
+test_expect_success 'convert back to version 2' '
+	git update-index --index-version 2 &&
+	test $(index_version) = 2 &&
+	git ls-files -s >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'core.indexVersion applies to a new index' '
+	git config core.indexversion 4 &&
+	git update-index --index-version 2 &&
+	test $(index_version) = 2 &&
+	rm .git/index &&
+	git read-tree HEAD &&
+	git update-index --refresh &&
+	test $(index_version) = 4 &&
+	git config --unset core.indexversion &&
+	git ls-files -s >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'split index with version 4' '
+	git config core.splitindex true &&
+	echo split >b/two &&
+	git add b/two &&
+	shared=$(ls .git/sharedindex.*) &&
+	test $(index_version $shared) = 4 &&
+	echo again >b/three &&
+	git add b/three &&
+	test $(index_version) = 4 &&
+	git ls-files -s >actual &&
+	test $(wc -l <actual) = $(wc -l <expect) &&
+	git diff-files --exit-code &&
+	git config core.splitindex false &&
+	git reset -q --hard &&
+	git ls-files -s >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'bad versions are refused' '
+	test_must_fail git update-index --index-version 1 &&
+	test_must_fail git update-index --index-version 5
+'
+
+test_done
@@ -95,4 +95,99 @@ test_expect_success 'master: branch --no-merged' '
 
 '
 
+# brute force: every ref whose merge base with $2 is $2 itself
+contains_by_merge_base () {
+	want=$(git rev-parse "$2") &&
+	git for-each-ref --format="%(refname)" "$1" |
+	while read ref
+	do
+		if test "$(git merge-base $ref $want)" = $want
+		then
+			echo "$ref"
+		fi
+	done | sed -e "s|^$1/||" | sort
+}
+
+test_expect_success 'setup many tags and branches' '
+	git checkout -q master &&
+	for i in 1 2 3 4 5 6 7 8 9 10
+	do
+		git checkout -q -b topic$i master &&
+		echo $i >topic &&
+		git add topic &&
+		test_tick &&
+		git commit -q -m topic$i &&
+		git tag t$i &&
+		git checkout -q master &&
+		echo m$i >file &&
+		test_tick &&
+		git commit -q -a -m master$i &&
+		git tag m$i || return 1
+	done &&
+	git checkout -q -b merged topic3 &&
+	test_tick &&
+	git merge -q m5 &&
+	git tag merged &&
+	git checkout -q master
+'
+
+for c in m1 m5 m10 t3 t7 merged side
+do
+	test_expect_success "tag and branch --contains $c on many refs" "
+		git tag --contains $c >actual &&
+		contains_by_merge_base refs/tags $c >expect &&
+		test_cmp expect actual &&
+		git branch --contains $c | sed -e 's/^..//' | sort >actual &&
+		contains_by_merge_base refs/heads $c >expect &&
+		test_cmp expect actual
+	"
+done
+
+test_expect_success '--contains with several commits' '
+	git tag --contains t3 --contains m9 >actual &&
+	{
+		contains_by_merge_base refs/tags t3 &&
+		contains_by_merge_base refs/tags m9
+	} | sort -u >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success '--contains is exact with skewed commit dates' '
+	git checkout -q -b skewed m10 &&
+	GIT_COMMITTER_DATE="1000000000 +0000" \
+	git commit -q --allow-empty -m "committed years earlier" &&
+	git tag skewed-tag &&
+	git checkout -q -b skewed-child skewed &&
+	test_tick &&
+	git commit -q --allow-empty -m "on top of the skewed commit" &&
+	git tag skewed-child-tag &&
+	git checkout -q master &&
+	git tag --contains m10 >actual &&
+	grep "^skewed-tag$" actual &&
+	grep "^skewed-child-tag$" actual &&
+	git branch --contains m9 | sed -e "s/^..//" >actual &&
+	grep "^skewed$" actual &&
+	grep "^skewed-child$" actual
+'
+
+test_expect_success '--contains prunes by generation with a commit-graph' '
+	git commit-graph write &&
+	for c in m1 m5 t3 merged
+	do
+		git tag --contains $c >actual &&
+		contains_by_merge_base refs/tags $c >expect &&
+		test_cmp expect actual || return 1
+	done &&
+	test_tick &&
+	git commit -q --allow-empty -m "not in the graph" &&
+	git tag new &&
+	git tag --contains m10 >actual &&
+	contains_by_merge_base refs/tags m10 >expect &&
+	test_cmp expect actual &&
+	grep "^new$" actual &&
+	git tag --contains new >actual &&
+	echo new >expect &&
+	test_cmp expect actual
+'
+
 test_done
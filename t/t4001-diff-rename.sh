@@ -77,4 +77,47 @@ test_expect_success  'favour same basenames even with minor differences' '
 	git show HEAD:path1 | sed "s/15/16/" > subdir/path1 &&
 	git status | grep "renamed: .*path1 -> subdir/path1"'
 
+# Every file is mostly lines that all the others have, too, so
+# that the rename index treats those as common chunks and every
+# pair is a candidate that has to be scored; there are more of
+# them than diffcore_rename() scores in one batch.
+many_files () {
+	i=1
+	while test $i -le 150
+	do
+		echo $i
+		i=$(($i + 1))
+	done
+}
+
+test_expect_success 'renames among many files with common lines' '
+	git reset -q --hard &&
+	mkdir many moved &&
+	for i in $(many_files)
+	do
+		for j in $(many_files)
+		do
+			echo "}"
+		done >many/$i &&
+		for j in 1 2 3 4 5
+		do
+			echo "file $i line $j"
+		done >>many/$i || return 1
+	done &&
+	git add many &&
+	git commit -q -m many &&
+	for i in $(many_files)
+	do
+		sed -e "s/line 3/line three/" many/$i >moved/$i &&
+		git rm -q many/$i || return 1
+	done &&
+	git add moved &&
+	git diff --cached -M --name-status >actual &&
+	test $(wc -l <actual) = 150 &&
+	for i in $(many_files)
+	do
+		grep "^R09[0-9].many/$i.moved/$i\$" actual || return 1
+	done
+'
+
 test_done
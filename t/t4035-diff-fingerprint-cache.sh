@@ -0,0 +1,76 @@
+#!/bin/sh
+
+test_description='fingerprint cache for rename and copy detection'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	for i in 1 2 3 4 5 6
+	do
+		for j in 1 2 3 4 5 6 7 8 9 10
+		do
+			echo "file $i line $j"
+		done >file$i || return 1
+	done &&
+	git add . &&
+	test_tick &&
+	git commit -q -m initial &&
+	for i in 1 2 3
+	do
+		sed -e "s/line 5/line five/" file$i >copy$i &&
+		git add copy$i &&
+		test_tick &&
+		git commit -q -m "copy $i" || return 1
+	done &&
+	git config diff.fingerprintCacheLimit 0 &&
+	git log -C -C --name-status >expect &&
+	grep "^C" expect &&
+	git config --unset diff.fingerprintCacheLimit
+'
+
+test_expect_success 'unchanged sources are fingerprinted once' '
+	GIT_TRACE_PERFORMANCE="$(pwd)/trace" git log -C -C --name-status >actual &&
+	test_cmp expect actual &&
+	grep "fingerprint cache: [1-9][0-9]* hits" trace
+'
+
+test_expect_success 'a small cache evicts but detects the same copies' '
+	git config diff.fingerprintCacheLimit 200 &&
+	rm -f trace &&
+	GIT_TRACE_PERFORMANCE="$(pwd)/trace" git log -C -C --name-status >actual &&
+	test_cmp expect actual &&
+	grep "[1-9][0-9]* evictions" trace &&
+	git config --unset diff.fingerprintCacheLimit
+'
+
+test_expect_success 'fingerprints are kept on disk with diff.fingerprintCache' '
+	git config diff.fingerprintCache true &&
+	git log -C -C --name-status >actual &&
+	test_cmp expect actual &&
+	test -s .git/fingerprints &&
+	rm -f trace &&
+	GIT_TRACE_PERFORMANCE="$(pwd)/trace" git log -C -C --name-status >actual &&
+	test_cmp expect actual &&
+	grep "fingerprint cache: [1-9][0-9]* hits, 0 misses" trace
+'
+
+test_expect_success 'a corrupt cache file is ignored' '
+	echo garbage >.git/fingerprints &&
+	git log -C -C --name-status >actual 2>err &&
+	test_cmp expect actual &&
+	grep "ignoring corrupt" err &&
+	git log -C -C --name-status >actual 2>err &&
+	test_cmp expect actual &&
+	! grep "ignoring corrupt" err
+'
+
+test_expect_success 'an attribute that makes a file binary is honoured' '
+	echo "copy1 -diff" >.gitattributes &&
+	git config diff.fingerprintCacheLimit 0 &&
+	git log -C -C --name-status >expect &&
+	git config --unset diff.fingerprintCacheLimit &&
+	git log -C -C --name-status >actual &&
+	test_cmp expect actual
+'
+
+test_done
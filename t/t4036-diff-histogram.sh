@@ -0,0 +1,257 @@
+#!/bin/sh
+
+test_description='histogram diff algorithm'
+
+. ./test-lib.sh
+
+cat >file1 <<\EOF
+#include <stdio.h>
+
+// Frobs foo heartily
+int frobnitz(int foo)
+{
+    int i;
+    for(i = 0; i < 10; i++)
+    {
+        printf("Your answer is: ");
+        printf("%d\n", foo);
+    }
+}
+
+int fact(int n)
+{
+    if(n > 1)
+    {
+        return fact(n-1) * n;
+    }
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    frobnitz(fact(10));
+}
+EOF
+
+cat >file2 <<\EOF
+#include <stdio.h>
+
+int fib(int n)
+{
+    if(n > 2)
+    {
+        return fib(n-1) + fib(n-2);
+    }
+    return 1;
+}
+
+// Frobs foo heartily
+int frobnitz(int foo)
+{
+    int i;
+    for(i = 0; i < 10; i++)
+    {
+        printf("%d\n", foo);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    frobnitz(fib(10));
+}
+EOF
+
+cat >expect <<\EOF
+diff --git a/file1 b/file2
+index 6faa5a3..e3af329 100644
+--- a/file1
++++ b/file2
+@@ -1,26 +1,25 @@
+ #include <stdio.h>
+ 
++int fib(int n)
++{
++    if(n > 2)
++    {
++        return fib(n-1) + fib(n-2);
++    }
++    return 1;
++}
++
+ // Frobs foo heartily
+ int frobnitz(int foo)
+ {
+     int i;
+     for(i = 0; i < 10; i++)
+     {
+-        printf("Your answer is: ");
+         printf("%d\n", foo);
+     }
+ }
+ 
+-int fact(int n)
+-{
+-    if(n > 1)
+-    {
+-        return fact(n-1) * n;
+-    }
+-    return 1;
+-}
+-
+ int main(int argc, char **argv)
+ {
+-    frobnitz(fact(10));
++    frobnitz(fib(10));
+ }
+EOF
+
+test_expect_success 'histogram diff' '
+
+	test_must_fail git diff --no-index --histogram file1 file2 > output &&
+	test_cmp expect output
+
+'
+
+test_expect_success 'histogram diff output is valid' '
+
+	mv file2 expect &&
+	git apply < output &&
+	test_cmp expect file2
+
+'
+
+cat >uniq1 <<\EOF
+1
+2
+3
+4
+5
+6
+EOF
+
+cat >uniq2 <<\EOF
+a
+b
+c
+d
+e
+f
+EOF
+
+cat >expect <<\EOF
+diff --git a/uniq1 b/uniq2
+index b414108..0fdf397 100644
+--- a/uniq1
++++ b/uniq2
+@@ -1,6 +1,6 @@
+-1
+-2
+-3
+-4
+-5
+-6
++a
++b
++c
++d
++e
++f
+EOF
+
+test_expect_success 'completely different files' '
+
+	test_must_fail git diff --no-index --histogram uniq1 uniq2 > output &&
+	test_cmp expect output
+
+'
+
+# Files made mostly of repeated lines, where few anchors are unique.
+repeated () {
+	i=0
+	while test $i -lt $2
+	do
+		case $((($i * $1 + $i / 7) % 5)) in
+		0) echo "}" ;;
+		1) echo ;;
+		2) echo "	return 0;" ;;
+		3) echo "line $(($i % $1))" ;;
+		*) echo "{" ;;
+		esac
+		i=$(($i + 1))
+	done
+}
+
+test_expect_success 'setup files with repeated lines' '
+
+	repeated 3 300 >old &&
+	repeated 4 280 >new &&
+	test_must_fail git diff --no-index --histogram old new >histogram &&
+	test_must_fail git diff --no-index --patience old new >patience &&
+	! test_cmp histogram patience
+
+'
+
+test_expect_success 'diff.algorithm and --diff-algorithm choose histogram' '
+
+	test_must_fail git diff --no-index --histogram old new >expect &&
+	git config diff.algorithm histogram &&
+	test_must_fail git diff --no-index old new >output &&
+	test_cmp expect output &&
+	git config --unset diff.algorithm &&
+	test_must_fail git diff --no-index --diff-algorithm=histogram \
+		old new >output &&
+	test_cmp expect output
+
+'
+
+test_expect_success 'command line overrides diff.algorithm' '
+
+	test_must_fail git diff --no-index --patience old new >expect &&
+	git config diff.algorithm histogram &&
+	test_must_fail git diff --no-index --patience old new >output &&
+	test_cmp expect output &&
+	test_must_fail git diff --no-index --diff-algorithm=myers \
+		old new >output &&
+	git config --unset diff.algorithm &&
+	test_must_fail git diff --no-index old new >expect &&
+	test_cmp expect output
+
+'
+
+test_expect_success 'unknown diff algorithm is an error' '
+
+	test_must_fail git diff --no-index --diff-algorithm=bogus old new &&
+	git config diff.algorithm bogus &&
+	test_must_fail git diff --no-index old new &&
+	git config --unset diff.algorithm
+
+'
+
+test_expect_success 'histogram diff output is valid with repeated lines' '
+
+	for seed in 3 4 7 11 13
+	do
+		repeated $seed 300 >old &&
+		repeated $(($seed + 1)) 280 >new &&
+		test_must_fail git diff --no-index --histogram -b old new >output &&
+		test -s output &&
+		test_must_fail git diff --no-index --histogram old new >output &&
+		mv new expect &&
+		git apply <output &&
+		test_cmp expect new || return 1
+	done
+
+'
+
+test_expect_success 'test-xdiff compares the algorithms on blob pairs' '
+
+	old=$(git hash-object -w file2) &&
+	new=$(git hash-object -w expect) &&
+	echo "$old $new" | test-xdiff --rounds=2 >output &&
+	grep "^myers " output &&
+	grep "^patience " output &&
+	grep "^histogram " output
+
+'
+
+test_done
@@ -382,4 +382,32 @@ test_expect_success 'tolerate absurdly small packsizelimit' '
 	test $(wc -l <obj-list) = $(ls test-9-*.pack | wc -l)
 '
 
+test_expect_success 'compressing on several threads gives the same pack' '
+	git config --unset pack.packSizeLimit &&
+	packname_10=$(git pack-objects --no-reuse-object --threads=1 \
+		test-10 <obj-list) &&
+	packname_11=$(git pack-objects --no-reuse-object --threads=4 \
+		test-11 <obj-list) &&
+	test $packname_10 = $packname_11 &&
+	cmp test-10-$packname_10.pack test-11-$packname_11.pack
+'
+
+test_expect_success 'delta search on several threads with skewed sizes' '
+	test_create_repo skewed &&
+	(
+		cd skewed &&
+		for i in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20
+		do
+			echo "small $i" >small-$i &&
+			{ test-genrandom big 300000 && echo $i; } >big &&
+			git add small-$i big &&
+			git commit -q -m $i || return 1
+		done &&
+		git rev-list --objects --all >objs &&
+		name=$(git pack-objects --threads=4 --window=3 test-12 <objs) &&
+		git verify-pack -v test-12-$name.pack >verify &&
+		grep "chain length = 2:" verify
+	)
+'
+
 test_done
@@ -65,6 +65,13 @@ test_expect_success \
     'cmp "test-1-${pack1}.idx" "1.idx" &&
      cmp "test-2-${pack2}.idx" "2.idx"'
 
+test_expect_success \
+    'threaded index-pack gives identical indexes' \
+    'git index-pack --threads=4 --index-version=1 -o 1t.idx "test-1-${pack1}.pack" &&
+     git index-pack --threads=4 --index-version=2 -o 2t.idx "test-1-${pack1}.pack" &&
+     cmp 1.idx 1t.idx &&
+     cmp 2.idx 2t.idx'
+
 test_expect_success \
     'index v2: force some 64-bit offsets with pack-objects' \
     'pack3=$(git pack-objects --index-version=2,0x40000 test-3 <obj-list)'
@@ -0,0 +1,43 @@
+#!/bin/sh
+
+test_description='delta base cache'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	i=1 &&
+	while test $i -le 60
+	do
+		echo "line $i" >>file &&
+		test-genrandom "seed $i" 400 >>file &&
+		git add file &&
+		test_tick &&
+		git commit -q -m "commit $i" &&
+		i=$(($i + 1)) || return 1
+	done &&
+	git repack -a -d --depth=50 &&
+	git log -p >expect
+'
+
+test_expect_success 'cached bases give the same objects' '
+	GIT_TRACE_PERFORMANCE="$(pwd)/trace" git log -p >actual &&
+	test_cmp expect actual &&
+	grep "delta base cache: [1-9][0-9]* hits" trace
+'
+
+test_expect_success 'a small cache evicts but reads correctly' '
+	git config core.deltaBaseCacheLimit 1000 &&
+	rm -f trace &&
+	GIT_TRACE_PERFORMANCE="$(pwd)/trace" git log -p >actual &&
+	test_cmp expect actual &&
+	grep "[1-9][0-9]* evictions" trace
+'
+
+test_expect_success 'an empty cache still works' '
+	git config core.deltaBaseCacheLimit 0 &&
+	git log -p >actual &&
+	test_cmp expect actual &&
+	git fsck --full
+'
+
+test_done
@@ -0,0 +1,129 @@
+#!/bin/sh
+
+test_description='pack reachability bitmaps'
+
+. ./test-lib.sh
+
+objects_sorted () {
+	git rev-list --objects "$@" | cut -c1-40 | sort
+}
+
+test_expect_success 'setup' '
+	i=1 &&
+	while test $i -le 150
+	do
+		echo $i >file$(($i % 10)) &&
+		mkdir -p dir$(($i % 3)) &&
+		echo $i >dir$(($i % 3))/file &&
+		git add . &&
+		test_tick &&
+		git commit -q -m "commit $i" &&
+		i=$(($i + 1)) || return 1
+	done &&
+	git tag -a -m tagged tagged HEAD~40 &&
+	git checkout -b side HEAD~70 &&
+	echo side >side &&
+	git add side &&
+	test_tick &&
+	git commit -m side &&
+	git checkout master &&
+	test_tick &&
+	git merge -m merge side
+'
+
+test_expect_success 'repack -b writes a bitmap' '
+	git repack -a -d -b &&
+	ls .git/objects/pack/pack-*.pack >packs &&
+	test $(wc -l <packs) = 1 &&
+	bitmap=$(sed -e "s/\.pack$/.bitmap/" packs) &&
+	test -f "$bitmap"
+'
+
+test_expect_success 'rev-list --use-bitmap-index lists all objects' '
+	objects_sorted --all >expect &&
+	git rev-list --use-bitmap-index --objects --all | sort >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'rev-list --use-bitmap-index with negative refs' '
+	git rev-list master ^side ^tagged | sort >expect &&
+	git rev-list --use-bitmap-index master ^side ^tagged | sort >actual &&
+	test_cmp expect actual &&
+	objects_sorted master ^side ^tagged >walk &&
+	git rev-list --use-bitmap-index --objects master ^side ^tagged |
+		sort >actual &&
+	objects_sorted side tagged >have &&
+	# the walk may list objects the negative side has, never fewer
+	comm -13 walk actual >missing &&
+	test ! -s missing &&
+	comm -23 walk actual >extra &&
+	comm -23 extra have >unexplained &&
+	test ! -s unexplained
+'
+
+test_expect_success 'objects outside the bitmapped pack are found' '
+	echo loose >loose &&
+	git add loose &&
+	test_tick &&
+	git commit -m loose &&
+	objects_sorted --all >expect &&
+	git rev-list --use-bitmap-index --objects --all | sort >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'pack-objects --revs packs the same objects' '
+	git rev-parse --all >revs &&
+	pack=$(git pack-objects --revs --use-bitmap-index bm <revs) &&
+	git show-index <bm-$pack.idx | cut -d" " -f2 | sort >actual &&
+	pack=$(git pack-objects --revs --no-use-bitmap-index walk <revs) &&
+	git show-index <walk-$pack.idx | cut -d" " -f2 | sort >expect &&
+	test_cmp expect actual &&
+	git verify-pack bm-$pack.pack
+'
+
+test_expect_success 'clone and fetch through upload-pack' '
+	git clone "file://$(pwd)/.git" clone &&
+	(
+		cd clone &&
+		git fsck --full &&
+		test "$(git rev-parse master)" = "$(cd .. && git rev-parse master)"
+	) &&
+	echo more >>loose &&
+	git commit -a -m more &&
+	(
+		cd clone &&
+		git pull &&
+		git fsck --full &&
+		test "$(git rev-parse master)" = "$(cd .. && git rev-parse master)"
+	)
+'
+
+test_expect_success 'shallow clone still works' '
+	git clone --depth 2 "file://$(pwd)/.git" shallow &&
+	(
+		cd shallow &&
+		git fsck --full &&
+		test $(git rev-list HEAD | wc -l) -lt 10
+	)
+'
+
+test_expect_success 'pack-objects only writes bitmaps for --all' '
+	git rev-parse master >revs &&
+	git pack-objects --revs --write-bitmap-index partial <revs 2>err &&
+	grep "not writing a bitmap" err &&
+	! ls partial-*.bitmap
+'
+
+test_expect_success 'a corrupt bitmap is ignored' '
+	git repack -a -d -b &&
+	bitmap=$(ls .git/objects/pack/pack-*.bitmap) &&
+	chmod u+w "$bitmap" &&
+	printf "BITM" >"$bitmap" &&
+	objects_sorted --all >expect &&
+	git rev-list --use-bitmap-index --objects --all >actual 2>err &&
+	cut -c1-40 actual | sort >actual.sorted &&
+	test_cmp expect actual.sorted &&
+	grep "bad signature" err
+'
+
+test_done
@@ -0,0 +1,105 @@
+#!/bin/sh
+
+test_description='commit-graph file'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	for i in 1 2 3 4 5 6
+	do
+		echo $i >file &&
+		git add file &&
+		test_tick &&
+		git commit -m "commit $i" || return 1
+	done &&
+	git checkout -b side HEAD~3 &&
+	for i in 1 2 3
+	do
+		echo $i >side &&
+		git add side &&
+		test_tick &&
+		git commit -m "side $i" || return 1
+	done &&
+	git checkout -b other master~4 &&
+	echo other >other &&
+	git add other &&
+	test_tick &&
+	git commit -m other &&
+	git checkout master &&
+	test_tick &&
+	git merge -s ours -m octopus side other &&
+	git tag -a -m tagged tagged side~1 &&
+	git rev-list --parents --all >expect.rev-list &&
+	git merge-base --all side other >expect.merge-base &&
+	git branch --contains side~2 >expect.branch &&
+	git tag --contains side~2 >expect.tag &&
+	git log --pretty=raw master >expect.log
+'
+
+test_expect_success 'write graph' '
+	git commit-graph write &&
+	test -f .git/objects/info/commit-graph &&
+	echo "num_commits: 11" >expect &&
+	echo "chunks: oid_fanout oid_lookup commit_data extra_edges" >>expect &&
+	git commit-graph read >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'rev-list uses the graph' '
+	git rev-list --parents --all >actual &&
+	test_cmp expect.rev-list actual
+'
+
+test_expect_success 'merge-base and --contains agree with the graph' '
+	git merge-base --all side other >actual &&
+	test_cmp expect.merge-base actual &&
+	git branch --contains side~2 >actual &&
+	test_cmp expect.branch actual &&
+	git tag --contains side~2 >actual &&
+	test_cmp expect.tag actual
+'
+
+test_expect_success 'log still shows the full commits' '
+	git log --pretty=raw master >actual &&
+	test_cmp expect.log actual
+'
+
+test_expect_success 'commits newer than the graph are parsed normally' '
+	echo 7 >file &&
+	git add file &&
+	test_tick &&
+	git commit -m "commit 7" &&
+	git rev-list --parents HEAD >actual &&
+	git rev-list --parents HEAD~1 >expect &&
+	test $(wc -l <actual) = $(($(wc -l <expect) + 1)) &&
+	git branch --contains other >actual &&
+	printf "* master\n  other\n" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'core.commitGraph=false ignores the graph' '
+	git config core.commitGraph false &&
+	git rev-list --parents --all >actual &&
+	git config --unset core.commitGraph &&
+	git rev-list --parents --all >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'grafts override the graph' '
+	git rev-parse master~1 >.git/info/grafts &&
+	git rev-list master >actual &&
+	test $(wc -l <actual) = 2 &&
+	test_must_fail git commit-graph write &&
+	rm .git/info/grafts
+'
+
+test_expect_success 'corrupt graph is ignored' '
+	echo garbage >.git/objects/info/commit-graph &&
+	git rev-list --parents --all >actual 2>err &&
+	git config core.commitGraph false &&
+	git rev-list --parents --all >expect &&
+	git config --unset core.commitGraph &&
+	test_cmp expect actual
+'
+
+test_done
@@ -0,0 +1,118 @@
+#!/bin/sh
+
+test_description='multi-pack-index file'
+
+. ./test-lib.sh
+
+objdir=.git/objects
+packdir=$objdir/pack
+
+test_expect_success 'setup' '
+	for i in 1 2 3 4 5 6 7 8
+	do
+		echo "content $i" >file$i &&
+		git add file$i &&
+		test_tick &&
+		git commit -q -m "commit $i" &&
+		git repack -q -d || return 1
+	done &&
+	test $(ls $packdir/*.pack | wc -l) = 8 &&
+	git rev-list --objects --all | cut -c1-40 | sort >objects &&
+	git cat-file --batch-check <objects >expect
+'
+
+test_expect_success 'write the multi-pack-index' '
+	git multi-pack-index write &&
+	test -f $packdir/multi-pack-index &&
+	git multi-pack-index read >actual &&
+	{
+		echo "num_packs: 8" &&
+		echo "num_objects: $(wc -l <objects)" &&
+		echo "chunks: pack_names oid_fanout oid_lookup object_offsets" &&
+		echo "packs:" &&
+		(cd $packdir && ls *.idx)
+	} >expect.read &&
+	test_cmp expect.read actual
+'
+
+test_expect_success 'objects are read through the multi-pack-index' '
+	git cat-file --batch-check <objects >actual &&
+	test_cmp expect actual &&
+	git fsck --full &&
+	git log --pretty=oneline >log &&
+	test $(wc -l <log) = 8
+'
+
+test_expect_success 'abbreviated names are resolved' '
+	for sha1 in $(cat objects)
+	do
+		test $(git rev-parse $(echo $sha1 | cut -c1-8)) = $sha1 ||
+		return 1
+	done
+'
+
+test_expect_success 'objects of packs written later are found' '
+	echo "content 9" >file9 &&
+	git add file9 &&
+	test_tick &&
+	git commit -q -m "commit 9" &&
+	git repack -q &&
+	git rev-parse HEAD:file9 >expect.blob &&
+	git rev-parse $(git rev-parse HEAD:file9 | cut -c1-8) >actual &&
+	test_cmp expect.blob actual &&
+	git cat-file blob HEAD:file9 >actual &&
+	echo "content 9" >expect.content &&
+	test_cmp expect.content actual
+'
+
+test_expect_success 'incremental write adds the new pack' '
+	git multi-pack-index write &&
+	git multi-pack-index read >actual &&
+	grep "^num_packs: 9$" actual &&
+	git rev-list --objects --all | cut -c1-40 | sort >objects &&
+	grep "^num_objects: $(wc -l <objects)$" actual &&
+	git cat-file --batch-check <objects >expect &&
+	git config core.multiPackIndex false &&
+	git cat-file --batch-check <objects >expect.nomidx &&
+	git config --unset core.multiPackIndex &&
+	test_cmp expect.nomidx expect
+'
+
+test_expect_success 'objects are found when their recorded pack is gone' '
+	ls $packdir/*.pack >before &&
+	git repack -q -a &&
+	ls $packdir/*.pack >after &&
+	new=$(comm -13 before after) &&
+	test-chmtime =+100 $new &&
+	git multi-pack-index write &&
+	git multi-pack-index read >actual &&
+	grep "^num_packs: 10$" actual &&
+	mv $new new.pack &&
+	git cat-file --batch-check <objects >actual &&
+	test_cmp expect actual &&
+	git fsck &&
+	mv new.pack $new
+'
+
+test_expect_success 'repack -a -d rewrites the multi-pack-index' '
+	git repack -q -a -d &&
+	test $(ls $packdir/*.pack | wc -l) = 1 &&
+	git multi-pack-index read >actual &&
+	grep "^num_packs: 1$" actual &&
+	git cat-file --batch-check <objects >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'a corrupt multi-pack-index is ignored' '
+	echo garbage >$packdir/multi-pack-index &&
+	git cat-file --batch-check <objects >actual 2>err &&
+	test_cmp expect actual &&
+	grep "multi-pack-index" err &&
+	git config core.multiPackIndex false &&
+	git cat-file --batch-check <objects >actual 2>err &&
+	test_cmp expect actual &&
+	! test -s err &&
+	test_must_fail git multi-pack-index read
+'
+
+test_done
@@ -48,10 +48,20 @@ test_expect_success 'corrupt repo differently' '
 test_expect_success 'fsck fails' '
 	test_must_fail git fsck
 '
-test_expect_success 'upload-pack fails due to error in rev-list' '
+test_expect_success 'upload-pack fails due to error in pack-objects counting' '
 
 	! echo "0032want $(git rev-parse HEAD)
 00000009done
+0000" | git upload-pack . > /dev/null 2> output.err &&
+	grep "bad tree object" output.err &&
+	grep "pack-objects died" output.err
+'
+
+test_expect_success 'upload-pack fails due to error in rev-list' '
+
+	# a shallow request still enumerates the objects with rev-list
+	! echo "0032want $(git rev-parse HEAD)
+0034shallow $(git rev-parse HEAD^)00000009done
 0000" | git upload-pack . > /dev/null 2> output.err &&
 	grep "waitpid (async) failed" output.err
 '
@@ -18,9 +18,21 @@ test_expect_success 'setup (initial)' '
 	git tag initial
 '
 
+# The files are alike enough that every one is a rename candidate
+# for every other, so that the limit applies to all of them.
 make_text() {
 	echo $1: $2
 	for i in `count 20`; do
+		echo common: $i
+	done
+	echo $1: $3
+}
+
+# These files share nothing and each is twice as long as the one
+# before, so that each has only one candidate, even by size alone.
+make_distinct_text() {
+	echo $1: $2
+	for i in `count $((10 << $1))`; do
 		echo $1: $i
 	done
 	echo $1: $3
@@ -30,22 +42,23 @@ test_rename() {
 	test_expect_success "rename ($1, $2)" '
 	n='$1'
 	expect='$2'
+	text='${3-make_text}'
 	git checkout -f master &&
 	git branch -D test$n || true &&
 	git reset --hard initial &&
 	for i in $(count $n); do
-		make_text $i initial initial >$i
+		$text $i initial initial >$i
 	done &&
 	git add . &&
 	git commit -m add=$n &&
 	for i in $(count $n); do
-		make_text $i changed initial >$i
+		$text $i changed initial >$i
 	done &&
 	git commit -a -m change=$n &&
 	git checkout -b test$n HEAD^ &&
 	for i in $(count $n); do
 		git rm $i
-		make_text $i initial changed >$i.moved
+		$text $i initial changed >$i.moved
 	done &&
 	git add . &&
 	git commit -m change+rename=$n &&
@@ -69,5 +82,6 @@ test_expect_success 'set merge.renamelimit to 5' '
 '
 test_rename 5 ok
 test_rename 6 fail
+test_rename 8 ok make_distinct_text
 
 test_done
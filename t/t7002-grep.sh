@@ -171,4 +171,63 @@ test_expect_success 'grep with CE_VALID file' '
 	git checkout t/t
 '
 
+cat >literals <<EOF
+color
+colour
+colouur
+colr
+col
+x.y
+xay
+foo|bar
+EOF
+
+test_expect_success 'grep with required literals' '
+	git add literals &&
+	git grep --cached -h -E "colou?r" literals >actual &&
+	printf "color\ncolour\n" >expect &&
+	test_cmp expect actual &&
+	git grep --cached -h "colou*r" literals >actual &&
+	printf "color\ncolour\ncolouur\n" >expect &&
+	test_cmp expect actual &&
+	git grep --cached -h -E "co(l|x)r|l\$" literals >actual &&
+	printf "colr\ncol\n" >expect &&
+	test_cmp expect actual &&
+	git grep --cached -h -n -e "x\.y" -e "foo|" literals >actual &&
+	printf "6:x.y\n8:foo|bar\n" >expect &&
+	test_cmp expect actual &&
+	git grep --cached -h -A1 -E "colouu+r" literals >actual &&
+	printf "colouur\ncolr\n" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'threaded grep gives the same output' '
+	i=0 &&
+	while test $i -lt 300
+	do
+		echo "line $i in file$i" >many$i &&
+		i=$(($i + 1)) || return 1
+	done &&
+	git add many* &&
+	test_tick &&
+	git commit -q -m many &&
+	for opts in "--cached -n line" "-c in HEAD" "-l 9 HEAD" \
+		"-L 9 HEAD" "-C1 --all-match -e foo -e bar HEAD" \
+		"--no-ext-grep -z -n 1"
+	do
+		git grep --threads=1 $opts >expect &&
+		git grep --threads=4 $opts >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
+test_expect_success 'threaded grep exit status' '
+	git grep --threads=4 --cached "line 299" &&
+	test_must_fail git grep --threads=4 --cached nosuchstring &&
+	git config grep.threads 3 &&
+	git grep --cached -l "line 1" >actual &&
+	git grep --threads=1 --cached -l "line 1" >expect &&
+	test_cmp expect actual
+'
+
 test_done
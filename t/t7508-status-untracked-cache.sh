@@ -0,0 +1,119 @@
+#!/bin/sh
+
+test_description='git status with the untracked cache'
+
+. ./test-lib.sh
+
+# Make the work tree look old, so that the cache trusts its stat data.
+backdate () {
+	find . -name .git -prune -o -print | xargs test-chmtime -60
+}
+
+# Compare what status reports with and without the cache.  Scratch
+# files live in .git, so that they do not touch the work tree.
+check_status () {
+	{ git status "$@" >.git/actual; :; } &&
+	cp .git/index .git/plain-index &&
+	git config core.untrackedcache false &&
+	{ GIT_INDEX_FILE=.git/plain-index git status "$@" >.git/expect; :; } &&
+	git config core.untrackedcache true &&
+	test_cmp .git/expect .git/actual
+}
+
+scanned () {
+	{ GIT_TRACE_PERFORMANCE="$(pwd)/.git/trace" git status >/dev/null; :; } &&
+	sed -n -e "s/^performance: untracked cache: .* reused, \([0-9]*\) scanned$/\1/p" .git/trace >.git/count &&
+	rm -f .git/trace &&
+	test "$(cat .git/count)" = "$1"
+}
+
+test_expect_success 'setup' '
+	mkdir -p tracked/sub untracked/deep empty &&
+	echo one >tracked/one &&
+	echo two >tracked/sub/two &&
+	echo "*.o" >.gitignore &&
+	git add tracked .gitignore &&
+	test_tick &&
+	git commit -q -m initial &&
+	echo new >tracked/new &&
+	echo obj >tracked/sub/file.o &&
+	echo deep >untracked/deep/file &&
+	git config core.untrackedcache true &&
+	backdate
+'
+
+test_expect_success 'first status fills the cache' '
+	check_status &&
+	grep UNTR .git/index >/dev/null
+'
+
+test_expect_success 'unchanged directories are not read again' '
+	scanned 0 &&
+	check_status &&
+	check_status -u &&
+	scanned 0
+'
+
+test_expect_success 'new file is found' '
+	echo another >tracked/sub/another &&
+	scanned 1 &&
+	check_status &&
+	grep "tracked/sub/another" .git/actual
+'
+
+test_expect_success 'removed file disappears' '
+	backdate &&
+	check_status &&
+	rm tracked/new &&
+	scanned 1 &&
+	check_status &&
+	! grep "tracked/new" .git/actual
+'
+
+test_expect_success 'change to .gitignore is noticed' '
+	echo another >tracked/sub/.gitignore &&
+	backdate &&
+	check_status &&
+	! grep "tracked/sub/another" .git/actual &&
+	echo "*.c" >tracked/sub/.gitignore &&
+	test-chmtime -60 tracked/sub/.gitignore &&
+	scanned 1 &&
+	check_status &&
+	grep "tracked/sub/another" .git/actual
+'
+
+test_expect_success 'change to info/exclude is noticed' '
+	scanned 0 &&
+	echo another >>.git/info/exclude &&
+	check_status &&
+	! grep "tracked/sub/another" .git/actual
+'
+
+test_expect_success 'file deep inside an untracked directory' '
+	rm -f untracked/deep/file &&
+	backdate &&
+	check_status &&
+	! grep "^#	untracked/" .git/actual &&
+	echo again >untracked/deep/file &&
+	check_status &&
+	grep "^#	untracked/" .git/actual
+'
+
+test_expect_success 'adding to the index changes how a directory is shown' '
+	backdate &&
+	check_status &&
+	git add untracked/deep/file &&
+	check_status &&
+	! grep "^#	untracked/" .git/actual &&
+	git rm -q --cached untracked/deep/file &&
+	check_status &&
+	grep "^#	untracked/" .git/actual
+'
+
+test_expect_success 'disabling the cache drops the extension' '
+	git config core.untrackedcache false &&
+	{ git status >/dev/null; :; } &&
+	! grep UNTR .git/index >/dev/null
+'
+
+test_done
@@ -0,0 +1,168 @@
+#!/bin/sh
+
+test_description='git repack --geometric keeps packs in a size progression'
+
+. ./test-lib.sh
+
+packdir=.git/objects/pack
+
+pack_sizes () {
+	for p in $packdir/*.pack
+	do
+		wc -c <$p
+	done | sort -n
+}
+
+test_expect_success 'setup' '
+	test-genrandom big 100000 >big &&
+	git add big &&
+	test_tick &&
+	git commit -q -m big &&
+	git repack -q -d &&
+	ls $packdir/*.pack >big-pack &&
+	for i in 1 2 3 4 5 6
+	do
+		echo $i >file$i &&
+		git add file$i &&
+		test_tick &&
+		git commit -q -m $i &&
+		git repack -q -d || return 1
+	done &&
+	test $(ls $packdir/*.pack | wc -l) = 7 &&
+	git rev-list --objects --all | sort >objects
+'
+
+test_expect_success 'invalid factors are refused' '
+	test_must_fail git repack --geometric=1 &&
+	test_must_fail git repack --geometric=x &&
+	test_must_fail git repack -a --geometric=2
+'
+
+test_expect_success 'small packs are rolled up, the big one is kept' '
+	echo loose >loose &&
+	git add loose &&
+	test_tick &&
+	git commit -q -m loose &&
+	git repack --geometric=2 -d -q &&
+	test $(ls $packdir/*.pack | wc -l) = 2 &&
+	ls $packdir/*.pack >packs &&
+	grep -F -f big-pack packs &&
+	test $(git count-objects | sed -e "s/ .*//") = 0 &&
+	pack_sizes >sizes &&
+	test $(sed -n 2p sizes) -gt $(( 2 * $(sed -n 1p sizes) )) &&
+	git fsck --full &&
+	git rev-list --objects --all | sort >actual &&
+	test $(wc -l <actual) = $(( $(wc -l <objects) + 3 ))
+'
+
+test_expect_success 'nothing to roll up packs only loose objects' '
+	ls $packdir/*.pack >before &&
+	echo more >loose &&
+	git add loose &&
+	test_tick &&
+	git commit -q -m more &&
+	git repack --geometric=2 -d -q &&
+	ls $packdir/*.pack >after &&
+	test $(comm -12 before after | wc -l) = 2 &&
+	test $(comm -13 before after | wc -l) = 1
+'
+
+test_expect_success 'unreachable objects in rolled up packs are loosened' '
+	unreachable=$(echo unreachable | git hash-object -w --stdin) &&
+	echo $unreachable | git pack-objects -q $packdir/pack &&
+	other=$(echo other unreachable | git hash-object -w --stdin) &&
+	echo $other | git pack-objects -q $packdir/pack &&
+	git prune-packed &&
+	ls $packdir/*.pack >before &&
+	git repack --geometric=2 -d -q &&
+	ls $packdir/*.pack >after &&
+	test $(wc -l <after) = $(( $(wc -l <before) - 2 )) &&
+	git cat-file -e $unreachable &&
+	git cat-file -e $other &&
+	test $(git count-objects | sed -e "s/ .*//") = 2 &&
+	git prune --expire=now &&
+	test_must_fail git cat-file -e $unreachable &&
+	test_must_fail git cat-file -e $other
+'
+
+test_expect_success '--list-rollup lists the packs to roll up' '
+	test_must_fail git repack --list-rollup &&
+	git repack --geometric=2 --list-rollup >actual &&
+	test_cmp /dev/null actual &&
+	echo list >list &&
+	git add list &&
+	test_tick &&
+	git commit -q -m list &&
+	git repack -q -d &&
+	git repack --geometric=2 --list-rollup >actual &&
+	test -s actual &&
+	for p in $(cat actual)
+	do
+		test -f $packdir/$p.pack || return 1
+	done &&
+	! grep -F "$(basename $(cat big-pack) .pack)" actual
+'
+
+test_expect_success 'packs marked with .keep are not rolled up' '
+	echo kept >kept &&
+	git add kept &&
+	test_tick &&
+	git commit -q -m kept &&
+	git repack -q -d &&
+	kept=$(ls -t $packdir/*.pack | head -n 1) &&
+	touch ${kept%.pack}.keep &&
+	echo other >other &&
+	git add other &&
+	test_tick &&
+	git commit -q -m other &&
+	git repack -q -d &&
+	git repack --geometric=2 -d -q &&
+	test -f $kept &&
+	rm ${kept%.pack}.keep &&
+	git fsck --full
+'
+
+test_expect_success 'gc --auto uses gc.geometricRepack' '
+	ls $packdir/*.pack >before &&
+	for i in 1 2 3
+	do
+		echo auto$i >auto$i &&
+		git add auto$i &&
+		test_tick &&
+		git commit -q -m auto$i &&
+		git repack -q -d || return 1
+	done &&
+	git config gc.autopacklimit 3 &&
+	git config gc.geometricrepack 2 &&
+	git gc --auto -q &&
+	ls $packdir/*.pack >after &&
+	grep -F -f big-pack after &&
+	test $(wc -l <after) -lt $(( $(wc -l <before) + 3 )) &&
+	git fsck --full
+'
+
+test_expect_success 'gc --auto ignores packs that keep the progression' '
+	ls $packdir/*.pack >before &&
+	git gc --auto -q &&
+	ls $packdir/*.pack >after &&
+	test_cmp before after
+'
+
+test_expect_success 'gc --auto expires unreachable objects of rolled up packs' '
+	for i in 1 2 3
+	do
+		echo gone$i | git hash-object -w --stdin >>gone &&
+		tail -n 1 gone | git pack-objects -q $packdir/pack || return 1
+	done &&
+	git prune-packed &&
+	git config gc.pruneexpire now &&
+	git gc --auto -q &&
+	for o in $(cat gone)
+	do
+		test_must_fail git cat-file -e $o || return 1
+	done &&
+	test $(git count-objects | sed -e "s/ .*//") = 0 &&
+	git fsck --full
+'
+
+test_done
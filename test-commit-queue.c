@@ -0,0 +1,37 @@
+#include "cache.h"
+#include "commit.h"
+
+/*
+ * Put a commit dated <n> in the queue for each number argument, and
+ * take the first one out for each "get", printing its date and the
+ * order in which it was put in.
+ */
+int main(int argc, char **argv)
+{
+	struct commit_queue queue = { NULL };
+	unsigned char sha1[20];
+	int i, nr = 0;
+
+	for (i = 1; i < argc; i++) {
+		struct commit *commit;
+
+		if (!strcmp(argv[i], "get")) {
+			commit = commit_queue_get(&queue);
+			if (commit)
+				printf("%lu %u\n", commit->date,
+				       *(unsigned *)commit->util);
+			else
+				printf("NULL\n");
+			continue;
+		}
+		hashclr(sha1);
+		memcpy(sha1, &nr, sizeof(nr));
+		commit = lookup_commit(sha1);
+		commit->date = strtoul(argv[i], NULL, 10);
+		commit->util = xmalloc(sizeof(unsigned));
+		*(unsigned *)commit->util = nr++;
+		commit_queue_put(&queue, commit);
+	}
+	clear_commit_queue(&queue);
+	return 0;
+}
@@ -1,5 +1,78 @@
 #include "cache.h"
 
+static const char test_sha1_usage[] =
+"test-sha1 [--backend=<name>] [<bufsz>] | test-sha1 --benchmark [<megabytes>]";
+
+#define BENCH_STREAMS 8
+
+static double elapsed(struct timeval *since)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - since->tv_sec) +
+		(now.tv_usec - since->tv_usec) / 1e6;
+}
+
+/*
+ * Hash "size" bytes as one stream, and as BENCH_STREAMS streams of
+ * size/BENCH_STREAMS bytes with git_SHA1_Update_multi(), and report
+ * the throughput of both.
+ */
+static void benchmark(const char *name, const unsigned char *buf,
+		      unsigned long size)
+{
+	git_SHA_CTX ctx[BENCH_STREAMS], *cp[BENCH_STREAMS];
+	const void *data[BENCH_STREAMS];
+	unsigned long len[BENCH_STREAMS];
+	unsigned char sha1[20];
+	struct timeval start;
+	double single, multi;
+	int i;
+
+	gettimeofday(&start, NULL);
+	git_SHA1_Init(&ctx[0]);
+	git_SHA1_Update(&ctx[0], buf, size);
+	git_SHA1_Final(sha1, &ctx[0]);
+	single = elapsed(&start);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < BENCH_STREAMS; i++) {
+		git_SHA1_Init(&ctx[i]);
+		cp[i] = &ctx[i];
+		data[i] = buf + i * (size / BENCH_STREAMS);
+		len[i] = size / BENCH_STREAMS;
+	}
+	git_SHA1_Update_multi(cp, data, len, BENCH_STREAMS);
+	for (i = 0; i < BENCH_STREAMS; i++)
+		git_SHA1_Final(sha1, &ctx[i]);
+	multi = elapsed(&start);
+
+	printf("%-12s %10.1f MB/s %10.1f MB/s\n", name,
+	       size / 1048576.0 / (single > 0 ? single : 1e-9),
+	       size / 1048576.0 / (multi > 0 ? multi : 1e-9));
+}
+
+static void run_benchmark(unsigned long size)
+{
+	unsigned char *buf = xmalloc(size);
+	unsigned long i;
+
+	for (i = 0; i < size; i++)
+		buf[i] = i * 2654435761UL >> 24;
+
+	printf("%-12s %15s %15s\n", "backend", "one stream",
+	       "8 streams");
+#ifdef git_SHA1_select_backend
+	for (i = 0; git_SHA1_backends[i]; i++)
+		if (!git_SHA1_select_backend(git_SHA1_backends[i]))
+			benchmark(git_SHA1_backends[i], buf, size);
+#else
+	benchmark("default", buf, size);
+#endif
+	free(buf);
+}
+
 int main(int ac, char **av)
 {
 	git_SHA_CTX ctx;
@@ -7,6 +80,26 @@ int main(int ac, char **av)
 	unsigned bufsz = 8192;
 	char *buffer;
 
+	if (ac > 1 && !strcmp(av[1], "--benchmark")) {
+		unsigned long mb = ac > 2 ? strtoul(av[2], NULL, 10) : 256;
+		run_benchmark((mb ? mb : 1) * 1024 * 1024);
+		return 0;
+	}
+
+	if (ac > 1 && !prefixcmp(av[1], "--backend=")) {
+#ifdef git_SHA1_select_backend
+		if (git_SHA1_select_backend(av[1] + 10))
+			die("SHA-1 backend %s is not available", av[1] + 10);
+#else
+		if (strcmp(av[1] + 10, "auto"))
+			die("SHA-1 backend %s is not available", av[1] + 10);
+#endif
+		ac--;
+		av++;
+	}
+
+	if (ac > 2 || (ac == 2 && av[1][0] == '-'))
+		usage(test_sha1_usage);
 	if (ac == 2)
 		bufsz = strtoul(av[1], NULL, 10) * 1024 * 1024;
 
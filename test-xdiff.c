@@ -0,0 +1,141 @@
+/*
+ * test-xdiff.c: compare the speed and output size of the diff algorithms
+ *
+ * Reads a corpus of real file pairs as "<old> <new>" pairs of blob names,
+ * one per line of the standard input.  The modified files of a history
+ * make a good one, e.g.
+ *
+ *   git log --raw --no-abbrev --no-merges --diff-filter=M |
+ *   sed -n -e 's/^:[0-7]* [0-7]* \([0-9a-f]*\) \([0-9a-f]*\) M.*$/\1 \2/p' |
+ *   test-xdiff --rounds=3
+ *
+ * Every pair is diffed with each algorithm, "rounds" times, and the time
+ * spent is reported with the number of lines it removed and added; the
+ * fewer, the smaller the diff.  Each algorithm is run both as is and
+ * with XDF_NEED_MINIMAL, which is what "git diff" asks for.
+ */
+
+#include "cache.h"
+#include "xdiff-interface.h"
+
+static const char usage_str[] = "test-xdiff [--rounds=<n>] <pairs";
+
+static struct mode {
+	const char *name;
+	long flags;
+} modes[] = {
+	{ "default", 0 },
+	{ "minimal", XDF_NEED_MINIMAL },
+};
+
+static struct algorithm {
+	const char *name;
+	long flags;
+} algorithms[] = {
+	{ "myers", 0 },
+	{ "patience", XDF_PATIENCE_DIFF },
+	{ "histogram", XDF_HISTOGRAM_DIFF },
+};
+
+struct pair {
+	mmfile_t old, new;
+};
+
+struct line_count {
+	unsigned long removed, added;
+};
+
+static void count_lines(void *priv, char *line, unsigned long len)
+{
+	struct line_count *count = priv;
+
+	if (line[0] == '-')
+		count->removed++;
+	else if (line[0] == '+')
+		count->added++;
+}
+
+static void read_blob(mmfile_t *mf, const char *name)
+{
+	unsigned char sha1[20];
+	enum object_type type;
+	unsigned long size;
+
+	if (get_sha1(name, sha1))
+		die("not a valid object name: %s", name);
+	mf->ptr = read_sha1_file(sha1, &type, &size);
+	if (!mf->ptr || type != OBJ_BLOB)
+		die("not a blob: %s", name);
+	mf->size = size;
+}
+
+static double elapsed(struct timeval *since)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - since->tv_sec) +
+		(now.tv_usec - since->tv_usec) / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct pair *pairs = NULL;
+	int nr = 0, alloc = 0, rounds = 1, i, j, k, r;
+
+	if (argc > 1 && !prefixcmp(argv[1], "--rounds=")) {
+		rounds = atoi(argv[1] + 9);
+		argc--;
+	}
+	if (argc > 1 || rounds < 1)
+		usage(usage_str);
+
+	setup_git_directory();
+	while (strbuf_getline(&buf, stdin, '\n') != EOF) {
+		char *space = strchr(buf.buf, ' ');
+
+		if (!space)
+			die("expected \"<old> <new>\": %s", buf.buf);
+		*space = '\0';
+		ALLOC_GROW(pairs, nr + 1, alloc);
+		read_blob(&pairs[nr].old, buf.buf);
+		read_blob(&pairs[nr].new, space + 1);
+		nr++;
+	}
+	strbuf_release(&buf);
+
+	printf("%-10s %-8s %10s %10s %10s   (%d pairs, %d rounds)\n",
+	       "algorithm", "mode", "seconds", "removed", "added",
+	       nr, rounds);
+	for (i = 0; i < ARRAY_SIZE(algorithms); i++)
+		for (k = 0; k < ARRAY_SIZE(modes); k++) {
+			struct line_count count;
+			struct timeval start;
+			double seconds;
+
+			gettimeofday(&start, NULL);
+			for (r = 0; r < rounds; r++) {
+				memset(&count, 0, sizeof(count));
+				for (j = 0; j < nr; j++) {
+					xpparam_t xpp;
+					xdemitconf_t xecfg;
+					xdemitcb_t ecb;
+
+					memset(&xpp, 0, sizeof(xpp));
+					memset(&xecfg, 0, sizeof(xecfg));
+					xpp.flags = algorithms[i].flags |
+						modes[k].flags;
+					xdi_diff_outf(&pairs[j].old,
+						      &pairs[j].new,
+						      count_lines, &count,
+						      &xpp, &xecfg, &ecb);
+				}
+			}
+			seconds = elapsed(&start);
+			printf("%-10s %-8s %10.3f %10lu %10lu\n",
+			       algorithms[i].name, modes[k].name,
+			       seconds, count.removed, count.added);
+		}
+	return 0;
+}
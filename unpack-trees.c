@@ -118,6 +118,8 @@ static int check_updates(struct unpack_trees_options *o)
 		}
 	}
 
+	if (o->update)
+		start_parallel_checkout();
 	for (i = 0; i < index->cache_nr; i++) {
 		struct cache_entry *ce = index->cache[i];
 
@@ -129,6 +131,8 @@ static int check_updates(struct unpack_trees_options *o)
 			}
 		}
 	}
+	if (o->update)
+		errs |= finish_parallel_checkout();
 	stop_progress(&progress);
 	return errs != 0;
 }
@@ -380,8 +384,10 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 
 	memset(&o->result, 0, sizeof(o->result));
 	o->result.initialized = 1;
-	if (o->src_index)
+	if (o->src_index) {
 		o->result.timestamp = o->src_index->timestamp;
+		o->result.version = o->src_index->version;
+	}
 	o->merge_size = len;
 
 	if (!dfc)
@@ -412,6 +418,17 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 	if (o->trivial_merges_only && o->nontrivial_merge)
 		return unpack_failed(o, "Merge requires file-level merging");
 
+	/*
+	 * The untracked cache validates itself, and a split index is
+	 * written by comparing against its shared index; keep both.
+	 */
+	if (o->src_index == o->dst_index) {
+		o->result.untracked = o->src_index->untracked;
+		o->src_index->untracked = NULL;
+		o->result.split_index = o->src_index->split_index;
+		o->src_index->split_index = NULL;
+	}
+
 	o->src_index = NULL;
 	ret = check_updates(o) ? (-2) : 0;
 	if (o->dst_index)
@@ -25,6 +25,7 @@ static const char upload_pack_usage[] = "git upload-pack [--strict] [--timeout=n
 #define CLIENT_SHALLOW	(1u << 18)
 
 static unsigned long oldest_have;
+static int shallow_nr;
 
 static int multi_ack, nr_our_refs;
 static int use_thin_pack, use_ofs_delta, use_include_tag;
@@ -140,6 +141,31 @@ static int do_rev_list(int fd, void *create_full_pack)
 	return 0;
 }
 
+/*
+ * Without shallow boundaries to honor, pack-objects can count the
+ * objects itself from the wants and haves, which lets it use the
+ * reachability bitmaps instead of walking the history.
+ */
+static int send_wants_and_haves(int fd, void *unused)
+{
+	FILE *pipe = fdopen(fd, "w");
+	int i;
+
+	if (!pipe)
+		die("unable to fdopen pipe to pack-objects");
+	for (i = 0; i < want_obj.nr; i++)
+		fprintf(pipe, "%s\n",
+			sha1_to_hex(want_obj.objects[i].item->sha1));
+	fprintf(pipe, "--not\n");
+	for (i = 0; i < have_obj.nr; i++)
+		fprintf(pipe, "%s\n",
+			sha1_to_hex(have_obj.objects[i].item->sha1));
+	fprintf(pipe, "\n");
+	fflush(pipe);
+	fclose(pipe);
+	return 0;
+}
+
 static void create_pack_file(void)
 {
 	struct async rev_list;
@@ -153,14 +179,24 @@ static void create_pack_file(void)
 	const char *argv[10];
 	int arg = 0;
 
-	rev_list.proc = do_rev_list;
-	/* .data is just a boolean: any non-NULL value will do */
-	rev_list.data = create_full_pack ? &rev_list : NULL;
+	if (shallow_nr) {
+		rev_list.proc = do_rev_list;
+		/* .data is just a boolean: any non-NULL value will do */
+		rev_list.data = create_full_pack ? &rev_list : NULL;
+	} else {
+		rev_list.proc = send_wants_and_haves;
+		rev_list.data = NULL;
+	}
 	if (start_async(&rev_list))
 		die("git upload-pack: unable to fork git-rev-list");
 
 	argv[arg++] = "pack-objects";
 	argv[arg++] = "--stdout";
+	if (!shallow_nr) {
+		argv[arg++] = "--revs";
+		if (use_thin_pack && !create_full_pack)
+			argv[arg++] = "--thin";
+	}
 	if (!no_progress)
 		argv[arg++] = "--progress";
 	if (use_ofs_delta)
@@ -533,6 +569,7 @@ static void receive_needs(void)
 				packet_write(1, "shallow %s",
 						sha1_to_hex(object->sha1));
 				register_shallow(object->sha1);
+				shallow_nr++;
 			}
 			result = result->next;
 		}
@@ -558,6 +595,7 @@ static void receive_needs(void)
 			}
 			/* make sure commit traversal conforms to client */
 			register_shallow(object->sha1);
+			shallow_nr++;
 		}
 		packet_flush(1);
 	} else
@@ -565,6 +603,7 @@ static void receive_needs(void)
 			int i;
 			for (i = 0; i < shallows.nr; i++)
 				register_shallow(shallows.objects[i].item->sha1);
+			shallow_nr += shallows.nr;
 		}
 	free(shallows.objects);
 }
@@ -67,14 +67,17 @@ static int process_tree(struct walker *walker, struct tree *tree)
 #define SEEN		(1U << 1)
 #define TO_SCAN		(1U << 2)
 
-static struct commit_list *complete = NULL;
+static struct commit_queue complete;
 
 static int process_commit(struct walker *walker, struct commit *commit)
 {
+	struct commit *recent;
+
 	if (parse_commit(commit))
 		return -1;
 
-	while (complete && complete->item->date >= commit->date) {
+	while ((recent = commit_queue_peek(&complete)) &&
+	       recent->date >= commit->date) {
 		pop_most_recent_commit(&complete, COMPLETE);
 	}
 
@@ -207,7 +210,7 @@ static int mark_complete(const char *path, const unsigned char *sha1, int flag,
 	struct commit *commit = lookup_commit_reference_gently(sha1, 1);
 	if (commit) {
 		commit->object.flags |= COMPLETE;
-		insert_by_date(commit, &complete);
+		commit_queue_put(&complete, commit);
 	}
 	return 0;
 }
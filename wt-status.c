@@ -255,6 +255,11 @@ static void wt_status_print_untracked(struct wt_status *s)
 		dir.hide_empty_directories = 1;
 	}
 	setup_standard_excludes(&dir);
+	if (core_untracked_cache) {
+		if (!the_index.untracked)
+			the_index.untracked = xcalloc(1, sizeof(*the_index.untracked));
+		dir.untracked = the_index.untracked;
+	}
 
 	read_directory(&dir, ".", "", 0, NULL);
 	for(i = 0; i < dir.nr; i++) {
@@ -322,6 +322,45 @@ int xdl_recs_cmp(diffdata_t *dd1, long off1, long lim1,
 }
 
 
+/*
+ * Diff lines line1..line1+count1-1 of the first file against lines
+ * line2..line2+count2-1 of the second one with the classic Myers
+ * algorithm, for the other algorithms when they cannot do better.
+ * Lines are numbered from 1.
+ *
+ * This probably does not work outside Git, since we have a very
+ * simple mmfile structure.
+ *
+ * Note: ideally, we would reuse the prepared environment, but the
+ * libxdiff interface does not (yet) allow for diffing only ranges of
+ * lines instead of the whole files.
+ */
+int xdl_fall_back_diff(xdfenv_t *diff_env, xpparam_t const *xpp,
+		       int line1, int count1, int line2, int count2)
+{
+	mmfile_t subfile1, subfile2;
+	xpparam_t subxpp;
+	xdfenv_t env;
+
+	subfile1.ptr = (char *)diff_env->xdf1.recs[line1 - 1]->ptr;
+	subfile1.size = diff_env->xdf1.recs[line1 + count1 - 2]->ptr +
+		diff_env->xdf1.recs[line1 + count1 - 2]->size - subfile1.ptr;
+	subfile2.ptr = (char *)diff_env->xdf2.recs[line2 - 1]->ptr;
+	subfile2.size = diff_env->xdf2.recs[line2 + count2 - 2]->ptr +
+		diff_env->xdf2.recs[line2 + count2 - 2]->size - subfile2.ptr;
+	subxpp.flags = xpp->flags & ~XDF_DIFF_ALGORITHM_MASK;
+	if (xdl_do_diff(&subfile1, &subfile2, &subxpp, &env) < 0)
+		return -1;
+
+	memcpy(diff_env->xdf1.rchg + line1 - 1, env.xdf1.rchg, count1);
+	memcpy(diff_env->xdf2.rchg + line2 - 1, env.xdf2.rchg, count2);
+
+	xdl_free_env(&env);
+
+	return 0;
+}
+
+
 int xdl_do_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
 		xdfenv_t *xe) {
 	long ndiags;
@@ -331,6 +370,8 @@ int xdl_do_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
 
 	if (xpp->flags & XDF_PATIENCE_DIFF)
 		return xdl_do_patience_diff(mf1, mf2, xpp, xe);
+	if (xpp->flags & XDF_HISTOGRAM_DIFF)
+		return xdl_do_histogram_diff(mf1, mf2, xpp, xe);
 
 	if (xdl_prepare_env(mf1, mf2, xpp, xe) < 0) {
 
@@ -0,0 +1,226 @@
+/*
+ *  LibXDiff by Davide Libenzi ( File Differential Library )
+ *  Copyright (C) 2003-2009 Davide Libenzi, Johannes E. Schindelin
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *  Davide Libenzi <davidel@xmailserver.org>
+ *
+ */
+#include "xinclude.h"
+#include "xtypes.h"
+#include "xdiff.h"
+
+/*
+ * Histogram diff is an extension of patience diff.  Instead of only
+ * anchoring on lines that are unique in both files, it counts how
+ * often each line of the first file occurs (the histogram), and picks
+ * the longest run of common lines among those that start on one of
+ * the rarest lines.  Unique lines are simply the rarest, so when
+ * there are any, the result is much like patience diff; but files
+ * with few unique lines (say, lots of "}" and blank lines) still get
+ * good anchors instead of falling back to Myers right away.
+ *
+ * The regions before and after the chosen run are then diffed the same
+ * way.  A region in which all the common lines occur too often is
+ * handed to the classic Myers algorithm.
+ *
+ * Lines are compared through the equivalence classes that
+ * xdl_prepare_env() leaves in the "ha" member of each record, so two
+ * lines match exactly when their "ha" are equal, whatever the
+ * whitespace flags.
+ */
+
+/* lines occurring more often than this are not tried as anchors */
+#define MAX_CHAIN_LENGTH 64
+
+struct histindex {
+	/*
+	 * For each equivalence class, the first line of the first file
+	 * in the current region that is in it (0 if none), and how many
+	 * such lines the region has.  next_line[] chains the lines of a
+	 * class in increasing order.  Lines are numbered from 1.
+	 */
+	long *first_line, *count;
+	long *next_line;
+	xdfenv_t *env;
+};
+
+struct region {
+	long begin1, end1, begin2, end2;
+};
+
+#define HA1(index, line) ((long)(index)->env->xdf1.recs[(line) - 1]->ha)
+#define HA2(index, line) ((long)(index)->env->xdf2.recs[(line) - 1]->ha)
+
+/*
+ * Find the longest run of common lines, among those that start on the
+ * rarest line of the first file, in lines line1..line1+count1-1 and
+ * line2..line2+count2-1.  Returns 0 if one was found and stored in
+ * lcs, 1 if there are common lines but all are too frequent, and 2 if
+ * there are none.
+ */
+static int find_lcs(struct histindex *index, struct region *lcs,
+		long line1, long count1, long line2, long count2)
+{
+	long end1 = line1 + count1, end2 = line2 + count2;
+	long best_count = MAX_CHAIN_LENGTH, best_len = 0;
+	long a, b, b_next;
+	int has_common = 0;
+
+	/* index the first file backwards, so that chains come out sorted */
+	for (a = end1 - 1; a >= line1; a--) {
+		long ha = HA1(index, a);
+		index->next_line[a] = index->first_line[ha];
+		index->first_line[ha] = a;
+		index->count[ha]++;
+	}
+
+	for (b = line2; b < end2; b = b_next) {
+		long ha = HA2(index, b);
+
+		b_next = b + 1;
+		if (!index->first_line[ha])
+			continue;
+		has_common = 1;
+		if (index->count[ha] > best_count)
+			continue;
+
+		for (a = index->first_line[ha]; a; a = index->next_line[a]) {
+			long as = a, ae = a, bs = b, be = b;
+			long rare = index->count[ha];
+
+			while (as > line1 && bs > line2 &&
+			       HA1(index, as - 1) == HA2(index, bs - 1)) {
+				as--;
+				bs--;
+				if (rare > index->count[HA1(index, as)])
+					rare = index->count[HA1(index, as)];
+			}
+			while (ae < end1 - 1 && be < end2 - 1 &&
+			       HA1(index, ae + 1) == HA2(index, be + 1)) {
+				ae++;
+				be++;
+				if (rare > index->count[HA1(index, ae)])
+					rare = index->count[HA1(index, ae)];
+			}
+
+			/* no run starts again inside this one */
+			if (b_next <= be)
+				b_next = be + 1;
+			if (best_len < ae - as + 1 || rare < best_count) {
+				lcs->begin1 = as;
+				lcs->end1 = ae;
+				lcs->begin2 = bs;
+				lcs->end2 = be;
+				best_len = ae - as + 1;
+				best_count = rare;
+			}
+		}
+	}
+
+	for (a = line1; a < end1; a++) {
+		long ha = HA1(index, a);
+		index->first_line[ha] = 0;
+		index->count[ha] = 0;
+	}
+
+	if (!has_common)
+		return 2;
+	return best_len ? 0 : 1;
+}
+
+static int histogram_diff(xpparam_t const *xpp, struct histindex *index,
+		long line1, long count1, long line2, long count2)
+{
+	xdfenv_t *env = index->env;
+	struct region lcs;
+
+	for (;;) {
+		/* trivial case: one side is empty */
+		if (!count1) {
+			while (count2--)
+				env->xdf2.rchg[line2++ - 1] = 1;
+			return 0;
+		} else if (!count2) {
+			while (count1--)
+				env->xdf1.rchg[line1++ - 1] = 1;
+			return 0;
+		}
+
+		switch (find_lcs(index, &lcs, line1, count1, line2, count2)) {
+		case 1:
+			return xdl_fall_back_diff(env, xpp,
+					line1, count1, line2, count2);
+		case 2:
+			while (count1--)
+				env->xdf1.rchg[line1++ - 1] = 1;
+			while (count2--)
+				env->xdf2.rchg[line2++ - 1] = 1;
+			return 0;
+		}
+
+		if (histogram_diff(xpp, index,
+				line1, lcs.begin1 - line1,
+				line2, lcs.begin2 - line2))
+			return -1;
+
+		/* what follows the run is handled by looping */
+		count1 = line1 + count1 - 1 - lcs.end1;
+		line1 = lcs.end1 + 1;
+		count2 = line2 + count2 - 1 - lcs.end2;
+		line2 = lcs.end2 + 1;
+	}
+}
+
+int xdl_do_histogram_diff(mmfile_t *file1, mmfile_t *file2,
+		xpparam_t const *xpp, xdfenv_t *env)
+{
+	struct histindex index;
+	long i, nr_classes = 0;
+	int result;
+
+	if (xdl_prepare_env(file1, file2, xpp, env) < 0)
+		return -1;
+
+	for (i = 0; i < env->xdf1.nrec; i++)
+		if (nr_classes <= (long)env->xdf1.recs[i]->ha)
+			nr_classes = env->xdf1.recs[i]->ha + 1;
+	for (i = 0; i < env->xdf2.nrec; i++)
+		if (nr_classes <= (long)env->xdf2.recs[i]->ha)
+			nr_classes = env->xdf2.recs[i]->ha + 1;
+
+	index.env = env;
+	index.first_line = xdl_malloc((nr_classes + 1) * 2 * sizeof(long));
+	index.next_line = xdl_malloc((env->xdf1.nrec + 1) * sizeof(long));
+	if (!index.first_line || !index.next_line) {
+		xdl_free(index.first_line);
+		xdl_free(index.next_line);
+		xdl_free_env(env);
+		return -1;
+	}
+	memset(index.first_line, 0, (nr_classes + 1) * 2 * sizeof(long));
+	index.count = index.first_line + nr_classes + 1;
+
+	result = histogram_diff(xpp, &index,
+			1, env->xdf1.nrec, 1, env->xdf2.nrec);
+
+	xdl_free(index.first_line);
+	xdl_free(index.next_line);
+	/* on success, the environment is cleaned up in xdl_diff() */
+	if (result < 0)
+		xdl_free_env(env);
+	return result;
+}